@@ -0,0 +1,26 @@
+
+#
+# benchmarks
+#
+
+# kiraz_bench
+option(KIRAZ_BENCH "Build the compiler throughput benchmarks" TRUE)
+
+if (KIRAZ_BENCH)
+    add_executable(kiraz_bench
+        kiraz/bench/Bench.h
+        kiraz/bench/Bench.cpp
+        kiraz/bench/Generator.h
+        kiraz/bench/Generator.cpp
+        kiraz/bench/kiraz_bench.cc
+    )
+    target_link_libraries(kiraz_bench kiraz ${FLEX_LIBRARIES})
+
+    ## kiraz_bench: binary emission through wabt, when it is being built anyway
+    if (KIRAZ_TEST_WASMGEN)
+        target_include_directories(kiraz_bench SYSTEM PUBLIC ${WABT_INCLUDE_DIRS})
+        target_link_libraries(kiraz_bench ${WABT_STATIC_LIBRARIES})
+        target_compile_definitions(kiraz_bench PRIVATE KIRAZ_HAVE_WABT)
+        add_dependencies(kiraz_bench wabt)
+    endif()
+endif()
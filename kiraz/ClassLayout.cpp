@@ -0,0 +1,355 @@
+#include "ClassLayout.h"
+
+#include <algorithm>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/Runtime.h>
+#include <kiraz/ast/Literal.h>
+#include <kiraz/ast/Operator.h>
+
+namespace kiraz {
+
+namespace {
+
+uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Size and alignment in linear memory
+std::pair<uint32_t, uint32_t> memory_type(ValueKind kind) {
+    switch (kind) {
+    case ValueKind::Integer64:
+        return {8, 8};
+    case ValueKind::Boolean:
+        return {1, 1};
+    case ValueKind::String:
+        return {8, 4};
+    case ValueKind::Object:
+        return {4, 4};
+    case ValueKind::Void:
+        break;
+    }
+    return {0, 1};
+}
+
+// For fields declared without a type
+std::string literal_type(const Node::Ptr &init) {
+    if (std::dynamic_pointer_cast<ast::String>(init)) {
+        return "String";
+    }
+    if (std::dynamic_pointer_cast<ast::Boolean>(init)
+            || (init && (init->get_id() == "true" || init->get_id() == "false"))) {
+        return "Boolean";
+    }
+    return "Integer64";
+}
+
+const std::string &ret_type(const ast::Func &func) {
+    static const std::string void_type = "Void";
+    return func.get_ret_type() ? func.get_ret_type()->get_id() : void_type;
+}
+
+template <typename Fn>
+void for_each_assignment(const Node &node, const Fn &fn) {
+    if (node.is_assign()) {
+        fn(static_cast<const ast::Assignment &>(node));
+    }
+    node.for_each_child([&](const Node::Ptr &child) { for_each_assignment(*child, fn); });
+}
+
+// Whether node could be part of a pure function: no members, no allocations
+// and no calls other than of the top-level functions added to callees.
+bool pure_body(const Node &node, std::vector<std::string> &callees) {
+    if (node.is_dot()) {
+        return false;
+    }
+    if (node.is_call()) {
+        const auto &name = static_cast<const ast::Call &>(node).get_name();
+        if (name->is_dot()) {
+            return false;
+        }
+        callees.push_back(name->get_id());
+    }
+    if (auto let = dynamic_cast<const ast::Let *>(&node)) {
+        if (! let->get_init() && let->get_type()
+                && kind_of(let->get_type()->get_id()) == ValueKind::Object) {
+            return false;
+        }
+    }
+    bool retval = true;
+    node.for_each_child([&](const Node::Ptr &child) {
+        retval = retval && pure_body(*child, callees);
+    });
+    return retval;
+}
+
+} // namespace
+
+ValueKind kind_of(std::string_view type_name) {
+    if (type_name.empty() || type_name == "Integer64") {
+        return ValueKind::Integer64;
+    }
+    if (type_name == "Boolean") {
+        return ValueKind::Boolean;
+    }
+    if (type_name == "String") {
+        return ValueKind::String;
+    }
+    if (type_name == "Void" || type_name == "Null") {
+        return ValueKind::Void;
+    }
+    return ValueKind::Object;
+}
+
+std::string_view wasm_types(ValueKind kind) {
+    switch (kind) {
+    case ValueKind::Integer64:
+        return "i64";
+    case ValueKind::Boolean:
+    case ValueKind::Object:
+        return "i32";
+    case ValueKind::String:
+        return "i32 i32";
+    case ValueKind::Void:
+        break;
+    }
+    return "";
+}
+
+ClassLayout::ClassLayout(const ast::Class &cls) : m_name(cls.get_name()->get_id()) {
+    // Names assigned without a Dot in methods, fields of this among them
+    std::unordered_set<std::string> assigned;
+
+    auto scope = cls.get_scope();
+    if (scope && scope->is_stmt_list()) {
+        for (const auto &stmt : static_cast<const ast::StmtList &>(*scope).get_stmts()) {
+            m_leaks_this = m_leaks_this || ! only_dereferenced(*stmt, "this");
+            if (stmt->is_func()) {
+                const auto &func = static_cast<const ast::Func &>(*stmt);
+                m_methods[func.get_name()->get_id()] = ret_type(func);
+                for_each_assignment(func, [&](const ast::Assignment &assignment) {
+                    if (! assignment.get_lhs()->is_dot()) {
+                        assigned.insert(assignment.get_lhs()->get_id());
+                    }
+                });
+            }
+            else if (auto let = std::dynamic_pointer_cast<ast::Let>(stmt)) {
+                FieldLayout field;
+                field.name = let->get_name()->get_id();
+                field.type = let->get_type() ? let->get_type()->get_id()
+                                             : literal_type(let->get_init());
+                field.kind = kind_of(field.type);
+                std::tie(field.size, field.align) = memory_type(field.kind);
+                field.offset = 0;
+                field.init = let->get_init();
+                m_fields.push_back(std::move(field));
+            }
+        }
+    }
+
+    std::vector<FieldLayout *> order;
+    order.reserve(m_fields.size());
+    for (auto &field : m_fields) {
+        field.immutable = ! assigned.contains(field.name);
+        order.push_back(&field);
+    }
+    std::stable_sort(order.begin(), order.end(),
+            [](const FieldLayout *a, const FieldLayout *b) { return a->align > b->align; });
+
+    uint32_t offset = 0;
+    for (auto field : order) {
+        offset = align_up(offset, field->align);
+        field->offset = offset;
+        offset += field->size;
+        m_align = std::max(m_align, field->align);
+    }
+
+    // Instances of a class without fields still get addresses of their own.
+    m_size = std::max(align_up(offset, m_align), m_align);
+}
+
+const FieldLayout *ClassLayout::find_field(std::string_view name) const {
+    for (const auto &field : m_fields) {
+        if (field.name == name) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+const std::string *ClassLayout::find_method(std::string_view name) const {
+    auto iter = m_methods.find(std::string(name));
+    return iter == m_methods.end() ? nullptr : &iter->second;
+}
+
+std::shared_ptr<const ModuleLayout> ModuleLayout::compute(const Node &root) {
+    auto retval = std::make_shared<ModuleLayout>();
+    if (root.is_stmt_list()) {
+        root.for_each_child([&](const Node::Ptr &stmt) { retval->add(*stmt); });
+    }
+    else {
+        retval->add(root);
+    }
+    retval->find_immutable_fields(root);
+    retval->find_pure_functions(root);
+    return retval;
+}
+
+void ModuleLayout::add(const Node &stmt) {
+    if (stmt.is_class()) {
+        const auto &cls = static_cast<const ast::Class &>(stmt);
+        m_classes.emplace(cls.get_name()->get_id(), ClassLayout(cls));
+    }
+    else if (stmt.is_func()) {
+        const auto &func = static_cast<const ast::Func &>(stmt);
+        m_functions[func.get_name()->get_id()] = ret_type(func);
+        m_definitions[func.get_name()->get_id()] = &func;
+    }
+}
+
+void ModuleLayout::find_immutable_fields(const Node &root) {
+    std::unordered_set<std::string> assigned;
+    for_each_assignment(root, [&](const ast::Assignment &assignment) {
+        const auto &lhs = assignment.get_lhs();
+        if (lhs->is_dot()) {
+            assigned.insert(static_cast<const ast::Dot &>(*lhs).get_rhs()->get_id());
+        }
+    });
+
+    for (auto &[name, cls] : m_classes) {
+        for (auto &field : cls.m_fields) {
+            field.immutable = field.immutable && ! assigned.contains(field.name);
+        }
+    }
+}
+
+void ModuleLayout::find_pure_functions(const Node &root) {
+    // Functions are pure unless they do something impure or call a function
+    // that is not pure, which can take a few rounds to find out.
+    std::unordered_map<std::string, std::vector<std::string>> callees;
+    auto add = [&](const Node &stmt) {
+        if (! stmt.is_func()) {
+            return;
+        }
+        const auto &func = static_cast<const ast::Func &>(stmt);
+        std::vector<std::string> calls;
+        if (! func.get_scope() || pure_body(*func.get_scope(), calls)) {
+            callees[func.get_name()->get_id()] = std::move(calls);
+        }
+    };
+    if (root.is_stmt_list()) {
+        root.for_each_child([&](const Node::Ptr &stmt) { add(*stmt); });
+    }
+    else {
+        add(root);
+    }
+
+    for (bool changed = true; changed;) {
+        changed = std::erase_if(callees, [&](const auto &entry) {
+            return std::any_of(entry.second.begin(), entry.second.end(),
+                    [&](const std::string &callee) { return ! callees.contains(callee); });
+        });
+    }
+    for (auto &[name, calls] : callees) {
+        m_pure_functions.insert(name);
+    }
+}
+
+const ClassLayout *ModuleLayout::find_class(std::string_view name) const {
+    auto iter = m_classes.find(std::string(name));
+    return iter == m_classes.end() ? nullptr : &iter->second;
+}
+
+const std::string *ModuleLayout::find_function(std::string_view name) const {
+    auto iter = m_functions.find(std::string(name));
+    return iter == m_functions.end() ? nullptr : &iter->second;
+}
+
+const ast::Func *ModuleLayout::find_definition(std::string_view name) const {
+    auto iter = m_definitions.find(std::string(name));
+    return iter == m_definitions.end() ? nullptr : iter->second;
+}
+
+bool ModuleLayout::is_pure(std::string_view function) const {
+    return m_pure_functions.contains(std::string(function));
+}
+
+std::string type_of(const WasmContext &ctx, const Node &node) {
+    if (dynamic_cast<const ast::Integer *>(&node)) {
+        return "Integer64";
+    }
+    if (dynamic_cast<const ast::String *>(&node)) {
+        return "String";
+    }
+    if (dynamic_cast<const ast::Boolean *>(&node)) {
+        return "Boolean";
+    }
+    if (auto op = dynamic_cast<const ast::BinaryOp *>(&node)) {
+        return op->is_comparison() ? "Boolean" : type_of(ctx, *op->get_left());
+    }
+    if (auto sign = dynamic_cast<const ast::Signed *>(&node)) {
+        return type_of(ctx, *sign->get_operand());
+    }
+
+    const auto &frame = ctx.frame();
+    const auto &layout = ctx.get_layout();
+    const std::string *retval = nullptr;
+
+    if (dynamic_cast<const ast::Id *>(&node)) {
+        const auto &name = node.get_id();
+        if (name == "true" || name == "false") {
+            return "Boolean";
+        }
+        retval = frame.find_local(name);
+        if (! retval) {
+            auto cls = layout.find_class(frame.self);
+            auto field = cls ? cls->find_field(name) : nullptr;
+            retval = field ? &field->type : nullptr;
+        }
+    }
+    else if (node.is_dot()) {
+        const auto &dot = static_cast<const ast::Dot &>(node);
+        auto cls = layout.find_class(type_of(ctx, *dot.get_lhs()));
+        auto field = cls ? cls->find_field(dot.get_rhs()->get_id()) : nullptr;
+        retval = field ? &field->type : nullptr;
+    }
+    else if (node.is_call()) {
+        auto callee = static_cast<const ast::Call &>(node).get_name();
+        if (callee->is_dot()) {
+            const auto &dot = static_cast<const ast::Dot &>(*callee);
+            auto type = type_of(ctx, *dot.get_lhs());
+            auto cls = layout.find_class(type);
+            const auto &method = dot.get_rhs()->get_id();
+            retval = cls                     ? cls->find_method(method)
+                    : is_memory_class(type) ? find_memory_method(method)
+                                            : nullptr;
+        }
+        else {
+            auto cls = layout.find_class(frame.self);
+            retval = cls ? cls->find_method(callee->get_id()) : nullptr;
+            if (! retval) {
+                retval = layout.find_function(callee->get_id());
+            }
+        }
+    }
+
+    return retval ? *retval : std::string();
+}
+
+bool only_dereferenced(const Node &node, std::string_view name) {
+    if (node.is_dot()) {
+        // The right hand side names a member
+        auto lhs = static_cast<const ast::Dot &>(node).get_lhs();
+        return dynamic_cast<const ast::Id *>(lhs.get()) || only_dereferenced(*lhs, name);
+    }
+    if (dynamic_cast<const ast::Id *>(&node)) {
+        return node.get_id() != name;
+    }
+    bool retval = true;
+    node.for_each_child([&](const Node::Ptr &child) {
+        retval = retval && only_dereferenced(*child, name);
+    });
+    return retval;
+}
+
+} // namespace kiraz
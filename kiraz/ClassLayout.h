@@ -0,0 +1,147 @@
+#ifndef KIRAZ_CLASSLAYOUT_H
+#define KIRAZ_CLASSLAYOUT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <kiraz/Node.h>
+
+namespace ast {
+class Class;
+class Func;
+} // namespace ast
+
+namespace kiraz {
+
+class WasmContext;
+
+/**
+ * @brief ValueKind: How values of a kiraz type are represented in wasm.
+ * Strings are (address, length) pairs, objects the address of their fields in
+ * linear memory.
+ */
+enum class ValueKind {
+    Void,
+    Integer64,
+    Boolean,
+    String,
+    Object,
+};
+
+// The builtin types by name; any other type name is a class.
+ValueKind kind_of(std::string_view type_name);
+
+// Wasm value types of the slots that hold one value, "" for Void
+std::string_view wasm_types(ValueKind kind);
+
+struct FieldLayout {
+    std::string name;
+    std::string type;
+    ValueKind kind;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t align;
+    Node::Ptr init;
+
+    // Only ever stored to by $Class.__init, see ModuleLayout
+    bool immutable = false;
+};
+
+/**
+ * @brief ClassLayout: Where the fields of a class live in an instance.
+ *
+ * Fields are placed in decreasing order of alignment, declaration order
+ * otherwise. Field sizes are multiples of their alignments, so this leaves no
+ * padding between fields; only the tail is padded, to the alignment of the
+ * instance.
+ *
+ * Methods are not virtual: a call compiles to a direct call of
+ * $Class.method with the receiver as the first argument.
+ */
+class ClassLayout {
+public:
+    explicit ClassLayout(const ast::Class &cls);
+
+    const auto &get_name() const { return m_name; }
+    uint32_t get_size() const { return m_size; }
+    uint32_t get_align() const { return m_align; }
+
+    // In declaration order
+    const auto &get_fields() const { return m_fields; }
+    const FieldLayout *find_field(std::string_view name) const;
+
+    // Return type of a method, null if there is no such method
+    const std::string *find_method(std::string_view name) const;
+
+    // Whether some method or initialiser uses `this` other than to reach a
+    // member, which could keep an instance alive after its last use.
+    bool leaks_this() const { return m_leaks_this; }
+
+private:
+    friend class ModuleLayout;
+
+    std::string m_name;
+    std::vector<FieldLayout> m_fields;
+    std::unordered_map<std::string, std::string> m_methods;
+    uint32_t m_size = 0;
+    uint32_t m_align = 1;
+    bool m_leaks_this = false;
+};
+
+/**
+ * @brief ModuleLayout: Layouts of the classes and signatures of the functions
+ * of a module. Computed once before code generation and only read afterwards,
+ * so all fragments share it.
+ */
+class ModuleLayout {
+public:
+    static std::shared_ptr<const ModuleLayout> compute(const Node &root);
+
+    const ClassLayout *find_class(std::string_view name) const;
+
+    // Return type of a top-level function, null if there is no such function
+    const std::string *find_function(std::string_view name) const;
+
+    // The declaration of a top-level function, valid for as long as the tree
+    // the layout was computed from
+    const ast::Func *find_definition(std::string_view name) const;
+
+    // Whether a top-level function computes its results from its arguments
+    // alone, without touching memory or calling anything that does. Calls with
+    // the same arguments can share their results.
+    bool is_pure(std::string_view function) const;
+
+    bool has_classes() const { return ! m_classes.empty(); }
+
+private:
+    void add(const Node &stmt);
+
+    // Fields that no assignment can reach are immutable. Types of the left
+    // hand sides are not known here, so a member assigned through any Dot is
+    // assumed assigned in every class. Memory.write over instances is not
+    // accounted for; it would break the allocator anyway.
+    void find_immutable_fields(const Node &root);
+    void find_pure_functions(const Node &root);
+
+    std::unordered_map<std::string, ClassLayout> m_classes;
+    std::unordered_map<std::string, std::string> m_functions;
+    std::unordered_map<std::string, const ast::Func *> m_definitions;
+    std::unordered_set<std::string> m_pure_functions;
+};
+
+// Kiraz type of an expression in the function being generated, "" if unknown.
+// Semantic analysis does not annotate the tree yet, so code generation works
+// this out on its own.
+std::string type_of(const WasmContext &ctx, const Node &node);
+
+// Whether every use of name in node is the left hand side of a Dot
+bool only_dereferenced(const Node &node, std::string_view name);
+
+} // namespace kiraz
+
+#endif
@@ -1,10 +1,20 @@
 #include "Compiler.h"
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <cstring> 
+#include <filesystem>
+#include <fstream>
+#include <numeric>
 #include <fmt/format.h>
+#include <kiraz/Parallel.h>
+#include <kiraz/Runtime.h>
+#include <kiraz/SourceManager.h>
+#include <kiraz/Token.h>
+#include <kiraz/Trace.h>
+#include <kiraz/ast/Operator.h>
 #include <resource/FILE_io_ki.h>
 
-extern Token::Ptr curtoken;
 
 namespace kiraz { // <--- EKLENDİ
 
@@ -31,41 +41,103 @@ Compiler::~Compiler() {
 }
 
 int Compiler::compile_file(const std::string &file_name) {
-    yyin = fopen(file_name.data(), "rb");
-    if (! yyin) {
-        perror(file_name.data());
-        return 2;
+    std::string code;
+    {
+        std::ifstream f(file_name, std::ios::binary);
+        if (! f.is_open()) {
+            perror(file_name.data());
+            return 2;
+        }
+        code.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
     }
 
-    yyparse();
-    auto root = Node::get_root();
-    reset();
+    if (! m_cache) {
+        return compile(parse(file_name, code));
+    }
 
-    return compile(root);
+    // Modules from different directories may share a base name.
+    auto path = std::filesystem::absolute(file_name).lexically_normal();
+    auto name = FF("{}-{:08x}", path.stem().string(),
+            ModuleCache::hash(path.string()) & 0xFFFFFFFF);
+    auto key = ModuleCache::make_key(code);
+
+    // Registered either way, as the nodes of a cached AST point into it too.
+    auto base = SourceManager::instance().add_file(file_name, code);
+
+    // Unchanged module: skip the lexer and the parser altogether.
+    if (auto root = m_cache->load_ast(name, key, base)) {
+        Node::set_root(root);
+        return compile(root);
+    }
+
+    auto root = parse(base, code);
+    auto ret = compile(root);
+    if (ret == 0) {
+        m_cache->store(name, key, root, base);
+    }
+
+    return ret;
 }
 
 int Compiler::compile_string(const std::string &code) {
-    buffer = yy_scan_string(code.data());
-    yyparse();
-    auto root = Node::get_root();
-    reset();
-
-    return compile(root);
+    return compile(parse("<string>", code));
 }
 
 Node::Ptr Compiler::compile_module(const std::string &str) {
-    buffer = yy_scan_string(str.data());
-    yyparse();
-    auto retval = Node::pop_root();
-    reset();
+    return compile_module("<module>", str);
+}
+
+Node::Ptr Compiler::compile_module(const std::string &name, const std::string &str) {
+    if (! m_cache) {
+        auto retval = parse(name, str);
+        assert(retval);
+        return retval;
+    }
+
+    auto key = ModuleCache::make_key(str);
+    auto base = SourceManager::instance().add_file(name, str);
+    if (auto retval = m_cache->load_ast(name, key, base)) {
+        return retval;
+    }
+
+    auto retval = parse(base, str);
     assert(retval);
+    m_cache->store(name, key, retval, base);
     return retval;
 }
 
+Node::Ptr Compiler::parse(const std::string &name, const std::string &code) {
+    return parse(SourceManager::instance().add_file(name, code), code);
+}
+
+Node::Ptr Compiler::parse(uint32_t base, const std::string &code) {
+    buffer = yy_scan_bytes(code.data(), code.size());
+    token::offset = base;
+    {
+        KIRAZ_STATS_TIMER(Parse);
+        Trace::Scope trace("phase", "parse");
+        yyparse();
+    }
+    auto retval = Node::get_root();
+    if (! retval) {
+        retval = std::move(m_partial_root);
+    }
+    m_partial_root.reset();
+    reset();
+    return retval;
+}
+
+void Compiler::add_diagnostic(uint32_t offset, const std::string &message) {
+    auto loc = SourceManager::instance().lookup(offset);
+    m_error += FF("Error at {}:{}: {}\n", loc.line, loc.col, message);
+    m_diagnostics.push_back({offset, message});
+}
+
 void Compiler::reset_parser() {
     curtoken.reset();
+    token::offset = 0;
+    Node::set_next_offset(0);
     Node::reset_root();
-    Token::colno = 0;
     yylex_destroy();
 }
 
@@ -77,6 +149,27 @@ void Compiler::reset() {
     reset_parser();
 }
 
+// Calls of a top-level function, or of the methods of a class
+static uint64_t profile_entries(const Profile &profile, const Node &stmt) {
+    if (stmt.is_func()) {
+        return profile.entries(static_cast<const ast::Func &>(stmt).get_name()->get_id());
+    }
+    uint64_t retval = 0;
+    if (stmt.is_class()) {
+        const auto &cls = static_cast<const ast::Class &>(stmt);
+        const auto &name = cls.get_name()->get_id();
+        if (cls.get_scope()) {
+            cls.get_scope()->for_each_child([&](const Node::Ptr &member) {
+                if (member->is_func()) {
+                    const auto &func = static_cast<const ast::Func &>(*member);
+                    retval += profile.entries(FF("{}.{}", name, func.get_name()->get_id()));
+                }
+            });
+        }
+    }
+    return retval;
+}
+
 int Compiler::compile(Node::Ptr root) {
     if (! root) {
         return 1;
@@ -84,23 +177,133 @@ int Compiler::compile(Node::Ptr root) {
 
     SymbolTable st(ScopeType::Module);
 
-    if (auto ret = root->compute_stmt_type(st)) {
-        set_error(FF("Error at {}:{}: {}\n", ret->get_line(), ret->get_col(), ret->get_error()));
-        Node::reset_root();
-        return 1;
+    {
+        KIRAZ_STATS_TIMER(Analyse);
+        Trace::Scope trace("phase", "analyse");
+        trace.arg("nodes", Trace::enabled() ? root->count_nodes() : 0);
+
+        // Top-level statements are checked one by one so that an error in one
+        // of them does not hide the errors in the rest.
+        if (root->is_stmt_list()) {
+            root->set_cur_symtab(st.get_cur_symtab());
+            root->for_each_child([&](const Node::Ptr &stmt) {
+                if (auto ret = stmt->add_to_symtab_forward(st)) {
+                    add_diagnostic(ret->get_offset(), ret->get_error());
+                }
+            });
+
+            std::vector<Node::Ptr> stmts;
+            root->for_each_child([&](const Node::Ptr &stmt) { stmts.push_back(stmt); });
+
+            // Everything but function bodies may add to the module scope, so it
+            // goes first and in order. Function bodies only read it once the
+            // forward pass is done, which lets them go in parallel. Checking
+            // them is not implemented yet (compute_stmt_type returns nullptr),
+            // so for now it is code generation that gains from --jobs.
+            std::vector<Node::Ptr> errors(stmts.size());
+            std::vector<size_t> funcs;
+            for (size_t i = 0; i < stmts.size(); ++i) {
+                if (stmts[i]->is_func()) {
+                    funcs.push_back(i);
+                }
+                else {
+                    errors[i] = stmts[i]->compute_stmt_type(st);
+                }
+            }
+
+            auto module = st.get_cur_symtab();
+            parallel_for(funcs.size(), m_jobs, [&](size_t i) {
+                SymbolTable func_st(module);
+                errors[funcs[i]] = stmts[funcs[i]]->compute_stmt_type(func_st);
+            });
+
+            for (auto &ret : errors) {
+                if (ret) {
+                    add_diagnostic(ret->get_offset(), ret->get_error());
+                }
+            }
+        }
+        else if (auto ret = root->compute_stmt_type(st)) {
+            add_diagnostic(ret->get_offset(), ret->get_error());
+        }
+
+        // Includes syntax errors: a recovered module is analysed, never compiled.
+        if (! m_diagnostics.empty()) {
+            Node::reset_root();
+            return 1;
+        }
     }
-    
+
+    auto layout = ModuleLayout::compute(*root);
+    m_ctx.set_layout(layout);
+
     m_ctx.body() << "(module\n";
     m_ctx.body() << "  (import \"io\" \"print_i\" (func $io_print_i (param i64)))\n";
     m_ctx.body() << "  (import \"io\" \"print_s\" (func $io_print_s (param i32 i32)))\n";
     m_ctx.body() << "  (import \"io\" \"print_b\" (func $io_print_b (param i32)))\n";
-    m_ctx.body() << "  (memory (export \"memory\") 1)\n";
+    if (m_ctx.get_profile_options().generate) {
+        m_ctx.body() << "  (import \"profile\" \"dump\" (func $profile_dump (param i32 i32)))\n";
+    }
+
+    {
+        KIRAZ_STATS_TIMER(CodeGen);
+        Trace::Scope trace("phase", "codegen");
+        if (! root->is_stmt_list()) {
+            if (auto ret = root->gen_wat(m_ctx)) {
+                add_diagnostic(ret->get_offset(), ret->get_error());
+                return 2;
+            }
+        }
+        else {
+            // One fragment per top-level statement, merged in source order: the
+            // output does not depend on the number of jobs.
+            std::vector<Node::Ptr> stmts;
+            root->for_each_child([&](const Node::Ptr &stmt) { stmts.push_back(stmt); });
+
+            std::vector<WasmContext> fragments;
+            fragments.reserve(stmts.size());
+            for (size_t i = 0; i < stmts.size(); ++i) {
+                fragments.emplace_back(WasmContext::Fragment{}, m_ctx);
+            }
 
-    if (auto ret = root->gen_wat(m_ctx)) {
-        return 2;
+            std::vector<Node::Ptr> errors(stmts.size());
+            parallel_for(stmts.size(), m_jobs, [&](size_t i) {
+                errors[i] = stmts[i]->gen_wat(fragments[i]);
+            });
+
+            // With a profile the functions called most go first, next to each
+            // other.
+            std::vector<size_t> order(stmts.size());
+            std::iota(order.begin(), order.end(), 0);
+            if (const auto &profile = m_ctx.get_profile_options().use) {
+                std::vector<uint64_t> entries(stmts.size());
+                for (size_t i = 0; i < stmts.size(); ++i) {
+                    entries[i] = profile_entries(*profile, *stmts[i]);
+                }
+                std::stable_sort(order.begin(), order.end(),
+                        [&](size_t a, size_t b) { return entries[a] > entries[b]; });
+            }
+
+            for (size_t i = 0; i < stmts.size(); ++i) {
+                if (errors[i]) {
+                    add_diagnostic(errors[i]->get_offset(), errors[i]->get_error());
+                    return 2;
+                }
+            }
+            for (auto i : order) {
+                m_ctx.merge(fragments[i]);
+            }
+        }
     }
 
+    // The static data and the list heads of the runtime after it must fit.
+    auto data_end = m_ctx.get_memory().size() + 8 + runtime::SIZE_CLASSES * 4;
+    m_ctx.body() << FF("  (memory (export \"memory\") {})\n", (data_end + 0xFFFF) / 0x10000);
+
     if (!m_ctx.get_memory_view().empty()) {
+        KIRAZ_STATS_TIMER(DataSegment);
+        Trace::Scope trace("phase", "data_segment");
+        trace.arg("bytes", m_ctx.get_memory().size());
         m_ctx.body() << "  (data (i32.const 0) \"";
         for (unsigned char c : m_ctx.get_memory()) {
             if (isalnum(c)) {
@@ -112,17 +315,29 @@ int Compiler::compile(Node::Ptr root) {
         m_ctx.body() << "\")\n";
     }
 
+    if (m_ctx.uses_runtime()) {
+        emit_runtime(m_ctx);
+    }
+    if (m_ctx.get_profile_options().generate) {
+        emit_profile_dump(m_ctx);
+    }
+
     m_ctx.body() << ")\n";
+    KIRAZ_STATS_ADD(BytesEmitted, m_ctx.body().tellp());
 
     return 0;
 }
 
 SymbolTable::SymbolTable()
         : m_symbols({
-                  std::make_shared<Scope>(Scope::SymTab{}, ScopeType::Module, nullptr),
+                  std::make_shared<Scope>(nullptr, ScopeType::Module, nullptr),
           }) {
+    load_prelude();
+}
+
+void SymbolTable::load_prelude() {
     if (! s_module_io) {
-        s_module_io = Compiler::current()->compile_module(FILE_io_ki);
+        s_module_io = Compiler::current()->compile_module("io", FILE_io_ki);
     }
 }
 
@@ -130,6 +345,8 @@ SymbolTable::SymbolTable(ScopeType scope_type) : SymbolTable() {
     m_symbols.back()->scope_type = scope_type;
 }
 
+SymbolTable::SymbolTable(std::shared_ptr<Scope> module) : m_symbols({module}), m_shared_base(true) {}
+
 WasmContext::Coords WasmContext::add_to_memory(const std::string &s) {
     uint32_t offset = m_memory.size();
     uint32_t length = s.length();
@@ -146,4 +363,61 @@ WasmContext::Coords WasmContext::add_to_memory(uint32_t s) {
     return {offset, 4}; 
 }
 
+const ModuleLayout &WasmContext::get_layout() const {
+    static const ModuleLayout empty;
+    return m_layout ? *m_layout : empty;
+}
+
+void WasmContext::emit_address(uint32_t offset) {
+    if (! m_fragment) {
+        body() << "    i32.const " << offset << "\n";
+        return;
+    }
+
+    body() << "    i32.const " << ADDRESS_MARK << offset << ADDRESS_MARK << "\n";
+    m_has_addresses = true;
+}
+
+void WasmContext::merge(const WasmContext &fragment) {
+    assert(fragment.m_streams.size() == 1);
+    m_uses_runtime = m_uses_runtime || fragment.m_uses_runtime;
+
+    auto base = static_cast<uint32_t>(m_memory.size());
+    m_memory.insert(m_memory.end(), fragment.m_memory.begin(), fragment.m_memory.end());
+    for (auto [record, counters] : fragment.m_profile_records) {
+        add_profile_record({base + record.offset, record.length},
+                {base + counters.offset, counters.length});
+    }
+
+    auto &out = body();
+    out << fragment.m_streams.back().locals.str();
+    auto code = fragment.m_streams.back().body.str();
+    if (! fragment.m_has_addresses) {
+        out << code;
+        return;
+    }
+
+    // A fragment merged into another fragment keeps its placeholders, only
+    // rebased.
+    std::string_view rest(code);
+    for (auto mark = rest.find(ADDRESS_MARK); mark != rest.npos; mark = rest.find(ADDRESS_MARK)) {
+        auto end = rest.find(ADDRESS_MARK, mark + 1);
+        assert(end != rest.npos);
+
+        uint32_t offset = 0;
+        std::from_chars(rest.data() + mark + 1, rest.data() + end, offset);
+
+        out << rest.substr(0, mark);
+        if (m_fragment) {
+            out << ADDRESS_MARK << base + offset << ADDRESS_MARK;
+        }
+        else {
+            out << base + offset;
+        }
+        rest.remove_prefix(end + 1);
+    }
+    out << rest;
+    m_has_addresses = m_has_addresses || m_fragment;
+}
+
 } // namespace kiraz
@@ -2,12 +2,19 @@
 #define KIRAZ_COMPILER_H
 
 #include <cassert>
-#include <map>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 #include <string>
 
+#include <kiraz/ClassLayout.h>
+#include <kiraz/ModuleCache.h>
 #include <kiraz/Node.h>
+#include <kiraz/Profile.h>
+#include <kiraz/Runtime.h>
+#include <kiraz/Stats.h>
+#include <kiraz/SymbolMap.h>
+#include <kiraz/ir/Optimize.h>
 #include <lexer.hpp>
 
 namespace kiraz { // <--- BU SATIR EKSİKTİ, EKLENDİ
@@ -19,28 +26,35 @@ enum class ScopeType {
     Method,
 };
 
+/**
+ * @brief Scope: Symbols declared in one scope. Lookups continue in the
+ * enclosing scopes, so entering a scope copies nothing.
+ */
 struct Scope {
-    using SymTab = std::map<std::string, Node::Ptr>;
+    using SymTab = SymbolMap;
 
-    Scope(const std::map<std::string, Node::Ptr> &map, ScopeType stype, Node::Ptr s)
-            : symbols(map), scope_type(stype), stmt(s) {}
+    Scope(std::shared_ptr<const Scope> p, ScopeType stype, Node::Ptr s)
+            : parent(std::move(p)), scope_type(stype), stmt(s) {}
 
     SymTab symbols;
+    std::shared_ptr<const Scope> parent;
     ScopeType scope_type;
     Node::Ptr stmt;
 
-    auto find(const std::string &s) { return symbols.find(s); }
-    auto find(const std::string &s) const { return symbols.find(s); }
-    auto end() { return symbols.end(); }
-    auto end() const { return symbols.end(); }
+    const Node::Ptr *find(std::string_view name, uint64_t hash) const {
+        for (auto scope = this; scope; scope = scope->parent.get()) {
+            if (auto retval = scope->symbols.find(name, hash)) {
+                return retval;
+            }
+        }
+        return nullptr;
+    }
+    const Node::Ptr *find(std::string_view name) const { return find(name, SymTab::hash(name)); }
 
     decltype(auto) operator[](const std::string &s) { return (symbols[s]); }
     Node::SymTabEntry get_symbol(const std::string &name) const {
-        auto iter = symbols.find(name);
-        if (iter == symbols.end()) {
-            return name;
-        }
-        return {name, iter->second};
+        auto node = find(name);
+        return {name, node ? *node : nullptr};
     }
 };
 
@@ -62,24 +76,38 @@ public:
     explicit SymbolTable();
     explicit SymbolTable(ScopeType);
 
+    // Read-only view of an analysed module, for analysing function bodies in
+    // parallel. The module scope is shared, never written to: symbols can only
+    // be added after entering a scope of one's own.
+    explicit SymbolTable(std::shared_ptr<Scope> module);
+
     virtual ~SymbolTable();
 
     Node::Ptr add_symbol(const std::string &name, Node::Ptr m) {
         assert(! name.empty());
+        assert(! m_shared_base || m_symbols.size() > 1);
         (*m_symbols.back())[name] = m;
         return m;
     }
 
     Node::SymTabEntry get_symbol(const std::string &name) const {
+        KIRAZ_STATS_INC(SymbolLookups);
         return m_symbols.back()->get_symbol(name);
     }
 
+    // For callers that look the same name up repeatedly
+    const Node::Ptr *find_symbol(std::string_view name, uint64_t hash) const {
+        KIRAZ_STATS_INC(SymbolLookups);
+        return m_symbols.back()->find(name, hash);
+    }
+
+    // Symbols declared in the current scope only
     const auto &get_symbols() const { return m_symbols.back()->symbols; }
 
     ScopeRef enter_scope(ScopeType scope_type, Node::Ptr stmt) {
         assert(stmt->get_cur_symtab() == m_symbols.back());
-        m_symbols.emplace_back(
-                std::make_shared<Scope>(m_symbols.back()->symbols, scope_type, stmt));
+        KIRAZ_STATS_INC(ScopesEntered);
+        m_symbols.emplace_back(std::make_shared<Scope>(m_symbols.back(), scope_type, stmt));
         assert(m_symbols.size() > 1);
         return ScopeRef(*this);
     }
@@ -91,10 +119,15 @@ public:
 
     static auto get_module_io() { return s_module_io; }
 
+    // Parses the modules every program can import, once per process. Needs a
+    // current Compiler.
+    static void load_prelude();
+
 private:
     void exit_scope() { m_symbols.pop_back(); }
 
     std::vector<std::shared_ptr<Scope>> m_symbols;
+    bool m_shared_base = false;
 
     static Node::Ptr s_module_ki;
     static Node::Ptr s_module_io;
@@ -109,6 +142,16 @@ class WasmContext {
 public:
     WasmContext() : m_streams(1) {}
 
+    // A fragment is generated on its own, e.g. one per function on a worker
+    // thread, and then merged into the module's context in source order, or
+    // the order of a profile.
+    // Fragments share the layouts and options of the module.
+    struct Fragment {};
+    WasmContext(Fragment, const WasmContext &module)
+            : m_streams(1), m_layout(module.m_layout), m_runtime_options(module.m_runtime_options),
+              m_optimize_options(module.m_optimize_options),
+              m_profile_options(module.m_profile_options), m_fragment(true) {}
+
     struct Coords {
         Coords(uint32_t o = 0, uint32_t l = 0) : offset(o), length(l) {}
         uint32_t offset;
@@ -123,6 +166,59 @@ public:
     Coords add_to_memory(const std::string &s);
     Coords add_to_memory(uint32_t u);
 
+    // Writes "i32.const" with the address of offset in get_memory(). Where the
+    // memory of a fragment ends up is only known at merge time, so fragments
+    // write a placeholder that merge() fills in.
+    void emit_address(uint32_t offset);
+
+    // Appends the code of a fragment. Its memory goes after ours.
+    void merge(const WasmContext &fragment);
+
+    // Layouts of the module being compiled, shared with its fragments
+    void set_layout(std::shared_ptr<const ModuleLayout> layout) { m_layout = std::move(layout); }
+    const ModuleLayout &get_layout() const;
+
+    void set_runtime_options(const RuntimeOptions &opts) { m_runtime_options = opts; }
+    const auto &get_runtime_options() const { return m_runtime_options; }
+
+    void set_optimize_options(const ir::OptimizeOptions &opts) { m_optimize_options = opts; }
+    const auto &get_optimize_options() const { return m_optimize_options; }
+
+    void set_profile_options(const ProfileOptions &opts) { m_profile_options = opts; }
+    const auto &get_profile_options() const { return m_profile_options; }
+
+    // Records of instrumented functions in get_memory(), and their counters
+    void add_profile_record(Coords record, Coords counters) {
+        m_profile_records.emplace_back(record, counters);
+    }
+    const auto &get_profile_records() const { return m_profile_records; }
+
+    // Code calling into the runtime marks the module as needing it.
+    void use_runtime() { m_uses_runtime = true; }
+    bool uses_runtime() const { return m_uses_runtime; }
+
+    // State of the function being generated
+    struct Frame {
+        std::string self; // class of `this`, empty outside of methods
+        std::unordered_map<std::string, std::string> locals; // name -> kiraz type
+        std::vector<std::string_view> temps; // wasm types of $__t0, $__t1...
+
+        const std::string *find_local(std::string_view name) const {
+            auto iter = locals.find(std::string(name));
+            return iter == locals.end() ? nullptr : &iter->second;
+        }
+
+        // A local for intermediate values, declared by the function once its
+        // body is done
+        std::string add_temp(std::string_view type = "i32") {
+            temps.push_back(type);
+            return FF("$__t{}", temps.size() - 1);
+        }
+    };
+
+    Frame &frame() { return m_frame; }
+    const Frame &frame() const { return m_frame; }
+
     auto &body() { return m_streams.back().body; }
     auto &body() const { return m_streams.back().body; }
     auto &locals() { return m_streams.back().locals; }
@@ -142,8 +238,24 @@ public:
     }
 
 private:
+    static constexpr char ADDRESS_MARK = '\x01';
+
     std::vector<unsigned char> m_memory;
     std::vector<Streams> m_streams;
+    std::shared_ptr<const ModuleLayout> m_layout;
+    RuntimeOptions m_runtime_options;
+    ir::OptimizeOptions m_optimize_options;
+    ProfileOptions m_profile_options;
+    std::vector<std::pair<Coords, Coords>> m_profile_records;
+    Frame m_frame;
+    bool m_fragment = false;
+    bool m_has_addresses = false;
+    bool m_uses_runtime = false;
+};
+
+struct Diagnostic {
+    uint32_t offset; // see SourceManager
+    std::string message;
 };
 
 class Compiler {
@@ -154,11 +266,32 @@ public:
     int compile_file(const std::string &file_name);
     int compile_string(const std::string &str);
     Node::Ptr compile_module(const std::string &str);
+    Node::Ptr compile_module(const std::string &name, const std::string &str);
+
+    void set_module_cache(std::shared_ptr<ModuleCache> cache) { m_cache = cache; }
+    void set_runtime_options(const RuntimeOptions &opts) { m_ctx.set_runtime_options(opts); }
+    void set_optimize_options(const ir::OptimizeOptions &opts) {
+        m_ctx.set_optimize_options(opts);
+    }
+    void set_profile_options(const ProfileOptions &opts) { m_ctx.set_profile_options(opts); }
+
+    // Threads used for analysing and generating code for function bodies
+    void set_jobs(unsigned jobs) { m_jobs = jobs ? jobs : 1; }
+    auto get_jobs() const { return m_jobs; }
+    auto get_module_cache() const { return m_cache; }
 
     static void reset_parser();
     void reset();
     void set_error(const std::string &str) { m_error = str; }
     const auto &get_error() const { return m_error; }
+
+    // Syntax and semantic errors, in the order they were found. get_error()
+    // holds the same list as text, one "Error at line:col: ..." line each.
+    void add_diagnostic(uint32_t offset, const std::string &message);
+    const auto &get_diagnostics() const { return m_diagnostics; }
+
+    // What the parser could recover from a module with syntax errors
+    void set_partial_root(Node::Ptr root) { m_partial_root = root; }
     const auto &get_wasm_ctx() const { return m_ctx; }
 
     ~Compiler();
@@ -166,10 +299,20 @@ public:
 protected:
     int compile(Node::Ptr root);
 
+    // Lexes and parses code as the contents of the file called name.
+    Node::Ptr parse(const std::string &name, const std::string &code);
+
+    // The same for code already registered with SourceManager at base
+    Node::Ptr parse(uint32_t base, const std::string &code);
+
 private:
     YY_BUFFER_STATE buffer = nullptr;
     std::string m_error;
+    std::vector<Diagnostic> m_diagnostics;
+    Node::Ptr m_partial_root;
     WasmContext m_ctx;
+    std::shared_ptr<ModuleCache> m_cache;
+    unsigned m_jobs = 1;
     static Compiler *s_current;
 };
 
@@ -0,0 +1,179 @@
+#include "IncrementalParser.h"
+
+#include <algorithm>
+
+#include <lexer.hpp>
+#include <main.h>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/SourceManager.h>
+#include <kiraz/Token.h>
+#include <kiraz/ast/Operator.h>
+
+namespace kiraz {
+
+bool IncrementalParser::s_speculating = false;
+
+IncrementalParser::~IncrementalParser() {
+    drop_items(m_items.begin(), m_items.end());
+}
+
+Node::Ptr IncrementalParser::set_text(std::string text) {
+    m_text = std::move(text);
+    return reparse_all();
+}
+
+void IncrementalParser::drop_items(
+        std::vector<Item>::const_iterator begin, std::vector<Item>::const_iterator end) {
+    std::vector<uint32_t> segs;
+    segs.reserve(end - begin);
+    for (auto it = begin; it != end; ++it) {
+        segs.push_back(it->seg);
+    }
+    SourceManager::instance().drop_ranges(std::move(segs));
+}
+
+bool IncrementalParser::parse_region(
+        uint32_t begin, uint32_t end, std::vector<Item> &out, bool speculative) {
+    auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+    if (std::all_of(m_text.begin() + begin, m_text.begin() + end, is_space)) {
+        return true;
+    }
+
+    auto &sm = SourceManager::instance();
+    auto seg = sm.map_range(m_file, begin, end - begin);
+    if (! seg && ! speculative) {
+        // Out of offsets. Nodes of other buffers lose their locations.
+        sm.clear();
+        m_file = sm.add_file(m_name, m_text);
+        seg = sm.map_range(m_file, begin, end - begin);
+    }
+    if (! seg) {
+        return false;
+    }
+
+    // A region that does not parse sets no root: one left over from an
+    // earlier parse must not pass for it.
+    Node::reset_root();
+    s_speculating = speculative;
+    auto buffer = yy_scan_bytes(m_text.data() + begin, end - begin);
+    token::offset = seg;
+    auto failed = yyparse() != 0;
+    auto root = Node::pop_root();
+    yy_delete_buffer(buffer);
+    Compiler::reset_parser();
+    s_speculating = false;
+
+    if (failed || ! root) {
+        sm.drop_ranges({seg});
+        return false;
+    }
+
+    // Give each statement a range of its own so that it can move on its own.
+    // The first one also covers what precedes it in the region.
+    const auto &stmts = static_cast<ast::StmtList &>(*root).get_stmts();
+    for (size_t i = 0; i < stmts.size(); ++i) {
+        auto offset = stmts[i]->get_offset();
+        if (i == 0) {
+            out.push_back({begin, seg, stmts[i]});
+            continue;
+        }
+        sm.split_range(offset);
+        out.push_back({begin + (offset - seg), offset, stmts[i]});
+    }
+    m_reparsed += stmts.size();
+    return true;
+}
+
+Node::Ptr IncrementalParser::reparse_all() {
+    auto &sm = SourceManager::instance();
+    drop_items(m_items.begin(), m_items.end());
+    m_items.clear();
+    m_reparsed = m_reused = 0;
+
+    if (m_file) {
+        sm.update_file(m_file, m_text);
+    }
+    else {
+        m_file = sm.add_file(m_name, m_text);
+    }
+
+    std::vector<Item> items;
+    if (! parse_region(0, m_text.size(), items, false)) {
+        m_root.reset();
+        return m_root;
+    }
+
+    m_items = std::move(items);
+    make_root();
+    return m_root;
+}
+
+Node::Ptr IncrementalParser::apply(const TextEdit &edit) {
+    if (edit.offset > m_text.size() || edit.removed > m_text.size() - edit.offset) {
+        return m_root;
+    }
+
+    m_text.replace(edit.offset, edit.removed, edit.inserted);
+    SourceManager::instance().update_file(m_file, m_text);
+    if (m_items.empty()) {
+        return reparse_all();
+    }
+
+    auto delta = static_cast<int64_t>(edit.inserted.size()) - edit.removed;
+    auto by_start = [](uint32_t pos, const Item &item) { return pos < item.start; };
+
+    // Damaged: from the statement the edit starts strictly inside of, so that
+    // text typed right after a statement can extend it (an else after an if),
+    // up to and including the one the edit ends at.
+    auto lo = m_items.begin();
+    if (edit.offset > 0) {
+        lo = std::upper_bound(m_items.begin(), m_items.end(), edit.offset - 1, by_start);
+        if (lo != m_items.begin()) {
+            --lo;
+        }
+    }
+    auto hi = std::upper_bound(m_items.begin(), m_items.end(), edit.offset + edit.removed, by_start);
+
+    // Text before the first statement belongs to it.
+    auto begin = lo == m_items.begin() ? 0 : lo->start;
+    auto end = static_cast<uint32_t>(m_text.size());
+
+    // Statements after the damage move with the text. Should the region fail
+    // to parse, reparse_all() starts over anyway.
+    auto &sm = SourceManager::instance();
+    if (hi != m_items.end()) {
+        if (delta != 0) {
+            sm.shift_ranges(m_file, hi->start, delta);
+            for (auto it = hi; it != m_items.end(); ++it) {
+                it->start += delta;
+            }
+        }
+        end = hi->start;
+    }
+    drop_items(lo, hi);
+
+    std::vector<Item> items;
+    m_reparsed = 0;
+    if (! parse_region(begin, end, items, true)) {
+        return reparse_all();
+    }
+
+    m_reused = m_items.size() - (hi - lo);
+    auto at = m_items.erase(lo, hi);
+    m_items.insert(at, items.begin(), items.end());
+
+    make_root();
+    return m_root;
+}
+
+void IncrementalParser::make_root() {
+    std::vector<Node::Ptr> stmts;
+    stmts.reserve(m_items.size());
+    for (const auto &item : m_items) {
+        stmts.push_back(item.node);
+    }
+    m_root = std::make_shared<ast::StmtList>(std::move(stmts));
+}
+
+} // namespace kiraz
@@ -0,0 +1,84 @@
+#ifndef KIRAZ_INCREMENTALPARSER_H
+#define KIRAZ_INCREMENTALPARSER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <kiraz/Node.h>
+
+namespace kiraz {
+
+// Replace the removed bytes at offset with inserted. Offsets count bytes of
+// the text as it was before the edit.
+struct TextEdit {
+    uint32_t offset = 0;
+    uint32_t removed = 0;
+    std::string inserted;
+};
+
+/**
+ * @brief IncrementalParser: Keeps the AST of a buffer that is being edited,
+ * e.g. in an editor.
+ *
+ * Top-level statements are the unit of reuse. An edit only re-lexes and
+ * reparses the statements it touches; every other statement, func and class
+ * bodies included, is shared as is by the new root. Node offsets of the
+ * shared statements stay valid since their SourceManager ranges are moved
+ * along with the text.
+ *
+ * When the damaged statements no longer parse on their own, the whole buffer
+ * is parsed again, which also reports the syntax errors the usual way.
+ */
+class IncrementalParser {
+public:
+    explicit IncrementalParser(std::string name = "<incremental>") : m_name(std::move(name)) {}
+    ~IncrementalParser();
+
+    IncrementalParser(const IncrementalParser &) = delete;
+    IncrementalParser &operator=(const IncrementalParser &) = delete;
+
+    // Parses text from scratch. Returns the root, null on syntax errors.
+    Node::Ptr set_text(std::string text);
+
+    Node::Ptr apply(const TextEdit &edit);
+
+    const auto &get_text() const { return m_text; }
+    const auto &get_root() const { return m_root; }
+
+    // Statements parsed and reused by the last call
+    auto get_reparsed() const { return m_reparsed; }
+    auto get_reused() const { return m_reused; }
+
+    // True while parsing a region that may turn out to be malformed. The
+    // parser stays quiet about syntax errors then.
+    static bool is_speculating() { return s_speculating; }
+
+private:
+    // A top-level statement together with the text up to the next one
+    struct Item {
+        uint32_t start; // position in m_text
+        uint32_t seg;   // SourceManager range the node's offsets are in
+        Node::Ptr node;
+    };
+
+    bool parse_region(uint32_t begin, uint32_t end, std::vector<Item> &out, bool speculative);
+    Node::Ptr reparse_all();
+    void make_root();
+    void drop_items(std::vector<Item>::const_iterator begin, std::vector<Item>::const_iterator end);
+
+    std::string m_name;
+    std::string m_text;
+    uint32_t m_file = 0;
+    std::vector<Item> m_items;
+    Node::Ptr m_root;
+
+    size_t m_reparsed = 0;
+    size_t m_reused = 0;
+
+    static bool s_speculating;
+};
+
+} // namespace kiraz
+
+#endif
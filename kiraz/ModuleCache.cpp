@@ -0,0 +1,659 @@
+#include "ModuleCache.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+#include <kiraz/ast/Literal.h>
+#include <kiraz/ast/Operator.h>
+
+#ifndef KIRAZ_VERSION
+#define KIRAZ_VERSION "unknown"
+#endif
+
+namespace kiraz {
+
+namespace {
+
+#ifndef _WIN32
+auto process_id() { return getpid(); }
+#else
+auto process_id() { return _getpid(); }
+#endif
+
+constexpr char MAGIC_AST[4] = {'K', 'I', 'R', 'A'};
+
+enum class Tag : uint8_t {
+    Null = 0,
+    StmtList,
+    Module,
+    Func,
+    FuncArgs,
+    FArg,
+    Let,
+    Assignment,
+    Class,
+    If,
+    While,
+    Import,
+    Return,
+    Dot,
+    Call,
+    Add,
+    Sub,
+    Mult,
+    Div,
+    OpEq,
+    OpNe,
+    OpLt,
+    OpGt,
+    OpLe,
+    OpGe,
+    Integer,
+    String,
+    Boolean,
+    Id,
+    Signed,
+};
+
+class Writer {
+public:
+    Writer(std::string &out, uint32_t base) : m_out(out), m_base(base) {}
+
+    void u8(uint8_t v) { m_out.push_back(static_cast<char>(v)); }
+    void u32(uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            u8((v >> (i * 8)) & 0xFF);
+        }
+    }
+    void u64(uint64_t v) {
+        for (int i = 0; i < 8; ++i) {
+            u8((v >> (i * 8)) & 0xFF);
+        }
+    }
+    void str(std::string_view s) {
+        u32(s.size());
+        m_out.append(s);
+    }
+    void raw(const char *p, size_t n) { m_out.append(p, n); }
+
+    bool node(const Node::Ptr &n);
+
+private:
+    // The tag, then the offset of the node relative to the module, 0 if unknown
+    void head(Tag tag, const Node &n) {
+        u8(static_cast<uint8_t>(tag));
+        auto offset = n.get_offset();
+        u32(offset != 0 && offset >= m_base ? offset - m_base + 1 : 0);
+    }
+
+    template <typename T>
+    bool binary(Tag tag, const T &op) {
+        head(tag, op);
+        return node(op.get_left()) && node(op.get_right());
+    }
+
+    bool list(Tag tag, const Node &n, const std::vector<Node::Ptr> &nodes) {
+        head(tag, n);
+        u32(nodes.size());
+        for (auto &n : nodes) {
+            if (! node(n)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string &m_out;
+    uint32_t m_base;
+};
+
+bool Writer::node(const Node::Ptr &n) {
+    using namespace ast;
+
+    if (! n) {
+        u8(static_cast<uint8_t>(Tag::Null));
+        return true;
+    }
+
+    auto p = n.get();
+
+    if (auto v = dynamic_cast<const Id *>(p)) {
+        head(Tag::Id, *p);
+        str(v->get_id());
+        return true;
+    }
+    if (auto v = dynamic_cast<const Integer *>(p)) {
+        head(Tag::Integer, *p);
+        u64(static_cast<uint64_t>(v->get_value()));
+        return true;
+    }
+    if (auto v = dynamic_cast<const String *>(p)) {
+        head(Tag::String, *p);
+        str(v->get_value());
+        return true;
+    }
+    if (auto v = dynamic_cast<const Boolean *>(p)) {
+        head(Tag::Boolean, *p);
+        u8(v->get_value());
+        return true;
+    }
+    if (auto v = dynamic_cast<const Signed *>(p)) {
+        head(Tag::Signed, *p);
+        str(v->get_op());
+        return node(v->get_operand());
+    }
+
+    if (auto v = dynamic_cast<const Add *>(p)) {
+        return binary(Tag::Add, *v);
+    }
+    if (auto v = dynamic_cast<const Sub *>(p)) {
+        return binary(Tag::Sub, *v);
+    }
+    if (auto v = dynamic_cast<const Mult *>(p)) {
+        return binary(Tag::Mult, *v);
+    }
+    if (auto v = dynamic_cast<const Div *>(p)) {
+        return binary(Tag::Div, *v);
+    }
+    if (auto v = dynamic_cast<const OpEq *>(p)) {
+        return binary(Tag::OpEq, *v);
+    }
+    if (auto v = dynamic_cast<const OpNe *>(p)) {
+        return binary(Tag::OpNe, *v);
+    }
+    if (auto v = dynamic_cast<const OpLt *>(p)) {
+        return binary(Tag::OpLt, *v);
+    }
+    if (auto v = dynamic_cast<const OpGt *>(p)) {
+        return binary(Tag::OpGt, *v);
+    }
+    if (auto v = dynamic_cast<const OpLe *>(p)) {
+        return binary(Tag::OpLe, *v);
+    }
+    if (auto v = dynamic_cast<const OpGe *>(p)) {
+        return binary(Tag::OpGe, *v);
+    }
+
+    if (auto v = dynamic_cast<const StmtList *>(p)) {
+        return list(Tag::StmtList, *p, v->get_stmts());
+    }
+    if (auto v = dynamic_cast<const Module *>(p)) {
+        return list(Tag::Module, *p, v->get_stmts());
+    }
+    if (auto v = dynamic_cast<const FuncArgs *>(p)) {
+        return list(Tag::FuncArgs, *p, v->get_args());
+    }
+
+    if (auto v = dynamic_cast<const Func *>(p)) {
+        head(Tag::Func, *p);
+        return node(v->get_name()) && node(v->get_args()) && node(v->get_ret_type())
+                && node(v->get_scope());
+    }
+    if (auto v = dynamic_cast<const FArg *>(p)) {
+        head(Tag::FArg, *p);
+        return node(v->get_name()) && node(v->get_type());
+    }
+    if (auto v = dynamic_cast<const Let *>(p)) {
+        head(Tag::Let, *p);
+        return node(v->get_name()) && node(v->get_type()) && node(v->get_init());
+    }
+    if (auto v = dynamic_cast<const Assignment *>(p)) {
+        head(Tag::Assignment, *p);
+        return node(v->get_lhs()) && node(v->get_rhs());
+    }
+    if (auto v = dynamic_cast<const Class *>(p)) {
+        head(Tag::Class, *p);
+        return node(v->get_name()) && node(v->get_scope());
+    }
+    if (auto v = dynamic_cast<const If *>(p)) {
+        head(Tag::If, *p);
+        return node(v->get_cond()) && node(v->get_then()) && node(v->get_else());
+    }
+    if (auto v = dynamic_cast<const While *>(p)) {
+        head(Tag::While, *p);
+        return node(v->get_cond()) && node(v->get_repeat());
+    }
+    if (auto v = dynamic_cast<const Import *>(p)) {
+        head(Tag::Import, *p);
+        return node(v->get_name());
+    }
+    if (auto v = dynamic_cast<const Return *>(p)) {
+        head(Tag::Return, *p);
+        return node(v->get_value());
+    }
+    if (auto v = dynamic_cast<const Dot *>(p)) {
+        head(Tag::Dot, *p);
+        return node(v->get_lhs()) && node(v->get_rhs());
+    }
+    if (auto v = dynamic_cast<const Call *>(p)) {
+        head(Tag::Call, *p);
+        return node(v->get_name()) && node(v->get_args());
+    }
+
+    // Unknown node type, the module is not cacheable.
+    return false;
+}
+
+class Reader {
+public:
+    Reader(std::string_view data, uint32_t base) : m_data(data), m_base(base) {}
+
+    bool ok() const { return m_ok; }
+    bool at_end() const { return m_pos == m_data.size(); }
+
+    uint8_t u8() {
+        if (! need(1)) {
+            return 0;
+        }
+        return static_cast<uint8_t>(m_data[m_pos++]);
+    }
+    uint32_t u32() {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) {
+            v |= uint32_t(u8()) << (i * 8);
+        }
+        return v;
+    }
+    uint64_t u64() {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) {
+            v |= uint64_t(u8()) << (i * 8);
+        }
+        return v;
+    }
+    std::string_view str() {
+        auto len = u32();
+        if (! need(len)) {
+            return {};
+        }
+        auto retval = m_data.substr(m_pos, len);
+        m_pos += len;
+        return retval;
+    }
+    bool magic(const char (&m)[4]) {
+        if (! need(4)) {
+            return false;
+        }
+        m_ok = std::memcmp(m_data.data() + m_pos, m, 4) == 0;
+        m_pos += 4;
+        return m_ok;
+    }
+
+    Node::Ptr node();
+
+private:
+    Node::Ptr make(Tag tag);
+
+    bool need(size_t n) {
+        if (! m_ok || m_data.size() - m_pos < n) {
+            m_ok = false;
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<Node::Ptr> list() {
+        std::vector<Node::Ptr> retval;
+        auto count = u32();
+        // Every node takes at least one byte, reject absurd counts early.
+        if (! need(count)) {
+            return retval;
+        }
+        retval.reserve(count);
+        for (uint32_t i = 0; i < count && m_ok; ++i) {
+            retval.push_back(node());
+        }
+        return retval;
+    }
+
+    std::string_view m_data;
+    uint32_t m_base;
+    size_t m_pos = 0;
+    bool m_ok = true;
+};
+
+Node::Ptr Reader::node() {
+    auto tag = static_cast<Tag>(u8());
+    if (! m_ok || tag == Tag::Null) {
+        return nullptr;
+    }
+
+    // See Writer::head. An offset past what the source manager can hand out
+    // only comes from a damaged entry.
+    auto offset = u32();
+    auto retval = make(tag);
+    if (retval) {
+        auto fits = offset != 0 && offset - 1 < std::numeric_limits<uint32_t>::max() - m_base;
+        retval->set_offset(fits ? m_base + offset - 1 : 0);
+    }
+    return retval;
+}
+
+Node::Ptr Reader::make(Tag tag) {
+    using namespace ast;
+
+    switch (tag) {
+    case Tag::Null:
+        return nullptr;
+
+    case Tag::Id:
+        return std::make_shared<Id>(std::string(str()));
+    case Tag::Integer:
+        return std::make_shared<Integer>(static_cast<int64_t>(u64()));
+    case Tag::String:
+        return std::make_shared<String>(std::string(str()));
+    case Tag::Boolean:
+        return std::make_shared<Boolean>(u8() != 0);
+    case Tag::Signed: {
+        auto op = std::string(str());
+        return std::make_shared<Signed>(std::move(op), node());
+    }
+
+    case Tag::Add: {
+        auto l = node();
+        return std::make_shared<Add>(l, node());
+    }
+    case Tag::Sub: {
+        auto l = node();
+        return std::make_shared<Sub>(l, node());
+    }
+    case Tag::Mult: {
+        auto l = node();
+        return std::make_shared<Mult>(l, node());
+    }
+    case Tag::Div: {
+        auto l = node();
+        return std::make_shared<Div>(l, node());
+    }
+    case Tag::OpEq: {
+        auto l = node();
+        return std::make_shared<OpEq>(l, node());
+    }
+    case Tag::OpNe: {
+        auto l = node();
+        return std::make_shared<OpNe>(l, node());
+    }
+    case Tag::OpLt: {
+        auto l = node();
+        return std::make_shared<OpLt>(l, node());
+    }
+    case Tag::OpGt: {
+        auto l = node();
+        return std::make_shared<OpGt>(l, node());
+    }
+    case Tag::OpLe: {
+        auto l = node();
+        return std::make_shared<OpLe>(l, node());
+    }
+    case Tag::OpGe: {
+        auto l = node();
+        return std::make_shared<OpGe>(l, node());
+    }
+
+    case Tag::StmtList:
+        return std::make_shared<StmtList>(list());
+    case Tag::Module:
+        return std::make_shared<Module>(list());
+    case Tag::FuncArgs:
+        return std::make_shared<FuncArgs>(list());
+
+    case Tag::Func: {
+        auto name = node();
+        auto args = node();
+        auto ret_type = node();
+        return std::make_shared<Func>(name, args, ret_type, node());
+    }
+    case Tag::FArg: {
+        auto name = node();
+        return std::make_shared<FArg>(name, node());
+    }
+    case Tag::Let: {
+        auto name = node();
+        auto type = node();
+        return std::make_shared<Let>(name, type, node());
+    }
+    case Tag::Assignment: {
+        auto lhs = node();
+        return std::make_shared<Assignment>(lhs, node());
+    }
+    case Tag::Class: {
+        auto name = node();
+        return std::make_shared<Class>(name, node());
+    }
+    case Tag::If: {
+        auto cond = node();
+        auto then_stmts = node();
+        return std::make_shared<If>(cond, then_stmts, node());
+    }
+    case Tag::While: {
+        auto cond = node();
+        return std::make_shared<While>(cond, node());
+    }
+    case Tag::Import:
+        return std::make_shared<Import>(node());
+    case Tag::Return:
+        return std::make_shared<Return>(node());
+    case Tag::Dot: {
+        auto lhs = node();
+        return std::make_shared<Dot>(lhs, node());
+    }
+    case Tag::Call: {
+        auto name = node();
+        return std::make_shared<Call>(name, node());
+    }
+    }
+
+    m_ok = false;
+    return nullptr;
+}
+
+bool write_file(const std::string &path, const std::string &data) {
+    // Write to a temporary name first so that concurrent builds never observe a
+    // partially written cache entry. The name is unique to the process and the
+    // write, as threads and other processes may store the same entry.
+    static std::atomic<uint32_t> s_writes;
+    auto tmp = FF("{}.{}-{}.tmp", path, process_id(), s_writes++);
+    std::error_code ec;
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (! f.is_open()) {
+            return false;
+        }
+        f.write(data.data(), data.size());
+        if (! f.good()) {
+            f.close();
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+/*
+ * MappedFile
+ */
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::open(const std::string &path) {
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(path.data(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    m_data = static_cast<const char *>(addr);
+    m_size = sb.st_size;
+    m_mapped = true;
+    return true;
+#else
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    if (! f.is_open()) {
+        return false;
+    }
+    m_fallback.resize(f.tellg());
+    f.seekg(0);
+    if (m_fallback.empty() || ! f.read(m_fallback.data(), m_fallback.size())) {
+        m_fallback.clear();
+        return false;
+    }
+    m_data = m_fallback.data();
+    m_size = m_fallback.size();
+    return true;
+#endif
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+    if (m_mapped) {
+        munmap(const_cast<char *>(m_data), m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    m_fallback.clear();
+}
+
+/*
+ * ModuleCache
+ */
+ModuleCache::ModuleCache(const std::string &dir) : m_dir(dir) {
+    std::error_code ec;
+    std::filesystem::create_directories(m_dir, ec);
+}
+
+uint64_t ModuleCache::hash(std::string_view data, uint64_t seed) {
+    // FNV-1a, 64 bit
+    uint64_t h = seed;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint64_t ModuleCache::make_key(std::string_view source) {
+    auto h = hash(KIRAZ_VERSION);
+    h = hash(std::string_view(reinterpret_cast<const char *>(&FORMAT_VERSION),
+                     sizeof(FORMAT_VERSION)),
+            h);
+    return hash(source, h);
+}
+
+std::string ModuleCache::path_for(const std::string &name, uint64_t key, const char *ext) const {
+    return FF("{}/{}.{:016x}.{}", m_dir, name, key, ext);
+}
+
+bool ModuleCache::serialize(Node::Ptr root, std::string &out, uint32_t base) {
+    Writer w(out, base);
+    return w.node(root);
+}
+
+Node::Ptr ModuleCache::deserialize(std::string_view data, uint32_t base) {
+    Reader r(data, base);
+    auto retval = r.node();
+    if (! r.ok() || ! r.at_end()) {
+        return nullptr;
+    }
+    return retval;
+}
+
+bool ModuleCache::store(const std::string &name, uint64_t key, Node::Ptr root, uint32_t base) {
+    std::string ast;
+    {
+        Writer w(ast, base);
+        w.raw(MAGIC_AST, sizeof(MAGIC_AST));
+        w.u32(FORMAT_VERSION);
+        w.u64(key);
+        if (! w.node(root)) {
+            return false;
+        }
+    }
+
+    if (! write_file(path_for(name, key, "kia"), ast)) {
+        return false;
+    }
+
+    prune(name, key);
+    return true;
+}
+
+Node::Ptr ModuleCache::load_ast(const std::string &name, uint64_t key, uint32_t base) {
+    MappedFile file;
+    if (! file.open(path_for(name, key, "kia"))) {
+        ++m_misses;
+        return nullptr;
+    }
+
+    Reader r(file.view(), base);
+    if (! r.magic(MAGIC_AST) || r.u32() != FORMAT_VERSION || r.u64() != key) {
+        ++m_misses;
+        return nullptr;
+    }
+
+    auto root = r.node();
+    if (! r.ok() || ! r.at_end() || ! root) {
+        ++m_misses;
+        return nullptr;
+    }
+
+    ++m_hits;
+    return root;
+}
+
+void ModuleCache::prune(const std::string &name, uint64_t keep_key) {
+    std::error_code ec;
+    auto keep = FF("{}.{:016x}.kia", name, keep_key);
+    auto prefix = name + ".";
+
+    for (auto &entry : std::filesystem::directory_iterator(m_dir, ec)) {
+        auto fn = entry.path().filename().string();
+        if (! fn.starts_with(prefix) || fn == keep) {
+            continue;
+        }
+
+        // Only <name>.<16 hex digits>.kia belongs to this module.
+        auto rest = std::string_view(fn).substr(prefix.size());
+        if (rest.size() != 16 + 4 || ! rest.ends_with(".kia")) {
+            continue;
+        }
+
+        std::filesystem::remove(entry.path(), ec);
+    }
+}
+
+} // namespace kiraz
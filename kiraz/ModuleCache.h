@@ -0,0 +1,85 @@
+#ifndef KIRAZ_MODULECACHE_H
+#define KIRAZ_MODULECACHE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <kiraz/Node.h>
+
+namespace kiraz {
+
+/**
+ * @brief MappedFile: Read-only view of a file. Uses mmap where available and
+ * falls back to reading the whole file into memory otherwise.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    bool open(const std::string &path);
+    void close();
+
+    std::string_view view() const { return {m_data, m_size}; }
+    bool is_open() const { return m_data != nullptr; }
+
+private:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::vector<char> m_fallback;
+};
+
+/**
+ * @brief ModuleCache: On-disk cache of parsed modules.
+ *
+ * For every module the AST is written under the cache directory in a
+ * compact, tagged binary form, named after the module and a key derived from
+ * the source text and the compiler version:
+ *
+ *   <name>.<key>.kia
+ *
+ * A changed source or compiler yields a different key, so stale entries are
+ * never read; they are only left behind for `prune()` to remove. Imports such
+ * as io go through the same cache, see Compiler::compile_module.
+ *
+ * Nodes keep their source offsets, stored relative to base: the offset
+ * SourceManager gave the first byte of the module. The source of a module
+ * loaded from the cache is to be registered again, and its offset passed as
+ * base, for diagnostics to point into it.
+ */
+class ModuleCache {
+public:
+    static constexpr uint32_t FORMAT_VERSION = 2;
+
+    explicit ModuleCache(const std::string &dir);
+
+    static uint64_t hash(std::string_view data, uint64_t seed = 0xcbf29ce484222325ull);
+    static uint64_t make_key(std::string_view source);
+
+    Node::Ptr load_ast(const std::string &name, uint64_t key, uint32_t base = 0);
+    bool store(const std::string &name, uint64_t key, Node::Ptr root, uint32_t base = 0);
+    void prune(const std::string &name, uint64_t keep_key);
+
+    static bool serialize(Node::Ptr root, std::string &out, uint32_t base = 0);
+    static Node::Ptr deserialize(std::string_view data, uint32_t base = 0);
+
+    const auto &get_dir() const { return m_dir; }
+    auto get_hits() const { return m_hits; }
+    auto get_misses() const { return m_misses; }
+
+private:
+    std::string path_for(const std::string &name, uint64_t key, const char *ext) const;
+
+    std::string m_dir;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+};
+
+} // namespace kiraz
+
+#endif
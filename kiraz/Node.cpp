@@ -1,12 +1,23 @@
 #include "Node.h"
 #include <kiraz/Compiler.h> // SymbolTable ve WasmContext tanımları için şart
+#include <kiraz/SourceManager.h>
+#include <kiraz/Stats.h>
 
 Node::Ptr Node::s_root;
 Node::Ptr Node::s_root_before;
+uint32_t Node::s_next_offset;
 
-Node::Node() {}
+Node::Node() : m_offset(s_next_offset) { KIRAZ_STATS_INC(NodesAllocated); }
 Node::~Node() {}
 
+int Node::get_line() const {
+    return kiraz::SourceManager::instance().lookup(m_offset).line;
+}
+
+int Node::get_col() const {
+    return kiraz::SourceManager::instance().lookup(m_offset).col;
+}
+
 // Semantik Analiz (Base implementasyonlar)
 Node::Ptr Node::compute_stmt_type(kiraz::SymbolTable &st) {
     // Varsayılan olarak mevcut scope'u kaydet
@@ -26,6 +37,18 @@ Node::SymTabEntry Node::get_subsymbol(Ptr name) const {
     return {};
 }
 
+std::string Node::as_string() const {
+    fmt::memory_buffer out;
+    format_to(out);
+    return fmt::to_string(out);
+}
+
+size_t Node::count_nodes() const {
+    size_t retval = 1;
+    for_each_child([&retval](const Ptr &child) { retval += child->count_nodes(); });
+    return retval;
+}
+
 // WASM Kod Üretimi (Base implementasyon)
 Node::Ptr Node::gen_wat(kiraz::WasmContext &ctx) {
     return nullptr;
@@ -1,9 +1,12 @@
 #ifndef KIRAZ_NODE_H
 #define KIRAZ_NODE_H
 
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
 
 #include <fmt/format.h>
 
@@ -21,6 +24,7 @@ class Node : public std::enable_shared_from_this<Node> {
 public:
     using Ptr = std::shared_ptr<Node>;
     using SymTabEntry = std::pair<std::string, Ptr>;
+    using ChildFn = std::function<void(const Ptr &)>;
 
     Node();
     virtual ~Node();
@@ -29,11 +33,15 @@ public:
     void set_id(const std::string &id) { m_id = id; }
     const std::string &get_id() const { return m_id; }
 
-    // Konum Bilgileri
-    void set_line(int line) { m_line = line; }
-    int get_line() const { return m_line; }
-    void set_col(int col) { m_col = col; }
-    int get_col() const { return m_col; }
+    // Konum Bilgileri: tek bir kaynak ofseti tutulur, satır/sütun istenince
+    // SourceManager üzerinden hesaplanır.
+    void set_offset(uint32_t offset) { m_offset = offset; }
+    uint32_t get_offset() const { return m_offset; }
+    int get_line() const;
+    int get_col() const;
+
+    // Yeni oluşturulan düğümlerin alacağı ofset (lexer ve parser ayarlar)
+    static void set_next_offset(uint32_t offset) { s_next_offset = offset; }
 
     // Hata Yönetimi
     void set_error(const std::string &error) { m_error = error; }
@@ -54,8 +62,15 @@ public:
     // WasmContext artık kiraz namespace'i altında
     virtual Ptr gen_wat(kiraz::WasmContext &ctx);
 
+    // Alt düğümler, kaynak sırasıyla. Boş (nullptr) çocuklar atlanır.
+    virtual void for_each_child(const ChildFn &fn) const {}
+    size_t count_nodes() const;
+
+    // Yazdırma: bütün ağaç tek bir tampona yazılır, ara string oluşturulmaz.
+    virtual void format_to(fmt::memory_buffer &out) const = 0;
+    std::string as_string() const;
+
     // Sanal Metotlar (Type Checks)
-    virtual std::string as_string() const = 0;
     virtual bool is_stmt_list() const { return false; }
     virtual bool is_funcarg_list() const { return false; }
     virtual bool is_func() const { return false; }
@@ -81,9 +96,12 @@ public:
     std::shared_ptr<void> get_cur_symtab() const { return m_cur_symtab; }
 
 protected:
+    static void put(fmt::memory_buffer &out, std::string_view str) {
+        out.append(str.data(), str.data() + str.size());
+    }
+
     std::string m_id;
-    int m_line = 0;
-    int m_col = 0;
+    uint32_t m_offset;
     std::string m_error;
     Ptr m_stmt_type;
     std::shared_ptr<void> m_cur_symtab;
@@ -91,6 +109,7 @@ protected:
 private:
     static Ptr s_root;
     static Ptr s_root_before;
+    static uint32_t s_next_offset;
 };
 
 // Loglama operatörü
@@ -0,0 +1,43 @@
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace kiraz {
+
+unsigned hardware_jobs() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void parallel_for(size_t count, unsigned jobs, const std::function<void(size_t)> &fn) {
+    auto threads = std::min<size_t>(jobs, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next = 0;
+    auto work = [&] {
+        for (auto i = next.fetch_add(1, std::memory_order_relaxed); i < count;
+                i = next.fetch_add(1, std::memory_order_relaxed)) {
+            fn(i);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+
+    for (auto &w : workers) {
+        w.join();
+    }
+}
+
+} // namespace kiraz
@@ -0,0 +1,24 @@
+#ifndef KIRAZ_PARALLEL_H
+#define KIRAZ_PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+namespace kiraz {
+
+/**
+ * @brief parallel_for: Runs fn(0) ... fn(count - 1) on up to jobs threads, the
+ * calling thread included, and returns once all of them are done.
+ *
+ * Indices are handed out one at a time, so one large function does not hold
+ * up a batch of small ones. The order in which they run is unspecified; fn is
+ * expected to write its results to a slot of its own.
+ */
+void parallel_for(size_t count, unsigned jobs, const std::function<void(size_t)> &fn);
+
+// Number of hardware threads, at least 1
+unsigned hardware_jobs();
+
+} // namespace kiraz
+
+#endif
@@ -0,0 +1,158 @@
+#include "Profile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace kiraz {
+
+namespace {
+
+constexpr char MAGIC[4] = {'K', 'P', 'R', 'F'};
+
+void put(std::string &out, uint64_t v, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        out.push_back(static_cast<char>((v >> (i * 8)) & 0xFF));
+    }
+}
+
+class Reader {
+public:
+    explicit Reader(std::string_view data) : m_data(data) {}
+
+    bool ok() const { return m_ok; }
+    bool at_end() const { return m_pos == m_data.size(); }
+    size_t left() const { return m_data.size() - m_pos; }
+
+    uint64_t get(size_t size) {
+        if (! need(size)) {
+            return 0;
+        }
+        uint64_t v = 0;
+        for (size_t i = 0; i < size; ++i) {
+            v |= uint64_t(static_cast<uint8_t>(m_data[m_pos++])) << (i * 8);
+        }
+        return v;
+    }
+    std::string_view bytes(size_t size) {
+        if (! need(size)) {
+            return {};
+        }
+        auto retval = m_data.substr(m_pos, size);
+        m_pos += size;
+        return retval;
+    }
+
+private:
+    bool need(size_t n) {
+        if (! m_ok || m_data.size() - m_pos < n) {
+            m_ok = false;
+            return false;
+        }
+        return true;
+    }
+
+    std::string_view m_data;
+    size_t m_pos = 0;
+    bool m_ok = true;
+};
+
+} // namespace
+
+std::string Profile::make_record(std::string_view name, uint64_t hash, uint32_t counters) {
+    std::string retval(MAGIC, sizeof(MAGIC));
+    put(retval, FORMAT_VERSION, 4);
+    put(retval, name.size(), 4);
+    retval.append(name);
+    put(retval, hash, 8);
+    put(retval, counters, 4);
+    retval.append(counters * size_t(8), '\0');
+    return retval;
+}
+
+size_t Profile::counters_offset(std::string_view name) {
+    return sizeof(MAGIC) + 4 + 4 + name.size() + 8 + 4;
+}
+
+bool Profile::merge(std::string_view data) {
+    struct Record {
+        std::string_view name;
+        Function fn;
+    };
+    std::vector<Record> records;
+
+    Reader r(data);
+    while (r.ok() && ! r.at_end()) {
+        auto magic = r.bytes(sizeof(MAGIC));
+        if (! r.ok() || std::memcmp(magic.data(), MAGIC, sizeof(MAGIC)) != 0
+                || r.get(4) != FORMAT_VERSION) {
+            return false;
+        }
+        auto &record = records.emplace_back();
+        record.name = r.bytes(r.get(4));
+        record.fn.hash = r.get(8);
+        auto count = r.get(4);
+        if (! r.ok() || count > r.left() / 8) {
+            return false;
+        }
+        record.fn.counters.resize(count);
+        for (auto &counter : record.fn.counters) {
+            counter = r.get(8);
+        }
+    }
+    if (! r.ok()) {
+        return false;
+    }
+
+    for (auto &[name, fn] : records) {
+        m_total_entries += fn.entries();
+        auto &fns = m_functions[std::string(name)];
+        auto iter = std::find_if(fns.begin(), fns.end(), [&](const Function &f) {
+            return f.hash == fn.hash && f.counters.size() == fn.counters.size();
+        });
+        if (iter == fns.end()) {
+            fns.push_back(std::move(fn));
+            continue;
+        }
+        for (size_t i = 0; i < fn.counters.size(); ++i) {
+            iter->counters[i] += fn.counters[i];
+        }
+    }
+    return true;
+}
+
+bool Profile::load(const std::string &path) {
+    std::ifstream f(path, std::ios::binary);
+    if (! f.is_open()) {
+        return false;
+    }
+    std::string data(std::istreambuf_iterator<char>(f), {});
+    return merge(data);
+}
+
+const Profile::Function *Profile::find(std::string_view name, uint64_t hash) const {
+    auto iter = m_functions.find(std::string(name));
+    if (iter == m_functions.end()) {
+        return nullptr;
+    }
+    for (const auto &fn : iter->second) {
+        if (fn.hash == hash) {
+            return &fn;
+        }
+    }
+    return nullptr;
+}
+
+uint64_t Profile::entries(std::string_view name) const {
+    auto iter = m_functions.find(std::string(name));
+    if (iter == m_functions.end()) {
+        return 0;
+    }
+    uint64_t retval = 0;
+    for (const auto &fn : iter->second) {
+        retval += fn.entries();
+    }
+    return retval;
+}
+
+} // namespace kiraz
@@ -0,0 +1,79 @@
+#ifndef KIRAZ_PROFILE_H
+#define KIRAZ_PROFILE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace kiraz {
+
+/**
+ * @brief Profile: Counts of a run of a module built with --profile-generate,
+ * read back for --profile-use.
+ *
+ * Instrumented modules import
+ *
+ *   (import "profile" "dump" (func $profile_dump (param i32 i32)))
+ *
+ * and call it at the end of main with the address and length of the record
+ * of each function, clearing the counts after it. Hosts append the bytes to
+ * the profile as they are, so the profile of several runs is the records of
+ * all of them, and profiles are merged by concatenating their files. A
+ * record is, little endian:
+ *
+ *   "KPRF"             magic
+ *   u32 version        FORMAT_VERSION
+ *   u32 length, name   the wasm name of the function
+ *   u64 hash           of the shape of its IR, see ir::shape_hash
+ *   u32 count          of the counters that follow
+ *   u64 counters[]     entries, then executions and times taken of each
+ *                      cond_br in block order
+ *
+ * Counts of records with the same name and hash add up. Records of functions
+ * that have changed since do not match their hash and are left unused.
+ */
+class Profile {
+public:
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    struct Function {
+        uint64_t hash = 0;
+        std::vector<uint64_t> counters;
+
+        uint64_t entries() const { return counters.empty() ? 0 : counters[0]; }
+    };
+
+    // A record with every counter at zero, and where in it the counters start
+    static std::string make_record(std::string_view name, uint64_t hash, uint32_t counters);
+    static size_t counters_offset(std::string_view name);
+
+    // Adds the records of data, false with nothing added if one is malformed
+    bool merge(std::string_view data);
+    bool load(const std::string &path);
+
+    const Function *find(std::string_view name, uint64_t hash) const;
+
+    // Of the records of name whatever their hash, for what is decided before
+    // functions are lowered
+    uint64_t entries(std::string_view name) const;
+    uint64_t total_entries() const { return m_total_entries; }
+
+private:
+    std::unordered_map<std::string, std::vector<Function>> m_functions;
+    uint64_t m_total_entries = 0;
+};
+
+struct ProfileOptions {
+    // Counts function entries and branches, see Profile
+    bool generate = false;
+
+    // Counts of a previous run to optimize for
+    std::shared_ptr<const Profile> use;
+};
+
+} // namespace kiraz
+
+#endif
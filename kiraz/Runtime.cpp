@@ -0,0 +1,176 @@
+#include "Runtime.h"
+
+#include <algorithm>
+#include <bit>
+#include <unordered_map>
+
+#include <kiraz/Compiler.h>
+
+namespace kiraz {
+
+using namespace runtime;
+
+void emit_runtime(WasmContext &ctx) {
+    // The list heads go first, the heap after them.
+    auto lists = (std::max<size_t>(ctx.get_memory().size(), 8) + 7) & ~size_t(7);
+    auto heap_base = lists + SIZE_CLASSES * 4;
+    auto shift = std::countr_zero(SIZE_CLASS_STEP);
+
+    ctx.body() << FF("  (global $__heap (mut i32) (i32.const {}))\n", heap_base);
+
+    // The address of the head of the list for size, in $list
+    auto find_list = FF(R"(    local.get $size
+    i32.const 1
+    i32.sub
+    i32.const {}
+    i32.shr_u
+    i32.const 2
+    i32.shl
+    i32.const {}
+    i32.add
+)",
+            shift, lists);
+
+    // Sizes of 0 wrap around and take the bump path.
+    ctx.body() << FF(R"(  (func $__alloc (param $size i32) (result i32)
+    (local $list i32)
+    (local $ptr i32)
+    (local $end i32)
+    local.get $size
+    i32.const 1
+    i32.sub
+    i32.const {0}
+    i32.lt_u
+    (if
+      (then
+{1}        local.tee $list
+        i32.load
+        local.tee $ptr
+        (if
+          (then
+            local.get $list
+            local.get $ptr
+            i32.load
+            i32.store
+            local.get $ptr
+            i32.const 0
+            local.get $size
+            memory.fill
+            local.get $ptr
+            return
+          )
+        )
+      )
+    )
+    global.get $__heap
+    local.tee $ptr
+    local.get $size
+    i32.add
+    i32.const 7
+    i32.add
+    i32.const -8
+    i32.and
+    local.tee $end
+    memory.size
+    i32.const 16
+    i32.shl
+    i32.gt_u
+    (if
+      (then
+        local.get $end
+        i32.const 65535
+        i32.add
+        i32.const 16
+        i32.shr_u
+        memory.size
+        i32.sub
+        memory.grow
+        i32.const -1
+        i32.eq
+        (if
+          (then
+            unreachable
+          )
+        )
+      )
+    )
+    local.get $end
+    global.set $__heap
+    local.get $ptr
+  )
+)",
+            MAX_SMALL_SIZE, find_list);
+
+    // Large blocks are only reclaimed by $__reset.
+    ctx.body() << FF(R"(  (func $__free (param $ptr i32) (param $size i32)
+    (local $list i32)
+    local.get $size
+    i32.const 1
+    i32.sub
+    i32.const {0}
+    i32.ge_u
+    (if
+      (then
+        return
+      )
+    )
+{1}    local.set $list
+    local.get $ptr
+    local.get $list
+    i32.load
+    i32.store
+    local.get $list
+    local.get $ptr
+    i32.store
+  )
+)",
+            MAX_SMALL_SIZE, find_list);
+
+    // Memory past the heap is still zero, what is before it is cleared here.
+    ctx.body() << FF(R"(  (func $__reset
+    i32.const {0}
+    i32.const 0
+    global.get $__heap
+    i32.const {0}
+    i32.sub
+    memory.fill
+    i32.const {1}
+    global.set $__heap
+  )
+)",
+            lists, heap_base);
+}
+
+void emit_profile_dump(WasmContext &ctx) {
+    ctx.body() << "  (func $__profile_dump\n";
+    for (auto [record, counters] : ctx.get_profile_records()) {
+        ctx.body() << FF(R"(    i32.const {}
+    i32.const {}
+    call $profile_dump
+    i32.const {}
+    i32.const 0
+    i32.const {}
+    memory.fill
+)",
+                record.offset, record.length, counters.offset, counters.length);
+    }
+    ctx.body() << "  )\n";
+}
+
+bool is_memory_class(std::string_view type) { return type == "Memory"; }
+
+const std::string *find_memory_method(std::string_view name) {
+    static const std::unordered_map<std::string_view, std::string> methods = {
+            {"read", "String"},
+            {"write", "String"},
+            {"size", "Integer64"},
+            {"load8", "Integer64"},
+            {"store8", "Void"},
+            {"load64", "Integer64"},
+            {"store64", "Void"},
+    };
+    auto iter = methods.find(name);
+    return iter == methods.end() ? nullptr : &iter->second;
+}
+
+} // namespace kiraz
@@ -0,0 +1,70 @@
+#ifndef KIRAZ_RUNTIME_H
+#define KIRAZ_RUNTIME_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace kiraz {
+
+class WasmContext;
+
+struct RuntimeOptions {
+    // Every call of main starts with an empty heap, dropping whatever the
+    // previous call allocated. For modules that serve one request per call.
+    bool reset_heap = false;
+};
+
+/**
+ * @brief emit_runtime: Writes the support functions of the generated code
+ * into ctx, once the static data is final:
+ *
+ *   $__alloc (size) -> address   zeroed memory, aligned to 8
+ *   $__free (address, size)      returns a block to its size class
+ *   $__reset ()                  empties the heap
+ *
+ * Blocks of up to MAX_SMALL_SIZE bytes are kept on free lists, one per
+ * multiple of 8. Everything else comes from a bump pointer, and memory is
+ * grown as it runs out.
+ */
+void emit_runtime(WasmContext &ctx);
+
+/**
+ * @brief emit_profile_dump: Writes $__profile_dump, which instrumented main
+ * calls before it returns. It hands every record of the profile to the host
+ * through $profile_dump and clears its counters, so that the next call of
+ * main is counted on its own. See Profile.h.
+ */
+void emit_profile_dump(WasmContext &ctx);
+
+/**
+ * @brief io.Memory is a view of the linear memory of the module. Instances
+ * take no space and its methods are lowered inline to bulk memory
+ * instructions:
+ *
+ *   read(offset, length)   a copy of the bytes, in a block from $__alloc
+ *   write(offset, data)    copies data to offset, returns the bytes written
+ *   size()                 the size of the memory in bytes
+ *   load8(offset)          the byte at offset
+ *   store8(offset, value)  stores the low byte of value
+ *   load64(offset)         the integer at offset, little endian
+ *   store64(offset, value)
+ *
+ * Out of bounds accesses trap.
+ */
+bool is_memory_class(std::string_view type);
+
+// Return type of a Memory method, null if there is no such method
+const std::string *find_memory_method(std::string_view name);
+
+namespace runtime {
+
+constexpr uint32_t SIZE_CLASS_STEP = 8;
+constexpr uint32_t SIZE_CLASSES = 16;
+constexpr uint32_t MAX_SMALL_SIZE = SIZE_CLASS_STEP * SIZE_CLASSES;
+
+} // namespace runtime
+
+} // namespace kiraz
+
+#endif
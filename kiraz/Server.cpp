@@ -0,0 +1,385 @@
+#include "Server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <kiraz/Compiler.h>
+#include <kiraz/Parallel.h>
+#include <kiraz/SourceManager.h>
+
+namespace kiraz {
+
+#ifndef _WIN32
+
+namespace {
+
+// A non-blocking socket and the time by which the exchange on it must be
+// done. Past it every read and write fails, so a stalled peer can not hold
+// up the other side.
+struct Conn {
+    int fd;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+Conn make_conn(int fd, std::chrono::milliseconds timeout) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return {fd, std::chrono::steady_clock::now() + timeout};
+}
+
+bool wait_for(const Conn &c, short events) {
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                c.deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            return false;
+        }
+        pollfd p{c.fd, events, 0};
+        auto n = ::poll(&p, 1, static_cast<int>(left.count()));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return n > 0;
+    }
+}
+
+bool again() {
+    return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+bool read_full(Conn &c, void *buf, size_t len) {
+    auto p = static_cast<char *>(buf);
+    while (len > 0) {
+        if (! wait_for(c, POLLIN)) {
+            return false;
+        }
+        auto n = ::read(c.fd, p, len);
+        if (n < 0 && again()) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool write_full(Conn &c, const void *buf, size_t len) {
+    auto p = static_cast<const char *>(buf);
+    while (len > 0) {
+        if (! wait_for(c, POLLOUT)) {
+            return false;
+        }
+        auto n = ::write(c.fd, p, len);
+        if (n < 0 && again()) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool read_u32(Conn &c, uint32_t &v) {
+    unsigned char b[4];
+    if (! read_full(c, b, 4)) {
+        return false;
+    }
+    v = b[0] | (b[1] << 8) | (b[2] << 16) | (uint32_t(b[3]) << 24);
+    return true;
+}
+
+bool read_str(Conn &c, std::string &s, size_t &budget) {
+    uint32_t len;
+    if (! read_u32(c, len) || len > budget) {
+        return false;
+    }
+    budget -= len;
+    s.resize(len);
+    return read_full(c, s.data(), len);
+}
+
+bool read_magic(Conn &c, const char *magic) {
+    char b[4];
+    return read_full(c, b, 4) && std::memcmp(b, magic, 4) == 0;
+}
+
+void put_u32(std::string &out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((v >> (i * 8)) & 0xFF));
+    }
+}
+
+void put_str(std::string &out, const std::string &s) {
+    put_u32(out, s.size());
+    out.append(s);
+}
+
+constexpr uint32_t FLAG_RESET_HEAP = 1;
+constexpr uint32_t FLAG_SIMD = 2;
+constexpr uint32_t FLAG_PROFILE_GENERATE = 4;
+
+// Also what tells requests for the same source apart in the memo
+void put_options(std::string &out, const CompileRequest &req) {
+    uint32_t flags = 0;
+    flags |= req.runtime.reset_heap ? FLAG_RESET_HEAP : 0u;
+    flags |= req.optimize.simd ? FLAG_SIMD : 0u;
+    flags |= req.profile_generate ? FLAG_PROFILE_GENERATE : 0u;
+
+    put_u32(out, req.jobs);
+    put_u32(out, flags);
+    put_u32(out, req.optimize.level);
+    put_u32(out, req.optimize.unroll);
+    put_str(out, req.profile);
+}
+
+bool read_options(Conn &c, CompileRequest &req, size_t &budget) {
+    uint32_t flags;
+    if (! read_u32(c, req.jobs) || ! read_u32(c, flags) || ! read_u32(c, req.optimize.level)
+            || ! read_u32(c, req.optimize.unroll) || ! read_str(c, req.profile, budget)) {
+        return false;
+    }
+    req.runtime.reset_heap = flags & FLAG_RESET_HEAP;
+    req.optimize.simd = flags & FLAG_SIMD;
+    req.profile_generate = flags & FLAG_PROFILE_GENERATE;
+    return true;
+}
+
+int connect_to(const std::string &path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.data(), path.size());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+CompileServer::CompileServer(const std::string &socket_path, size_t max_memo)
+        : m_path(socket_path), m_max_memo(max_memo) {}
+
+CompileServer::~CompileServer() {
+    if (m_listen_fd >= 0) {
+        ::close(m_listen_fd);
+        ::unlink(m_path.data());
+    }
+}
+
+CompileResponse CompileServer::compile(const CompileRequest &req) {
+    ++m_requests;
+
+    std::string options;
+    put_options(options, req);
+    auto key = ModuleCache::hash(options, ModuleCache::make_key(req.source));
+    if (auto it = m_memo_index.find(key); it != m_memo_index.end()) {
+        ++m_memo_hits;
+        m_memo.splice(m_memo.begin(), m_memo, it->second);
+        return it->second->second;
+    }
+
+    CompileResponse retval;
+    ProfileOptions profile_options{req.profile_generate, nullptr};
+    if (! req.profile.empty()) {
+        auto profile = std::make_shared<Profile>();
+        if (! profile->merge(req.profile)) {
+            retval.status = 2;
+            retval.diagnostics = FF("{}: malformed profile\n", req.name);
+            return retval;
+        }
+        profile_options.use = std::move(profile);
+    }
+
+    {
+        Compiler compiler;
+        compiler.set_module_cache(m_cache);
+        compiler.set_jobs(std::min(req.jobs, hardware_jobs()));
+        compiler.set_runtime_options(req.runtime);
+        compiler.set_optimize_options(req.optimize);
+        compiler.set_profile_options(profile_options);
+
+        // The source is only needed while it compiles. The prelude outlives
+        // the request, so it must be registered before the mark.
+        SymbolTable::load_prelude();
+        auto &sm = SourceManager::instance();
+        auto mark = sm.mark();
+        retval.status = compiler.compile_string(req.source);
+        sm.release(mark);
+        retval.diagnostics = compiler.get_error();
+        if (retval.status == 0) {
+            retval.wat = compiler.get_wasm_ctx().body().str();
+        }
+        else if (retval.diagnostics.empty()) {
+            retval.diagnostics = FF("{}: compilation failed\n", req.name);
+        }
+    }
+
+    if (m_max_memo > 0) {
+        if (m_memo.size() >= m_max_memo) {
+            m_memo_index.erase(m_memo.back().first);
+            m_memo.pop_back();
+        }
+        m_memo.emplace_front(key, retval);
+        m_memo_index[key] = m_memo.begin();
+    }
+
+    return retval;
+}
+
+bool CompileServer::serve(int fd) {
+    CompileRequest req;
+    uint32_t version;
+    size_t budget = MAX_MESSAGE_SIZE;
+    auto c = make_conn(fd, m_io_timeout);
+
+    if (! read_magic(c, "KZRQ") || ! read_u32(c, version) || version != PROTOCOL_VERSION) {
+        return false;
+    }
+    if (! read_str(c, req.name, budget) || ! read_str(c, req.source, budget)
+            || ! read_options(c, req, budget)) {
+        return false;
+    }
+
+    auto resp = compile(req);
+    c.deadline = std::chrono::steady_clock::now() + m_io_timeout;
+
+    std::string out = "KZRS";
+    put_u32(out, PROTOCOL_VERSION);
+    put_u32(out, static_cast<uint32_t>(resp.status));
+    put_str(out, resp.wat);
+    put_str(out, resp.diagnostics);
+    return write_full(c, out.data(), out.size());
+}
+
+int CompileServer::run() {
+    // A client that goes away mid-response must not take the server down.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr{};
+    if (m_path.size() >= sizeof(addr.sun_path)) {
+        fmt::print(stderr, "{}: socket path too long\n", m_path);
+        return 2;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, m_path.data(), m_path.size());
+
+    // Replace a stale socket left behind by a previous server, but refuse to
+    // steal it from a live one.
+    if (int fd = connect_to(m_path); fd >= 0) {
+        ::close(fd);
+        fmt::print(stderr, "{}: a server is already listening\n", m_path);
+        return 2;
+    }
+    ::unlink(m_path.data());
+
+    m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listen_fd < 0) {
+        perror("socket");
+        return 2;
+    }
+    if (::bind(m_listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        perror(m_path.data());
+        return 2;
+    }
+    if (::listen(m_listen_fd, 16) != 0) {
+        perror("listen");
+        return 2;
+    }
+
+    m_running = true;
+    while (m_running) {
+        int fd = ::accept(m_listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("accept");
+            return 2;
+        }
+
+        serve(fd);
+        ::close(fd);
+    }
+
+    return 0;
+}
+
+bool CompileClient::compile(const std::string &socket_path, const CompileRequest &req,
+        CompileResponse &resp, std::chrono::milliseconds timeout) {
+    int fd = connect_to(socket_path);
+    if (fd < 0) {
+        return false;
+    }
+    auto c = make_conn(fd, timeout);
+
+    std::string out = "KZRQ";
+    put_u32(out, CompileServer::PROTOCOL_VERSION);
+    put_str(out, req.name);
+    put_str(out, req.source);
+    put_options(out, req);
+
+    uint32_t version = 0, status = 0;
+    size_t budget = CompileServer::MAX_MESSAGE_SIZE;
+    bool ok = write_full(c, out.data(), out.size()) && read_magic(c, "KZRS")
+            && read_u32(c, version) && version == CompileServer::PROTOCOL_VERSION
+            && read_u32(c, status) && read_str(c, resp.wat, budget)
+            && read_str(c, resp.diagnostics, budget);
+    ::close(fd);
+
+    resp.status = static_cast<int32_t>(status);
+    return ok;
+}
+
+#else
+
+CompileServer::CompileServer(const std::string &socket_path, size_t max_memo)
+        : m_path(socket_path), m_max_memo(max_memo) {}
+
+CompileServer::~CompileServer() {}
+
+CompileResponse CompileServer::compile(const CompileRequest &req) {
+    return {};
+}
+
+bool CompileServer::serve(int fd) {
+    return false;
+}
+
+int CompileServer::run() {
+    fmt::print(stderr, "Compile server is not supported on this platform\n");
+    return 2;
+}
+
+bool CompileClient::compile(const std::string &socket_path, const CompileRequest &req,
+        CompileResponse &resp, std::chrono::milliseconds timeout) {
+    return false;
+}
+
+#endif
+
+} // namespace kiraz
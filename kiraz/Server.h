@@ -0,0 +1,107 @@
+#ifndef KIRAZ_SERVER_H
+#define KIRAZ_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <kiraz/ModuleCache.h>
+#include <kiraz/Runtime.h>
+#include <kiraz/ir/Optimize.h>
+
+namespace kiraz {
+
+struct CompileRequest {
+    std::string name;
+    std::string source;
+
+    // The options of the client's command line
+    unsigned jobs = 1;
+    RuntimeOptions runtime;
+    ir::OptimizeOptions optimize;
+    bool profile_generate = false;
+    std::string profile; // the file of --profile-use, empty for none
+};
+
+struct CompileResponse {
+    int32_t status = -1;
+    std::string wat;
+    std::string diagnostics;
+};
+
+/**
+ * @brief CompileServer: Long-lived compiler process listening on a Unix domain
+ * socket.
+ *
+ * The io prelude, the module cache and the results of recent compilations stay
+ * in memory between requests, so a client only pays for the work that is
+ * specific to its source and options. Requests are served one at a time; a
+ * client that does not send its request or take its response within the I/O
+ * timeout is dropped so that it can not hold up the others.
+ *
+ * Wire format, all integers little endian:
+ *
+ *   request:  "KZRQ" u32:version u32:len name u32:len source options
+ *   options:  u32:jobs u32:flags u32:level u32:unroll u32:len profile
+ *   response: "KZRS" u32:version i32:status u32:len wat u32:len diagnostics
+ */
+class CompileServer {
+public:
+    static constexpr uint32_t PROTOCOL_VERSION = 2;
+    static constexpr size_t MAX_MESSAGE_SIZE = 64 << 20;
+    static constexpr std::chrono::milliseconds IO_TIMEOUT{2000};
+
+    explicit CompileServer(const std::string &socket_path, size_t max_memo = 64);
+    ~CompileServer();
+
+    void set_module_cache(std::shared_ptr<ModuleCache> cache) { m_cache = cache; }
+    void set_io_timeout(std::chrono::milliseconds timeout) { m_io_timeout = timeout; }
+
+    int run();
+    void stop() { m_running = false; }
+
+    CompileResponse compile(const CompileRequest &req);
+
+    auto get_requests() const { return m_requests; }
+    auto get_memo_hits() const { return m_memo_hits; }
+
+private:
+    bool serve(int fd);
+
+    std::string m_path;
+    int m_listen_fd = -1;
+    std::atomic<bool> m_running = false;
+    std::chrono::milliseconds m_io_timeout = IO_TIMEOUT;
+
+    std::shared_ptr<ModuleCache> m_cache;
+
+    // source and options key -> response, most recently used first
+    size_t m_max_memo;
+    std::list<std::pair<uint64_t, CompileResponse>> m_memo;
+    std::unordered_map<uint64_t, decltype(m_memo)::iterator> m_memo_index;
+
+    size_t m_requests = 0;
+    size_t m_memo_hits = 0;
+};
+
+/**
+ * @brief CompileClient: Thin client for CompileServer. Returns false when no
+ * server answers on the given socket within the timeout, in which case the
+ * caller is expected to compile in-process.
+ */
+class CompileClient {
+public:
+    // Covers the whole exchange, the compile on the server included
+    static constexpr std::chrono::milliseconds TIMEOUT{10000};
+
+    static bool compile(const std::string &socket_path, const CompileRequest &req,
+            CompileResponse &resp, std::chrono::milliseconds timeout = TIMEOUT);
+};
+
+} // namespace kiraz
+
+#endif
@@ -0,0 +1,157 @@
+#include "SourceManager.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace kiraz {
+
+namespace {
+
+constexpr auto MAX_OFFSET = std::numeric_limits<uint32_t>::max();
+
+} // namespace
+
+SourceManager &SourceManager::instance() {
+    static SourceManager retval;
+    return retval;
+}
+
+void SourceManager::scan_lines(std::string_view text, std::vector<uint32_t> &out) {
+    out.clear();
+    out.push_back(0);
+
+    // memchr is vectorized in every libc we build against, which makes this
+    // far cheaper than counting newlines in the lexer rules.
+    const char *begin = text.data();
+    const char *end = begin + text.size();
+    const char *p = begin;
+    while (auto nl = static_cast<const char *>(std::memchr(p, '\n', end - p))) {
+        p = nl + 1;
+        out.push_back(static_cast<uint32_t>(p - begin));
+    }
+}
+
+uint32_t SourceManager::add_file(std::string name, std::string_view text) {
+    if (text.size() >= MAX_OFFSET - 1) {
+        text = text.substr(0, MAX_OFFSET - 2);
+    }
+    if (text.size() >= MAX_OFFSET - m_next) {
+        // Out of offsets: start over. Nodes of the dropped files lose their
+        // locations, nothing else.
+        clear();
+    }
+
+    File file{std::move(name), {}};
+    scan_lines(text, file.line_starts);
+    m_files.push_back(std::move(file));
+
+    return add_segment(static_cast<uint32_t>(m_files.size() - 1), 0,
+            static_cast<uint32_t>(text.size()));
+}
+
+uint32_t SourceManager::map_range(uint32_t file, uint32_t pos, uint32_t size) {
+    auto seg = find(file);
+    if (! seg || size >= MAX_OFFSET - m_next) {
+        return 0;
+    }
+    return add_segment(seg->file, pos, size);
+}
+
+uint32_t SourceManager::add_segment(uint32_t index, uint32_t pos, uint32_t size) {
+    auto retval = m_next;
+    m_segments.push_back({retval, size, index, pos});
+
+    // +1 so that the end position still belongs to this range.
+    m_next += size + 1;
+    return retval;
+}
+
+const SourceManager::Segment *SourceManager::find(uint32_t offset) const {
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), offset,
+            [](uint32_t off, const Segment &s) { return off < s.begin; });
+    if (it == m_segments.begin()) {
+        return nullptr;
+    }
+
+    --it;
+    if (offset - it->begin > it->size) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+SourceLocation SourceManager::lookup(uint32_t offset) const {
+    auto seg = find(offset);
+    if (! seg) {
+        return {};
+    }
+
+    const auto &file = m_files[seg->file];
+    auto pos = seg->pos + (offset - seg->begin);
+    auto line = std::upper_bound(file.line_starts.begin(), file.line_starts.end(), pos) - 1;
+    return {file.name, static_cast<uint32_t>(line - file.line_starts.begin() + 1),
+            pos - *line + 1};
+}
+
+void SourceManager::update_file(uint32_t file, std::string_view text) {
+    if (auto seg = find(file)) {
+        scan_lines(text, m_files[seg->file].line_starts);
+    }
+}
+
+void SourceManager::split_range(uint32_t offset) {
+    auto seg = find(offset);
+    if (! seg || seg->begin == offset) {
+        return;
+    }
+
+    Segment tail{offset, seg->size - (offset - seg->begin), seg->file,
+            seg->pos + (offset - seg->begin)};
+    auto at = seg - m_segments.data();
+    m_segments[at].size = offset - seg->begin;
+    m_segments.insert(m_segments.begin() + at + 1, tail);
+}
+
+void SourceManager::shift_ranges(uint32_t file, uint32_t from, int64_t delta) {
+    auto seg = find(file);
+    if (! seg) {
+        return;
+    }
+
+    // A single pass over every range is cheaper than a lookup for each one
+    // that moves, which is most of them for an edit near the top of the file.
+    auto index = seg->file;
+    for (auto &s : m_segments) {
+        if (s.file == index && s.pos >= from) {
+            s.pos = static_cast<uint32_t>(s.pos + delta);
+        }
+    }
+}
+
+void SourceManager::drop_ranges(std::vector<uint32_t> begins) {
+    std::sort(begins.begin(), begins.end());
+    std::erase_if(m_segments, [&begins](const Segment &s) {
+        return std::binary_search(begins.begin(), begins.end(), s.begin);
+    });
+}
+
+void SourceManager::release(Mark mark) {
+    if (mark.next > m_next || mark.files > m_files.size()) {
+        // Cleared since, none of it is left
+        return;
+    }
+    std::erase_if(m_segments, [&mark](const Segment &s) {
+        return s.begin >= mark.next || s.file >= mark.files;
+    });
+    m_files.resize(mark.files);
+    m_next = mark.next;
+}
+
+void SourceManager::clear() {
+    m_files.clear();
+    m_segments.clear();
+    m_next = 1;
+}
+
+} // namespace kiraz
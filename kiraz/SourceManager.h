@@ -0,0 +1,107 @@
+#ifndef KIRAZ_SOURCEMANAGER_H
+#define KIRAZ_SOURCEMANAGER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace kiraz {
+
+// Used as the parser's YYLTYPE: byte offsets, [begin, end)
+struct SourceRange {
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+struct SourceLocation {
+    std::string_view file;
+    uint32_t line = 0;
+    uint32_t col = 0;
+
+    explicit operator bool() const { return line != 0; }
+};
+
+/**
+ * @brief SourceManager: Maps 32-bit source offsets back to file:line:col.
+ *
+ * Every registered buffer gets its own range of offsets, so a single offset
+ * identifies both the file and the position in it. Offset 0 is never handed
+ * out and means "unknown". Line starts are recorded once when the buffer is
+ * registered; the line/column of an offset is only computed on lookup.
+ *
+ * A file whose text changes (see IncrementalParser) can have further ranges
+ * mapped onto it. Each range can be moved or dropped on its own, which keeps
+ * the offsets already stored in nodes valid as the text around them shifts.
+ */
+class SourceManager {
+public:
+    static SourceManager &instance();
+
+    /**
+     * @brief add_file: Registers a buffer that is about to be lexed.
+     * @return The offset of the first byte of text. The lexer should start
+     * counting from there. It also identifies the file in the calls below.
+     */
+    uint32_t add_file(std::string name, std::string_view text);
+
+    SourceLocation lookup(uint32_t offset) const;
+
+    void clear();
+
+    // Replaces the text of the file, rescanning its line starts.
+    void update_file(uint32_t file, std::string_view text);
+
+    // Hands out fresh offsets for [pos, pos + size) of the file. Returns 0 once
+    // the offsets run out.
+    uint32_t map_range(uint32_t file, uint32_t pos, uint32_t size);
+
+    // Makes offset the start of a range of its own. Only meant for the range
+    // mapped last, which is where the parser adds statements.
+    void split_range(uint32_t offset);
+
+    // Ranges of the file that map to pos >= from now map delta bytes further.
+    void shift_ranges(uint32_t file, uint32_t from, int64_t delta);
+
+    void drop_ranges(std::vector<uint32_t> begins);
+
+    // What is registered from here on, for release()
+    struct Mark {
+        uint32_t next;
+        size_t files;
+    };
+    Mark mark() const { return {m_next, m_files.size()}; }
+
+    // Forgets the files and ranges registered since mark and hands their
+    // offsets out again. Nodes of those files lose their locations.
+    void release(Mark mark);
+
+private:
+    struct File {
+        std::string name;
+        std::vector<uint32_t> line_starts;
+    };
+
+    struct Segment {
+        uint32_t begin;
+        uint32_t size;
+        uint32_t file;
+        uint32_t pos;
+    };
+
+    uint32_t add_segment(uint32_t index, uint32_t pos, uint32_t size);
+    const Segment *find(uint32_t offset) const;
+    Segment *find(uint32_t offset) {
+        return const_cast<Segment *>(static_cast<const SourceManager *>(this)->find(offset));
+    }
+
+    static void scan_lines(std::string_view text, std::vector<uint32_t> &out);
+
+    std::vector<File> m_files;
+    std::vector<Segment> m_segments; // sorted by begin
+    uint32_t m_next = 1;
+};
+
+} // namespace kiraz
+
+#endif
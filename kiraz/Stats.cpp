@@ -0,0 +1,127 @@
+#include "Stats.h"
+
+#include <fmt/format.h>
+
+namespace kiraz {
+
+bool Stats::s_enabled;
+std::array<std::atomic<uint64_t>, Stats::COUNTER_COUNT> Stats::s_counters;
+std::array<std::atomic<uint64_t>, Stats::PHASE_COUNT> Stats::s_phase_ns;
+std::array<std::atomic<uint64_t>, Stats::PHASE_COUNT> Stats::s_phase_calls;
+
+void Stats::reset() {
+    for (auto &c : s_counters) {
+        c = 0;
+    }
+    for (auto &t : s_phase_ns) {
+        t = 0;
+    }
+    for (auto &n : s_phase_calls) {
+        n = 0;
+    }
+}
+
+void Stats::add_time(Phase p, std::chrono::nanoseconds d) {
+    s_phase_ns[p].fetch_add(d.count(), std::memory_order_relaxed);
+    s_phase_calls[p].fetch_add(1, std::memory_order_relaxed);
+}
+
+const char *Stats::name_of(Phase p) {
+    switch (p) {
+    case Parse:
+        return "parse";
+    case Analyse:
+        return "analyse";
+    case CodeGen:
+        return "codegen";
+    case DataSegment:
+        return "data_segment";
+    case PHASE_COUNT:
+        break;
+    }
+    return "?";
+}
+
+const char *Stats::name_of(Counter c) {
+    switch (c) {
+    case NodesAllocated:
+        return "nodes_allocated";
+    case TokensLexed:
+        return "tokens_lexed";
+    case SymbolLookups:
+        return "symbol_lookups";
+    case ScopesEntered:
+        return "scopes_entered";
+    case BytesEmitted:
+        return "bytes_emitted";
+    case RedundantValues:
+        return "redundant_values";
+    case HoistedValues:
+        return "hoisted_values";
+    case RemovedLoops:
+        return "removed_loops";
+    case ReducedMultiplies:
+        return "reduced_multiplies";
+    case UnrolledLoops:
+        return "unrolled_loops";
+    case VectorizedLoops:
+        return "vectorized_loops";
+    case RemovedChecks:
+        return "removed_checks";
+    case NarrowedValues:
+        return "narrowed_values";
+    case InlinedCalls:
+        return "inlined_calls";
+    case COUNTER_COUNT:
+        break;
+    }
+    return "?";
+}
+
+std::string Stats::report() {
+    uint64_t total = 0;
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        total += get_ns(Phase(p));
+    }
+
+    fmt::memory_buffer out;
+    auto it = std::back_inserter(out);
+
+    fmt::format_to(it, "===---------------------------------------------------===\n");
+    fmt::format_to(it, "                  kiraz time report\n");
+    fmt::format_to(it, "===---------------------------------------------------===\n");
+    fmt::format_to(it, "  {:<16} {:>12} {:>8} {:>8}\n", "phase", "time (ms)", "%", "calls");
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        auto ns = get_ns(Phase(p));
+        fmt::format_to(it, "  {:<16} {:>12.3f} {:>8.1f} {:>8}\n", name_of(Phase(p)), ns / 1e6,
+                total ? 100.0 * ns / total : 0.0, get_calls(Phase(p)));
+    }
+    fmt::format_to(it, "  {:<16} {:>12.3f}\n\n", "total", total / 1e6);
+
+    fmt::format_to(it, "  {:<16} {:>12}\n", "counter", "value");
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        fmt::format_to(it, "  {:<16} {:>12}\n", name_of(Counter(c)), get(Counter(c)));
+    }
+
+    return fmt::to_string(out);
+}
+
+std::string Stats::report_json() {
+    fmt::memory_buffer out;
+    auto it = std::back_inserter(out);
+
+    fmt::format_to(it, "{{\"phases\":{{");
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        fmt::format_to(it, "{}\"{}\":{{\"ns\":{},\"calls\":{}}}", p ? "," : "", name_of(Phase(p)),
+                get_ns(Phase(p)), get_calls(Phase(p)));
+    }
+    fmt::format_to(it, "}},\"counters\":{{");
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        fmt::format_to(it, "{}\"{}\":{}", c ? "," : "", name_of(Counter(c)), get(Counter(c)));
+    }
+    fmt::format_to(it, "}}}}\n");
+
+    return fmt::to_string(out);
+}
+
+} // namespace kiraz
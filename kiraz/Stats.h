@@ -0,0 +1,112 @@
+#ifndef KIRAZ_STATS_H
+#define KIRAZ_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace kiraz {
+
+/**
+ * @brief Stats: Process-wide phase timers and event counters.
+ *
+ * Collection is off until enable() is called. When the library is built
+ * without KIRAZ_ENABLE_STATS, the KIRAZ_STATS_* macros expand to nothing;
+ * otherwise every hook costs one predictable branch on a global flag while
+ * disabled.
+ */
+class Stats {
+public:
+    enum Phase {
+        Parse,
+        Analyse,
+        CodeGen,
+        DataSegment,
+        PHASE_COUNT,
+    };
+
+    enum Counter {
+        NodesAllocated,
+        TokensLexed,
+        SymbolLookups,
+        ScopesEntered,
+        BytesEmitted,
+        RedundantValues,
+        HoistedValues,
+        RemovedLoops,
+        ReducedMultiplies,
+        UnrolledLoops,
+        VectorizedLoops,
+        RemovedChecks,
+        NarrowedValues,
+        InlinedCalls,
+        COUNTER_COUNT,
+    };
+
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Phase phase) : m_phase(phase) {
+            if (s_enabled) {
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+        ~ScopedTimer() {
+            if (s_enabled && m_start.time_since_epoch().count() != 0) {
+                add_time(m_phase, std::chrono::steady_clock::now() - m_start);
+            }
+        }
+
+    private:
+        Phase m_phase;
+        std::chrono::steady_clock::time_point m_start{};
+    };
+
+    static bool enabled() { return s_enabled; }
+    static void enable(bool e = true) { s_enabled = e; }
+    static void reset();
+
+    static void inc(Counter c, uint64_t n = 1) {
+        if (s_enabled) {
+            s_counters[c].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+    static void add_time(Phase p, std::chrono::nanoseconds d);
+
+    static uint64_t get(Counter c) { return s_counters[c].load(std::memory_order_relaxed); }
+    static uint64_t get_ns(Phase p) { return s_phase_ns[p].load(std::memory_order_relaxed); }
+    static uint64_t get_calls(Phase p) { return s_phase_calls[p].load(std::memory_order_relaxed); }
+
+    static const char *name_of(Phase p);
+    static const char *name_of(Counter c);
+
+    static std::string report();
+    static std::string report_json();
+
+private:
+    static bool s_enabled;
+    static std::array<std::atomic<uint64_t>, COUNTER_COUNT> s_counters;
+    static std::array<std::atomic<uint64_t>, PHASE_COUNT> s_phase_ns;
+    static std::array<std::atomic<uint64_t>, PHASE_COUNT> s_phase_calls;
+};
+
+} // namespace kiraz
+
+#define KIRAZ_STATS_CAT_(a, b) a##b
+#define KIRAZ_STATS_CAT(a, b) KIRAZ_STATS_CAT_(a, b)
+
+#ifdef KIRAZ_ENABLE_STATS
+#define KIRAZ_STATS_INC(c) ::kiraz::Stats::inc(::kiraz::Stats::c)
+#define KIRAZ_STATS_ADD(c, n) ::kiraz::Stats::inc(::kiraz::Stats::c, (n))
+#define KIRAZ_STATS_TIMER(p)                                                                       \
+    ::kiraz::Stats::ScopedTimer KIRAZ_STATS_CAT(stats_timer_, __LINE__)(::kiraz::Stats::p)
+#else
+#define KIRAZ_STATS_INC(c) ((void)0)
+#define KIRAZ_STATS_ADD(c, n) ((void)0)
+#define KIRAZ_STATS_TIMER(p) ((void)0)
+#endif
+
+#endif
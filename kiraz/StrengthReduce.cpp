@@ -0,0 +1,172 @@
+#include "StrengthReduce.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+namespace kiraz::strength {
+
+namespace {
+
+// The operand, kept in a temporary
+constexpr int64_t X = 0;
+
+uint64_t magnitude(int64_t c) { return c < 0 ? 0 - static_cast<uint64_t>(c) : c; }
+
+// log2 of |c| if it is a power of two
+std::optional<int> power_of_two(int64_t c) {
+    auto m = magnitude(c);
+    if (! std::has_single_bit(m)) {
+        return std::nullopt;
+    }
+    return std::countr_zero(m);
+}
+
+// Negates the value on the stack
+void negate(Sequence &seq, int64_t tmp) {
+    seq.insert(seq.end(), {
+                                  {Opcode::Set, tmp},
+                                  {Opcode::Const, 0},
+                                  {Opcode::Get, tmp},
+                                  {Opcode::Sub},
+                          });
+}
+
+// x + (2^k - 1) for negative x, so that shifting right rounds toward zero
+void round_toward_zero(Sequence &seq, int k) {
+    seq.insert(seq.end(), {
+                                  {Opcode::Get, X},
+                                  {Opcode::Const, 63},
+                                  {Opcode::ShrS},
+                                  {Opcode::Const, 64 - k},
+                                  {Opcode::ShrU},
+                                  {Opcode::Get, X},
+                                  {Opcode::Add},
+                          });
+}
+
+} // namespace
+
+std::optional<Sequence> lower_mul(int64_t c) {
+    if (c == 0) {
+        return Sequence{{Opcode::Set, X}, {Opcode::Const, 0}};
+    }
+
+    Sequence retval;
+    auto m = magnitude(c);
+    if (auto k = power_of_two(c)) {
+        // INT64_MIN is its own negation, which the shift agrees with.
+        if (*k > 0) {
+            retval = {{Opcode::Const, *k}, {Opcode::Shl}};
+        }
+        if (c < 0 && c != std::numeric_limits<int64_t>::min()) {
+            negate(retval, X);
+        }
+    }
+    else if (c > 0 && std::has_single_bit(m - 1)) {
+        retval = {
+                {Opcode::Tee, X},
+                {Opcode::Const, std::countr_zero(m - 1)},
+                {Opcode::Shl},
+                {Opcode::Get, X},
+                {Opcode::Add},
+        };
+    }
+    else if (std::has_single_bit(m + 1)) {
+        // x * (2^k - 1) is (x << k) - x, x * -(2^k - 1) is x - (x << k)
+        retval = {{Opcode::Tee, X}};
+        if (c < 0) {
+            retval.push_back({Opcode::Get, X});
+        }
+        retval.insert(retval.end(), {{Opcode::Const, std::countr_zero(m + 1)}, {Opcode::Shl}});
+        if (c > 0) {
+            retval.push_back({Opcode::Get, X});
+        }
+        retval.push_back({Opcode::Sub});
+    }
+    else {
+        return std::nullopt;
+    }
+    return retval;
+}
+
+std::optional<Sequence> lower_div(int64_t c) {
+    auto k = power_of_two(c);
+    if (! k || *k == 63 || c == -1) {
+        return std::nullopt;
+    }
+    Sequence retval;
+    if (*k > 0) {
+        retval.push_back({Opcode::Set, X});
+        round_toward_zero(retval, *k);
+        retval.insert(retval.end(), {{Opcode::Const, *k}, {Opcode::ShrS}});
+    }
+    if (c < 0) {
+        negate(retval, X);
+    }
+    return retval;
+}
+
+std::optional<Sequence> lower_rem(int64_t c) {
+    if (c == 0 || c == -1) {
+        return std::nullopt;
+    }
+    if (c == 1) {
+        return Sequence{{Opcode::Set, X}, {Opcode::Const, 0}};
+    }
+
+    // The sign of the remainder is that of x, whatever the sign of c.
+    if (auto k = power_of_two(c)) {
+        Sequence retval = {{Opcode::Tee, X}};
+        round_toward_zero(retval, *k);
+        retval.insert(retval.end(), {
+                                            {Opcode::Const, static_cast<int64_t>(0 - magnitude(c))},
+                                            {Opcode::And},
+                                            {Opcode::Sub},
+                                    });
+        return retval;
+    }
+    return Sequence{{Opcode::Const, c}, {Opcode::RemS}};
+}
+
+uint32_t count_temps(const Sequence &seq) {
+    int64_t retval = 0;
+    for (const auto &insn : seq) {
+        if (insn.op == Opcode::Get || insn.op == Opcode::Set || insn.op == Opcode::Tee) {
+            retval = std::max(retval, insn.imm + 1);
+        }
+    }
+    return retval;
+}
+
+std::string_view opcode_name(Opcode op) {
+    switch (op) {
+    case Opcode::Const:
+        return "i64.const";
+    case Opcode::Get:
+        return "local.get";
+    case Opcode::Set:
+        return "local.set";
+    case Opcode::Tee:
+        return "local.tee";
+    case Opcode::Add:
+        return "i64.add";
+    case Opcode::Sub:
+        return "i64.sub";
+    case Opcode::Mul:
+        return "i64.mul";
+    case Opcode::And:
+        return "i64.and";
+    case Opcode::Shl:
+        return "i64.shl";
+    case Opcode::ShrS:
+        return "i64.shr_s";
+    case Opcode::ShrU:
+        return "i64.shr_u";
+    case Opcode::RemS:
+        return "i64.rem_s";
+    }
+    return "";
+}
+
+} // namespace kiraz::strength
@@ -0,0 +1,56 @@
+#ifndef KIRAZ_STRENGTHREDUCE_H
+#define KIRAZ_STRENGTHREDUCE_H
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace kiraz::strength {
+
+/**
+ * @brief Straight line i64 code replacing a multiplication, division or
+ * remainder by a constant. It starts with the other operand on the stack and
+ * leaves the result there. Temporaries are i64 locals numbered from 0.
+ *
+ * Powers of two become shifts and masks, multipliers next to one shifts and
+ * an add or a sub. Wasm has no multiply-high, and emulating one from 32 bit
+ * halves costs more than i64.div_s, so division by other constants is left to
+ * the engine.
+ */
+enum class Opcode : uint8_t {
+    Const,
+    Get,
+    Set,
+    Tee,
+    Add,
+    Sub,
+    Mul,
+    And,
+    Shl,
+    ShrS,
+    ShrU,
+    RemS,
+};
+
+struct Insn {
+    Opcode op;
+    int64_t imm = 0; // value of Const, temporary of Get, Set and Tee
+};
+
+using Sequence = std::vector<Insn>;
+
+// Truncating, like i64.div_s and i64.rem_s. Nothing is returned where the
+// plain instruction is as good, or where its trap has to be kept: division by
+// 0, -1 and INT64_MIN. lower_rem stands for x - x / c * c, which traps for c
+// of 0 and -1.
+std::optional<Sequence> lower_mul(int64_t c);
+std::optional<Sequence> lower_div(int64_t c);
+std::optional<Sequence> lower_rem(int64_t c);
+
+uint32_t count_temps(const Sequence &seq);
+std::string_view opcode_name(Opcode op);
+
+} // namespace kiraz::strength
+
+#endif
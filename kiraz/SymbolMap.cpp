@@ -0,0 +1,98 @@
+#include "SymbolMap.h"
+
+#include <cstring>
+
+namespace kiraz {
+
+uint64_t SymbolMap::hash(std::string_view name) {
+    // Eight bytes at a time; identifiers are short, the tail is most of it.
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ name.size();
+    auto p = name.data();
+    auto n = name.size();
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t k;
+        std::memcpy(&k, p, 8);
+        h = (h ^ k) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    if (n) {
+        uint64_t k = 0;
+        std::memcpy(&k, p, n);
+        h = (h ^ k) * 0xc4ceb9fe1a85ec53ull;
+    }
+    return h ^ (h >> 29);
+}
+
+const Node::Ptr *SymbolMap::find(std::string_view name, uint64_t hash) const {
+    if (m_size <= INLINE_SIZE) {
+        for (size_t i = 0; i < m_size; ++i) {
+            if (m_inline[i].hash == hash && m_inline[i].name == name) {
+                return &m_inline[i].node;
+            }
+        }
+        return nullptr;
+    }
+
+    auto mask = m_slots.size() - 1;
+    auto sh = slot_hash(hash);
+    for (auto i = static_cast<size_t>(hash >> 32) & mask;; i = (i + 1) & mask) {
+        const auto &slot = m_slots[i];
+        if (slot.hash == 0) {
+            return nullptr;
+        }
+        if (slot.hash == sh) {
+            const auto &e = m_spill[slot.index];
+            if (e.hash == hash && e.name == name) {
+                return &e.node;
+            }
+        }
+    }
+}
+
+Node::Ptr &SymbolMap::operator[](std::string_view name) {
+    auto h = hash(name);
+    if (auto found = find(name, h)) {
+        return const_cast<Node::Ptr &>(*found);
+    }
+
+    if (m_size < INLINE_SIZE) {
+        m_inline[m_size] = {h, std::string(name), nullptr};
+        return m_inline[m_size++].node;
+    }
+
+    if (m_size == INLINE_SIZE) {
+        // Spill: the table takes over from here on.
+        m_spill.reserve(INLINE_SIZE * 4);
+        for (auto &e : m_inline) {
+            m_spill.push_back(std::move(e));
+            e = {};
+        }
+        rehash(INLINE_SIZE * 4);
+    }
+    else if ((m_size + 1) * 2 > m_slots.size()) {
+        rehash(m_slots.size() * 2);
+    }
+
+    m_spill.push_back({h, std::string(name), nullptr});
+    insert_slot(h, static_cast<uint32_t>(m_size));
+    ++m_size;
+    return m_spill.back().node;
+}
+
+void SymbolMap::insert_slot(uint64_t hash, uint32_t index) {
+    auto mask = m_slots.size() - 1;
+    auto i = static_cast<size_t>(hash >> 32) & mask;
+    while (m_slots[i].hash != 0) {
+        i = (i + 1) & mask;
+    }
+    m_slots[i] = {slot_hash(hash), index};
+}
+
+void SymbolMap::rehash(size_t capacity) {
+    m_slots.assign(capacity, {0, 0});
+    for (size_t i = 0; i < m_spill.size(); ++i) {
+        insert_slot(m_spill[i].hash, static_cast<uint32_t>(i));
+    }
+}
+
+} // namespace kiraz
@@ -0,0 +1,69 @@
+#ifndef KIRAZ_SYMBOLMAP_H
+#define KIRAZ_SYMBOLMAP_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <kiraz/Node.h>
+
+namespace kiraz {
+
+/**
+ * @brief SymbolMap: Open-addressing hash map from names to nodes.
+ *
+ * Names are hashed once per lookup, however many scopes the lookup goes
+ * through, and entries keep their hash: probing compares hashes and only
+ * looks at a name on a match. Up to INLINE_SIZE symbols, which covers most
+ * function scopes, live in the map itself and are found by a linear scan; the
+ * table is only allocated past that. Iteration follows insertion order.
+ */
+class SymbolMap {
+public:
+    static constexpr size_t INLINE_SIZE = 8;
+
+    struct Entry {
+        uint64_t hash = 0;
+        std::string name;
+        Node::Ptr node;
+    };
+
+    static uint64_t hash(std::string_view name);
+
+    const Node::Ptr *find(std::string_view name, uint64_t hash) const;
+    const Node::Ptr *find(std::string_view name) const { return find(name, hash(name)); }
+
+    // Inserts a null entry for a new name
+    Node::Ptr &operator[](std::string_view name);
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const Entry *begin() const { return data(); }
+    const Entry *end() const { return data() + m_size; }
+
+private:
+    struct Slot {
+        uint32_t hash; // low half, 0 for an empty slot
+        uint32_t index;
+    };
+
+    const Entry *data() const { return m_size <= INLINE_SIZE ? m_inline.data() : m_spill.data(); }
+    Entry *data() { return m_size <= INLINE_SIZE ? m_inline.data() : m_spill.data(); }
+
+    static uint32_t slot_hash(uint64_t hash) { return static_cast<uint32_t>(hash) | 1; }
+
+    void insert_slot(uint64_t hash, uint32_t index);
+    void rehash(size_t capacity);
+
+    size_t m_size = 0;
+    std::array<Entry, INLINE_SIZE> m_inline;
+    std::vector<Entry> m_spill;
+    std::vector<Slot> m_slots; // power of two, at most half full
+};
+
+} // namespace kiraz
+
+#endif
@@ -1,5 +1,71 @@
 
 #include "Token.h"
 
-int Token::colno;
 Token::~Token() {}
+
+token::Record curtoken;
+
+namespace token {
+
+uint32_t offset;
+
+std::string describe(const Record &tok, std::string_view text) {
+    switch (tok.kind) {
+    case IDENTIFIER:
+        return fmt::format("IDENTIFIER({})", text);
+
+    case L_INTEGER:
+        return fmt::format("L_INTEGER(10, \"{}\")", text);
+
+    case L_STRING:
+        if (text.size() >= 2) {
+            text = text.substr(1, text.size() - 2);
+        }
+        return fmt::format("L_STRING(\"{}\")", unescape(text));
+
+    case REJECTED:
+        return fmt::format("REJECTED({})", text);
+
+    default:
+        return std::string(text);
+    }
+}
+
+std::string unescape(std::string_view text) {
+    std::string retval;
+    retval.reserve(text.size());
+
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c != '\\' || i + 1 == text.size()) {
+            retval.push_back(c);
+            continue;
+        }
+
+        switch (text[i + 1]) {
+        case 'n':
+            retval.push_back('\n');
+            break;
+        case 't':
+            retval.push_back('\t');
+            break;
+        case 'r':
+            retval.push_back('\r');
+            break;
+        case '\\':
+            retval.push_back('\\');
+            break;
+        case '"':
+            retval.push_back('"');
+            break;
+        default:
+            retval.push_back(c);
+            continue;
+        }
+        ++i;
+    }
+
+    return retval;
+}
+
+} // namespace token
@@ -1,6 +1,10 @@
 #ifndef KIRAZ_TOKEN_H
 #define KIRAZ_TOKEN_H
 
+#include <cstdint>
+#include <string>
+#include <string_view>
+
 #include "main.h"
 
 #ifndef YYUNDEF
@@ -28,8 +32,6 @@ public:
         return std::make_shared<T>(std::forward<Args>(args)...);
     }
 
-    static int colno;
-
     virtual int get_id() const { return m_id; }
 
 private:
@@ -49,6 +51,40 @@ namespace token {
 inline auto fmt(int v) {
     return static_cast<yytokentype>(v);
 }
+
+/**
+ * @brief Record: The token most recently returned by the lexer. It refers to
+ * its text by position in the source buffer instead of owning a copy, so
+ * lexing allocates nothing for tokens that do not end up in the AST.
+ */
+struct Record {
+    int kind = 0; // yytokentype, 0 before the first token
+    uint32_t offset = 0; // see SourceManager
+    uint32_t length = 0;
+
+    explicit operator bool() const { return kind != 0; }
+    void reset() { *this = {}; }
+};
+
+/**
+ * @brief describe: Formats a token for diagnostics, e.g. IDENTIFIER(a),
+ * L_INTEGER(10, "5"), L_STRING("x") or the operator / keyword itself.
+ * @param text: The raw text of the token as it appears in the source.
+ */
+std::string describe(const Record &tok, std::string_view text);
+
+/**
+ * @brief unescape: Decodes the \n, \t, \r, \\ and \" escapes of a string
+ * literal in a single pass. Unknown escapes are kept as they are.
+ */
+std::string unescape(std::string_view text);
+
+// Source offset of the next byte to be lexed. Set it to the value returned by
+// SourceManager::add_file before lexing a buffer.
+extern uint32_t offset;
+
 } // namespace token
 
+extern token::Record curtoken;
+
 #endif // KIRAZ_TOKEN_H
@@ -0,0 +1,148 @@
+#include "Trace.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#include <fmt/format.h>
+
+namespace kiraz {
+
+namespace {
+
+struct ThreadBuffer {
+    int tid;
+    std::string name;
+    std::vector<Trace::Event> events;
+};
+
+std::mutex s_buffers_mutex;
+std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+
+ThreadBuffer &thread_buffer() {
+    thread_local ThreadBuffer *buf = nullptr;
+    if (! buf) {
+        std::lock_guard lock(s_buffers_mutex);
+        auto tid = static_cast<int>(s_buffers.size()) + 1;
+        s_buffers.push_back(std::make_unique<ThreadBuffer>(
+                ThreadBuffer{tid, tid == 1 ? "main" : fmt::format("worker-{}", tid - 1), {}}));
+        buf = s_buffers.back().get();
+    }
+    return *buf;
+}
+
+void write_json_string(fmt::memory_buffer &out, std::string_view s) {
+    auto it = std::back_inserter(out);
+    out.push_back('"');
+    for (char c : s) {
+        switch (c) {
+        case '"':
+            fmt::format_to(it, "\\\"");
+            break;
+        case '\\':
+            fmt::format_to(it, "\\\\");
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                fmt::format_to(it, "\\u{:04x}", c);
+            }
+            else {
+                out.push_back(c);
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+} // namespace
+
+bool Trace::s_enabled;
+std::string Trace::s_path;
+std::chrono::steady_clock::time_point Trace::s_epoch;
+
+Trace::Scope::Scope(const char *cat, std::string_view name)
+        : m_active(s_enabled), m_cat(cat) {
+    if (m_active) {
+        m_name = name;
+        m_start = std::chrono::steady_clock::now();
+    }
+}
+
+Trace::Scope::~Scope() {
+    if (! m_active) {
+        return;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    auto ts = now_us(m_start);
+    record({std::move(m_name), m_cat, ts, now_us(end) - ts, std::move(m_args)});
+}
+
+void Trace::start(const std::string &path) {
+    s_path = path;
+    s_epoch = std::chrono::steady_clock::now();
+    s_enabled = true;
+
+    // Make sure the thread that starts tracing is reported as tid 1.
+    thread_buffer();
+}
+
+void Trace::set_thread_name(const std::string &name) {
+    if (s_enabled) {
+        thread_buffer().name = name;
+    }
+}
+
+int64_t Trace::now_us(std::chrono::steady_clock::time_point tp) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(tp - s_epoch).count();
+}
+
+void Trace::record(Event &&ev) {
+    thread_buffer().events.push_back(std::move(ev));
+}
+
+bool Trace::write() {
+    if (! s_enabled) {
+        return true;
+    }
+
+    fmt::memory_buffer out;
+    auto it = std::back_inserter(out);
+    bool first = true;
+
+    fmt::format_to(it, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    std::lock_guard lock(s_buffers_mutex);
+    for (auto &buf : s_buffers) {
+        fmt::format_to(it, "{}{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":{},"
+                           "\"args\":{{\"name\":",
+                first ? "" : ",\n", buf->tid);
+        write_json_string(out, buf->name);
+        fmt::format_to(it, "}}}}");
+        first = false;
+
+        for (auto &ev : buf->events) {
+            fmt::format_to(it, ",\n{{\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{},"
+                               "\"cat\":\"{}\",\"name\":",
+                    buf->tid, ev.ts_us, ev.dur_us, ev.cat);
+            write_json_string(out, ev.name);
+            fmt::format_to(it, ",\"args\":{{");
+            for (size_t i = 0; i < ev.args.size(); ++i) {
+                fmt::format_to(
+                        it, "{}\"{}\":{}", i ? "," : "", ev.args[i].first, ev.args[i].second);
+            }
+            fmt::format_to(it, "}}}}");
+        }
+    }
+
+    fmt::format_to(it, "\n]}}\n");
+
+    std::ofstream f(s_path, std::ios::binary | std::ios::trunc);
+    if (! f.is_open()) {
+        return false;
+    }
+    f.write(out.data(), out.size());
+    return f.good();
+}
+
+} // namespace kiraz
@@ -0,0 +1,68 @@
+#ifndef KIRAZ_TRACE_H
+#define KIRAZ_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kiraz {
+
+/**
+ * @brief Trace: Chrome trace-event recorder (chrome://tracing, Perfetto).
+ *
+ * Every thread appends complete ("X") events to its own buffer, so recording
+ * takes no locks; the buffers are merged when the trace is written. While
+ * tracing is off a Trace::Scope only tests a global flag.
+ */
+class Trace {
+public:
+    struct Event {
+        std::string name;
+        const char *cat;
+        int64_t ts_us;
+        int64_t dur_us;
+        std::vector<std::pair<const char *, int64_t>> args;
+    };
+
+    class Scope {
+    public:
+        Scope(const char *cat, std::string_view name);
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+        ~Scope();
+
+        void arg(const char *key, int64_t value) {
+            if (m_active) {
+                m_args.emplace_back(key, value);
+            }
+        }
+
+    private:
+        bool m_active;
+        const char *m_cat;
+        std::string m_name;
+        std::chrono::steady_clock::time_point m_start;
+        std::vector<std::pair<const char *, int64_t>> m_args;
+    };
+
+    static bool enabled() { return s_enabled; }
+    static void start(const std::string &path);
+    static bool write();
+
+    static void set_thread_name(const std::string &name);
+
+private:
+    static void record(Event &&ev);
+    static int64_t now_us(std::chrono::steady_clock::time_point tp);
+
+    static bool s_enabled;
+    static std::string s_path;
+    static std::chrono::steady_clock::time_point s_epoch;
+};
+
+} // namespace kiraz
+
+#endif
@@ -9,17 +9,21 @@ namespace ast {
 class Integer : public Node {
 public:
     Integer(int64_t v) : m_value(v) {}
-    std::string as_string() const override { return FF("Int({})", m_value); }
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    void format_to(fmt::memory_buffer &out) const override {
+        fmt::format_to(std::back_inserter(out), "Int({})", m_value);
+    }
+    int64_t get_value() const { return m_value; }
 private:
     int64_t m_value;
 };
 
 class String : public Node {
 public:
-    String(const std::string &v) : m_value(v) {}
-    std::string as_string() const override { return FF("Str({})", m_value); }
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    String(std::string v) : m_value(std::move(v)) {}
+    void format_to(fmt::memory_buffer &out) const override {
+        fmt::format_to(std::back_inserter(out), "Str({})", m_value);
+    }
+    const std::string &get_value() const { return m_value; }
 private:
     std::string m_value;
 };
@@ -27,21 +31,37 @@ private:
 class Boolean : public Node {
 public:
     Boolean(bool v) : m_value(v) {}
-    std::string as_string() const override { return FF("Bool({})", m_value); }
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    void format_to(fmt::memory_buffer &out) const override {
+        fmt::format_to(std::back_inserter(out), "Bool({})", m_value);
+    }
+    bool get_value() const { return m_value; }
 private:
     bool m_value;
 };
 
-class SignedNode : public Node {
+class Signed : public Node {
 public:
+    Signed(std::string op, Node::Ptr operand) : m_op(std::move(op)), m_operand(operand) {}
+    void format_to(fmt::memory_buffer &out) const override {
+        fmt::format_to(std::back_inserter(out), "Signed({}, ", m_op);
+        m_operand->format_to(out);
+        put(out, ")");
+    }
+    void for_each_child(const ChildFn &fn) const override { fn(m_operand); }
+    bool is_negative() const { return m_op == "OP_MINUS"; }
+    const std::string &get_op() const { return m_op; }
+    Node::Ptr get_operand() const { return m_operand; }
+private:
+    std::string m_op;
+    Node::Ptr m_operand;
 };
 
 class Id : public Node {
 public:
     Id(const std::string &n) { set_id(n); }
-    std::string as_string() const override { return FF("Id({})", get_id()); }
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    void format_to(fmt::memory_buffer &out) const override {
+        fmt::format_to(std::back_inserter(out), "Id({})", get_id());
+    }
 };
 
 }
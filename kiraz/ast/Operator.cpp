@@ -1,152 +1,80 @@
 #include "Operator.h"
 #include <kiraz/Compiler.h>
+#include <kiraz/Trace.h>
+#include <kiraz/ir/Emit.h>
+#include <kiraz/ir/Lower.h>
+#include <kiraz/ir/Optimize.h>
+#include <kiraz/ir/ProfileGuided.h>
 #include <fmt/format.h>
 #include "Literal.h"
 
+using kiraz::SymbolTable;
 using kiraz::WasmContext; // Bu dosya içinde WasmContext kullanımını kolaylaştırır
 
 namespace ast {
 
 Node::Ptr Func::gen_wat(WasmContext &ctx) {
-    std::string func_name = m_name->as_string();
-    if (auto id_node = std::dynamic_pointer_cast<Id>(m_name)) {
-        func_name = id_node->get_id();
-    } else {
-        if (func_name.rfind("Id(", 0) == 0) {
-            func_name = func_name.substr(3, func_name.length() - 4);
-        }
-    }
-
-    ctx.body() << fmt::format("  (func ${}", func_name);
+    const auto &frame = ctx.frame();
+    const auto &func_name = m_name->get_id();
+    auto wat_name = frame.self.empty() ? func_name : FF("{}.{}", frame.self, func_name);
 
-    bool is_main = (func_name == "main");
-    bool returns_int64 = false;
-
-    if (m_ret_type) {
-        std::string ret_str = m_ret_type->as_string();
-        if (ret_str.find("Integer64") != std::string::npos) {
-            returns_int64 = true;
-        }
+    kiraz::Trace::Scope trace("func", wat_name);
+    if (kiraz::Trace::enabled()) {
+        trace.arg("nodes", count_nodes());
     }
 
-    if (returns_int64) {
-        ctx.body() << " (result i64)";
-    } 
-
-    ctx.body() << "\n";
-
-    if (auto stmts = std::dynamic_pointer_cast<StmtList>(m_scope)) {
-        for (auto &stmt : stmts->get_stmts()) {
-            if (auto let = std::dynamic_pointer_cast<Let>(stmt)) {
-                 std::string var_name = "";
-                 if (auto id_node = std::dynamic_pointer_cast<Id>(let->get_name())) {
-                     var_name = id_node->get_id();
-                 } else {
-                     var_name = let->get_name()->as_string();
-                     if (var_name.rfind("Id(", 0) == 0) {
-                        var_name = var_name.substr(3, var_name.length() - 4);
-                     }
-                 }
-                ctx.body() << fmt::format("    (local ${} i64)\n", var_name);
-            }
-        }
+    ir::Function fn(wat_name);
+    if (auto ret = ir::lower(ctx, *this, fn)) {
+        return ret;
     }
-    
-    if (m_scope) {
-        m_scope->gen_wat(ctx);
-    }
-    
-    ctx.body() << "  )\n";
-
-    if (is_main) {
-        ctx.body() << "  (export \"main\" (func $main))\n";
+    if (ctx.get_profile_options().generate) {
+        ir::instrument(ctx, fn);
     }
-
-    return nullptr;
-}
-
-Node::Ptr Call::gen_wat(WasmContext &ctx) {
-    std::string name_str = m_name->as_string();
-    
-    if (name_str.find("io") != std::string::npos && name_str.find("print") != std::string::npos) {
-        auto args = std::dynamic_pointer_cast<FuncArgs>(m_args);
-        if (args && !args->get_args().empty()) {
-            auto arg = args->get_args()[0];
-            
-            arg->gen_wat(ctx);
-            
-            auto type = arg->get_stmt_type();
-            std::string type_name = type ? type->get_id() : "";
-            
-            if (type_name == "String" || std::dynamic_pointer_cast<String>(arg)) {
-                ctx.body() << "    call $io_print_s\n";
-            } else if (type_name == "Boolean" || std::dynamic_pointer_cast<Boolean>(arg)) {
-                ctx.body() << "    call $io_print_b\n";
-            } else {
-                ctx.body() << "    call $io_print_i\n";
-            }
-        }
+    else if (ctx.get_profile_options().use) {
+        ir::use_profile(ctx, fn);
     }
-    return nullptr;
-}
+    ir::optimize(fn, ctx.get_optimize_options());
+    ir::emit(ctx, fn);
 
-Node::Ptr Let::gen_wat(WasmContext &ctx) {
-    if (m_init) {
-        m_init->gen_wat(ctx);
-        std::string var_name = "";
-        if (auto id_node = std::dynamic_pointer_cast<Id>(m_name)) {
-            var_name = id_node->get_id();
-        } else {
-            var_name = m_name->as_string();
-             if (var_name.rfind("Id(", 0) == 0) {
-                var_name = var_name.substr(3, var_name.length() - 4);
-             }
-        }
-        ctx.body() << fmt::format("    local.set ${}\n", var_name);
+    if (func_name == "main" && frame.self.empty()) {
+        ctx.body() << "  (export \"main\" (func $main))\n";
     }
     return nullptr;
 }
 
-Node::Ptr Add::gen_wat(WasmContext &ctx) {
-    m_left->gen_wat(ctx);
-    m_right->gen_wat(ctx);
-    ctx.body() << "    i64.add\n";
-    return nullptr;
-}
+Node::Ptr Class::gen_wat(WasmContext &ctx) {
+    const auto &name = m_name->get_id();
+    auto layout = ctx.get_layout().find_class(name);
+    assert(layout);
 
-Node::Ptr OpEq::gen_wat(WasmContext &ctx) {
-    m_left->gen_wat(ctx);
-    m_right->gen_wat(ctx);
-    ctx.body() << "    i64.eq\n";
-    return nullptr;
-}
+    kiraz::Trace::Scope trace("class", name);
 
-Node::Ptr If::gen_wat(WasmContext &ctx) {
-    m_cond->gen_wat(ctx);
-    ctx.body() << "    (if\n";
-    ctx.body() << "      (then\n";
-    m_then->gen_wat(ctx);
-    ctx.body() << "      )\n";
-    if (m_else) {
-        ctx.body() << "      (else\n";
-        m_else->gen_wat(ctx);
-        ctx.body() << "      )\n";
+    auto &frame = ctx.frame();
+    ir::Function init(FF("{}.__init", name));
+    auto retval = ir::lower_init(ctx, *layout, init);
+    if (! retval) {
+        ir::emit(ctx, init);
     }
-    ctx.body() << "    )\n";
-    return nullptr;
-}
 
-Node::Ptr Return::gen_wat(WasmContext &ctx) {
-    if (m_val) {
-        m_val->gen_wat(ctx);
+    if (! retval && m_scope) {
+        m_scope->for_each_child([&](const Node::Ptr &stmt) {
+            if (! retval && stmt->is_func()) {
+                frame.self = name;
+                retval = stmt->gen_wat(ctx);
+            }
+        });
     }
-    ctx.body() << "    return\n";
-    return nullptr;
+
+    frame.self.clear();
+    return retval;
 }
 
+// Top-level statements; function bodies are lowered as a whole.
 Node::Ptr StmtList::gen_wat(WasmContext &ctx) {
     for (auto &s : m_stmts) {
-        s->gen_wat(ctx);
+        if (auto ret = s->gen_wat(ctx)) {
+            return ret;
+        }
     }
     return nullptr;
 }
@@ -159,7 +87,6 @@ Node::Ptr Module::gen_wat(WasmContext &ctx) {
 }
 
 Node::Ptr BinaryOp::compute_stmt_type(SymbolTable &st) { return nullptr; }
-Node::Ptr BinaryOp::gen_wat(WasmContext &ctx) { return nullptr; }
 std::string Add::get_op_symbol() const { return "+"; }
 std::string Sub::get_op_symbol() const { return "-"; }
 std::string Mult::get_op_symbol() const { return "*"; }
@@ -179,9 +106,15 @@ Node::Ptr StmtList::compute_stmt_type(SymbolTable &st) { return nullptr; }
 Node::Ptr Func::compute_stmt_type(SymbolTable &st) { return nullptr; }
 Node::Ptr Func::add_to_symtab_forward(SymbolTable &st) { return nullptr; }
 Node::Ptr Assignment::compute_stmt_type(SymbolTable &st) { return nullptr; }
-Node::Ptr Assignment::gen_wat(WasmContext &ctx) { return nullptr; }
 Node::SymTabEntry Class::get_subsymbol(Node::Ptr) const { return {}; }
-Node::Ptr Class::compute_stmt_type(SymbolTable &st) { return nullptr; }
+Node::Ptr Class::compute_stmt_type(SymbolTable &st) {
+    kiraz::Trace::Scope trace("class", m_name ? m_name->get_id() : "?");
+    if (kiraz::Trace::enabled()) {
+        trace.arg("nodes", count_nodes());
+    }
+
+    return nullptr;
+}
 Node::Ptr Class::add_to_symtab_forward(SymbolTable &st) { return nullptr; }
 Node::Ptr If::compute_stmt_type(SymbolTable &st) { return nullptr; }
 Node::Ptr While::compute_stmt_type(SymbolTable &st) { return nullptr; }
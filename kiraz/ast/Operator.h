@@ -2,12 +2,12 @@
 #define KIRAZ_AST_OPERATOR_H
 
 #include <cassert>
-#include <map>
 #include <vector>
 #include <string>
 #include <memory>
 
 #include <kiraz/Node.h>
+#include <kiraz/SymbolMap.h>
 
 // Forward declaration
 namespace kiraz { class WasmContext; }
@@ -16,19 +16,46 @@ namespace ast {
 
 class BinaryOp : public Node {
 public:
+    // Indexes the opcode table of ir/Lower.cpp, which ends at Ge
+    enum class Kind {
+        Add,
+        Sub,
+        Mult,
+        Div,
+        Eq,
+        Ne,
+        Lt,
+        Gt,
+        Le,
+        Ge,
+    };
+
     BinaryOp(Node::Ptr left, Node::Ptr right) : m_left(left), m_right(right) {}
 
     Node::Ptr get_left() const { return m_left; }
     Node::Ptr get_right() const { return m_right; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
-    // kiraz::WasmContext olarak tam ad kullanıldı
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        fn(m_left);
+        fn(m_right);
+    }
 
     virtual std::string get_op_symbol() const = 0;
+    virtual Kind get_kind() const = 0;
     virtual bool is_comparison() const { return false; }
 
 protected:
+    void format_binary(fmt::memory_buffer &out, std::string_view name) const {
+        put(out, name);
+        put(out, "(l=");
+        m_left->format_to(out);
+        put(out, ", r=");
+        m_right->format_to(out);
+        put(out, ")");
+    }
+
     Node::Ptr m_left;
     Node::Ptr m_right;
 };
@@ -37,69 +64,61 @@ class Add : public BinaryOp {
 public:
     Add(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("Add(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "Add"); }
 
     std::string get_op_symbol() const override;
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    Kind get_kind() const override { return Kind::Add; }
 };
 
 class Sub : public BinaryOp {
 public:
     Sub(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("Sub(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "Sub"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Sub; }
 };
 
 class Mult : public BinaryOp {
 public:
     Mult(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("Mult(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "Mult"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Mult; }
 };
 
 class Div : public BinaryOp {
 public:
     Div(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("DivF(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "DivF"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Div; }
 };
 
 class OpEq : public BinaryOp {
 public:
     OpEq(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("OpEq(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "OpEq"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Eq; }
     bool is_comparison() const override { return true; }
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
 };
 
 class OpNe : public BinaryOp {
 public:
     OpNe(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("OpNe(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "OpNe"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Ne; }
     bool is_comparison() const override { return true; }
 };
 
@@ -107,11 +126,10 @@ class OpLt : public BinaryOp {
 public:
     OpLt(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("OpLt(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "OpLt"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Lt; }
     bool is_comparison() const override { return true; }
 };
 
@@ -119,11 +137,10 @@ class OpGt : public BinaryOp {
 public:
     OpGt(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("OpGt(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "OpGt"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Gt; }
     bool is_comparison() const override { return true; }
 };
 
@@ -131,11 +148,10 @@ class OpLe : public BinaryOp {
 public:
     OpLe(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("OpLe(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "OpLe"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Le; }
     bool is_comparison() const override { return true; }
 };
 
@@ -143,11 +159,10 @@ class OpGe : public BinaryOp {
 public:
     OpGe(Node::Ptr left, Node::Ptr right) : BinaryOp(left, right) {}
 
-    std::string as_string() const override {
-        return fmt::format("OpGe(l={}, r={})", m_left->as_string(), m_right->as_string());
-    }
+    void format_to(fmt::memory_buffer &out) const override { format_binary(out, "OpGe"); }
 
     std::string get_op_symbol() const override;
+    Kind get_kind() const override { return Kind::Ge; }
     bool is_comparison() const override { return true; }
 };
 
@@ -156,25 +171,38 @@ public:
     Let(Node::Ptr name, Node::Ptr type, Node::Ptr init)
             : m_name(name), m_type(type), m_init(init) {}
 
-    std::string as_string() const override {
-        std::string result = "Let(n=" + m_name->as_string();
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Let(n=");
+        m_name->format_to(out);
         if (m_type) {
-            result += ", t=" + m_type->as_string();
+            put(out, ", t=");
+            m_type->format_to(out);
         }
         if (m_init) {
-            result += ", i=" + m_init->as_string();
+            put(out, ", i=");
+            m_init->format_to(out);
         }
-        result += ")";
-        return result;
+        put(out, ")");
     }
 
     Node::Ptr get_name() const { return m_name; }
     Node::Ptr get_type() const { return m_type; }
     Node::Ptr get_init() const { return m_init; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
-    Node::Ptr add_to_symtab_ordered(SymbolTable &st) override;
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+    Node::Ptr add_to_symtab_ordered(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_name) {
+            fn(m_name);
+        }
+        if (m_type) {
+            fn(m_type);
+        }
+        if (m_init) {
+            fn(m_init);
+        }
+    }
 
 private:
     Node::Ptr m_name;
@@ -186,14 +214,27 @@ class FArg : public Node {
 public:
     FArg(Node::Ptr name, Node::Ptr type) : m_name(name), m_type(type) {}
 
-    std::string as_string() const override {
-        return fmt::format("FArg(n={}, t={})", m_name->as_string(), m_type->as_string());
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "FArg(n=");
+        m_name->format_to(out);
+        put(out, ", t=");
+        m_type->format_to(out);
+        put(out, ")");
     }
 
     Node::Ptr get_name() const { return m_name; }
     Node::Ptr get_type() const { return m_type; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_name) {
+            fn(m_name);
+        }
+        if (m_type) {
+            fn(m_type);
+        }
+    }
 
 private:
     Node::Ptr m_name;
@@ -204,18 +245,17 @@ class FuncArgs : public Node {
 public:
     FuncArgs(std::vector<Node::Ptr> args) : m_args(args) {}
 
-    std::string as_string() const override {
-        std::string result = "[";
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "[");
         bool first = true;
         for (const auto &arg : m_args) {
             if (! first) {
-                result += ", ";
+                put(out, ", ");
             }
             first = false;
-            result += arg->as_string();
+            arg->format_to(out);
         }
-        result += "]";
-        return result;
+        put(out, "]");
     }
 
     bool is_funcarg_list() const override { return true; }
@@ -223,7 +263,13 @@ public:
     void add(Node::Ptr arg) { m_args.push_back(arg); }
     const std::vector<Node::Ptr> &get_args() const { return m_args; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        for (auto &n : m_args) {
+            fn(n);
+        }
+    }
 
 private:
     std::vector<Node::Ptr> m_args;
@@ -231,29 +277,46 @@ private:
 
 class StmtList : public Node {
 public:
-    StmtList(std::vector<Node::Ptr> stmts) : m_stmts(stmts) {}
+    StmtList(std::vector<Node::Ptr> stmts) : m_stmts(std::move(stmts)) {}
 
-    std::string as_string_inner() const {
-        std::string result = "[";
+    // Nested lists print as a bare [...], without the Module() wrapper.
+    void format_inner(fmt::memory_buffer &out) const {
+        put(out, "[");
         bool first = true;
         for (const auto &stmt : m_stmts) {
             if (! first) {
-                result += ", ";
+                put(out, ", ");
             }
             first = false;
-            auto nested = std::dynamic_pointer_cast<StmtList>(stmt);
-            if (nested) {
-                result += nested->as_string_inner();
-            }
-            else {
-                result += stmt->as_string();
-            }
+            format_scope(out, stmt);
         }
-        result += "]";
-        return result;
+        put(out, "]");
     }
 
-    std::string as_string() const override { return "Module(" + as_string_inner() + ")"; }
+    std::string as_string_inner() const {
+        fmt::memory_buffer out;
+        format_inner(out);
+        return fmt::to_string(out);
+    }
+
+    // Blocks of func/class/if/while: the inner form for lists, "[]" for none
+    static void format_scope(fmt::memory_buffer &out, const Node::Ptr &node) {
+        if (! node) {
+            put(out, "[]");
+        }
+        else if (node->is_stmt_list()) {
+            static_cast<const StmtList &>(*node).format_inner(out);
+        }
+        else {
+            node->format_to(out);
+        }
+    }
+
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Module(");
+        format_inner(out);
+        put(out, ")");
+    }
 
     bool is_stmt_list() const override { return true; }
 
@@ -261,9 +324,15 @@ public:
     std::vector<Node::Ptr> &get_stmts() { return m_stmts; }
     const std::vector<Node::Ptr> &get_stmts() const { return m_stmts; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
     Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
 
+    void for_each_child(const ChildFn &fn) const override {
+        for (auto &n : m_stmts) {
+            fn(n);
+        }
+    }
+
 private:
     std::vector<Node::Ptr> m_stmts;
 };
@@ -273,20 +342,24 @@ public:
     Func(Node::Ptr name, Node::Ptr args, Node::Ptr ret_type, Node::Ptr scope)
             : m_name(name), m_args(args), m_ret_type(ret_type), m_scope(scope) {}
 
-    std::string as_string() const override {
-        auto scope_list = std::dynamic_pointer_cast<StmtList>(m_scope);
-        std::string scope_str = scope_list ? scope_list->as_string_inner() : m_scope->as_string();
-
-        auto args_list = std::dynamic_pointer_cast<FuncArgs>(m_args);
-        std::string args_str;
-        if (args_list && args_list->get_args().empty()) {
-            args_str = "[]";
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Func(n=");
+        m_name->format_to(out);
+        put(out, ", a=");
+        if (m_args->is_funcarg_list()
+                && static_cast<const FuncArgs &>(*m_args).get_args().empty()) {
+            put(out, "[]");
         }
         else {
-            args_str = "FuncArgs(" + m_args->as_string() + ")";
+            put(out, "FuncArgs(");
+            m_args->format_to(out);
+            put(out, ")");
         }
-        return fmt::format("Func(n={}, a={}, r={}, s={})", m_name->as_string(), args_str,
-                m_ret_type->as_string(), scope_str);
+        put(out, ", r=");
+        m_ret_type->format_to(out);
+        put(out, ", s=");
+        StmtList::format_scope(out, m_scope);
+        put(out, ")");
     }
 
     bool is_func() const override { return true; }
@@ -296,10 +369,25 @@ public:
     Node::Ptr get_ret_type() const { return m_ret_type; }
     Node::Ptr get_scope() const { return m_scope; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
-    Node::Ptr add_to_symtab_forward(SymbolTable &st) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+    Node::Ptr add_to_symtab_forward(kiraz::SymbolTable &st) override;
     Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
 
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_name) {
+            fn(m_name);
+        }
+        if (m_args) {
+            fn(m_args);
+        }
+        if (m_ret_type) {
+            fn(m_ret_type);
+        }
+        if (m_scope) {
+            fn(m_scope);
+        }
+    }
+
 private:
     Node::Ptr m_name;
     Node::Ptr m_args;
@@ -311,8 +399,12 @@ class Assignment : public Node {
 public:
     Assignment(Node::Ptr name, Node::Ptr value) : m_name(name), m_value(value) {}
 
-    std::string as_string() const override {
-        return fmt::format("Assign(l={}, r={})", m_name->as_string(), m_value->as_string());
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Assign(l=");
+        m_name->format_to(out);
+        put(out, ", r=");
+        m_value->format_to(out);
+        put(out, ")");
     }
 
     bool is_assign() const override { return true; }
@@ -320,8 +412,16 @@ public:
     Node::Ptr get_lhs() const { return m_name; }
     Node::Ptr get_rhs() const { return m_value; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_name) {
+            fn(m_name);
+        }
+        if (m_value) {
+            fn(m_value);
+        }
+    }
 
 private:
     Node::Ptr m_name;
@@ -332,10 +432,12 @@ class Class : public Node {
 public:
     Class(Node::Ptr name, Node::Ptr scope) : m_name(name), m_scope(scope) {}
 
-    std::string as_string() const override {
-        auto scope_list = std::dynamic_pointer_cast<StmtList>(m_scope);
-        std::string scope_str = scope_list ? scope_list->as_string_inner() : m_scope->as_string();
-        return fmt::format("Class(n={}, s={})", m_name->as_string(), scope_str);
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Class(n=");
+        m_name->format_to(out);
+        put(out, ", s=");
+        StmtList::format_scope(out, m_scope);
+        put(out, ")");
     }
 
     bool is_class() const override { return true; }
@@ -343,23 +445,30 @@ public:
     Node::Ptr get_name() const { return m_name; }
     Node::Ptr get_scope() const { return m_scope; }
 
-    void set_subsymbols(const std::map<std::string, Node::Ptr> &syms) { m_subsymbols = syms; }
+    void set_subsymbols(kiraz::SymbolMap syms) { m_subsymbols = std::move(syms); }
     Node::SymTabEntry get_subsymbol(Node::Ptr) const override;
     Node::SymTabEntry get_subsymbol_by_name(const std::string &name) const {
-        auto it = m_subsymbols.find(name);
-        if (it == m_subsymbols.end()) {
-            return {name, nullptr};
-        }
-        return {name, it->second};
+        auto node = m_subsymbols.find(name);
+        return {name, node ? *node : nullptr};
     }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
-    Node::Ptr add_to_symtab_forward(SymbolTable &st) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+    Node::Ptr add_to_symtab_forward(kiraz::SymbolTable &st) override;
+    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_name) {
+            fn(m_name);
+        }
+        if (m_scope) {
+            fn(m_scope);
+        }
+    }
 
 private:
     Node::Ptr m_name;
     Node::Ptr m_scope;
-    std::map<std::string, Node::Ptr> m_subsymbols;
+    kiraz::SymbolMap m_subsymbols;
 };
 
 class If : public Node {
@@ -367,22 +476,14 @@ public:
     If(Node::Ptr cond, Node::Ptr then_stmts, Node::Ptr else_stmts)
             : m_cond(cond), m_then(then_stmts), m_else(else_stmts) {}
 
-    std::string as_string() const override {
-        auto unwrap = [](Node::Ptr node) -> std::string {
-            if (! node) {
-                return "[]";
-            }
-            auto list = std::dynamic_pointer_cast<StmtList>(node);
-            return list ? list->as_string_inner() : node->as_string();
-        };
-
-        if (m_else && m_else->is_if()) {
-            return fmt::format("If(?={}, then={}, else={})", m_cond->as_string(), unwrap(m_then),
-                    m_else->as_string());
-        }
-
-        return fmt::format(
-                "If(?={}, then={}, else={})", m_cond->as_string(), unwrap(m_then), unwrap(m_else));
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "If(?=");
+        m_cond->format_to(out);
+        put(out, ", then=");
+        StmtList::format_scope(out, m_then);
+        put(out, ", else=");
+        StmtList::format_scope(out, m_else);
+        put(out, ")");
     }
 
     bool is_if() const override { return true; }
@@ -391,8 +492,19 @@ public:
     Node::Ptr get_then() const { return m_then; }
     Node::Ptr get_else() const { return m_else; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_cond) {
+            fn(m_cond);
+        }
+        if (m_then) {
+            fn(m_then);
+        }
+        if (m_else) {
+            fn(m_else);
+        }
+    }
 
 private:
     Node::Ptr m_cond;
@@ -404,11 +516,12 @@ class While : public Node {
 public:
     While(Node::Ptr cond, Node::Ptr repeat_stmts) : m_cond(cond), m_repeat(repeat_stmts) {}
 
-    std::string as_string() const override {
-        auto repeat_list = std::dynamic_pointer_cast<StmtList>(m_repeat);
-        std::string repeat_str =
-                repeat_list ? repeat_list->as_string_inner() : m_repeat->as_string();
-        return fmt::format("While(?={}, repeat={})", m_cond->as_string(), repeat_str);
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "While(?=");
+        m_cond->format_to(out);
+        put(out, ", repeat=");
+        StmtList::format_scope(out, m_repeat);
+        put(out, ")");
     }
 
     bool is_while() const override { return true; }
@@ -416,7 +529,16 @@ public:
     Node::Ptr get_cond() const { return m_cond; }
     Node::Ptr get_repeat() const { return m_repeat; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_cond) {
+            fn(m_cond);
+        }
+        if (m_repeat) {
+            fn(m_repeat);
+        }
+    }
 
 private:
     Node::Ptr m_cond;
@@ -427,15 +549,23 @@ class Import : public Node {
 public:
     Import(Node::Ptr name) : m_name(name) {}
 
-    std::string as_string() const override {
-        return fmt::format("Import({})", m_name->as_string());
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Import(");
+        m_name->format_to(out);
+        put(out, ")");
     }
 
     bool is_import() const override { return true; }
 
     Node::Ptr get_name() const { return m_name; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_name) {
+            fn(m_name);
+        }
+    }
 
 private:
     Node::Ptr m_name;
@@ -445,16 +575,23 @@ class Return : public Node {
 public:
     Return(Node::Ptr value) : m_value(value) {}
 
-    std::string as_string() const override {
-        return fmt::format("Return({})", m_value->as_string());
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Return(");
+        m_value->format_to(out);
+        put(out, ")");
     }
 
     bool is_return() const override { return true; }
 
     Node::Ptr get_value() const { return m_value; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_value) {
+            fn(m_value);
+        }
+    }
 
 private:
     Node::Ptr m_value;
@@ -464,8 +601,12 @@ class Dot : public Node {
 public:
     Dot(Node::Ptr lhs, Node::Ptr rhs) : m_lhs(lhs), m_rhs(rhs) {}
 
-    std::string as_string() const override {
-        return fmt::format("Dot(l={}, r={})", m_lhs->as_string(), m_rhs->as_string());
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Dot(l=");
+        m_lhs->format_to(out);
+        put(out, ", r=");
+        m_rhs->format_to(out);
+        put(out, ")");
     }
 
     bool is_dot() const override { return true; }
@@ -473,7 +614,16 @@ public:
     Node::Ptr get_lhs() const { return m_lhs; }
     Node::Ptr get_rhs() const { return m_rhs; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_lhs) {
+            fn(m_lhs);
+        }
+        if (m_rhs) {
+            fn(m_rhs);
+        }
+    }
 
 private:
     Node::Ptr m_lhs;
@@ -484,8 +634,12 @@ class Call : public Node {
 public:
     Call(Node::Ptr name, Node::Ptr args) : m_name(name), m_args(args) {}
 
-    std::string as_string() const override {
-        return fmt::format("Call(n={}, a=FuncArgs({}))", m_name->as_string(), m_args->as_string());
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Call(n=");
+        m_name->format_to(out);
+        put(out, ", a=FuncArgs(");
+        m_args->format_to(out);
+        put(out, "))");
     }
 
     bool is_call() const override { return true; }
@@ -493,8 +647,16 @@ public:
     Node::Ptr get_name() const { return m_name; }
     Node::Ptr get_args() const { return m_args; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override;
-    Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override;
+
+    void for_each_child(const ChildFn &fn) const override {
+        if (m_name) {
+            fn(m_name);
+        }
+        if (m_args) {
+            fn(m_args);
+        }
+    }
 
 private:
     Node::Ptr m_name;
@@ -505,25 +667,31 @@ class Module : public Node {
 public:
     Module(std::vector<Node::Ptr> stmts) : m_stmts(stmts) {}
 
-    std::string as_string() const override {
-        std::string result = "Module([";
+    void format_to(fmt::memory_buffer &out) const override {
+        put(out, "Module([");
         bool first = true;
         for (const auto &stmt : m_stmts) {
             if (! first) {
-                result += ", ";
+                put(out, ", ");
             }
             first = false;
-            result += stmt->as_string();
+            stmt->format_to(out);
         }
-        result += "])";
-        return result;
+        put(out, "])");
     }
 
     void add(Node::Ptr stmt) { m_stmts.push_back(stmt); }
+    const std::vector<Node::Ptr> &get_stmts() const { return m_stmts; }
 
-    Node::Ptr compute_stmt_type(SymbolTable &st) override { return nullptr; }
+    Node::Ptr compute_stmt_type(kiraz::SymbolTable &st) override { return nullptr; }
     Node::Ptr gen_wat(kiraz::WasmContext &ctx) override;
 
+    void for_each_child(const ChildFn &fn) const override {
+        for (auto &n : m_stmts) {
+            fn(n);
+        }
+    }
+
 private:
     std::vector<Node::Ptr> m_stmts;
 };
@@ -0,0 +1,152 @@
+#include "Bench.h"
+
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <kiraz/ir/Optimize.h>
+
+namespace kiraz::bench {
+
+namespace {
+
+struct Entry {
+    const char *name;
+    Function fn;
+};
+
+bool s_count_instructions = false;
+unsigned s_optimize_level = ir::OptimizeOptions().level;
+bool s_simd = ir::OptimizeOptions().simd;
+
+std::vector<Entry> &registry() {
+    static std::vector<Entry> retval;
+    return retval;
+}
+
+std::string rate(uint64_t count, double seconds, const char *unit) {
+    if (count == 0 || seconds <= 0) {
+        return {};
+    }
+
+    auto per_sec = count / seconds;
+    if (per_sec >= 1e9) {
+        return fmt::format(" {:>8.2f}G{}/s", per_sec / 1e9, unit);
+    }
+    if (per_sec >= 1e6) {
+        return fmt::format(" {:>8.2f}M{}/s", per_sec / 1e6, unit);
+    }
+    if (per_sec >= 1e3) {
+        return fmt::format(" {:>8.2f}k{}/s", per_sec / 1e3, unit);
+    }
+    return fmt::format(" {:>8.2f} {}/s", per_sec, unit);
+}
+
+} // namespace
+
+int register_bench(const char *name, Function fn) {
+    registry().push_back({name, std::move(fn)});
+    return static_cast<int>(registry().size());
+}
+
+bool counting_instructions() { return s_count_instructions; }
+unsigned optimize_level() { return s_optimize_level; }
+bool simd() { return s_simd; }
+
+int run_all(int argc, char **argv) {
+    std::string_view filter;
+    double min_time = 0.5;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg.starts_with("--filter=")) {
+            filter = arg.substr(sizeof("--filter=") - 1);
+        }
+        else if (arg.starts_with("--min-time=")) {
+            min_time = std::stod(std::string(arg.substr(sizeof("--min-time=") - 1)));
+        }
+        else if (arg == "--instructions") {
+            s_count_instructions = true;
+        }
+        else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            s_optimize_level = arg[2] - '0';
+        }
+        else if (arg == "--simd") {
+            s_simd = true;
+        }
+        else if (arg == "--list") {
+            for (auto &e : registry()) {
+                fmt::print("{}\n", e.name);
+            }
+            return 0;
+        }
+        else {
+            fmt::print(stderr,
+                    "Usage: {} [--filter=substr] [--min-time=seconds] [--instructions] [-O[0-2]]"
+                    " [--simd] [--list]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    fmt::print("{:<40} {:>12} {:>10}  {}\n", "benchmark", "time/iter", "iters", "rates");
+
+    for (auto &e : registry()) {
+        if (! filter.empty() && std::string_view(e.name).find(filter) == std::string_view::npos) {
+            continue;
+        }
+
+        // Grow the iteration count until a run takes at least min_time.
+        uint64_t iterations = 1;
+        while (true) {
+            State state(iterations);
+            e.fn(state);
+
+            if (! state.get_skipped().empty()) {
+                fmt::print("{:<40} skipped: {}\n", e.name, state.get_skipped());
+                break;
+            }
+
+            auto secs = state.seconds();
+            if (secs >= min_time || iterations >= (uint64_t(1) << 30)) {
+                auto n = state.iterations() ? state.iterations() : 1;
+                auto per_iter = secs / n;
+                std::string time;
+                if (per_iter >= 1) {
+                    time = fmt::format("{:.3f} s", per_iter);
+                }
+                else if (per_iter >= 1e-3) {
+                    time = fmt::format("{:.3f} ms", per_iter * 1e3);
+                }
+                else {
+                    time = fmt::format("{:.3f} us", per_iter * 1e6);
+                }
+
+                auto instructions = state.get_instructions()
+                        ? fmt::format("  {} insn/iter", state.get_instructions())
+                        : std::string();
+                fmt::print("{:<40} {:>12} {:>10} {}{}{}{}{}{}\n", e.name, time, n,
+                        rate(state.get_tokens(), secs, "tok"),
+                        rate(state.get_nodes(), secs, "node"), rate(state.get_bytes(), secs, "B"),
+                        rate(state.get_items(), secs, "item"), instructions,
+                        state.get_label().empty() ? "" : "  " + state.get_label());
+                break;
+            }
+
+            // Aim a bit past min_time to avoid an extra round.
+            auto factor = secs > 0 ? 1.4 * min_time / secs : 10.0;
+            if (factor > 10) {
+                factor = 10;
+            }
+            if (factor < 2) {
+                factor = 2;
+            }
+            iterations = static_cast<uint64_t>(iterations * factor);
+        }
+    }
+
+    return 0;
+}
+
+} // namespace kiraz::bench
@@ -0,0 +1,104 @@
+#ifndef KIRAZ_BENCH_BENCH_H
+#define KIRAZ_BENCH_BENCH_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace kiraz::bench {
+
+/**
+ * @brief State: Per-run benchmark state, modelled after Google Benchmark.
+ *
+ *     KIRAZ_BENCH(parse) {
+ *         auto code = ...;            // untimed setup
+ *         while (state.keep_running()) {
+ *             ...                     // timed
+ *             state.add_tokens(n);
+ *         }
+ *     }
+ *
+ * Work between pause() and resume() is not timed.
+ */
+class State {
+public:
+    explicit State(uint64_t iterations) : m_max_iterations(iterations) {}
+
+    bool keep_running() {
+        if (m_iterations == 0) {
+            m_start = std::chrono::steady_clock::now();
+        }
+        if (m_iterations < m_max_iterations) {
+            ++m_iterations;
+            return true;
+        }
+        m_elapsed += std::chrono::steady_clock::now() - m_start;
+        return false;
+    }
+
+    void pause() { m_elapsed += std::chrono::steady_clock::now() - m_start; }
+    void resume() { m_start = std::chrono::steady_clock::now(); }
+
+    void add_tokens(uint64_t n) { m_tokens += n; }
+    void add_nodes(uint64_t n) { m_nodes += n; }
+    void add_bytes(uint64_t n) { m_bytes += n; }
+    void add_items(uint64_t n) { m_items += n; }
+    void set_instructions(uint64_t n) { m_instructions = n; }
+    void set_label(const std::string &label) { m_label = label; }
+
+    void skip(const std::string &reason) {
+        m_skipped = reason;
+        m_max_iterations = 0;
+    }
+
+    uint64_t iterations() const { return m_iterations; }
+    double seconds() const { return std::chrono::duration<double>(m_elapsed).count(); }
+
+    uint64_t get_tokens() const { return m_tokens; }
+    uint64_t get_nodes() const { return m_nodes; }
+    uint64_t get_bytes() const { return m_bytes; }
+    uint64_t get_items() const { return m_items; }
+    uint64_t get_instructions() const { return m_instructions; }
+    const auto &get_label() const { return m_label; }
+    const auto &get_skipped() const { return m_skipped; }
+
+private:
+    uint64_t m_max_iterations;
+    uint64_t m_iterations = 0;
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::duration m_elapsed{};
+
+    uint64_t m_tokens = 0;
+    uint64_t m_nodes = 0;
+    uint64_t m_bytes = 0;
+    uint64_t m_items = 0;
+    uint64_t m_instructions = 0; // executed by one iteration
+    std::string m_label;
+    std::string m_skipped;
+};
+
+using Function = std::function<void(State &)>;
+
+int register_bench(const char *name, Function fn);
+int run_all(int argc, char **argv);
+
+// Whether to count the instructions that benchmarks of generated code
+// execute, with --instructions. Counting is slow and not part of the timings.
+bool counting_instructions();
+
+// Optimization level of the code benchmarks generate, -O0 to -O2
+unsigned optimize_level();
+
+// Whether it vectorizes loops at -O2, with --simd
+bool simd();
+
+} // namespace kiraz::bench
+
+#define KIRAZ_BENCH(name)                                                                          \
+    static void bench_##name(::kiraz::bench::State &state);                                        \
+    [[maybe_unused]] static int bench_##name##_registered =                                        \
+            ::kiraz::bench::register_bench(#name, bench_##name);                                   \
+    static void bench_##name(::kiraz::bench::State &state)
+
+#endif
@@ -0,0 +1,214 @@
+#include "Generator.h"
+
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace kiraz::bench {
+
+namespace {
+
+// splitmix64: tiny and, unlike the std distributions, identical everywhere.
+class Rng {
+public:
+    explicit Rng(uint64_t seed) : m_state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (m_state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    int below(int n) { return n > 0 ? static_cast<int>(next() % n) : 0; }
+    bool chance(int percent) { return below(100) < percent; }
+
+private:
+    uint64_t m_state;
+};
+
+class Generator {
+public:
+    Generator(const GeneratorOptions &opts) : m_opts(opts), m_rng(opts.seed) {}
+
+    std::string run() {
+        m_out.reserve(static_cast<size_t>(m_opts.functions) * 512);
+        m_out += "import io;\n";
+
+        for (int i = 0; i < m_opts.classes; ++i) {
+            gen_class(i);
+        }
+        for (int i = 0; i < m_opts.functions; ++i) {
+            gen_func(i);
+        }
+
+        return std::move(m_out);
+    }
+
+private:
+    void indent(int level) { m_out.append(level * 4, ' '); }
+
+    std::string pick_var() {
+        if (m_vars.empty()) {
+            return fmt::format("{}", m_rng.below(1000));
+        }
+        return m_vars[m_rng.below(m_vars.size())];
+    }
+
+    void gen_expr(int ops) {
+        if (ops <= 0) {
+            if (m_rng.chance(50)) {
+                m_out += pick_var();
+            }
+            else {
+                m_out += fmt::format("{}", m_rng.below(100000));
+            }
+            return;
+        }
+
+        static const char *const binops[] = {"+", "-", "*", "/"};
+        auto left = m_rng.below(ops);
+        bool paren = m_rng.chance(30);
+        if (paren) {
+            m_out += "(";
+        }
+        gen_expr(left);
+        m_out += fmt::format(" {} ", binops[m_rng.below(4)]);
+        gen_expr(ops - 1 - left);
+        if (paren) {
+            m_out += ")";
+        }
+    }
+
+    void gen_cond() {
+        static const char *const cmpops[] = {"==", "!=", "<", ">", "<=", ">="};
+        gen_expr(m_opts.expr_size / 2);
+        m_out += fmt::format(" {} ", cmpops[m_rng.below(6)]);
+        gen_expr(m_opts.expr_size / 2);
+    }
+
+    void gen_string() {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        m_out += "\"";
+        for (int i = 0; i < m_opts.string_length; ++i) {
+            m_out += alphabet[m_rng.below(sizeof(alphabet) - 1)];
+        }
+        m_out += "\"";
+    }
+
+    void gen_block(int level, int depth) {
+        for (int i = 0; i < m_opts.stmts; ++i) {
+            indent(level);
+            int kind = m_rng.below(depth > 0 ? 5 : 3);
+            switch (kind) {
+            case 0: {
+                auto name = fmt::format("v{}", m_next_var++);
+                m_out += fmt::format("let {} : Integer64 = ", name);
+                gen_expr(m_opts.expr_size);
+                m_out += ";\n";
+                m_vars.push_back(name);
+                break;
+            }
+            case 1:
+                if (! m_vars.empty()) {
+                    m_out += fmt::format("{} = ", m_vars[m_rng.below(m_vars.size())]);
+                    gen_expr(m_opts.expr_size);
+                    m_out += ";\n";
+                    break;
+                }
+                [[fallthrough]];
+            case 2:
+                m_out += "io.print(";
+                gen_expr(m_opts.expr_size);
+                m_out += ");\n";
+                break;
+            case 3: {
+                auto scope = m_vars.size();
+                m_out += "if (";
+                gen_cond();
+                m_out += ") {\n";
+                gen_block(level + 1, depth - 1);
+                m_vars.resize(scope);
+                indent(level);
+                if (m_rng.chance(50)) {
+                    m_out += "} else {\n";
+                    gen_block(level + 1, depth - 1);
+                    m_vars.resize(scope);
+                    indent(level);
+                }
+                m_out += "};\n";
+                break;
+            }
+            case 4: {
+                auto scope = m_vars.size();
+                m_out += "while (";
+                gen_cond();
+                m_out += ") {\n";
+                gen_block(level + 1, depth - 1);
+                m_vars.resize(scope);
+                indent(level);
+                m_out += "};\n";
+                break;
+            }
+            }
+        }
+    }
+
+    void gen_func(int idx) {
+        m_vars = {"a", "b"};
+        m_next_var = 0;
+
+        m_out += fmt::format("func f{}(a : Integer64, b : Integer64) : Integer64 {{\n", idx);
+        for (int i = 0; i < m_opts.strings; ++i) {
+            indent(1);
+            m_out += "io.print(";
+            gen_string();
+            m_out += ");\n";
+        }
+        gen_block(1, m_opts.depth);
+        indent(1);
+        m_out += "return ";
+        gen_expr(m_opts.expr_size);
+        m_out += ";\n};\n";
+    }
+
+    void gen_class(int idx) {
+        m_out += fmt::format("class C{} {{\n", idx);
+        int fields = 2 + m_rng.below(4);
+        for (int i = 0; i < fields; ++i) {
+            indent(1);
+            m_out += fmt::format("let x{} : Integer64 = {};\n", i, m_rng.below(100));
+        }
+
+        m_vars.clear();
+        for (int i = 0; i < fields; ++i) {
+            m_vars.push_back(fmt::format("x{}", i));
+        }
+        int methods = 1 + m_rng.below(3);
+        for (int i = 0; i < methods; ++i) {
+            indent(1);
+            m_out += fmt::format("func m{}(k : Integer64) : Integer64 {{\n", i);
+            indent(2);
+            m_out += "return ";
+            gen_expr(m_opts.expr_size);
+            m_out += ";\n";
+            indent(1);
+            m_out += "};\n";
+        }
+        m_out += "};\n";
+    }
+
+    const GeneratorOptions &m_opts;
+    Rng m_rng;
+    std::string m_out;
+    std::vector<std::string> m_vars;
+    int m_next_var = 0;
+};
+
+} // namespace
+
+std::string generate_program(const GeneratorOptions &opts) {
+    return Generator(opts).run();
+}
+
+} // namespace kiraz::bench
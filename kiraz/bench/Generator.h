@@ -0,0 +1,29 @@
+#ifndef KIRAZ_BENCH_GENERATOR_H
+#define KIRAZ_BENCH_GENERATOR_H
+
+#include <cstdint>
+#include <string>
+
+namespace kiraz::bench {
+
+struct GeneratorOptions {
+    uint64_t seed = 1;
+    int functions = 100;   // top-level functions
+    int depth = 3;         // nesting of if/while blocks inside a function
+    int expr_size = 8;     // binary operators per expression
+    int strings = 4;       // string literals printed per function
+    int string_length = 24;
+    int classes = 10;      // classes, each with a few fields and methods
+    int stmts = 6;         // statements per block
+};
+
+/**
+ * @brief generate_program: Produces a syntactically valid kiraz module. The
+ * output only depends on the options, so a seed reproduces the same program on
+ * every platform.
+ */
+std::string generate_program(const GeneratorOptions &opts);
+
+} // namespace kiraz::bench
+
+#endif
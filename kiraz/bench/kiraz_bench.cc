@@ -0,0 +1,791 @@
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#ifdef KIRAZ_HAVE_WABT
+#include <wabt/binary-reader.h>
+#include <wabt/binary-writer.h>
+#include <wabt/interp/binary-reader-interp.h>
+#include <wabt/interp/interp.h>
+#include <wabt/stream.h>
+#include <wabt/validator.h>
+#include <wabt/wast-parser.h>
+#endif
+
+#include <lexer.hpp>
+#include <main.h>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/IncrementalParser.h>
+#include <kiraz/Node.h>
+#include <kiraz/Parallel.h>
+#include <kiraz/ast/Literal.h>
+#include <kiraz/ast/Operator.h>
+
+#include "Bench.h"
+#include "Generator.h"
+
+namespace kiraz::bench {
+
+namespace {
+
+const std::string &program() {
+    static const std::string retval = [] {
+        GeneratorOptions opts;
+        opts.seed = 42;
+        opts.functions = 200;
+        opts.depth = 3;
+        opts.expr_size = 8;
+        opts.strings = 4;
+        opts.classes = 20;
+        return generate_program(opts);
+    }();
+    return retval;
+}
+
+uint64_t count_tokens(const std::string &code) {
+    uint64_t retval = 0;
+    auto buffer = yy_scan_string(code.data());
+    while (yylex() > 0) {
+        ++retval;
+    }
+    yy_delete_buffer(buffer);
+    Compiler::reset_parser();
+    return retval;
+}
+
+// The default program repeated until it holds at least 10M tokens.
+const std::string &large_program() {
+    static const std::string retval = [] {
+        const auto &unit = program();
+        auto per_unit = count_tokens(unit);
+        auto copies = (10'000'000 + per_unit - 1) / per_unit;
+
+        std::string out;
+        out.reserve(unit.size() * copies);
+        for (uint64_t i = 0; i < copies; ++i) {
+            out += unit;
+        }
+        return out;
+    }();
+    return retval;
+}
+
+// Thousands of functions, for the per-function parallel phases
+const std::string &wide_program() {
+    static const std::string retval = [] {
+        GeneratorOptions opts;
+        opts.seed = 7;
+        opts.functions = 4000;
+        opts.depth = 2;
+        opts.classes = 0;
+        return generate_program(opts);
+    }();
+    return retval;
+}
+
+void compile_wide(State &state, unsigned jobs) {
+    const auto &code = wide_program();
+    state.set_label(FF("{} jobs", jobs));
+
+    while (state.keep_running()) {
+        Compiler compiler;
+        compiler.set_jobs(jobs);
+        if (compiler.compile_string(code) != 0) {
+            state.skip("generated program does not compile");
+            return;
+        }
+        state.add_bytes(code.size());
+    }
+}
+
+#ifdef KIRAZ_HAVE_WABT
+// Binary of a WAT module, empty if wabt rejects it
+std::vector<uint8_t> assemble(const std::string &wat) {
+    wabt::Features features;
+    features.enable_simd();
+    wabt::Errors errors;
+    auto lexer = wabt::WastLexer::CreateBufferLexer("bench.wat", wat.data(), wat.size(), &errors);
+
+    std::unique_ptr<wabt::Module> module;
+    wabt::WastParseOptions parse_options(features);
+    if (Failed(ParseWatModule(lexer.get(), &module, &errors, &parse_options))) {
+        return {};
+    }
+
+    wabt::ValidateOptions validate_options(features);
+    if (Failed(ValidateModule(module.get(), &errors, validate_options))) {
+        return {};
+    }
+
+    wabt::MemoryStream stream;
+    wabt::WriteBinaryOptions write_options;
+    if (Failed(WriteBinaryModule(&stream, module.get(), write_options))) {
+        return {};
+    }
+    return std::move(stream.output_buffer().data);
+}
+
+// Counts the lines of an interpreter trace, one per instruction executed
+class TraceCounter : public wabt::Stream {
+public:
+    uint64_t get_lines() const { return m_lines; }
+
+protected:
+    wabt::Result WriteDataImpl(size_t, const void *data, size_t size) override {
+        auto text = static_cast<const char *>(data);
+        m_lines += std::count(text, text + size, '\n');
+        return wabt::Result::Ok;
+    }
+    wabt::Result MoveDataImpl(size_t, size_t, size_t) override { return wabt::Result::Ok; }
+    wabt::Result TruncateImpl(size_t) override { return wabt::Result::Ok; }
+
+private:
+    uint64_t m_lines = 0;
+};
+#endif
+
+// Compiles code and times its main in the wabt interpreter, on a fresh
+// instance each time. Imports do nothing: these programs are not about io.
+void run_main(State &state, const std::string &code) {
+#ifdef KIRAZ_HAVE_WABT
+    namespace interp = wabt::interp;
+
+    std::vector<uint8_t> wasm;
+    {
+        Compiler compiler;
+        compiler.set_optimize_options({.level = optimize_level(), .simd = simd()});
+        if (compiler.compile_string(code) != 0) {
+            state.skip(FF("program does not compile: {}", compiler.get_error()));
+            return;
+        }
+        wasm = assemble(compiler.get_wasm_ctx().body().str());
+    }
+    if (wasm.empty()) {
+        state.skip("generated WAT does not validate");
+        return;
+    }
+
+    wabt::Features features;
+    features.enable_simd();
+    wabt::Errors errors;
+    wabt::ReadBinaryOptions read_options(features, nullptr, false, true, true);
+    interp::ModuleDesc desc;
+    if (Failed(interp::ReadBinaryInterp(
+                "bench.wasm", wasm.data(), wasm.size(), read_options, &errors, &desc))) {
+        state.skip("interpreter rejects the module");
+        return;
+    }
+
+    interp::Store store;
+    auto module = interp::Module::New(store, desc);
+    interp::RefVec imports;
+    for (const auto &import : module->desc().imports) {
+        auto type = *wabt::cast<interp::FuncType>(import.type.type.get());
+        auto host = interp::HostFunc::New(store, type,
+                [](interp::Thread &, const interp::Values &, interp::Values &,
+                        interp::Trap::Ptr *) { return wabt::Result::Ok; });
+        imports.push_back(host.ref());
+    }
+
+    size_t main_index = module->desc().exports.size();
+    for (size_t i = 0; i < module->desc().exports.size(); ++i) {
+        if (module->desc().exports[i].type.name == "main") {
+            main_index = i;
+        }
+    }
+    if (main_index == module->desc().exports.size()) {
+        state.skip("no main");
+        return;
+    }
+
+    // One traced run per program, whatever the number of iterations
+    if (counting_instructions()) {
+        static std::unordered_map<std::string, uint64_t> counts;
+        auto [count, added] = counts.try_emplace(code, 0);
+        if (added) {
+            interp::Trap::Ptr trap;
+            auto instance = interp::Instance::Instantiate(store, module.ref(), imports, &trap);
+            if (! instance) {
+                state.skip("instantiation failed");
+                return;
+            }
+            auto main = store.UnsafeGet<interp::Func>(instance->exports()[main_index]);
+            interp::Values params;
+            interp::Values results;
+            TraceCounter trace;
+            main->Call(store, params, results, &trap, &trace);
+            count->second = trace.get_lines();
+        }
+        state.set_instructions(count->second);
+    }
+
+    while (state.keep_running()) {
+        state.pause();
+        store.Collect();
+        interp::Trap::Ptr trap;
+        auto instance = interp::Instance::Instantiate(store, module.ref(), imports, &trap);
+        if (! instance) {
+            state.skip("instantiation failed");
+            return;
+        }
+        auto main = store.UnsafeGet<interp::Func>(instance->exports()[main_index]);
+        interp::Values params;
+        interp::Values results;
+        state.resume();
+
+        if (Failed(main->Call(store, params, results, &trap))) {
+            state.skip(FF("trap: {}", trap ? trap->message() : "?"));
+            return;
+        }
+    }
+#else
+    state.skip("built without wabt (KIRAZ_TEST_WASMGEN=OFF)");
+#endif
+}
+
+Node::Ptr parse(const std::string &code) {
+    auto buffer = yy_scan_string(code.data());
+    yyparse();
+    auto retval = Node::pop_root();
+    yy_delete_buffer(buffer);
+    Compiler::reset_parser();
+    return retval;
+}
+
+} // namespace
+
+KIRAZ_BENCH(lex) {
+    const auto &code = program();
+    auto tokens = count_tokens(code);
+
+    while (state.keep_running()) {
+        auto buffer = yy_scan_string(code.data());
+        while (yylex() > 0) {
+        }
+        yy_delete_buffer(buffer);
+        Compiler::reset_parser();
+
+        state.add_tokens(tokens);
+        state.add_bytes(code.size());
+    }
+}
+
+KIRAZ_BENCH(lex_10m) {
+    const auto &code = large_program();
+    auto tokens = count_tokens(code);
+
+    while (state.keep_running()) {
+        state.pause();
+        auto buffer = yy_scan_string(code.data());
+        state.resume();
+
+        while (yylex() > 0) {
+        }
+
+        state.pause();
+        yy_delete_buffer(buffer);
+        Compiler::reset_parser();
+        state.resume();
+
+        state.add_tokens(tokens);
+        state.add_bytes(code.size());
+    }
+}
+
+KIRAZ_BENCH(parse) {
+    const auto &code = program();
+    auto tokens = count_tokens(code);
+    auto root = parse(code);
+    if (! root) {
+        state.skip("generated program does not parse");
+        return;
+    }
+    auto nodes = root->count_nodes();
+
+    while (state.keep_running()) {
+        root = parse(code);
+
+        state.pause();
+        root.reset();
+        state.resume();
+
+        state.add_tokens(tokens);
+        state.add_nodes(nodes);
+        state.add_bytes(code.size());
+    }
+}
+
+// Edits in the middle of a 20k line file, alternately adding and removing a
+// term of a return expression.
+KIRAZ_BENCH(incremental_edit) {
+    std::string code;
+    while (std::count(code.begin(), code.end(), '\n') < 20000) {
+        code += program();
+    }
+    auto at = code.find("return ", code.size() / 2);
+
+    IncrementalParser parser("bench.ki");
+    if (! parser.set_text(code)) {
+        state.skip("generated program does not parse");
+        return;
+    }
+
+    bool inserted = false;
+    while (state.keep_running()) {
+        TextEdit edit;
+        edit.offset = static_cast<uint32_t>(at + 7);
+        if (inserted) {
+            edit.removed = 4;
+        }
+        else {
+            edit.inserted = "1 + ";
+        }
+        inserted = ! inserted;
+
+        parser.apply(edit);
+        state.add_items(1);
+    }
+    state.set_label(FF("{} statements reused", parser.get_reused()));
+}
+
+KIRAZ_BENCH(dump) {
+    auto root = parse(program());
+    if (! root) {
+        state.skip("generated program does not parse");
+        return;
+    }
+    auto nodes = root->count_nodes();
+
+    while (state.keep_running()) {
+        auto str = root->as_string();
+        state.add_nodes(nodes);
+        state.add_bytes(str.size());
+    }
+}
+
+// A left-leaning chain of additions. Built directly rather than parsed, as
+// the depth is past what is practical to push through the parser.
+KIRAZ_BENCH(dump_deep_expr) {
+    constexpr int depth = 20000;
+    Node::Ptr root = std::make_shared<ast::Integer>(0);
+    for (int i = 1; i < depth; ++i) {
+        root = std::make_shared<ast::Add>(root, std::make_shared<ast::Integer>(i));
+    }
+    auto nodes = root->count_nodes();
+
+    while (state.keep_running()) {
+        auto str = root->as_string();
+        state.add_nodes(nodes);
+        state.add_bytes(str.size());
+    }
+}
+
+KIRAZ_BENCH(analyse) {
+    Compiler compiler;
+    auto root = parse(program());
+    if (! root) {
+        state.skip("generated program does not parse");
+        return;
+    }
+    auto nodes = root->count_nodes();
+
+    while (state.keep_running()) {
+        SymbolTable st(ScopeType::Module);
+        root->compute_stmt_type(st);
+        state.add_nodes(nodes);
+    }
+}
+
+// Resolution of every symbol of a module with 50k of them, from inside a
+// function with a few locals.
+KIRAZ_BENCH(symbol_lookup_50k) {
+    constexpr int count = 50000;
+    Compiler compiler;
+    SymbolTable st(ScopeType::Module);
+
+    std::vector<std::string> names;
+    names.reserve(count + 4);
+    for (int i = 0; i < count; ++i) {
+        names.push_back(FF("sym_{}", i));
+        st.add_symbol(names.back(), std::make_shared<ast::Integer>(i));
+    }
+
+    auto func = std::make_shared<ast::Id>("f");
+    func->set_cur_symtab(st.get_cur_symtab());
+    auto scope = st.enter_scope(ScopeType::Func, func);
+    for (int i = 0; i < 4; ++i) {
+        names.push_back(FF("local_{}", i));
+        st.add_symbol(names.back(), std::make_shared<ast::Integer>(i));
+    }
+
+    while (state.keep_running()) {
+        size_t found = 0;
+        for (const auto &name : names) {
+            found += st.get_symbol(name).second != nullptr;
+        }
+        if (found != names.size()) {
+            state.skip("lookup failed");
+            return;
+        }
+        state.add_items(names.size());
+    }
+}
+
+KIRAZ_BENCH(wat_emit) {
+    Compiler compiler;
+    auto root = parse(program());
+    if (! root) {
+        state.skip("generated program does not parse");
+        return;
+    }
+    {
+        SymbolTable st(ScopeType::Module);
+        root->compute_stmt_type(st);
+    }
+    auto nodes = root->count_nodes();
+
+    while (state.keep_running()) {
+        WasmContext ctx;
+        root->gen_wat(ctx);
+        state.add_nodes(nodes);
+        state.add_bytes(ctx.body().tellp());
+    }
+}
+
+KIRAZ_BENCH(binary_emit) {
+#ifdef KIRAZ_HAVE_WABT
+    std::string wat;
+    {
+        Compiler compiler;
+        if (compiler.compile_string(program()) != 0) {
+            state.skip("generated program does not compile");
+            return;
+        }
+        wat = compiler.get_wasm_ctx().body().str();
+    }
+
+    while (state.keep_running()) {
+        wabt::Features features;
+        wabt::Errors errors;
+        auto lexer = wabt::WastLexer::CreateBufferLexer("bench.wat", wat.data(), wat.size(), &errors);
+
+        std::unique_ptr<wabt::Module> module;
+        wabt::WastParseOptions parse_options(features);
+        if (Failed(ParseWatModule(lexer.get(), &module, &errors, &parse_options))) {
+            state.skip("generated WAT does not parse");
+            return;
+        }
+
+        wabt::MemoryStream stream;
+        wabt::WriteBinaryOptions write_options;
+        if (Failed(WriteBinaryModule(&stream, module.get(), write_options))) {
+            state.skip("binary writer failed");
+            return;
+        }
+
+        state.add_bytes(stream.output_buffer().data.size());
+    }
+#else
+    state.skip("built without wabt (KIRAZ_TEST_WASMGEN=OFF)");
+#endif
+}
+
+KIRAZ_BENCH(compile_string) {
+    const auto &code = program();
+    auto tokens = count_tokens(code);
+
+    while (state.keep_running()) {
+        Compiler compiler;
+        compiler.compile_string(code);
+        state.add_tokens(tokens);
+        state.add_bytes(code.size());
+    }
+}
+
+KIRAZ_BENCH(compile_wide_serial) {
+    compile_wide(state, 1);
+}
+
+KIRAZ_BENCH(compile_wide_parallel) {
+    compile_wide(state, hardware_jobs());
+}
+
+// A million allocations of a small object, each followed by a method call.
+// Run in the wabt interpreter: compare runs with each other, not with engines.
+KIRAZ_BENCH(alloc_1m) {
+    static const std::string code = R"(
+import io;
+class Point {
+    let x : Integer64 = 1;
+    let y : Integer64;
+    let visible = true;
+    func move(dx : Integer64) : Integer64 {
+        x = x + dx;
+        return x;
+    };
+};
+func main() : Integer64 {
+    let i : Integer64 = 0;
+    let sum : Integer64 = 0;
+    while (i < 1000000) {
+        let p : Point;
+        sum = sum + p.move(i);
+        i = i + 1;
+    };
+    return sum;
+};
+)";
+
+    run_main(state, code);
+    state.add_items(state.iterations() * 1000000);
+}
+
+// Member reads and pure calls repeated in one expression
+KIRAZ_BENCH(members_1m) {
+    static const std::string code = R"(
+class Box {
+    let w : Integer64 = 3;
+    let h : Integer64 = 5;
+    let hits : Integer64 = 0;
+};
+func scale(x : Integer64) : Integer64 {
+    return x * 3 + 1;
+};
+func main() : Integer64 {
+    let b : Box;
+    let i : Integer64 = 0;
+    let sum : Integer64 = 0;
+    while (i < 1000000) {
+        sum = sum + b.w + b.w * i + b.h * scale(b.w) + scale(b.w);
+        b.hits = b.hits + 1;
+        i = i + 1;
+    };
+    return sum + b.hits;
+};
+)";
+
+    run_main(state, code);
+    state.add_items(state.iterations() * 1000000);
+}
+
+KIRAZ_BENCH(invariants_1m) {
+    // The sizes are assigned once before the loop, which only writes visits.
+    static const std::string code = R"(
+import io;
+class Grid {
+    let width : Integer64 = 0;
+    let height : Integer64 = 0;
+    let visits : Integer64 = 0;
+};
+func main() : Integer64 {
+    let m : Memory;
+    let g : Grid;
+    g.width = 640;
+    g.height = 480;
+    let i : Integer64 = 0;
+    let sum : Integer64 = 0;
+    while (i < 1000000) {
+        sum = sum + i / g.width + g.height * (4 * 1024) + m.size() / 65536;
+        g.visits = g.visits + 1;
+        i = i + 1;
+    };
+    return sum + g.visits;
+};
+)";
+
+    run_main(state, code);
+    state.add_items(state.iterations() * 1000000);
+}
+
+KIRAZ_BENCH(counted_1m) {
+    // Unrolled at -O2, with row * width stepping by width
+    static const std::string code = R"(
+func checksum(width : Integer64, rows : Integer64) : Integer64 {
+    let row : Integer64 = 0;
+    let sum : Integer64 = 0;
+    while (row < rows) {
+        let offset : Integer64 = row * width;
+        sum = sum + offset + (offset + 8) * 3;
+        row = row + 1;
+    };
+    return sum;
+};
+func main() : Integer64 {
+    return checksum(640, 1000000);
+};
+)";
+
+    run_main(state, code);
+    state.add_items(state.iterations() * 1000000);
+}
+
+KIRAZ_BENCH(memory_copy_64m) {
+    // Reads of doubling size grow the memory to fit 64 MB first.
+    static const std::string code = R"(
+import io;
+func main() : Integer64 {
+    let m : Memory;
+    let length : Integer64 = 65536;
+    let data : String;
+    while (length < 67108864) {
+        data = m.read(0, length);
+        length = length * 2;
+    };
+    data = m.read(0, length);
+    m.write(length, data);
+    return m.size();
+};
+)";
+
+    run_main(state, code);
+    state.add_bytes(state.iterations() * 2 * 67108864);
+}
+
+KIRAZ_BENCH(fib_27) {
+    static const std::string code = R"(
+func fib(n : Integer64) : Integer64 {
+    if (n < 2) {
+        return n;
+    };
+    return fib(n - 1) + fib(n - 2);
+};
+func main() : Integer64 {
+    return fib(27);
+};
+)";
+
+    run_main(state, code);
+    state.add_items(state.iterations() * 635621); // calls
+}
+
+KIRAZ_BENCH(gcd_100k) {
+    // Consecutive Fibonacci numbers take the most steps.
+    static const std::string code = R"(
+func gcd(a : Integer64, b : Integer64) : Integer64 {
+    while (b != 0) {
+        let t = b;
+        b = a - a / b * b;
+        a = t;
+    };
+    return a;
+};
+func main() : Integer64 {
+    let i : Integer64 = 0;
+    let sum : Integer64 = 0;
+    while (i < 100000) {
+        sum = sum + gcd(1134903170 + i, 701408733);
+        i = i + 1;
+    };
+    return sum;
+};
+)";
+
+    run_main(state, code);
+    state.add_items(state.iterations() * 100000);
+}
+
+KIRAZ_BENCH(digits_1m) {
+    // Division and remainder by constants
+    static const std::string code = R"(
+func main() : Integer64 {
+    let i : Integer64 = 0;
+    let sum : Integer64 = 0;
+    while (i < 1000000) {
+        let n = i;
+        while (n != 0) {
+            sum = sum + (n - n / 10 * 10) + (n - n / 16 * 16);
+            n = n / 10;
+        };
+        i = i + 1;
+    };
+    return sum;
+};
+)";
+
+    run_main(state, code);
+    state.add_items(state.iterations() * 1000000);
+}
+
+KIRAZ_BENCH(sum_bytes) {
+    // Vectorized with --simd at -O2. The bytes are the upper half of the
+    // first page, which memory always has.
+    static const std::string code = R"(
+func fill(base : Integer64, length : Integer64) : Void {
+    let m : Memory;
+    let x : Integer64 = 1;
+    let i : Integer64 = 0;
+    while (i < length) {
+        x = x * 1103515245 + 12345;
+        m.store8(base + i, x / 65536);
+        i = i + 1;
+    };
+};
+func sum(base : Integer64, length : Integer64) : Integer64 {
+    let m : Memory;
+    let i : Integer64 = 0;
+    let sum : Integer64 = 0;
+    while (i < length) {
+        sum = sum + m.load8(base + i);
+        i = i + 1;
+    };
+    return sum;
+};
+func main() : Integer64 {
+    fill(32768, 32768);
+    let pass : Integer64 = 0;
+    let total : Integer64 = 0;
+    while (pass < 32) {
+        total = total + sum(32768, 32768);
+        pass = pass + 1;
+    };
+    return total;
+};
+)";
+
+    run_main(state, code);
+    state.add_bytes(state.iterations() * 33 * 32768);
+}
+
+KIRAZ_BENCH(byte_histogram) {
+    // Counts of the bytes, as integers below them. Each one goes to a
+    // different count: wasm SIMD has no scatter, this loop stays scalar.
+    static const std::string code = R"(
+func fill(base : Integer64, length : Integer64) : Void {
+    let m : Memory;
+    let x : Integer64 = 1;
+    let i : Integer64 = 0;
+    while (i < length) {
+        x = x * 1103515245 + 12345;
+        m.store8(base + i, x / 65536);
+        i = i + 1;
+    };
+};
+func main() : Integer64 {
+    let m : Memory;
+    fill(32768, 32768);
+    let pass : Integer64 = 0;
+    while (pass < 32) {
+        let i : Integer64 = 0;
+        while (i < 32768) {
+            let count : Integer64 = 30720 + m.load8(32768 + i) * 8;
+            m.store64(count, m.load64(count) + 1);
+            i = i + 1;
+        };
+        pass = pass + 1;
+    };
+    return m.load64(30720) + m.load64(30720 + 255 * 8);
+};
+)";
+
+    run_main(state, code);
+    state.add_bytes(state.iterations() * 33 * 32768);
+}
+
+} // namespace kiraz::bench
+
+int main(int argc, char **argv) {
+    return kiraz::bench::run_all(argc, argv);
+}
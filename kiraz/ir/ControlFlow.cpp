@@ -0,0 +1,120 @@
+#include "ControlFlow.h"
+
+#include <algorithm>
+
+namespace ir {
+
+ControlFlow::ControlFlow(const Function &fn)
+        : m_order(fn.block_count(), NONE), m_idom(fn.block_count(), NONE),
+          m_loop(fn.block_count(), NONE), m_loop_parent(fn.block_count(), NONE) {
+    // Post order by an iterative depth first search, successors in order
+    std::vector<std::pair<BlockId, size_t>> stack = {{Function::ENTRY, 0}};
+    std::vector<bool> visited(fn.block_count());
+    visited[Function::ENTRY] = true;
+    while (! stack.empty()) {
+        auto &[b, next] = stack.back();
+        const auto &succs = fn.block(b).succs;
+        if (next < succs.size()) {
+            auto s = succs[next++];
+            if (s != NONE && ! visited[s]) {
+                visited[s] = true;
+                stack.push_back({s, 0});
+            }
+            continue;
+        }
+        m_rpo.push_back(b);
+        stack.pop_back();
+    }
+    std::reverse(m_rpo.begin(), m_rpo.end());
+    for (uint32_t i = 0; i < m_rpo.size(); ++i) {
+        m_order[m_rpo[i]] = i;
+    }
+
+    // Cooper, Harvey and Kennedy: "A Simple, Fast Dominance Algorithm"
+    auto intersect = [&](BlockId a, BlockId b) {
+        while (a != b) {
+            while (m_order[a] > m_order[b]) {
+                a = m_idom[a];
+            }
+            while (m_order[b] > m_order[a]) {
+                b = m_idom[b];
+            }
+        }
+        return a;
+    };
+    m_idom[Function::ENTRY] = Function::ENTRY;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto b : m_rpo) {
+            if (b == Function::ENTRY) {
+                continue;
+            }
+            auto idom = NONE;
+            for (auto pred : fn.block(b).preds) {
+                if (m_idom[pred] != NONE) {
+                    idom = idom == NONE ? pred : intersect(pred, idom);
+                }
+            }
+            if (m_idom[b] != idom) {
+                m_idom[b] = idom;
+                changed = true;
+            }
+        }
+    }
+
+    // Inner loops have later headers, and are found first.
+    std::vector<BlockId> work;
+    for (auto h = m_rpo.rbegin(); h != m_rpo.rend(); ++h) {
+        for (auto pred : fn.block(*h).preds) {
+            if (is_reachable(pred) && is_back_edge(pred, *h)) {
+                work.push_back(pred);
+            }
+        }
+        if (work.empty()) {
+            continue;
+        }
+        m_loop[*h] = *h;
+        while (! work.empty()) {
+            auto b = work.back();
+            work.pop_back();
+            if (m_loop[b] == NONE) {
+                m_loop[b] = *h;
+            }
+            else {
+                // Part of an inner loop: carry on from its outermost header.
+                auto inner = m_loop[b];
+                while (m_loop_parent[inner] != NONE) {
+                    inner = m_loop_parent[inner];
+                }
+                if (inner == *h) {
+                    continue;
+                }
+                m_loop_parent[inner] = *h;
+                b = inner;
+            }
+            for (auto pred : fn.block(b).preds) {
+                if (is_reachable(pred) && pred != *h && ! in_loop(pred, *h)) {
+                    work.push_back(pred);
+                }
+            }
+        }
+    }
+}
+
+bool ControlFlow::dominates(BlockId a, BlockId b) const {
+    while (m_order[b] > m_order[a]) {
+        b = m_idom[b];
+    }
+    return a == b;
+}
+
+bool ControlFlow::in_loop(BlockId b, BlockId header) const {
+    for (auto loop = m_loop[b]; loop != NONE; loop = m_loop_parent[loop]) {
+        if (loop == header) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace ir
@@ -0,0 +1,50 @@
+#ifndef KIRAZ_IR_CONTROLFLOW_H
+#define KIRAZ_IR_CONTROLFLOW_H
+
+#include <vector>
+
+#include <kiraz/ir/IR.h>
+
+namespace ir {
+
+/**
+ * @brief ControlFlow: Order, dominators and loops of the reachable blocks of
+ * a function, as of construction.
+ *
+ * The graphs lowered from kiraz are reducible: every loop is entered through
+ * its header only. A loop is the natural loop of the back edges into its
+ * header, and loops either nest or are disjoint.
+ */
+class ControlFlow {
+public:
+    explicit ControlFlow(const Function &fn);
+
+    // Reverse post order, the entry first
+    const auto &get_order() const { return m_rpo; }
+    uint32_t order_of(BlockId b) const { return m_order[b]; }
+    bool is_reachable(BlockId b) const { return m_order[b] != NONE; }
+
+    BlockId get_idom(BlockId b) const { return m_idom[b]; }
+    bool dominates(BlockId a, BlockId b) const;
+
+    // An edge to a block no later in reverse post order
+    bool is_back_edge(BlockId from, BlockId to) const { return m_order[to] <= m_order[from]; }
+
+    bool is_loop_header(BlockId b) const { return m_loop[b] == b; }
+    // Innermost loop containing b, NONE outside of loops. Headers are in their
+    // own loops.
+    BlockId get_loop(BlockId b) const { return m_loop[b]; }
+    BlockId get_parent_loop(BlockId header) const { return m_loop_parent[header]; }
+    bool in_loop(BlockId b, BlockId header) const;
+
+private:
+    std::vector<BlockId> m_rpo;
+    std::vector<uint32_t> m_order;
+    std::vector<BlockId> m_idom;
+    std::vector<BlockId> m_loop;
+    std::vector<BlockId> m_loop_parent; // of headers, NONE for outermost loops
+};
+
+} // namespace ir
+
+#endif
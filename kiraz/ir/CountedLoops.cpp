@@ -0,0 +1,642 @@
+#include "CountedLoops.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <kiraz/Stats.h>
+#include <kiraz/ir/Vectorize.h>
+
+namespace ir {
+
+namespace {
+
+// Instructions a loop may run at compile time, and have once unrolled
+constexpr size_t MAX_EVALUATED = 1 << 18;
+constexpr size_t MAX_UNROLLED = 256;
+
+using Values = std::vector<std::pair<ValueId, int64_t>>;
+
+size_t index_of(const std::vector<BlockId> &preds, BlockId b) {
+    return std::find(preds.begin(), preds.end(), b) - preds.begin();
+}
+
+int64_t wrap(Type type, uint64_t value) {
+    return type == Type::I32 ? int32_t(uint32_t(value)) : int64_t(value);
+}
+
+Op swapped(Op compare) {
+    switch (compare) {
+    case Op::LtS:
+        return Op::GtS;
+    case Op::GtS:
+        return Op::LtS;
+    case Op::LeS:
+        return Op::GeS;
+    case Op::GeS:
+        return Op::LeS;
+    default:
+        break;
+    }
+    return compare;
+}
+
+// Step of phi if next is phi plus or minus a constant
+std::optional<int64_t> step_of(const Function &fn, ValueId phi, ValueId next) {
+    auto operands = fn.operands(next);
+    if (operands.size() != 2) {
+        return std::nullopt;
+    }
+    auto a = operands[0];
+    auto b = operands[1];
+    int64_t retval = 0;
+    if (fn[next].op == Op::Add && a == phi && fn[b].op == Op::Const) {
+        retval = fn[b].imm;
+    }
+    else if (fn[next].op == Op::Add && b == phi && fn[a].op == Op::Const) {
+        retval = fn[a].imm;
+    }
+    else if (fn[next].op == Op::Sub && a == phi && fn[b].op == Op::Const
+            && fn[b].imm != std::numeric_limits<int64_t>::min()) {
+        retval = -fn[b].imm;
+    }
+    if (retval == 0) {
+        return std::nullopt;
+    }
+    return retval;
+}
+
+// Final values of the phis of a loop that only counts, nothing unless they
+// all step from constants and the counter stops at a constant bound
+std::optional<Values> count_loop(const Function &fn, const Loop &loop) {
+    if (! loop.is_counted()) {
+        return std::nullopt;
+    }
+    for (auto b : loop.blocks) {
+        for (auto v : fn.block(b).insts) {
+            auto op = fn[v].op;
+            if (has_side_effects(op) && ! is_terminator(op)) {
+                return std::nullopt;
+            }
+        }
+    }
+
+    // Other values of the header are not known.
+    std::unordered_set<ValueId> ivs;
+    for (const auto &iv : loop.ivs) {
+        if (fn[iv.init].op != Op::Const) {
+            return std::nullopt;
+        }
+        ivs.insert(iv.phi);
+    }
+    for (BlockId b = 0; b < fn.block_count(); ++b) {
+        if (loop.contains(b)) {
+            continue;
+        }
+        for (auto v : fn.block(b).insts) {
+            for (auto operand : fn.operands(v)) {
+                if (fn[operand].block == loop.header && ! ivs.contains(operand)) {
+                    return std::nullopt;
+                }
+            }
+        }
+    }
+    for (auto v : fn.block(loop.header).insts) {
+        if (fn[v].op == Op::Phi && ! ivs.contains(v)) {
+            return std::nullopt;
+        }
+    }
+
+    const auto &counter = loop.ivs[loop.counter];
+    if (fn[counter.phi].type != Type::I64 || fn[loop.bound].op != Op::Const) {
+        return std::nullopt;
+    }
+    __int128 a = fn[counter.init].imm;
+    __int128 b = fn[loop.bound].imm;
+    __int128 step = counter.step;
+    __int128 trips = 0;
+    switch (loop.compare) {
+    case Op::LtS:
+        trips = a >= b ? 0 : (b - a + step - 1) / step;
+        break;
+    case Op::LeS:
+        trips = a > b ? 0 : (b - a) / step + 1;
+        break;
+    case Op::GtS:
+        trips = a <= b ? 0 : (a - b - step - 1) / -step;
+        break;
+    case Op::GeS:
+        trips = a < b ? 0 : (a - b) / -step + 1;
+        break;
+    default:
+        return std::nullopt;
+    }
+    // Past the end of i64 the counter wraps around and goes on.
+    auto last = a + trips * step;
+    if (last < std::numeric_limits<int64_t>::min() || last > std::numeric_limits<int64_t>::max()) {
+        return std::nullopt;
+    }
+
+    Values retval;
+    for (const auto &iv : loop.ivs) {
+        auto value = uint64_t(fn[iv.init].imm) + uint64_t(trips) * uint64_t(iv.step);
+        retval.emplace_back(iv.phi, wrap(fn[iv.phi].type, value));
+    }
+    return retval;
+}
+
+// Values of the header when the loop is left, from running it at compile
+// time. Nothing if it does anything but arithmetic on constants, or runs
+// for too long.
+std::optional<Values> run_loop(const Function &fn, const Loop &loop) {
+    std::vector<int64_t> values(fn.value_count());
+    std::vector<bool> known(fn.value_count());
+    auto value = [&](ValueId v) -> std::optional<int64_t> {
+        if (known[v]) {
+            return values[v];
+        }
+        if (fn[v].op == Op::Const) {
+            return fn[v].imm;
+        }
+        return std::nullopt;
+    };
+
+    size_t steps = 0;
+    auto prev = loop.preheader;
+    for (auto b = loop.header; loop.contains(b);) {
+        const auto &block = fn.block(b);
+
+        // Phis all take the values they had at the end of prev.
+        auto pred = index_of(block.preds, prev);
+        Values phis;
+        for (auto v : block.insts) {
+            if (fn[v].op != Op::Phi) {
+                break;
+            }
+            auto x = value(fn.operands(v)[pred]);
+            if (! x) {
+                return std::nullopt;
+            }
+            phis.emplace_back(v, *x);
+        }
+        for (auto [v, x] : phis) {
+            values[v] = x;
+            known[v] = true;
+        }
+
+        auto next = NONE;
+        for (auto v : block.insts) {
+            const auto &inst = fn[v];
+            if (inst.op == Op::Phi) {
+                continue;
+            }
+            if (++steps > MAX_EVALUATED) {
+                return std::nullopt;
+            }
+
+            auto operands = fn.operands(v);
+            std::array<int64_t, 2> x{};
+            if (operands.size() > x.size()) {
+                return std::nullopt;
+            }
+            for (size_t i = 0; i < operands.size(); ++i) {
+                auto operand = value(operands[i]);
+                if (! operand) {
+                    return std::nullopt;
+                }
+                x[i] = *operand;
+            }
+
+            switch (inst.op) {
+            case Op::Const:
+                values[v] = inst.imm;
+                break;
+            case Op::Br:
+                next = block.succs[0];
+                break;
+            case Op::CondBr:
+                next = block.succs[x[0] ? 0 : 1];
+                break;
+            case Op::TrapIf:
+                if (x[0]) {
+                    return std::nullopt;
+                }
+                break;
+            default: {
+                if (operands.empty()) {
+                    return std::nullopt;
+                }
+                auto result = fold(inst.op, fn[operands[0]].type,
+                        std::span(x.data(), operands.size()));
+                if (! result) {
+                    return std::nullopt;
+                }
+                values[v] = *result;
+                break;
+            }
+            }
+            known[v] = true;
+        }
+        prev = b;
+        b = next;
+    }
+
+    Values retval;
+    for (auto v : fn.block(loop.header).insts) {
+        if (! is_terminator(fn[v].op)) {
+            retval.emplace_back(v, values[v]);
+        }
+    }
+    return retval;
+}
+
+// Replaces a loop whose results are known at compile time with them
+bool remove_loop(Function &fn, const Loop &loop) {
+    if (fn.block(loop.exit).preds.size() != 1) {
+        return false;
+    }
+    auto values = count_loop(fn, loop);
+    if (! values) {
+        values = run_loop(fn, loop);
+    }
+    if (! values) {
+        return false;
+    }
+
+    std::vector<ValueId> repl(fn.value_count(), NONE);
+    for (auto [v, x] : *values) {
+        if (fn[v].type != Type::Void) {
+            repl[v] = fn.add_const(loop.preheader, fn[v].type, x);
+        }
+    }
+    fn.redirect(loop.preheader, loop.header, loop.exit);
+    fn.replace_values(repl);
+    fn.remove_unreachable_blocks();
+    return true;
+}
+
+// Turns i * x, x loop invariant, into a phi starting at init * x and
+// stepping by step * x
+size_t reduce_multiplies(Function &fn, const Loop &loop) {
+    const auto &preds = fn.block(loop.header).preds;
+    auto entry = index_of(preds, loop.preheader);
+    auto back = index_of(preds, loop.latch);
+
+    std::vector<ValueId> repl(fn.value_count(), NONE);
+    std::vector<std::array<ValueId, 3>> products; // iv, factor, phi
+    size_t retval = 0;
+    for (auto b : loop.blocks) {
+        auto insts = fn.block(b).insts;
+        for (auto v : insts) {
+            if (fn[v].op != Op::Mul) {
+                continue;
+            }
+            auto x = fn.operands(v)[0];
+            auto y = fn.operands(v)[1];
+            for (const auto &iv : loop.ivs) {
+                if (x != iv.phi && y != iv.phi) {
+                    continue;
+                }
+                auto factor = x == iv.phi ? y : x;
+                if (loop.contains(fn[factor].block)) {
+                    continue;
+                }
+
+                auto found = std::find_if(products.begin(), products.end(),
+                        [&](const auto &product) {
+                            return product[0] == iv.phi && product[1] == factor;
+                        });
+                if (found == products.end()) {
+                    auto type = fn[v].type;
+                    auto start = fn.add(loop.preheader, Op::Mul, type, {iv.init, factor});
+                    auto step = fn.add(loop.preheader, Op::Mul, type,
+                            {fn.add_const(loop.preheader, type, iv.step), factor});
+                    auto phi = fn.add_phi(loop.header, type);
+                    std::vector<ValueId> operands(2);
+                    operands[entry] = start;
+                    operands[back] = fn.add(loop.latch, Op::Add, type, {phi, step});
+                    fn.set_operands(phi, operands);
+                    products.push_back({iv.phi, factor, phi});
+                    found = std::prev(products.end());
+                }
+                repl[v] = (*found)[2];
+                ++retval;
+                break;
+            }
+        }
+    }
+    fn.replace_values(repl);
+    return retval;
+}
+
+// Puts a copy of loop running unroll iterations at a time in front of it
+bool unroll_loop(Function &fn, const ControlFlow &cfg, const Loop &loop, unsigned unroll) {
+    if (unroll < 2 || ! loop.is_counted()
+            || fn[fn.block(loop.latch).insts.back()].op != Op::Br) {
+        return false;
+    }
+    size_t size = 0;
+    for (auto b : loop.blocks) {
+        if (b != loop.header && cfg.is_loop_header(b)) {
+            return false;
+        }
+        for (auto v : fn.block(b).insts) {
+            auto op = fn[v].op;
+            if (b == loop.header && has_side_effects(op) && ! is_terminator(op)) {
+                return false;
+            }
+            ++size;
+        }
+    }
+    // Loops a profile saw run fewer than unroll iterations at a time, if at all
+    if (auto counts = fn.get_counts(fn.block(loop.header).insts.back())) {
+        auto stays = fn.block(loop.header).succs[0] == loop.exit ? counts->not_taken
+                                                                  : counts->taken;
+        auto exits = counts->taken + counts->not_taken - stays;
+        if (stays == 0 || stays < exits * unroll) {
+            return false;
+        }
+    }
+
+    const auto &counter = loop.ivs[loop.counter];
+    auto span = __int128(unroll - 1) * (counter.step < 0 ? -__int128(counter.step) : counter.step);
+    if (size * unroll > MAX_UNROLLED || span > std::numeric_limits<int64_t>::max()) {
+        return false;
+    }
+
+    auto header = loop.header;
+    std::unordered_map<ValueId, std::pair<ValueId, ValueId>> phis; // from preheader and latch
+    std::vector<ValueId> order;
+    {
+        const auto &preds = fn.block(header).preds;
+        auto entry = index_of(preds, loop.preheader);
+        auto back = index_of(preds, loop.latch);
+        for (auto v : fn.block(header).insts) {
+            if (fn[v].op != Op::Phi) {
+                break;
+            }
+            phis[v] = {fn.operands(v)[entry], fn.operands(v)[back]};
+            order.push_back(v);
+        }
+    }
+
+    // The new header, with a phi for each of the header
+    auto unrolled_header = fn.add_block();
+    std::unordered_map<ValueId, ValueId> unrolled;
+    for (auto phi : order) {
+        unrolled[phi] = fn.add_phi(unrolled_header, fn[phi].type);
+    }
+
+    // Copies of the blocks and values of the loop, phis of the header are
+    // the values of the copy before.
+    std::vector<std::unordered_map<BlockId, BlockId>> blocks(unroll);
+    std::vector<std::unordered_map<ValueId, ValueId>> values(unroll);
+    std::unordered_map<BlockId, BlockId> original;
+    auto map = [&](size_t k, ValueId v) {
+        for (auto phi = phis.find(v); phi != phis.end(); phi = phis.find(v)) {
+            if (k == 0) {
+                return unrolled.at(v);
+            }
+            v = phi->second.second;
+            --k;
+        }
+        auto copy = values[k].find(v);
+        return copy == values[k].end() ? v : copy->second;
+    };
+
+    for (size_t k = 0; k < unroll; ++k) {
+        for (auto b : loop.blocks) {
+            blocks[k][b] = fn.add_block();
+            original[blocks[k][b]] = b;
+        }
+        for (auto b : loop.blocks) {
+            auto copy = blocks[k][b];
+            for (auto v : fn.block(b).insts) {
+                auto inst = fn[v];
+                if (inst.op == Op::Phi) {
+                    if (b != header) {
+                        values[k][v] = fn.add_phi(copy, inst.type);
+                    }
+                    continue;
+                }
+                if (is_terminator(inst.op)) {
+                    continue;
+                }
+                auto operands = fn.operands(v);
+                values[k][v] = fn.add(copy, inst.op, inst.type,
+                        std::vector<ValueId>(operands.begin(), operands.end()), inst.imm);
+                if (inst.invariant) {
+                    fn.set_invariant(values[k][v]);
+                }
+                if (inst.raw) {
+                    fn.set_raw(values[k][v]);
+                }
+            }
+        }
+    }
+
+    // Copies of the header go on to the body, the latches to the next copy.
+    for (size_t k = 0; k < unroll; ++k) {
+        for (auto b : loop.blocks) {
+            auto copy = blocks[k][b];
+            auto succs = fn.block(b).succs;
+            if (b == loop.latch) {
+                fn.br(copy, k + 1 < unroll ? blocks[k + 1][header] : unrolled_header);
+            }
+            else if (b == header) {
+                fn.br(copy, blocks[k][succs[0] == loop.exit ? succs[1] : succs[0]]);
+            }
+            else if (succs[1] == NONE) {
+                fn.br(copy, blocks[k][succs[0]]);
+            }
+            else {
+                auto branch = fn.block(b).insts.back();
+                fn.cond_br(copy, map(k, fn.operands(branch)[0]), blocks[k][succs[0]],
+                        blocks[k][succs[1]]);
+                if (auto counts = fn.get_counts(branch)) {
+                    fn.set_counts(fn.block(copy).insts.back(), BranchCounts(*counts));
+                }
+            }
+        }
+    }
+
+    std::vector<ValueId> operands;
+    for (size_t k = 0; k < unroll; ++k) {
+        for (auto [v, copy] : values[k]) {
+            operands.clear();
+            if (fn[v].op == Op::Phi) {
+                const auto &preds = fn.block(fn[v].block).preds;
+                for (auto pred : fn.block(fn[copy].block).preds) {
+                    operands.push_back(map(k, fn.operands(v)[index_of(preds, original[pred])]));
+                }
+            }
+            else {
+                for (auto operand : fn.operands(v)) {
+                    operands.push_back(map(k, operand));
+                }
+            }
+            fn.set_operands(copy, operands);
+        }
+    }
+
+    // The unrolled loop goes on while the counter is unroll - 1 steps away
+    // from the bound or more. Being in the loop at all, that distance is
+    // positive, so it is compared unsigned.
+    fn.redirect(loop.preheader, header, unrolled_header);
+    auto i = unrolled.at(counter.phi);
+    auto type = fn[counter.phi].type;
+    auto distance = counter.step > 0 ? fn.add(unrolled_header, Op::Sub, type, {loop.bound, i})
+                                     : fn.add(unrolled_header, Op::Sub, type, {i, loop.bound});
+    auto least = int64_t(span) - (loop.compare == Op::LeS || loop.compare == Op::GeS);
+    auto cond = fn.add(unrolled_header, Op::And, Type::I32,
+            {fn.add(unrolled_header, loop.compare, Type::I32, {i, loop.bound}),
+                    fn.add(unrolled_header, Op::GtU, Type::I32,
+                            {distance, fn.add_const(unrolled_header, type, least)})});
+    fn.cond_br(unrolled_header, cond, blocks[0][header], header);
+
+    for (auto phi : order) {
+        operands.clear();
+        for (auto pred : fn.block(unrolled_header).preds) {
+            operands.push_back(pred == loop.preheader ? phis[phi].first
+                                                      : map(unroll - 1, phis[phi].second));
+        }
+        fn.set_operands(unrolled.at(phi), operands);
+
+        operands.clear();
+        for (auto pred : fn.block(header).preds) {
+            operands.push_back(pred == loop.latch ? phis[phi].second : unrolled.at(phi));
+        }
+        fn.set_operands(phi, operands);
+    }
+    return true;
+}
+
+} // namespace
+
+bool Loop::contains(BlockId b) const {
+    return std::find(blocks.begin(), blocks.end(), b) != blocks.end();
+}
+
+std::optional<Loop> find_loop(const Function &fn, const ControlFlow &cfg, BlockId header) {
+    if (! cfg.is_reachable(header) || ! cfg.is_loop_header(header)) {
+        return std::nullopt;
+    }
+    Loop loop;
+    loop.header = header;
+    for (auto b : cfg.get_order()) {
+        if (cfg.in_loop(b, header)) {
+            loop.blocks.push_back(b);
+        }
+    }
+
+    const auto &preds = fn.block(header).preds;
+    for (auto pred : preds) {
+        auto &slot = loop.contains(pred) ? loop.latch : loop.preheader;
+        if (slot != NONE) {
+            return std::nullopt;
+        }
+        slot = pred;
+    }
+    if (loop.preheader == NONE || loop.latch == NONE || loop.latch == header
+            || fn.block(loop.preheader).succs[1] != NONE) {
+        return std::nullopt;
+    }
+    for (auto b : loop.blocks) {
+        for (auto s : fn.block(b).succs) {
+            if (s == NONE || loop.contains(s)) {
+                continue;
+            }
+            if (b != header || loop.exit != NONE) {
+                return std::nullopt;
+            }
+            loop.exit = s;
+        }
+    }
+    if (loop.exit == NONE) {
+        return std::nullopt;
+    }
+
+    auto entry = index_of(preds, loop.preheader);
+    auto back = index_of(preds, loop.latch);
+    for (auto v : fn.block(header).insts) {
+        if (fn[v].op != Op::Phi) {
+            break;
+        }
+        auto next = fn.operands(v)[back];
+        if (auto step = step_of(fn, v, next)) {
+            loop.ivs.push_back({v, fn.operands(v)[entry], next, *step});
+        }
+    }
+
+    // The counter, if the loop goes on while it compares to the bound
+    auto cond = fn.operands(fn.block(header).insts.back())[0];
+    if (fn.block(header).succs[0] == loop.exit || fn.operands(cond).size() != 2) {
+        return loop;
+    }
+    for (size_t i = 0; i < loop.ivs.size(); ++i) {
+        auto phi = loop.ivs[i].phi;
+        auto a = fn.operands(cond)[0];
+        auto b = fn.operands(cond)[1];
+        if (fn[phi].type != Type::I64 || (a != phi && b != phi)) {
+            continue;
+        }
+        auto compare = a == phi ? fn[cond].op : swapped(fn[cond].op);
+        auto bound = a == phi ? b : a;
+        bool up = loop.ivs[i].step > 0;
+        if (loop.contains(fn[bound].block)
+                || ! (up ? compare == Op::LtS || compare == Op::LeS
+                         : compare == Op::GtS || compare == Op::GeS)) {
+            continue;
+        }
+        loop.counter = i;
+        loop.compare = compare;
+        loop.bound = bound;
+        break;
+    }
+    return loop;
+}
+
+void optimize_loops(Function &fn, unsigned unroll, bool simd) {
+    fn.remove_unreachable_blocks();
+    fn.remove_trivial_phis();
+    fn.remove_dead_code();
+
+    std::vector<BlockId> headers;
+    {
+        ControlFlow cfg(fn);
+        const auto &order = cfg.get_order();
+        for (auto h = order.rbegin(); h != order.rend(); ++h) {
+            if (cfg.is_loop_header(*h)) {
+                headers.push_back(*h);
+            }
+        }
+    }
+
+    // Every loop changes the graph: the next one is found again.
+    for (auto header : headers) {
+        ControlFlow cfg(fn);
+        auto loop = find_loop(fn, cfg, header);
+        if (! loop) {
+            continue;
+        }
+        if (remove_loop(fn, *loop)) {
+            KIRAZ_STATS_INC(RemovedLoops);
+            continue;
+        }
+        if (auto reduced = reduce_multiplies(fn, *loop)) {
+            KIRAZ_STATS_ADD(ReducedMultiplies, reduced);
+            loop = find_loop(fn, cfg, header);
+        }
+        if (simd && loop && vectorize_loop(fn, *loop)) {
+            KIRAZ_STATS_INC(VectorizedLoops);
+            continue;
+        }
+        if (loop && unroll_loop(fn, cfg, *loop, unroll)) {
+            KIRAZ_STATS_INC(UnrolledLoops);
+        }
+    }
+}
+
+} // namespace ir
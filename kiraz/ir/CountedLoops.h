@@ -0,0 +1,69 @@
+#ifndef KIRAZ_IR_COUNTEDLOOPS_H
+#define KIRAZ_IR_COUNTEDLOOPS_H
+
+#include <optional>
+#include <vector>
+
+#include <kiraz/ir/ControlFlow.h>
+#include <kiraz/ir/IR.h>
+
+namespace ir {
+
+// A phi of a loop header that goes up or down by the same constant on every
+// iteration
+struct InductionVariable {
+    ValueId phi = NONE;
+    ValueId init = NONE; // from the preheader
+    ValueId next = NONE; // phi + step, from the latch
+    int64_t step = 0;
+};
+
+/**
+ * @brief Loop: A loop as lowered from a while statement. It is entered from
+ * the preheader and left from the header only, and the latch is the one
+ * block that goes back to the header.
+ *
+ * Counted loops go on while compare(counter, bound) holds, the counter
+ * stepping towards a bound that does not change in the loop:
+ *
+ *     while (i < n) { ...; i = i + 1; };
+ */
+struct Loop {
+    BlockId preheader = NONE;
+    BlockId header = NONE;
+    BlockId latch = NONE;
+    BlockId exit = NONE;
+    std::vector<BlockId> blocks; // in reverse post order, the header first
+    std::vector<InductionVariable> ivs;
+
+    size_t counter = NONE; // in ivs, NONE unless counted
+    Op compare = Op::Unreachable; // LtS, LeS with a step up, GtS, GeS down
+    ValueId bound = NONE;
+
+    bool is_counted() const { return counter != NONE; }
+    bool contains(BlockId b) const;
+};
+
+// The loop of header if it has the shape above, nothing otherwise
+std::optional<Loop> find_loop(const Function &fn, const ControlFlow &cfg, BlockId header);
+
+/**
+ * @brief optimize_loops: The -O2 transformations of loops, innermost first:
+ *
+ * - Loops without side effects are run at compile time when their phis start
+ *   from constants, and replaced with the values they leave. Ones that only
+ *   count are computed in closed form whatever the trip count.
+ * - Products of induction variables with loop invariants become induction
+ *   variables of their own, stepping by an addition.
+ * - Innermost counted loops are unrolled: a loop doing unroll iterations at a
+ *   time, for as long as that many are left, is put in front of the original
+ *   one, which runs the rest. Loops with branch counts from a profile are
+ *   only unrolled if they ran unroll iterations per entry on average.
+ * - With simd, loops that vectorize_loop of Vectorize.h takes are vectorized
+ *   instead.
+ */
+void optimize_loops(Function &fn, unsigned unroll, bool simd = false);
+
+} // namespace ir
+
+#endif
@@ -0,0 +1,874 @@
+#include "Emit.h"
+
+#include <algorithm>
+#include <bit>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/ir/ControlFlow.h>
+
+namespace ir {
+
+namespace {
+
+// Values that generate no code where they are defined
+bool is_virtual(Op op) {
+    switch (op) {
+    case Op::Param:
+    case Op::Phi:
+    case Op::Result:
+    case Op::Const:
+    case Op::Address:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+class Emitter {
+public:
+    Emitter(kiraz::WasmContext &ctx, const Function &fn)
+            : m_ctx(ctx), m_fn(fn), m_cfg(fn), m_uses(fn.count_uses()),
+              m_inlined(fn.value_count()), m_teed(fn.value_count()),
+              m_stacked(fn.value_count()), m_locals(fn.value_count()) {}
+
+    void run();
+
+private:
+    // A (block), (loop) or (if) being generated, innermost last
+    struct Frame {
+        enum Kind { Block, Loop, If } kind;
+        BlockId target; // what follows a block, the header of a loop
+        bool used = false;
+    };
+
+    struct Piece {
+        enum Kind { Code, Open, Else, End, Br, BrIf, Eqz, Drop, Return, Unreachable } kind;
+        uint32_t arg = 0; // the block of Code, the frame otherwise
+    };
+
+    using Context = std::vector<uint32_t>;
+
+    // Values of the block going to the phis of its successor, skipping the
+    // ones that already hold them
+    std::vector<std::pair<ValueId, ValueId>> copies(BlockId b) const;
+    std::vector<ValueId> operands(ValueId v) const;
+
+    bool can_inline(ValueId v, BlockId b) const;
+    bool is_sinkable(ValueId v) const;
+    void treeify(BlockId b);
+    void visit(ValueId v, BlockId b, size_t &cursor, bool sinking);
+    ValueId first_read(ValueId root) const;
+    void chain(BlockId b);
+
+    void reads(ValueId v, std::vector<uint32_t> &out, const std::vector<uint32_t> &index) const;
+    void writes(ValueId root, std::vector<ValueId> &out) const;
+    void assign_locals();
+
+    bool is_placed(BlockId b) const { return m_placed[b]; }
+    void do_tree(BlockId x, Context &ctx);
+    void nest(BlockId x, const std::vector<BlockId> &ys, size_t i, Context &ctx,
+            const std::vector<BlockId> *loop_body);
+    void code(BlockId x, Context &ctx);
+    void cond_branch(BlockId x, Context &ctx);
+    void branch(BlockId from, BlockId to, Context &ctx);
+
+    enum class Branch { Fall, Label, Inline };
+    Branch classify(BlockId from, BlockId to, const Context &ctx, uint32_t &frame) const;
+    BlockId fall_target(const Context &ctx) const;
+
+    uint32_t open(Frame::Kind kind, BlockId target, Context &ctx);
+    void close(Context &ctx);
+    void add(Piece::Kind kind, uint32_t arg = 0) { m_pieces.push_back({kind, arg}); }
+
+    void print();
+    void print_root(ValueId v);
+    void print_value(ValueId v);
+    void print_tree(ValueId v);
+    const std::string &local(ValueId v);
+
+    kiraz::WasmContext &m_ctx;
+    const Function &m_fn;
+    ControlFlow m_cfg;
+    std::vector<uint32_t> m_uses;
+    std::vector<bool> m_inlined;
+    std::vector<bool> m_teed; // roots kept in their local and on the stack for the next one
+    std::vector<bool> m_stacked; // roots only used by the next one, without a local
+    ValueId m_pending = NONE; // the value the next local.get finds on the stack instead
+    std::vector<std::string> m_locals;
+    std::vector<std::vector<ValueId>> m_roots;
+    std::vector<bool> m_placed;
+    std::vector<std::vector<BlockId>> m_children;
+    std::vector<Frame> m_frames;
+    std::vector<Piece> m_pieces;
+};
+
+std::vector<std::pair<ValueId, ValueId>> Emitter::copies(BlockId b) const {
+    std::vector<std::pair<ValueId, ValueId>> retval;
+    auto s = m_fn.block(b).succs[0];
+    if (s == NONE || m_fn.block(b).succs[1] != NONE) {
+        return retval;
+    }
+    const auto &preds = m_fn.block(s).preds;
+    auto index = std::find(preds.begin(), preds.end(), b) - preds.begin();
+    for (auto phi : m_fn.block(s).insts) {
+        if (m_fn[phi].op != Op::Phi) {
+            break;
+        }
+        auto value = m_fn.operands(phi)[index];
+        if (value != phi) {
+            retval.emplace_back(phi, value);
+        }
+    }
+    return retval;
+}
+
+std::vector<ValueId> Emitter::operands(ValueId v) const {
+    if (m_fn[v].op == Op::Br) {
+        std::vector<ValueId> retval;
+        for (auto [phi, value] : copies(m_fn[v].block)) {
+            retval.push_back(value);
+        }
+        return retval;
+    }
+    auto ops = m_fn.operands(v);
+    return {ops.begin(), ops.end()};
+}
+
+bool Emitter::can_inline(ValueId v, BlockId b) const {
+    const auto &inst = m_fn[v];
+    return m_uses[v] == 1 && inst.block == b && ! is_virtual(inst.op) && inst.type != Type::Void
+            && ! (inst.op == Op::Call && m_fn.callee(v).results.size() > 1);
+}
+
+// Code that can move past anything else in its block
+bool Emitter::is_sinkable(ValueId v) const {
+    auto op = m_fn[v].op;
+    return ! has_side_effects(op) && ! reads_memory(op);
+}
+
+void Emitter::treeify(BlockId b) {
+    const auto &insts = m_fn.block(b).insts;
+    auto &roots = m_roots[b];
+    for (size_t i = insts.size(); i-- > 0;) {
+        auto v = insts[i];
+        if (m_inlined[v] || is_virtual(m_fn[v].op)) {
+            continue;
+        }
+        roots.push_back(v);
+        size_t cursor = i;
+        visit(v, b, cursor, false);
+    }
+    std::reverse(roots.begin(), roots.end());
+}
+
+// Operands are generated in order, so going backwards, the last one can be the
+// code right before v. Each operand taken that way moves the cursor to the code
+// before it. Operands further up stay in locals unless they can be moved.
+void Emitter::visit(ValueId v, BlockId b, size_t &cursor, bool sinking) {
+    const auto &insts = m_fn.block(b).insts;
+    auto ops = operands(v);
+    for (size_t k = ops.size(); k-- > 0;) {
+        auto o = ops[k];
+        if (! can_inline(o, b)) {
+            continue;
+        }
+        if (! sinking) {
+            auto prev = cursor;
+            auto skipped = [&](ValueId u) { return m_inlined[u] || is_virtual(m_fn[u].op); };
+            while (prev > 0 && skipped(insts[prev - 1])) {
+                --prev;
+            }
+            if (prev > 0 && insts[prev - 1] == o) {
+                m_inlined[o] = true;
+                cursor = prev - 1;
+                visit(o, b, cursor, false);
+                continue;
+            }
+        }
+        if (is_sinkable(o)) {
+            m_inlined[o] = true;
+            size_t unused = 0;
+            visit(o, b, unused, true);
+        }
+    }
+}
+
+// The value the code of root starts with, if it is read from a local
+ValueId Emitter::first_read(ValueId root) const {
+    auto ops = operands(root);
+    if (ops.empty()) {
+        return NONE;
+    }
+    auto v = ops[0];
+    while (m_inlined[v]) {
+        auto inner = m_fn.operands(v);
+        if (inner.empty()) {
+            return NONE;
+        }
+        v = inner[0];
+    }
+    auto op = m_fn[v].op;
+    return op == Op::Const || op == Op::Address || op == Op::Param ? NONE : v;
+}
+
+// A root the next one reads first stays on the stack for it: with local.tee
+// if it has other uses, without a local if not.
+void Emitter::chain(BlockId b) {
+    const auto &roots = m_roots[b];
+    for (size_t i = 1; i < roots.size(); ++i) {
+        auto v = roots[i - 1];
+        const auto &inst = m_fn[v];
+        if (inst.type == Type::Void || m_uses[v] == 0 || is_terminator(inst.op)
+                || (inst.op == Op::Call && m_fn.callee(v).results.size() > 1)
+                || first_read(roots[i]) != v) {
+            continue;
+        }
+        (m_uses[v] == 1 ? m_stacked : m_teed)[v] = true;
+    }
+}
+
+// Locals read by the code of v, an operand
+void Emitter::reads(ValueId v, std::vector<uint32_t> &out,
+        const std::vector<uint32_t> &index) const {
+    if (m_inlined[v]) {
+        for (auto operand : m_fn.operands(v)) {
+            reads(operand, out, index);
+        }
+        return;
+    }
+    if (index[v] != NONE) {
+        out.push_back(index[v]);
+    }
+}
+
+// Values a root stores to locals, as print_root does
+void Emitter::writes(ValueId root, std::vector<ValueId> &out) const {
+    const auto &inst = m_fn[root];
+    switch (inst.op) {
+    case Op::Br:
+        for (auto [phi, value] : copies(inst.block)) {
+            out.push_back(phi);
+        }
+        return;
+    case Op::CondBr:
+    case Op::Return:
+    case Op::Unreachable:
+        return;
+    default:
+        break;
+    }
+    if (inst.op == Op::Call && m_fn.callee(root).results.size() > 1) {
+        for (size_t i = 0; i < m_fn.callee(root).results.size(); ++i) {
+            if (m_uses[root + i]) {
+                out.push_back(root + i);
+            }
+        }
+    }
+    else if (inst.type != Type::Void && m_uses[root] && ! m_stacked[root]) {
+        out.push_back(root);
+    }
+}
+
+/**
+ * Values share a local when neither is live where the other is written,
+ * from a liveness analysis over the roots of each block. Phis are written
+ * at the end of their predecessors, after all of their values are read.
+ * Locals are handed out greedily in the order values are written.
+ */
+void Emitter::assign_locals() {
+    const auto &order = m_cfg.get_order();
+    std::vector<uint32_t> index(m_fn.value_count(), NONE);
+    std::vector<ValueId> values;
+    std::vector<ValueId> defs;
+    for (auto b : order) {
+        for (auto root : m_roots[b]) {
+            defs.clear();
+            writes(root, defs);
+            for (auto v : defs) {
+                if (index[v] == NONE) {
+                    index[v] = values.size();
+                    values.push_back(v);
+                }
+            }
+        }
+    }
+    auto n = values.size();
+    if (n == 0) {
+        return;
+    }
+
+    // Reads and writes of each root, and what blocks read before writing
+    struct Access {
+        std::vector<uint32_t> reads;
+        std::vector<uint32_t> writes;
+    };
+    auto words = (n + 63) / 64;
+    using Set = std::vector<uint64_t>;
+    auto has = [](const Set &set, uint32_t i) { return (set[i / 64] >> (i % 64)) & 1; };
+    auto insert = [](Set &set, uint32_t i) { set[i / 64] |= uint64_t(1) << (i % 64); };
+    auto erase = [](Set &set, uint32_t i) { set[i / 64] &= ~(uint64_t(1) << (i % 64)); };
+
+    std::vector<std::vector<Access>> code(m_fn.block_count());
+    std::vector<Set> gen(m_fn.block_count(), Set(words));
+    std::vector<Set> kill(m_fn.block_count(), Set(words));
+    for (auto b : order) {
+        for (auto root : m_roots[b]) {
+            Access access;
+            for (auto operand : operands(root)) {
+                reads(operand, access.reads, index);
+            }
+            defs.clear();
+            writes(root, defs);
+            for (auto v : defs) {
+                access.writes.push_back(index[v]);
+            }
+            for (auto i : access.reads) {
+                if (! has(kill[b], i)) {
+                    insert(gen[b], i);
+                }
+            }
+            for (auto i : access.writes) {
+                insert(kill[b], i);
+            }
+            code[b].push_back(std::move(access));
+        }
+    }
+
+    std::vector<Set> live_in(m_fn.block_count(), Set(words));
+    std::vector<Set> live_out(m_fn.block_count(), Set(words));
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto iter = order.rbegin(); iter != order.rend(); ++iter) {
+            auto b = *iter;
+            auto &out = live_out[b];
+            for (auto s : m_fn.block(b).succs) {
+                if (s == NONE) {
+                    continue;
+                }
+                for (size_t w = 0; w < words; ++w) {
+                    out[w] |= live_in[s][w];
+                }
+            }
+            for (size_t w = 0; w < words; ++w) {
+                auto in = gen[b][w] | (out[w] & ~kill[b][w]);
+                if (in != live_in[b][w]) {
+                    live_in[b][w] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Values written interfere with what is live after them.
+    std::vector<std::vector<uint32_t>> edges(n);
+    auto interfere = [&](uint32_t a, uint32_t b) {
+        if (a != b && m_fn[values[a]].type == m_fn[values[b]].type) {
+            edges[a].push_back(b);
+            edges[b].push_back(a);
+        }
+    };
+    for (auto b : order) {
+        auto live = live_out[b];
+        for (auto access = code[b].rbegin(); access != code[b].rend(); ++access) {
+            for (auto d : access->writes) {
+                for (size_t w = 0; w < words; ++w) {
+                    for (auto bits = live[w]; bits; bits &= bits - 1) {
+                        interfere(d, w * 64 + std::countr_zero(bits));
+                    }
+                }
+                for (auto other : access->writes) {
+                    if (other < d) {
+                        interfere(d, other);
+                    }
+                }
+            }
+            for (auto d : access->writes) {
+                erase(live, d);
+            }
+            for (auto u : access->reads) {
+                insert(live, u);
+            }
+        }
+    }
+
+    std::vector<std::pair<Type, std::string>> slots;
+    std::vector<uint32_t> slot(n, NONE);
+    std::vector<bool> taken; // slots of the neighbours of the value being coloured
+    for (uint32_t i = 0; i < n; ++i) {
+        auto type = m_fn[values[i]].type;
+        taken.assign(slots.size(), false);
+        for (auto j : edges[i]) {
+            if (slot[j] != NONE) {
+                taken[slot[j]] = true;
+            }
+        }
+        for (uint32_t s = 0; s < slots.size() && slot[i] == NONE; ++s) {
+            if (slots[s].first == type && ! taken[s]) {
+                slot[i] = s;
+            }
+        }
+        if (slot[i] == NONE) {
+            slot[i] = slots.size();
+            slots.emplace_back(type, m_ctx.frame().add_temp(type_name(type)));
+        }
+        m_locals[values[i]] = slots[slot[i]].second;
+    }
+}
+
+void Emitter::run() {
+    auto count = m_fn.block_count();
+    m_roots.resize(count);
+    m_placed.resize(count);
+    for (auto b : m_cfg.get_order()) {
+        treeify(b);
+        chain(b);
+
+        // Merge nodes and loop exits get a (block) to branch out of.
+        uint32_t forward = 0;
+        for (auto pred : m_fn.block(b).preds) {
+            if (! m_cfg.is_back_edge(pred, b)) {
+                ++forward;
+            }
+            auto loop = m_cfg.get_loop(pred);
+            if (loop != NONE && ! m_cfg.in_loop(b, loop)) {
+                m_placed[b] = true;
+            }
+        }
+        m_placed[b] = m_placed[b] || forward >= 2;
+    }
+
+    // Placed blocks by dominator, the latest first: it is the outermost, as
+    // it follows everything else.
+    m_children.resize(count);
+    for (auto iter = m_cfg.get_order().rbegin(); iter != m_cfg.get_order().rend(); ++iter) {
+        if (*iter != Function::ENTRY && is_placed(*iter)) {
+            m_children[m_cfg.get_idom(*iter)].push_back(*iter);
+        }
+    }
+
+    assign_locals();
+
+    Context ctx;
+    do_tree(Function::ENTRY, ctx);
+
+    // Code that ends in an if, both arms of which return, falls off the end
+    // as far as validation is concerned.
+    if (! m_fn.get_results().empty() && m_pieces.back().kind == Piece::End) {
+        add(Piece::Unreachable);
+    }
+
+    print();
+}
+
+void Emitter::do_tree(BlockId x, Context &ctx) {
+    const auto &children = m_children[x];
+
+    if (! m_cfg.is_loop_header(x)) {
+        nest(x, children, 0, ctx, nullptr);
+        return;
+    }
+
+    // What follows a loop is placed outside of it.
+    std::vector<BlockId> inside, outside;
+    for (auto b : children) {
+        (m_cfg.in_loop(b, x) ? inside : outside).push_back(b);
+    }
+    nest(x, outside, 0, ctx, &inside);
+}
+
+void Emitter::nest(BlockId x, const std::vector<BlockId> &ys, size_t i, Context &ctx,
+        const std::vector<BlockId> *loop_body) {
+    if (i < ys.size()) {
+        open(Frame::Block, ys[i], ctx);
+        nest(x, ys, i + 1, ctx, loop_body);
+        close(ctx);
+        do_tree(ys[i], ctx);
+    }
+    else if (loop_body) {
+        open(Frame::Loop, x, ctx);
+        nest(x, *loop_body, 0, ctx, nullptr);
+        close(ctx);
+    }
+    else {
+        code(x, ctx);
+    }
+}
+
+void Emitter::code(BlockId x, Context &ctx) {
+    add(Piece::Code, x);
+
+    const auto &insts = m_fn.block(x).insts;
+    switch (m_fn[insts.back()].op) {
+    case Op::Br:
+        branch(x, m_fn.block(x).succs[0], ctx);
+        break;
+    case Op::CondBr:
+        cond_branch(x, ctx);
+        break;
+    case Op::Return:
+        // Results are left on the stack at the end of the function, outside
+        // of any block.
+        if (fall_target(ctx) != NONE || (! m_fn.get_results().empty() && ! ctx.empty())) {
+            add(Piece::Return);
+        }
+        break;
+    default:
+        add(Piece::Unreachable);
+        break;
+    }
+}
+
+void Emitter::branch(BlockId from, BlockId to, Context &ctx) {
+    uint32_t frame;
+    switch (classify(from, to, ctx, frame)) {
+    case Branch::Fall:
+        break;
+    case Branch::Label:
+        add(Piece::Br, frame);
+        break;
+    case Branch::Inline:
+        do_tree(to, ctx);
+        break;
+    }
+}
+
+void Emitter::cond_branch(BlockId x, Context &ctx) {
+    auto [t, f] = m_fn.block(x).succs;
+    uint32_t t_frame, f_frame;
+    auto t_kind = classify(x, t, ctx, t_frame);
+    auto f_kind = classify(x, f, ctx, f_frame);
+
+    if (t_kind == Branch::Label) {
+        add(Piece::BrIf, t_frame);
+        branch(x, f, ctx);
+        return;
+    }
+    if (f_kind == Branch::Label) {
+        add(Piece::Eqz);
+        add(Piece::BrIf, f_frame);
+        branch(x, t, ctx);
+        return;
+    }
+    if (t_kind == Branch::Fall && f_kind == Branch::Fall) {
+        add(Piece::Drop);
+        return;
+    }
+
+    if (t_kind == Branch::Fall) {
+        add(Piece::Eqz);
+        std::swap(t, f);
+        std::swap(t_kind, f_kind);
+    }
+    open(Frame::If, x, ctx);
+    do_tree(t, ctx);
+    if (f_kind == Branch::Inline) {
+        add(Piece::Else, ctx.back());
+        do_tree(f, ctx);
+    }
+    close(ctx);
+}
+
+Emitter::Branch Emitter::classify(BlockId from, BlockId to, const Context &ctx,
+        uint32_t &frame) const {
+    bool back = m_cfg.is_back_edge(from, to);
+    if (! back && ! is_placed(to)) {
+        return Branch::Inline;
+    }
+    if (! back && fall_target(ctx) == to) {
+        return Branch::Fall;
+    }
+    auto kind = back ? Frame::Loop : Frame::Block;
+    for (size_t i = ctx.size(); i-- > 0;) {
+        const auto &f = m_frames[ctx[i]];
+        if (f.kind == kind && f.target == to) {
+            frame = ctx[i];
+            return Branch::Label;
+        }
+    }
+    assert(false);
+    return Branch::Inline;
+}
+
+// Where control goes from the end of the code being generated, NONE for the
+// end of the function
+BlockId Emitter::fall_target(const Context &ctx) const {
+    for (size_t i = ctx.size(); i-- > 0;) {
+        const auto &f = m_frames[ctx[i]];
+        if (f.kind == Frame::Block) {
+            return f.target;
+        }
+    }
+    return NONE;
+}
+
+uint32_t Emitter::open(Frame::Kind kind, BlockId target, Context &ctx) {
+    uint32_t retval = m_frames.size();
+    m_frames.push_back({kind, target, kind != Frame::Block});
+    ctx.push_back(retval);
+    add(Piece::Open, retval);
+    return retval;
+}
+
+void Emitter::close(Context &ctx) {
+    add(Piece::End, ctx.back());
+    ctx.pop_back();
+}
+
+void Emitter::print() {
+    for (const auto &piece : m_pieces) {
+        if (piece.kind == Piece::Br || piece.kind == Piece::BrIf) {
+            m_frames[piece.arg].used = true;
+        }
+    }
+
+    auto &out = m_ctx.body();
+    std::vector<uint32_t> printed;
+    auto depth = [&](uint32_t frame) {
+        auto iter = std::find(printed.rbegin(), printed.rend(), frame);
+        assert(iter != printed.rend());
+        return iter - printed.rbegin();
+    };
+
+    for (const auto &piece : m_pieces) {
+        switch (piece.kind) {
+        case Piece::Code:
+            for (auto v : m_roots[piece.arg]) {
+                print_root(v);
+            }
+            break;
+        case Piece::Open: {
+            const auto &frame = m_frames[piece.arg];
+            if (! frame.used) {
+                break;
+            }
+            printed.push_back(piece.arg);
+            out << (frame.kind == Frame::Block ? "    (block\n"
+                            : frame.kind == Frame::Loop ? "    (loop\n"
+                                                        : "    (if\n      (then\n");
+            break;
+        }
+        case Piece::Else:
+            out << "      )\n      (else\n";
+            break;
+        case Piece::End: {
+            const auto &frame = m_frames[piece.arg];
+            if (! frame.used) {
+                break;
+            }
+            printed.pop_back();
+            out << (frame.kind == Frame::If ? "      )\n    )\n" : "    )\n");
+            break;
+        }
+        case Piece::Br:
+            out << FF("    br {}\n", depth(piece.arg));
+            break;
+        case Piece::BrIf:
+            out << FF("    br_if {}\n", depth(piece.arg));
+            break;
+        case Piece::Eqz:
+            out << "    i32.eqz\n";
+            break;
+        case Piece::Drop:
+            out << "    drop\n";
+            break;
+        case Piece::Return:
+            out << "    return\n";
+            break;
+        case Piece::Unreachable:
+            out << "    unreachable\n";
+            break;
+        }
+    }
+}
+
+const std::string &Emitter::local(ValueId v) {
+    auto &retval = m_locals[v];
+    if (retval.empty()) {
+        retval = m_ctx.frame().add_temp(type_name(m_fn[v].type));
+    }
+    return retval;
+}
+
+void Emitter::print_value(ValueId v) {
+    const auto &inst = m_fn[v];
+    auto &out = m_ctx.body();
+    if (m_inlined[v]) {
+        print_tree(v);
+    }
+    else if (inst.op == Op::Const) {
+        out << FF("    {}.const {}\n", type_name(inst.type), inst.imm);
+    }
+    else if (inst.op == Op::Address) {
+        m_ctx.emit_address(inst.imm);
+    }
+    else if (inst.op == Op::Param) {
+        out << FF("    local.get ${}\n", m_fn.get_params()[inst.imm].name);
+    }
+    else if (v == m_pending) {
+        m_pending = NONE;
+    }
+    else {
+        out << FF("    local.get {}\n", local(v));
+    }
+}
+
+void Emitter::print_root(ValueId v) {
+    const auto &inst = m_fn[v];
+    auto &out = m_ctx.body();
+
+    switch (inst.op) {
+    case Op::Br: {
+        // All values are read before any phi is written: phis of a loop
+        // header may take each other's values. Values already in the local
+        // of their phi need no copy.
+        auto values = copies(inst.block);
+        std::erase_if(values, [this](auto copy) {
+            auto [phi, value] = copy;
+            return ! m_inlined[value] && value != m_pending && ! m_locals[value].empty()
+                    && m_locals[value] == m_locals[phi];
+        });
+        for (auto [phi, value] : values) {
+            print_value(value);
+        }
+        for (auto iter = values.rbegin(); iter != values.rend(); ++iter) {
+            out << FF("    local.set {}\n", local(iter->first));
+        }
+        return;
+    }
+    case Op::CondBr:
+    case Op::Return:
+        for (auto operand : m_fn.operands(v)) {
+            print_value(operand);
+        }
+        return;
+    case Op::Unreachable:
+        return;
+    default:
+        break;
+    }
+
+    print_tree(v);
+    if (inst.op == Op::Call && m_fn.callee(v).results.size() > 1) {
+        // Results are on the stack in order, the last one on top.
+        auto count = m_fn.callee(v).results.size();
+        for (size_t i = count; i-- > 0;) {
+            if (m_uses[v + i]) {
+                out << FF("    local.set {}\n", local(v + i));
+            }
+            else {
+                out << "    drop\n";
+            }
+        }
+    }
+    else if (inst.type != Type::Void) {
+        if (m_stacked[v]) {
+            m_pending = v;
+        }
+        else if (m_teed[v]) {
+            out << FF("    local.tee {}\n", local(v));
+            m_pending = v;
+        }
+        else if (m_uses[v]) {
+            out << FF("    local.set {}\n", local(v));
+        }
+        else {
+            out << "    drop\n";
+        }
+    }
+}
+
+void Emitter::print_tree(ValueId v) {
+    const auto &inst = m_fn[v];
+    auto &out = m_ctx.body();
+    auto ops = m_fn.operands(v);
+    for (auto operand : ops) {
+        print_value(operand);
+    }
+
+    auto type = type_name(inst.type);
+    switch (inst.op) {
+    case Op::Eq:
+    case Op::Ne:
+    case Op::LtS:
+    case Op::GtS:
+    case Op::LeS:
+    case Op::GeS:
+    case Op::GtU:
+    case Op::Eqz:
+        out << FF("    {}.{}\n", type_name(m_fn[ops[0]].type), op_name(inst.op));
+        break;
+    case Op::Wrap:
+        out << "    i32.wrap_i64\n";
+        break;
+    case Op::ExtendU:
+        out << "    i64.extend_i32_u\n";
+        break;
+    case Op::Load:
+    case Op::Load8U:
+        out << FF("    {}.{} offset={}\n", type, op_name(inst.op), inst.imm);
+        break;
+    case Op::Store:
+    case Op::Store8:
+        out << FF("    {}.{} offset={}\n", type_name(m_fn[ops[1]].type), op_name(inst.op),
+                inst.imm);
+        break;
+    case Op::MemorySize:
+    case Op::MemoryCopy:
+        out << FF("    {}\n", op_name(inst.op));
+        break;
+    case Op::Call:
+        out << FF("    call ${}\n", m_fn.callee(v).name);
+        break;
+    case Op::TrapIf:
+        out << "    (if\n      (then\n        unreachable\n      )\n    )\n";
+        break;
+    case Op::VLoad:
+    case Op::VStore:
+        out << FF("    {} offset={}\n", op_name(inst.op), inst.imm);
+        break;
+    default:
+        if (is_simd(inst.op)) {
+            out << FF("    {}\n", simd_name(inst.op, inst.imm));
+            break;
+        }
+        out << FF("    {}.{}\n", type, op_name(inst.op));
+        break;
+    }
+}
+
+} // namespace
+
+void emit(kiraz::WasmContext &ctx, Function &fn) {
+    fn.remove_unreachable_blocks();
+    fn.remove_trivial_phis();
+    fn.remove_dead_code();
+    fn.split_critical_edges();
+
+    auto &out = ctx.body();
+    out << FF("  (func ${}", fn.get_name());
+    for (const auto &param : fn.get_params()) {
+        out << FF(" (param ${} {})", param.name, type_name(param.type));
+    }
+    if (! fn.get_results().empty()) {
+        out << " (result";
+        for (auto type : fn.get_results()) {
+            out << " " << type_name(type);
+        }
+        out << ")";
+    }
+    out << "\n";
+
+    // Locals are only known once the body is done, and go ahead of it.
+    ctx.push();
+    Emitter(ctx, fn).run();
+    const auto &temps = ctx.frame().temps;
+    for (size_t i = 0; i < temps.size(); ++i) {
+        ctx.locals() << FF("    (local $__t{} {})\n", i, temps[i]);
+    }
+    ctx.pop();
+
+    ctx.body() << "  )\n";
+}
+
+} // namespace ir
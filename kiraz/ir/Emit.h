@@ -0,0 +1,31 @@
+#ifndef KIRAZ_IR_EMIT_H
+#define KIRAZ_IR_EMIT_H
+
+#include <kiraz/ir/IR.h>
+
+namespace kiraz {
+class WasmContext;
+}
+
+namespace ir {
+
+/**
+ * @brief emit: Writes fn to ctx as a wasm function, cleaning it up first.
+ *
+ * Within a block, values with a single use are left on the stack for it where
+ * that does not reorder anything observable; the others, phis and the results
+ * of multi-value calls live in locals. A value the next statement reads first
+ * stays on the stack for it too, set with local.tee when it has other uses.
+ * Values that are never live at the same time share a local of their type.
+ *
+ * The control flow graph is turned back into block, loop and if as in Ramsey,
+ * "Beyond Relooper": a block whose branches cannot all nest inside the code of
+ * its dominator gets a (block) that ends right before it, a loop header a
+ * (loop), and blocks with a single predecessor are generated inline where it
+ * branches to them.
+ */
+void emit(kiraz::WasmContext &ctx, Function &fn);
+
+} // namespace ir
+
+#endif
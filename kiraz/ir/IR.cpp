@@ -0,0 +1,671 @@
+#include "IR.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+namespace ir {
+
+namespace {
+
+enum OpFlags : uint8_t {
+    SIDE_EFFECTS = 1,
+    READS_MEMORY = 2,
+    TERMINATOR = 4,
+};
+
+struct OpInfo {
+    const char *name = nullptr;
+    uint8_t flags = 0;
+};
+
+constexpr size_t OPS = size_t(Op::Unreachable) + 1;
+
+constexpr std::array<OpInfo, OPS> make_op_info() {
+    std::array<OpInfo, OPS> retval{};
+    auto set = [&](Op op, const char *name, uint8_t flags = 0) {
+        retval[size_t(op)] = {name, flags};
+    };
+
+    set(Op::Param, "param");
+    set(Op::Phi, "phi");
+    set(Op::Result, "result");
+    set(Op::Const, "const");
+    set(Op::Address, "address");
+    set(Op::Add, "add");
+    set(Op::Sub, "sub");
+    set(Op::Mul, "mul");
+    // Division by zero traps.
+    set(Op::DivS, "div_s", SIDE_EFFECTS);
+    set(Op::RemS, "rem_s", SIDE_EFFECTS);
+    set(Op::And, "and");
+    set(Op::Or, "or");
+    set(Op::Shl, "shl");
+    set(Op::ShrS, "shr_s");
+    set(Op::ShrU, "shr_u");
+    set(Op::Eq, "eq");
+    set(Op::Ne, "ne");
+    set(Op::LtS, "lt_s");
+    set(Op::GtS, "gt_s");
+    set(Op::LeS, "le_s");
+    set(Op::GeS, "ge_s");
+    set(Op::GtU, "gt_u");
+    set(Op::Eqz, "eqz");
+    set(Op::Wrap, "wrap_i64");
+    set(Op::ExtendU, "extend_i32_u");
+    set(Op::Load, "load", READS_MEMORY);
+    set(Op::Load8U, "load8_u", READS_MEMORY);
+    set(Op::Store, "store", SIDE_EFFECTS);
+    set(Op::Store8, "store8", SIDE_EFFECTS);
+    set(Op::MemorySize, "memory.size", READS_MEMORY);
+    set(Op::MemoryCopy, "memory.copy", SIDE_EFFECTS);
+    set(Op::VLoad, "v128.load", READS_MEMORY);
+    set(Op::VStore, "v128.store", SIDE_EFFECTS);
+    set(Op::VSplat, "splat");
+    set(Op::VAdd, "add");
+    set(Op::VSub, "sub");
+    set(Op::VMul, "mul");
+    set(Op::VAnd, "v128.and");
+    set(Op::VOr, "v128.or");
+    set(Op::VBitselect, "v128.bitselect");
+    set(Op::VShl, "shl");
+    set(Op::VShrS, "shr_s");
+    set(Op::VShrU, "shr_u");
+    set(Op::VEq, "eq");
+    set(Op::VNe, "ne");
+    set(Op::VLt, "lt");
+    set(Op::VGt, "gt");
+    set(Op::VLe, "le");
+    set(Op::VGe, "ge");
+    set(Op::VExtAddPairwiseU, "extadd_pairwise");
+    set(Op::VExtendLowU, "extend_low");
+    set(Op::VExtendHighU, "extend_high");
+    set(Op::VExtractLane, "extract_lane");
+    set(Op::Call, "call", SIDE_EFFECTS);
+    set(Op::TrapIf, "trap_if", SIDE_EFFECTS);
+    set(Op::Br, "br", TERMINATOR);
+    set(Op::CondBr, "br_if", TERMINATOR);
+    set(Op::Return, "return", TERMINATOR);
+    set(Op::Unreachable, "unreachable", TERMINATOR);
+    return retval;
+}
+
+constexpr auto OP_INFO = make_op_info();
+
+constexpr bool all_named() {
+    for (const auto &info : OP_INFO) {
+        if (! info.name) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(all_named());
+
+int64_t wrap(Type type, uint64_t value) {
+    return type == Type::I32 ? int32_t(uint32_t(value)) : int64_t(value);
+}
+
+std::string_view lanes_name(Lanes lanes) {
+    switch (lanes) {
+    case Lanes::I8x16:
+        return "i8x16";
+    case Lanes::I16x8:
+        return "i16x8";
+    case Lanes::I32x4:
+        return "i32x4";
+    case Lanes::I64x2:
+        return "i64x2";
+    }
+    return "";
+}
+
+} // namespace
+
+std::string_view type_name(Type type) {
+    switch (type) {
+    case Type::Void:
+        return "void";
+    case Type::I32:
+        return "i32";
+    case Type::I64:
+        return "i64";
+    case Type::V128:
+        return "v128";
+    }
+    return "";
+}
+
+std::string_view op_name(Op op) { return OP_INFO[size_t(op)].name; }
+bool has_side_effects(Op op) { return OP_INFO[size_t(op)].flags & (SIDE_EFFECTS | TERMINATOR); }
+bool reads_memory(Op op) { return OP_INFO[size_t(op)].flags & READS_MEMORY; }
+bool is_terminator(Op op) { return OP_INFO[size_t(op)].flags & TERMINATOR; }
+bool is_simd(Op op) { return op >= Op::VLoad && op <= Op::VExtractLane; }
+
+std::string simd_name(Op op, int64_t imm) {
+    auto lanes = Lanes(imm);
+    auto name = op_name(op);
+    switch (op) {
+    case Op::VLoad:
+    case Op::VStore:
+    case Op::VAnd:
+    case Op::VOr:
+    case Op::VBitselect:
+        return std::string(name);
+    case Op::VLt:
+    case Op::VGt:
+    case Op::VLe:
+    case Op::VGe:
+        return fmt::format("{}.{}_{}", lanes_name(lanes), name, lanes == Lanes::I8x16 ? "u" : "s");
+    case Op::VExtAddPairwiseU:
+    case Op::VExtendLowU:
+    case Op::VExtendHighU:
+        // From lanes half as wide
+        return fmt::format("{}.{}_{}_u", lanes_name(lanes), name, lanes_name(Lanes(imm - 1)));
+    case Op::VExtractLane:
+        return fmt::format("i64x2.{} {}", name, imm);
+    default:
+        break;
+    }
+    return fmt::format("{}.{}", lanes_name(lanes), name);
+}
+
+std::optional<int64_t> fold(Op op, Type type, std::span<const int64_t> x) {
+    auto bits = type == Type::I32 ? 32u : 64u;
+    auto a = uint64_t(x[0]);
+    auto b = x.size() > 1 ? uint64_t(x[1]) : 0;
+    auto ua = bits == 32 ? uint32_t(a) : a;
+    auto ub = bits == 32 ? uint32_t(b) : b;
+    switch (op) {
+    case Op::Add:
+        return wrap(type, a + b);
+    case Op::Sub:
+        return wrap(type, a - b);
+    case Op::Mul:
+        return wrap(type, a * b);
+    case Op::DivS:
+    case Op::RemS: {
+        auto min = bits == 32 ? std::numeric_limits<int32_t>::min()
+                              : std::numeric_limits<int64_t>::min();
+        if (x[1] == 0 || (op == Op::DivS && x[0] == min && x[1] == -1)) {
+            return std::nullopt;
+        }
+        if (x[1] == -1) {
+            return op == Op::DivS ? wrap(type, 0 - a) : 0;
+        }
+        return op == Op::DivS ? x[0] / x[1] : x[0] % x[1];
+    }
+    case Op::And:
+        return wrap(type, a & b);
+    case Op::Or:
+        return wrap(type, a | b);
+    case Op::Shl:
+        return wrap(type, a << (b % bits));
+    case Op::ShrS:
+        return wrap(type, uint64_t(x[0] >> (b % bits)));
+    case Op::ShrU:
+        return wrap(type, ua >> (b % bits));
+    case Op::Eq:
+        return x[0] == x[1];
+    case Op::Ne:
+        return x[0] != x[1];
+    case Op::LtS:
+        return x[0] < x[1];
+    case Op::GtS:
+        return x[0] > x[1];
+    case Op::LeS:
+        return x[0] <= x[1];
+    case Op::GeS:
+        return x[0] >= x[1];
+    case Op::GtU:
+        return ua > ub;
+    case Op::Eqz:
+        return x[0] == 0;
+    case Op::Wrap:
+        return wrap(Type::I32, a);
+    case Op::ExtendU:
+        return int64_t(uint32_t(a));
+    default:
+        break;
+    }
+    return std::nullopt;
+}
+
+ValueId Function::add_param(std::string name, Type type) {
+    if (m_blocks.empty()) {
+        add_block();
+    }
+    m_params.push_back({std::move(name), type});
+    return add(ENTRY, Op::Param, type, {}, m_params.size() - 1);
+}
+
+BlockId Function::add_block() {
+    m_blocks.emplace_back();
+    return m_blocks.size() - 1;
+}
+
+ValueId Function::add(BlockId b, Op op, Type type, std::span<const ValueId> operands,
+        int64_t imm) {
+    ValueId retval = m_insts.size();
+    m_insts.push_back({op, type, false, false, b, uint32_t(m_operands.size()),
+            uint32_t(operands.size()), imm});
+    m_operands.insert(m_operands.end(), operands.begin(), operands.end());
+
+    auto &insts = m_blocks[b].insts;
+    if (! is_terminator(op) && is_terminated(b)) {
+        insts.insert(std::prev(insts.end()), retval);
+    }
+    else {
+        insts.push_back(retval);
+    }
+    return retval;
+}
+
+ValueId Function::add_call(BlockId b, const Callee &callee, std::span<const ValueId> args) {
+    auto iter = std::find_if(m_callees.begin(), m_callees.end(),
+            [&](const Callee &c) { return c.name == callee.name; });
+    if (iter == m_callees.end()) {
+        iter = m_callees.insert(iter, callee);
+    }
+
+    auto type = callee.results.empty() ? Type::Void : callee.results.front();
+    auto retval = add(b, Op::Call, type, args, iter - m_callees.begin());
+    for (size_t i = 1; i < callee.results.size(); ++i) {
+        add(b, Op::Result, callee.results[i], {retval}, i);
+    }
+    return retval;
+}
+
+ValueId Function::add_before(
+        ValueId user, Op op, Type type, std::initializer_list<ValueId> operands, int64_t imm) {
+    auto b = m_insts[user].block;
+    auto retval = add(b, op, type, operands, imm);
+    auto &insts = m_blocks[b].insts;
+    insts.erase(std::find(insts.begin(), insts.end(), retval));
+    insts.insert(std::find(insts.begin(), insts.end(), user), retval);
+    return retval;
+}
+
+void Function::move(ValueId v, BlockId b) {
+    auto &from = m_blocks[m_insts[v].block].insts;
+    from.erase(std::find(from.begin(), from.end(), v));
+
+    m_insts[v].block = b;
+    auto &insts = m_blocks[b].insts;
+    insts.insert(is_terminated(b) ? std::prev(insts.end()) : insts.end(), v);
+}
+
+ValueId Function::add_phi(BlockId b, Type type) {
+    ValueId retval = m_insts.size();
+    m_insts.push_back({Op::Phi, type, false, false, b});
+
+    auto &insts = m_blocks[b].insts;
+    auto pos = std::find_if(insts.begin(), insts.end(),
+            [&](ValueId v) { return m_insts[v].op != Op::Phi; });
+    insts.insert(pos, retval);
+    return retval;
+}
+
+void Function::set_operands(ValueId v, std::span<const ValueId> operands) {
+    auto &inst = m_insts[v];
+    if (operands.size() <= inst.count) {
+        std::copy(operands.begin(), operands.end(), m_operands.begin() + inst.first);
+    }
+    else {
+        inst.first = m_operands.size();
+        m_operands.insert(m_operands.end(), operands.begin(), operands.end());
+    }
+    inst.count = operands.size();
+}
+
+void Function::br(BlockId from, BlockId to) {
+    assert(! is_terminated(from));
+    add(from, Op::Br, Type::Void);
+    m_blocks[from].succs = {to, NONE};
+    add_pred(to, from);
+}
+
+void Function::cond_br(BlockId from, ValueId cond, BlockId then_block, BlockId else_block) {
+    assert(! is_terminated(from) && then_block != else_block);
+    add(from, Op::CondBr, Type::Void, {cond});
+    m_blocks[from].succs = {then_block, else_block};
+    add_pred(then_block, from);
+    add_pred(else_block, from);
+}
+
+void Function::ret(BlockId from, std::span<const ValueId> values) {
+    assert(! is_terminated(from));
+    add(from, Op::Return, Type::Void, values);
+}
+
+void Function::unreachable(BlockId from) {
+    assert(! is_terminated(from));
+    add(from, Op::Unreachable, Type::Void);
+}
+
+void Function::invert(BlockId b, ValueId cond) {
+    auto branch = m_blocks[b].insts.back();
+    assert(m_insts[branch].op == Op::CondBr);
+    set_operands(branch, std::span(&cond, 1));
+    auto &succs = m_blocks[b].succs;
+    std::swap(succs[0], succs[1]);
+    if (auto iter = m_counts.find(branch); iter != m_counts.end()) {
+        std::swap(iter->second.taken, iter->second.not_taken);
+    }
+}
+
+BlockId Function::split_after(ValueId v) {
+    auto from = m_insts[v].block;
+    auto to = add_block();
+    auto &insts = m_blocks[from].insts;
+    auto rest = std::next(std::find(insts.begin(), insts.end(), v));
+    for (auto iter = rest; iter != insts.end(); ++iter) {
+        m_insts[*iter].block = to;
+    }
+    m_blocks[to].insts.assign(rest, insts.end());
+    insts.erase(rest, insts.end());
+
+    m_blocks[to].succs = std::exchange(m_blocks[from].succs, {NONE, NONE});
+    for (auto succ : m_blocks[to].succs) {
+        if (succ != NONE) {
+            auto &preds = m_blocks[succ].preds;
+            *std::find(preds.begin(), preds.end(), from) = to;
+        }
+    }
+    return to;
+}
+
+void Function::redirect(BlockId from, BlockId to, BlockId new_to) {
+    auto &succs = m_blocks[from].succs;
+    *std::find(succs.begin(), succs.end(), to) = new_to;
+    assert(succs[0] != succs[1]);
+
+    const auto &preds = m_blocks[to].preds;
+    remove_pred(to, std::find(preds.begin(), preds.end(), from) - preds.begin());
+    add_pred(new_to, from);
+}
+
+void Function::remove_pred(BlockId b, size_t index) {
+    auto &block = m_blocks[b];
+    block.preds.erase(block.preds.begin() + index);
+    for (auto v : block.insts) {
+        auto &inst = m_insts[v];
+        if (inst.op != Op::Phi) {
+            break;
+        }
+        auto operands = m_operands.begin() + inst.first;
+        std::copy(operands + index + 1, operands + inst.count, operands + index);
+        --inst.count;
+    }
+}
+
+void Function::remove_unreachable_blocks() {
+    std::vector<bool> reached(m_blocks.size());
+    std::vector<BlockId> stack = {ENTRY};
+    reached[ENTRY] = true;
+    while (! stack.empty()) {
+        auto b = stack.back();
+        stack.pop_back();
+        for (auto s : m_blocks[b].succs) {
+            if (s != NONE && ! reached[s]) {
+                reached[s] = true;
+                stack.push_back(s);
+            }
+        }
+    }
+
+    for (BlockId b = 0; b < m_blocks.size(); ++b) {
+        if (reached[b]) {
+            continue;
+        }
+        auto &block = m_blocks[b];
+        for (auto s : block.succs) {
+            if (s == NONE || ! reached[s]) {
+                continue;
+            }
+            auto &preds = m_blocks[s].preds;
+            for (size_t i = preds.size(); i-- > 0;) {
+                if (preds[i] == b) {
+                    remove_pred(s, i);
+                }
+            }
+        }
+        for (auto v : block.insts) {
+            detach(v);
+        }
+        block = {};
+    }
+}
+
+void Function::remove_trivial_phis() {
+    // Phis of a single value, or of one value and themselves, are that value.
+    std::vector<ValueId> repl(m_insts.size(), NONE);
+    auto resolve = [&](ValueId v) {
+        while (repl[v] != NONE) {
+            v = repl[v];
+        }
+        return v;
+    };
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto &block : m_blocks) {
+            for (auto v : block.insts) {
+                if (m_insts[v].op != Op::Phi) {
+                    break;
+                }
+                if (repl[v] != NONE) {
+                    continue;
+                }
+                auto same = NONE;
+                bool trivial = true;
+                for (auto operand : operands(v)) {
+                    operand = resolve(operand);
+                    if (operand == v || operand == same) {
+                        continue;
+                    }
+                    if (same != NONE) {
+                        trivial = false;
+                        break;
+                    }
+                    same = operand;
+                }
+                if (trivial && same != NONE) {
+                    repl[v] = same;
+                    changed = true;
+                }
+            }
+        }
+    }
+    replace_values(repl);
+}
+
+void Function::remove(ValueId v) {
+    auto &insts = m_blocks[m_insts[v].block].insts;
+    insts.erase(std::find(insts.begin(), insts.end(), v));
+    detach(v);
+}
+
+void Function::replace_values(std::span<const ValueId> repl) {
+    auto resolve = [&](ValueId v) {
+        while (v < repl.size() && repl[v] != NONE) {
+            v = repl[v];
+        }
+        return v;
+    };
+
+    for (auto &block : m_blocks) {
+        std::erase_if(block.insts, [&](ValueId v) {
+            if (v >= repl.size() || repl[v] == NONE) {
+                return false;
+            }
+            detach(v);
+            return true;
+        });
+        for (auto v : block.insts) {
+            auto &inst = m_insts[v];
+            for (uint32_t i = 0; i < inst.count; ++i) {
+                auto &operand = m_operands[inst.first + i];
+                operand = resolve(operand);
+            }
+        }
+    }
+}
+
+void Function::remove_dead_code() {
+    std::vector<bool> live(m_insts.size());
+    std::vector<ValueId> work;
+    for (auto &block : m_blocks) {
+        for (auto v : block.insts) {
+            if (has_side_effects(m_insts[v].op)) {
+                live[v] = true;
+                work.push_back(v);
+            }
+        }
+    }
+    while (! work.empty()) {
+        auto v = work.back();
+        work.pop_back();
+        for (auto operand : operands(v)) {
+            if (! live[operand]) {
+                live[operand] = true;
+                work.push_back(operand);
+            }
+        }
+    }
+
+    // Params stay: they are part of the signature.
+    for (auto &block : m_blocks) {
+        std::erase_if(block.insts, [&](ValueId v) {
+            if (live[v] || m_insts[v].op == Op::Param) {
+                return false;
+            }
+            detach(v);
+            return true;
+        });
+    }
+}
+
+void Function::split_critical_edges() {
+    // Copies into the phis of a block go at the end of its predecessors,
+    // which only works if they have no other successor.
+    for (BlockId b = 0; b < m_blocks.size(); ++b) {
+        for (size_t i = 0; i < 2; ++i) {
+            auto s = m_blocks[b].succs[i];
+            if (s == NONE || m_blocks[b].succs[1] == NONE || m_blocks[s].preds.size() < 2
+                    || m_insts[m_blocks[s].insts.front()].op != Op::Phi) {
+                continue;
+            }
+            auto edge = add_block();
+            add(edge, Op::Br, Type::Void);
+            m_blocks[edge].succs = {s, NONE};
+            m_blocks[edge].preds = {b};
+            m_blocks[b].succs[i] = edge;
+            auto &preds = m_blocks[s].preds;
+            *std::find(preds.begin(), preds.end(), b) = edge;
+        }
+    }
+}
+
+std::vector<uint32_t> Function::count_uses() const {
+    std::vector<uint32_t> retval(m_insts.size());
+    for (const auto &block : m_blocks) {
+        for (auto v : block.insts) {
+            for (auto operand : operands(v)) {
+                ++retval[operand];
+            }
+        }
+    }
+    return retval;
+}
+
+void Function::format_to(fmt::memory_buffer &out) const {
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "func ${}(", m_name);
+    for (size_t i = 0; i < m_params.size(); ++i) {
+        fmt::format_to(it, "{}{}", i ? ", " : "", type_name(m_params[i].type));
+    }
+    fmt::format_to(it, ")");
+    for (auto type : m_results) {
+        fmt::format_to(it, " {}", type_name(type));
+    }
+    fmt::format_to(it, "\n");
+
+    for (BlockId b = 0; b < m_blocks.size(); ++b) {
+        const auto &block = m_blocks[b];
+        if (block.insts.empty()) {
+            continue;
+        }
+        fmt::format_to(it, "b{}:", b);
+        if (! block.preds.empty()) {
+            fmt::format_to(it, " ; preds");
+            for (auto pred : block.preds) {
+                fmt::format_to(it, " b{}", pred);
+            }
+        }
+        fmt::format_to(it, "\n");
+
+        for (auto v : block.insts) {
+            const auto &inst = m_insts[v];
+            fmt::format_to(it, "  ");
+            if (inst.type != Type::Void) {
+                fmt::format_to(it, "v{}:{} = ", v, type_name(inst.type));
+            }
+            fmt::format_to(it, "{}", is_simd(inst.op) ? simd_name(inst.op, inst.imm)
+                                                        : std::string(op_name(inst.op)));
+
+            switch (inst.op) {
+            case Op::Param:
+                fmt::format_to(it, " ${}", m_params[inst.imm].name);
+                break;
+            case Op::Const:
+            case Op::Address:
+            case Op::Result:
+                fmt::format_to(it, " {}", inst.imm);
+                break;
+            case Op::Call:
+                fmt::format_to(it, " ${}", m_callees[inst.imm].name);
+                break;
+            default:
+                break;
+            }
+
+            auto ops = operands(v);
+            for (size_t i = 0; i < ops.size(); ++i) {
+                fmt::format_to(it, "{} v{}", i ? "," : "", ops[i]);
+                if (inst.op == Op::Phi) {
+                    fmt::format_to(it, " b{}", block.preds[i]);
+                }
+            }
+
+            if (inst.op == Op::Load || inst.op == Op::Load8U || inst.op == Op::Store
+                    || inst.op == Op::Store8 || inst.op == Op::VLoad || inst.op == Op::VStore) {
+                fmt::format_to(it, " offset={}", inst.imm);
+                if (inst.invariant) {
+                    fmt::format_to(it, " invariant");
+                }
+                if (inst.raw) {
+                    fmt::format_to(it, " raw");
+                }
+            }
+            if (inst.op == Op::Br || inst.op == Op::CondBr) {
+                for (auto s : block.succs) {
+                    if (s != NONE) {
+                        fmt::format_to(it, "{} b{}", inst.op == Op::CondBr ? "," : "", s);
+                    }
+                }
+            }
+            fmt::format_to(it, "\n");
+        }
+    }
+}
+
+std::string Function::as_string() const {
+    fmt::memory_buffer out;
+    format_to(out);
+    return fmt::to_string(out);
+}
+
+} // namespace ir
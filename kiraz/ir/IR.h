@@ -0,0 +1,305 @@
+#ifndef KIRAZ_IR_IR_H
+#define KIRAZ_IR_IR_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace ir {
+
+/**
+ * @brief Mid-level IR: functions in SSA form, lowered from the analysed AST
+ * and turned into wasm by the stackifier in Emit.h.
+ *
+ * A function owns its instructions in a single vector, and a value is the
+ * index of the instruction that computes it. Operands live in another vector
+ * shared by all instructions, as a (first, count) slice each. Instructions are
+ * never deleted, only detached from their block, so value ids stay valid for
+ * the lifetime of the function.
+ *
+ * Kiraz values map to wasm slots as in ClassLayout.h: strings are two i32
+ * values, booleans and objects one i32, integers one i64. V128 values only
+ * come from the vectorizer.
+ */
+enum class Type : uint8_t {
+    Void,
+    I32,
+    I64,
+    V128,
+};
+
+std::string_view type_name(Type type);
+
+// How SIMD instructions see a v128 value
+enum class Lanes : uint8_t {
+    I8x16,
+    I16x8,
+    I32x4,
+    I64x2,
+};
+
+using ValueId = uint32_t;
+using BlockId = uint32_t;
+
+constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+enum class Op : uint8_t {
+    // No code of their own: params and phis are wasm locals, results of calls
+    // are stored to locals by the call.
+    Param, // imm: index of the wasm param
+    Phi, // one operand per predecessor of the block, in order
+    Result, // imm: index of the result of the call operand, from 1
+
+    // Rematerialised at every use
+    Const,
+    Address, // imm: offset in the static data
+
+    // Integer arithmetic, on operands of the type of the result
+    Add,
+    Sub,
+    Mul,
+    DivS,
+    RemS,
+    And,
+    Or,
+    Shl,
+    ShrS,
+    ShrU,
+
+    // Comparisons produce an i32 from operands of any integer type.
+    Eq,
+    Ne,
+    LtS,
+    GtS,
+    LeS,
+    GeS,
+    GtU,
+    Eqz,
+
+    Wrap, // i64 -> i32
+    ExtendU, // i32 -> i64
+
+    // Address operand first, imm is the offset
+    Load,
+    Load8U,
+    Store,
+    Store8,
+
+    MemorySize,
+    MemoryCopy, // destination, source, length
+
+    // SIMD, on v128 values. Lane-wise instructions have the Lanes they work
+    // on as imm. Orderings are unsigned on i8x16 lanes and signed on i64x2.
+    VLoad, // address operand, imm is the offset
+    VStore,
+    VSplat, // of a scalar, i32 for lanes narrower than i64x2
+    VAdd,
+    VSub,
+    VMul,
+    VAnd,
+    VOr,
+    VBitselect, // lanes of the first operand where the third has bits set, the second elsewhere
+    VShl, // by an i32 operand
+    VShrS,
+    VShrU,
+    VEq,
+    VNe,
+    VLt,
+    VGt,
+    VLe,
+    VGe,
+    VExtAddPairwiseU, // imm: lanes of the result, twice as wide as the operand
+    VExtendLowU,
+    VExtendHighU,
+    VExtractLane, // i64 lane imm of an i64x2
+
+    Call, // imm: index in get_callees(), arguments as operands
+    TrapIf, // traps if its operand is not zero
+
+    // Terminators, the last instruction of every block
+    Br,
+    CondBr, // to the first successor if its operand is not zero
+    Return,
+    Unreachable,
+};
+
+std::string_view op_name(Op op);
+
+// The wasm instruction of a SIMD op given its imm, offsets of loads and stores
+// aside
+std::string simd_name(Op op, int64_t imm);
+bool is_simd(Op op);
+
+// Instructions that cannot be removed or reordered with each other
+bool has_side_effects(Op op);
+bool reads_memory(Op op);
+bool is_terminator(Op op);
+
+// Result of op on constants of type, nothing for what would trap or is not
+// arithmetic
+std::optional<int64_t> fold(Op op, Type type, std::span<const int64_t> x);
+
+struct Inst {
+    Op op;
+    Type type = Type::Void;
+    bool invariant = false; // loads: of memory that stays the same once read
+    bool raw = false; // loads and stores: through io.Memory, anywhere in memory
+    BlockId block = NONE; // NONE once removed
+    uint32_t first = 0;
+    uint32_t count = 0;
+    int64_t imm = 0;
+};
+
+struct Block {
+    std::vector<ValueId> insts; // phis first, the terminator last
+    std::vector<BlockId> preds; // in the order of the operands of phis
+    std::array<BlockId, 2> succs = {NONE, NONE};
+};
+
+struct Callee {
+    std::string name; // without the $
+    std::vector<Type> results;
+    bool pure = false; // results depend on the arguments only, memory is left alone
+};
+
+struct Param {
+    std::string name; // without the $
+    Type type;
+};
+
+// Times a cond_br went either way in a profiled run
+struct BranchCounts {
+    uint64_t taken = 0; // to the first successor
+    uint64_t not_taken = 0;
+};
+
+class Function {
+public:
+    explicit Function(std::string name = {}) : m_name(std::move(name)) {}
+
+    const auto &get_name() const { return m_name; }
+
+    // Signature. Params are also Param values of the entry block.
+    ValueId add_param(std::string name, Type type);
+    const auto &get_params() const { return m_params; }
+    void add_result(Type type) { m_results.push_back(type); }
+    const auto &get_results() const { return m_results; }
+
+    BlockId add_block();
+    static constexpr BlockId ENTRY = 0;
+
+    const Block &block(BlockId b) const { return m_blocks[b]; }
+    size_t block_count() const { return m_blocks.size(); }
+
+    const Inst &operator[](ValueId v) const { return m_insts[v]; }
+    size_t value_count() const { return m_insts.size(); }
+
+    std::span<const ValueId> operands(ValueId v) const {
+        return {m_operands.data() + m_insts[v].first, m_insts[v].count};
+    }
+
+    // Appends an instruction to b, before its terminator if it has one
+    ValueId add(BlockId b, Op op, Type type, std::span<const ValueId> operands, int64_t imm = 0);
+    ValueId add(BlockId b, Op op, Type type, std::initializer_list<ValueId> operands = {},
+            int64_t imm = 0) {
+        return add(b, op, type, std::span(operands.begin(), operands.size()), imm);
+    }
+    ValueId add_const(BlockId b, Type type, int64_t value) {
+        return add(b, Op::Const, type, {}, value);
+    }
+    // Inserts an instruction right before user, which is not a phi
+    ValueId add_before(ValueId user, Op op, Type type, std::initializer_list<ValueId> operands,
+            int64_t imm = 0);
+
+    // Results of calls: the call itself is the first one, Result values the
+    // others.
+    ValueId add_call(BlockId b, const Callee &callee, std::span<const ValueId> args);
+    const auto &get_callees() const { return m_callees; }
+    const Callee &callee(ValueId call) const { return m_callees[m_insts[call].imm]; }
+
+    // Counts of cond_br instructions from a profile, see Profile.h
+    void set_counts(ValueId branch, BranchCounts counts) { m_counts[branch] = counts; }
+    const BranchCounts *get_counts(ValueId branch) const {
+        auto iter = m_counts.find(branch);
+        return iter == m_counts.end() ? nullptr : &iter->second;
+    }
+
+    void set_invariant(ValueId load) { m_insts[load].invariant = true; }
+    void set_raw(ValueId access) { m_insts[access].raw = true; }
+    void set_type(ValueId v, Type type) { m_insts[v].type = type; }
+
+    // Moves v to the end of b, before its terminator
+    void move(ValueId v, BlockId b);
+
+    // An empty phi at the start of b, see set_operands
+    ValueId add_phi(BlockId b, Type type);
+    void set_operands(ValueId v, std::span<const ValueId> operands);
+
+    // Terminators
+    void br(BlockId from, BlockId to);
+    void cond_br(BlockId from, ValueId cond, BlockId then_block, BlockId else_block);
+    void ret(BlockId from, std::span<const ValueId> values);
+    void unreachable(BlockId from);
+
+    // Swaps the successors of the cond_br ending b, which branches on cond
+    // instead
+    void invert(BlockId b, ValueId cond);
+
+    // Moves the instructions after v to a new block, which takes over the
+    // successors of the block of v. That block is left without a terminator.
+    BlockId split_after(ValueId v);
+
+    // Makes the edge from -> to go to new_to instead. Phis of to lose their
+    // operand for it, the ones of new_to are left to set_operands.
+    void redirect(BlockId from, BlockId to, BlockId new_to);
+
+    bool is_terminated(BlockId b) const {
+        const auto &insts = m_blocks[b].insts;
+        return ! insts.empty() && is_terminator(m_insts[insts.back()].op);
+    }
+
+    // Clean ups, run by the emitter. Blocks keep their ids: removed blocks
+    // are left empty and without predecessors.
+    void remove_unreachable_blocks();
+    void remove_trivial_phis();
+    void remove_dead_code();
+    void split_critical_edges();
+
+    // Replaces the uses of every v with repl[v], unless that is NONE, and
+    // removes v from its block
+    void replace_values(std::span<const ValueId> repl);
+    // Removes v, which has no uses, from its block
+    void remove(ValueId v);
+
+    // Number of operands referring to each value, phis included
+    std::vector<uint32_t> count_uses() const;
+
+    void format_to(fmt::memory_buffer &out) const;
+    std::string as_string() const;
+
+private:
+    void add_pred(BlockId b, BlockId pred) { m_blocks[b].preds.push_back(pred); }
+    void remove_pred(BlockId b, size_t index);
+    void detach(ValueId v) { m_insts[v].block = NONE; }
+
+    std::string m_name;
+    std::vector<Param> m_params;
+    std::vector<Type> m_results;
+    std::vector<Inst> m_insts;
+    std::vector<ValueId> m_operands;
+    std::vector<Block> m_blocks;
+    std::vector<Callee> m_callees;
+    std::unordered_map<ValueId, BranchCounts> m_counts;
+};
+
+} // namespace ir
+
+#endif
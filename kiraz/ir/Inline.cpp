@@ -0,0 +1,134 @@
+#include "Inline.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <kiraz/ir/ControlFlow.h>
+
+namespace ir {
+
+bool inline_call(Function &fn, ValueId call, const Function &callee) {
+    ControlFlow cfg(callee);
+    const auto &order = cfg.get_order();
+    if (! callee.block(Function::ENTRY).preds.empty()
+            || std::none_of(order.begin(), order.end(), [&](BlockId b) {
+                   return callee[callee.block(b).insts.back()].op == Op::Return;
+               })) {
+        return false;
+    }
+
+    auto args = std::vector<ValueId>(fn.operands(call).begin(), fn.operands(call).end());
+    auto results = fn.callee(call).results;
+    auto rest = fn.split_after(call + (results.empty() ? 0 : results.size() - 1));
+
+    std::vector<BlockId> blocks(callee.block_count(), NONE);
+    std::unordered_map<BlockId, BlockId> original;
+    for (auto b : order) {
+        blocks[b] = fn.add_block();
+        original[blocks[b]] = b;
+    }
+
+    // Operands are set once everything they may refer to has its copy.
+    std::unordered_map<ValueId, ValueId> values;
+    std::vector<ValueId> copied;
+    for (auto b : order) {
+        auto copy = blocks[b];
+        for (auto v : callee.block(b).insts) {
+            const auto &inst = callee[v];
+            if (inst.op == Op::Param) {
+                values[v] = args[inst.imm];
+                continue;
+            }
+            if (inst.op == Op::Result || is_terminator(inst.op)) {
+                continue;
+            }
+            if (inst.op == Op::Phi) {
+                values[v] = fn.add_phi(copy, inst.type);
+            }
+            else if (inst.op == Op::Call) {
+                const auto &target = callee.callee(v);
+                values[v] = fn.add_call(copy, target, {});
+                for (size_t i = 1; i < target.results.size(); ++i) {
+                    values[v + i] = values[v] + i;
+                }
+            }
+            else {
+                values[v] = fn.add(copy, inst.op, inst.type, {}, inst.imm);
+                if (inst.invariant) {
+                    fn.set_invariant(values[v]);
+                }
+                if (inst.raw) {
+                    fn.set_raw(values[v]);
+                }
+            }
+            copied.push_back(v);
+        }
+    }
+
+    // Values returned, by each block going back to the rest of the caller
+    std::vector<std::vector<ValueId>> returned;
+    for (auto b : order) {
+        auto copy = blocks[b];
+        auto term = callee.block(b).insts.back();
+        const auto &succs = callee.block(b).succs;
+        switch (callee[term].op) {
+        case Op::Br:
+            fn.br(copy, blocks[succs[0]]);
+            break;
+        case Op::CondBr:
+            fn.cond_br(copy, values.at(callee.operands(term)[0]), blocks[succs[0]],
+                    blocks[succs[1]]);
+            if (auto counts = callee.get_counts(term)) {
+                fn.set_counts(fn.block(copy).insts.back(), *counts);
+            }
+            break;
+        case Op::Return:
+            fn.br(copy, rest);
+            returned.emplace_back();
+            for (auto operand : callee.operands(term)) {
+                returned.back().push_back(values.at(operand));
+            }
+            break;
+        default:
+            fn.unreachable(copy);
+            break;
+        }
+    }
+
+    std::vector<ValueId> operands;
+    for (auto v : copied) {
+        operands.clear();
+        if (callee[v].op == Op::Phi) {
+            const auto &preds = callee.block(callee[v].block).preds;
+            for (auto pred : fn.block(fn[values[v]].block).preds) {
+                auto iter = std::find(preds.begin(), preds.end(), original.at(pred));
+                operands.push_back(values.at(callee.operands(v)[iter - preds.begin()]));
+            }
+        }
+        else {
+            for (auto operand : callee.operands(v)) {
+                operands.push_back(values.at(operand));
+            }
+        }
+        fn.set_operands(values[v], operands);
+    }
+
+    fn.br(fn[call].block, blocks[Function::ENTRY]);
+    if (results.empty()) {
+        fn.remove(call);
+        return true;
+    }
+    std::vector<ValueId> repl(fn.value_count(), NONE);
+    for (size_t i = 0; i < results.size(); ++i) {
+        repl[call + i] = fn.add_phi(rest, results[i]);
+        operands.clear();
+        for (const auto &ret : returned) {
+            operands.push_back(ret[i]);
+        }
+        fn.set_operands(repl[call + i], operands);
+    }
+    fn.replace_values(repl);
+    return true;
+}
+
+} // namespace ir
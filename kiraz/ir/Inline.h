@@ -0,0 +1,21 @@
+#ifndef KIRAZ_IR_INLINE_H
+#define KIRAZ_IR_INLINE_H
+
+#include <kiraz/ir/IR.h>
+
+namespace ir {
+
+/**
+ * @brief inline_call: Replaces call in fn with a copy of the body of callee,
+ * the function it calls. The block of the call goes on to the entry of the
+ * copy, and its returns to the rest of the block, where phis take the values
+ * they return.
+ *
+ * Returns false and leaves fn alone for callees that never return or whose
+ * entry block is a loop header.
+ */
+bool inline_call(Function &fn, ValueId call, const Function &callee);
+
+} // namespace ir
+
+#endif
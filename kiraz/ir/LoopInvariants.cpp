@@ -0,0 +1,189 @@
+#include "LoopInvariants.h"
+
+#include <algorithm>
+
+#include <kiraz/Stats.h>
+#include <kiraz/ir/ControlFlow.h>
+
+namespace ir {
+
+namespace {
+
+// Bytes read or written by a load or a store
+int64_t access_size(const Function &fn, ValueId v) {
+    switch (fn[v].op) {
+    case Op::Load8U:
+    case Op::Store8:
+        return 1;
+    case Op::Store:
+        return fn[fn.operands(v)[1]].type == Type::I64 ? 8 : 4;
+    default:
+        break;
+    }
+    return fn[v].type == Type::I64 ? 8 : 4;
+}
+
+class LoopInvariants {
+public:
+    LoopInvariants(Function &fn, const ControlFlow &cfg, BlockId header)
+            : m_fn(fn), m_cfg(cfg), m_header(header) {}
+
+    size_t run();
+
+private:
+    BlockId find_preheader() const;
+    void find_writes(BlockId b);
+    bool is_invariant(ValueId v) const;
+    bool is_clobbered(ValueId load) const;
+
+    Function &m_fn;
+    const ControlFlow &m_cfg;
+    BlockId m_header;
+
+    // [offset, offset + size) of the stores in the loop
+    std::vector<std::pair<int64_t, int64_t>> m_stores;
+    bool m_writes_anywhere = false;
+    bool m_calls = false;
+};
+
+BlockId LoopInvariants::find_preheader() const {
+    auto retval = NONE;
+    for (auto pred : m_fn.block(m_header).preds) {
+        if (m_cfg.in_loop(pred, m_header)) {
+            continue;
+        }
+        if (retval != NONE) {
+            return NONE;
+        }
+        retval = pred;
+    }
+    // While loops are entered by a br from the block before them, nothing
+    // else needs a preheader of its own.
+    if (retval == NONE || m_fn.block(retval).succs[1] != NONE) {
+        return NONE;
+    }
+    return retval;
+}
+
+void LoopInvariants::find_writes(BlockId b) {
+    for (auto v : m_fn.block(b).insts) {
+        switch (m_fn[v].op) {
+        case Op::Store:
+        case Op::Store8:
+            if (m_fn[v].raw) {
+                m_writes_anywhere = true;
+            }
+            else {
+                m_stores.emplace_back(m_fn[v].imm, m_fn[v].imm + access_size(m_fn, v));
+            }
+            break;
+        case Op::VStore:
+        case Op::MemoryCopy:
+            m_writes_anywhere = true;
+            break;
+        case Op::Call:
+            if (! m_fn.callee(v).pure) {
+                m_writes_anywhere = true;
+                m_calls = true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool LoopInvariants::is_clobbered(ValueId load) const {
+    if (m_fn[load].invariant) {
+        return false;
+    }
+    if (m_writes_anywhere) {
+        return true;
+    }
+    auto begin = m_fn[load].imm;
+    auto end = begin + access_size(m_fn, load);
+    return std::any_of(m_stores.begin(), m_stores.end(),
+            [&](const auto &store) { return store.first < end && begin < store.second; });
+}
+
+bool LoopInvariants::is_invariant(ValueId v) const {
+    switch (m_fn[v].op) {
+    case Op::Param:
+    case Op::Phi:
+    case Op::Result:
+        return false;
+    case Op::Load:
+    case Op::Load8U:
+    case Op::VLoad:
+        if (m_fn[v].raw || is_clobbered(v)) {
+            return false;
+        }
+        break;
+    case Op::MemorySize:
+        return ! m_calls;
+    default:
+        if (has_side_effects(m_fn[v].op)) {
+            return false;
+        }
+        break;
+    }
+
+    auto operands = m_fn.operands(v);
+    return std::none_of(operands.begin(), operands.end(),
+            [&](ValueId operand) { return m_cfg.in_loop(m_fn[operand].block, m_header); });
+}
+
+size_t LoopInvariants::run() {
+    auto preheader = find_preheader();
+    if (preheader == NONE) {
+        return 0;
+    }
+
+    std::vector<BlockId> blocks;
+    for (auto b : m_cfg.get_order()) {
+        if (m_cfg.in_loop(b, m_header)) {
+            blocks.push_back(b);
+            find_writes(b);
+        }
+    }
+
+    // In reverse post order, operands are seen before their uses. Hoisted
+    // values are in the preheader, out of the loop, by the time their uses
+    // are looked at.
+    size_t retval = 0;
+    for (auto b : blocks) {
+        auto insts = m_fn.block(b).insts;
+        for (auto v : insts) {
+            if (! is_invariant(v)) {
+                continue;
+            }
+            m_fn.move(v, preheader);
+            if (m_fn[v].op != Op::Const && m_fn[v].op != Op::Address) {
+                ++retval;
+            }
+        }
+    }
+    return retval;
+}
+
+} // namespace
+
+size_t hoist_loop_invariants(Function &fn) {
+    // Phis of values that do not change in the loop would hide them.
+    fn.remove_unreachable_blocks();
+    fn.remove_trivial_phis();
+
+    // Headers of inner loops come later in reverse post order.
+    ControlFlow cfg(fn);
+    size_t retval = 0;
+    const auto &order = cfg.get_order();
+    for (auto h = order.rbegin(); h != order.rend(); ++h) {
+        if (cfg.is_loop_header(*h)) {
+            retval += LoopInvariants(fn, cfg, *h).run();
+        }
+    }
+    KIRAZ_STATS_ADD(HoistedValues, retval);
+    return retval;
+}
+
+} // namespace ir
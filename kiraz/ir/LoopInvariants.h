@@ -0,0 +1,30 @@
+#ifndef KIRAZ_IR_LOOPINVARIANTS_H
+#define KIRAZ_IR_LOOPINVARIANTS_H
+
+#include <kiraz/ir/IR.h>
+
+namespace ir {
+
+/**
+ * @brief hoist_loop_invariants: Moves what loops compute the same way on
+ * every iteration to their preheaders, the blocks that enter them. Inner
+ * loops go first, so values can move out of several loops.
+ *
+ * Hoisted values are computed even when the loop body is not run, so only
+ * instructions that cannot trap move: arithmetic, comparisons, loads of
+ * fields and memory.size. Fields of objects are in memory; loads through
+ * io.Memory are only in bounds after the check in front of them, and stay.
+ *
+ * A load is invariant if its address is and nothing in the loop can write
+ * what it reads. Field addresses are always the start of an object, so
+ * stores to other offsets do not alias them; stores through io.Memory,
+ * memory.copy and calls of functions that are not pure can write anywhere.
+ * Calls may also grow memory, which keeps memory.size in the loop.
+ *
+ * Returns the number of instructions moved, constants not included.
+ */
+size_t hoist_loop_invariants(Function &fn);
+
+} // namespace ir
+
+#endif
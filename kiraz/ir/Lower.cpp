@@ -0,0 +1,1083 @@
+#include "Lower.h"
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <unordered_map>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/StrengthReduce.h>
+#include <kiraz/ast/Literal.h>
+#include <kiraz/ast/Operator.h>
+
+namespace ir {
+
+using kiraz::ValueKind;
+
+namespace {
+
+// A kiraz value: one IR value per wasm slot, none for Void
+class Slots {
+public:
+    Slots() = default;
+    Slots(ValueId v) : m_ids{v, NONE}, m_size(1) {}
+    Slots(ValueId first, ValueId second) : m_ids{first, second}, m_size(2) {}
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    ValueId operator[](size_t i) const { return m_ids[i]; }
+
+    auto begin() const { return m_ids.begin(); }
+    auto end() const { return m_ids.begin() + m_size; }
+
+    bool operator==(const Slots &other) const = default;
+
+private:
+    std::array<ValueId, 2> m_ids = {NONE, NONE};
+    uint32_t m_size = 0;
+};
+
+std::span<const Type> slot_types(ValueKind kind) {
+    static constexpr Type I32[] = {Type::I32};
+    static constexpr Type I64[] = {Type::I64};
+    static constexpr Type STRING[] = {Type::I32, Type::I32};
+    switch (kind) {
+    case ValueKind::Void:
+        return {};
+    case ValueKind::Integer64:
+        return I64;
+    case ValueKind::String:
+        return STRING;
+    case ValueKind::Boolean:
+    case ValueKind::Object:
+        break;
+    }
+    return I32;
+}
+
+std::span<const Type> slot_types(std::string_view type) { return slot_types(kiraz::kind_of(type)); }
+
+struct BinaryOpcode {
+    Op op = Op::Unreachable;
+    bool defined = false;
+};
+
+constexpr size_t BINARY_OPS = size_t(ast::BinaryOp::Kind::Ge) + 1;
+constexpr size_t VALUE_KINDS = size_t(ValueKind::Object) + 1;
+
+using OpcodeTable = std::array<std::array<BinaryOpcode, VALUE_KINDS>, BINARY_OPS>;
+
+// Instruction by operator and kind of the operands, undefined where the
+// operator is not defined
+constexpr OpcodeTable make_binary_opcodes() {
+    OpcodeTable retval{};
+    auto set = [&](ast::BinaryOp::Kind op, ValueKind kind, Op opcode) {
+        retval[size_t(op)][size_t(kind)] = {opcode, true};
+    };
+
+    using K = ast::BinaryOp::Kind;
+    set(K::Add, ValueKind::Integer64, Op::Add);
+    set(K::Sub, ValueKind::Integer64, Op::Sub);
+    set(K::Mult, ValueKind::Integer64, Op::Mul);
+    set(K::Div, ValueKind::Integer64, Op::DivS);
+    set(K::Eq, ValueKind::Integer64, Op::Eq);
+    set(K::Ne, ValueKind::Integer64, Op::Ne);
+    set(K::Lt, ValueKind::Integer64, Op::LtS);
+    set(K::Gt, ValueKind::Integer64, Op::GtS);
+    set(K::Le, ValueKind::Integer64, Op::LeS);
+    set(K::Ge, ValueKind::Integer64, Op::GeS);
+
+    // Booleans and objects compare by value and by address
+    for (auto kind : {ValueKind::Boolean, ValueKind::Object}) {
+        set(K::Eq, kind, Op::Eq);
+        set(K::Ne, kind, Op::Ne);
+    }
+    return retval;
+}
+
+constexpr auto BINARY_OPCODES = make_binary_opcodes();
+
+constexpr BinaryOpcode binary_opcode(ast::BinaryOp::Kind op, ValueKind kind) {
+    return BINARY_OPCODES[size_t(op)][size_t(kind)];
+}
+
+static_assert(binary_opcode(ast::BinaryOp::Kind::Lt, ValueKind::Integer64).op == Op::LtS);
+static_assert(! binary_opcode(ast::BinaryOp::Kind::Add, ValueKind::String).defined);
+
+// Value of an integer constant, unary minus included
+std::optional<int64_t> constant_value(const Node &node) {
+    if (auto value = dynamic_cast<const ast::Integer *>(&node)) {
+        return value->get_value();
+    }
+    if (auto sign = dynamic_cast<const ast::Signed *>(&node)) {
+        auto value = constant_value(*sign->get_operand());
+        if (value && sign->is_negative()) {
+            return static_cast<int64_t>(0 - static_cast<uint64_t>(*value));
+        }
+        return value;
+    }
+    return std::nullopt;
+}
+
+struct Reduced {
+    Node::Ptr operand;
+    kiraz::strength::Sequence code;
+};
+
+// x * c, x / c and x - x / c * c for a constant c, as the code that computes
+// them from x
+std::optional<Reduced> strength_reduce(const ast::BinaryOp &op) {
+    namespace strength = kiraz::strength;
+    using K = ast::BinaryOp::Kind;
+    const auto &left = op.get_left();
+    const auto &right = op.get_right();
+
+    switch (op.get_kind()) {
+    case K::Mult:
+        for (auto [x, c] : {std::pair(left, right), std::pair(right, left)}) {
+            if (auto value = constant_value(*c)) {
+                if (auto code = strength::lower_mul(*value)) {
+                    return Reduced{x, std::move(*code)};
+                }
+                break;
+            }
+        }
+        break;
+
+    case K::Div:
+        if (auto value = constant_value(*right)) {
+            if (auto code = strength::lower_div(*value)) {
+                return Reduced{left, std::move(*code)};
+            }
+        }
+        break;
+
+    case K::Sub: {
+        // The language has no remainder operator, this is how it is written.
+        auto mult = std::dynamic_pointer_cast<ast::Mult>(right);
+        if (! mult || ! dynamic_cast<const ast::Id *>(left.get())) {
+            break;
+        }
+        for (auto [quot, c] : {std::pair(mult->get_left(), mult->get_right()),
+                     std::pair(mult->get_right(), mult->get_left())}) {
+            auto div = std::dynamic_pointer_cast<ast::Div>(quot);
+            auto value = constant_value(*c);
+            if (div && value && dynamic_cast<const ast::Id *>(div->get_left().get())
+                    && div->get_left()->get_id() == left->get_id()
+                    && constant_value(*div->get_right()) == value) {
+                if (auto code = strength::lower_rem(*value)) {
+                    return Reduced{left, std::move(*code)};
+                }
+            }
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+    return std::nullopt;
+}
+
+Op strength_op(kiraz::strength::Opcode op) {
+    using kiraz::strength::Opcode;
+    switch (op) {
+    case Opcode::Add:
+        return Op::Add;
+    case Opcode::Sub:
+        return Op::Sub;
+    case Opcode::Mul:
+        return Op::Mul;
+    case Opcode::And:
+        return Op::And;
+    case Opcode::Shl:
+        return Op::Shl;
+    case Opcode::ShrS:
+        return Op::ShrS;
+    case Opcode::ShrU:
+        return Op::ShrU;
+    case Opcode::RemS:
+        return Op::RemS;
+    default:
+        break;
+    }
+    assert(false);
+    return Op::Unreachable;
+}
+
+const std::vector<Node::Ptr> &call_args(const Node::Ptr &args) {
+    static const std::vector<Node::Ptr> none;
+    return args && args->is_funcarg_list() ? static_cast<const ast::FuncArgs &>(*args).get_args()
+                                           : none;
+}
+
+// Variables that some assignment in node may change
+void collect_assigned(const Node &node, std::vector<std::string> &names) {
+    if (node.is_assign()) {
+        const auto &lhs = static_cast<const ast::Assignment &>(node).get_lhs();
+        if (! lhs->is_dot()
+                && std::find(names.begin(), names.end(), lhs->get_id()) == names.end()) {
+            names.push_back(lhs->get_id());
+        }
+    }
+    node.for_each_child([&](const Node::Ptr &child) { collect_assigned(*child, names); });
+}
+
+class Lowering {
+public:
+    Lowering(kiraz::WasmContext &ctx, Function &fn) : m_ctx(ctx), m_fn(fn) {
+        if (fn.block_count() == 0) {
+            fn.add_block();
+        }
+        ctx.frame().locals.clear();
+        ctx.frame().temps.clear();
+    }
+
+    Node::Ptr func(const ast::Func &func);
+    Node::Ptr init(const kiraz::ClassLayout &cls);
+
+private:
+    using Vars = std::unordered_map<std::string, Slots>;
+
+    Node::Ptr stmt_list(const Node::Ptr &node);
+    Node::Ptr stmt(const Node::Ptr &node);
+    Node::Ptr let(const ast::Let &let);
+    Node::Ptr assign(const Node::Ptr &node);
+    Node::Ptr if_stmt(const ast::If &stmt);
+    Node::Ptr while_stmt(const ast::While &stmt);
+
+    Node::Ptr expr(const Node::Ptr &node, Slots &out);
+    Node::Ptr id(const Node::Ptr &node, Slots &out);
+    Node::Ptr binary(const Node::Ptr &node, Slots &out);
+    Node::Ptr call(const Node::Ptr &node, Slots &out);
+    Node::Ptr args(const std::vector<Node::Ptr> &args, std::vector<ValueId> &out);
+    Node::Ptr condition(const Node::Ptr &node, ValueId &out);
+    void memory_call(std::string_view method, const std::vector<ValueId> &args, Slots &out);
+
+    Slots load(ValueId address, const kiraz::FieldLayout &field);
+    Node::Ptr store(ValueId address, const kiraz::FieldLayout &field, const Node::Ptr &value);
+    const kiraz::FieldLayout *find_field(const ast::Dot &dot) const;
+
+    ValueId add(Op op, Type type, std::initializer_list<ValueId> operands = {}, int64_t imm = 0) {
+        return m_fn.add(m_block, op, type, operands, imm);
+    }
+    ValueId constant(Type type, int64_t value) { return m_fn.add_const(m_block, type, value); }
+    Slots zero(std::span<const Type> types);
+    Slots call(std::string name, std::span<const Type> results, std::span<const ValueId> args,
+            bool pure = false);
+    void bounds_check(ValueId offset, ValueId length);
+    ValueId element_address(ValueId offset, int64_t size);
+
+    Slots sequence(const kiraz::strength::Sequence &code, ValueId x);
+
+    // Joins the variables of before at the start of b, from vars at the end
+    // of each of its predecessors
+    void merge(BlockId b, const Vars &before, const std::vector<std::pair<BlockId, Vars>> &vars);
+
+    void finish_function();
+
+    template <typename... Args>
+    Node::Ptr error(const Node::Ptr &node, fmt::format_string<Args...> fmt, Args &&...args) {
+        node->set_error(fmt::format(fmt, std::forward<Args>(args)...));
+        return node;
+    }
+
+    kiraz::WasmContext &m_ctx;
+    Function &m_fn;
+    BlockId m_block = Function::ENTRY;
+    Vars m_vars;
+};
+
+Slots Lowering::zero(std::span<const Type> types) {
+    Slots retval;
+    if (types.size() == 1) {
+        retval = constant(types[0], 0);
+    }
+    else if (types.size() == 2) {
+        retval = {constant(types[0], 0), constant(types[1], 0)};
+    }
+    return retval;
+}
+
+Slots Lowering::call(std::string name, std::span<const Type> results,
+        std::span<const ValueId> args, bool pure) {
+    auto v = m_fn.add_call(
+            m_block, {std::move(name), {results.begin(), results.end()}, pure}, args);
+    if (results.size() == 2) {
+        return {v, v + 1};
+    }
+    return results.empty() ? Slots() : Slots(v);
+}
+
+Node::Ptr Lowering::func(const ast::Func &func) {
+    auto &frame = m_ctx.frame();
+    const auto &func_name = func.get_name()->get_id();
+
+    if (! frame.self.empty()) {
+        m_vars["this"] = m_fn.add_param("this", Type::I32);
+        frame.locals["this"] = frame.self;
+    }
+
+    for (auto &arg : call_args(func.get_args())) {
+        const auto &farg = static_cast<const ast::FArg &>(*arg);
+        const auto &arg_name = farg.get_name()->get_id();
+        const auto &arg_type = farg.get_type()->get_id();
+        auto types = slot_types(arg_type);
+        if (types.size() == 2) {
+            m_vars[arg_name] = {m_fn.add_param(arg_name, types[0]),
+                    m_fn.add_param(arg_name + ".len", types[1])};
+        }
+        else if (types.size() == 1) {
+            m_vars[arg_name] = m_fn.add_param(arg_name, types[0]);
+        }
+        frame.locals[arg_name] = arg_type;
+    }
+
+    auto ret_type = func.get_ret_type() ? func.get_ret_type()->get_id() : "Void";
+    for (auto type : slot_types(ret_type)) {
+        m_fn.add_result(type);
+    }
+
+    if (func_name == "main" && frame.self.empty() && m_ctx.get_runtime_options().reset_heap) {
+        m_ctx.use_runtime();
+        call("__reset", {}, {});
+    }
+
+    if (auto ret = stmt_list(func.get_scope())) {
+        return ret;
+    }
+    finish_function();
+    return nullptr;
+}
+
+Node::Ptr Lowering::init(const kiraz::ClassLayout &cls) {
+    auto &frame = m_ctx.frame();
+    frame.self = cls.get_name();
+    frame.locals["this"] = cls.get_name();
+
+    auto self = m_fn.add_param("this", Type::I32);
+    m_vars["this"] = self;
+    for (auto &field : cls.get_fields()) {
+        if (field.init) {
+            if (auto ret = store(self, field, field.init)) {
+                return ret;
+            }
+        }
+    }
+    finish_function();
+    return nullptr;
+}
+
+void Lowering::finish_function() {
+    if (m_fn.is_terminated(m_block)) {
+        return;
+    }
+    // Functions with results that get here have not returned on some path.
+    if (m_fn.get_results().empty()) {
+        m_fn.ret(m_block, {});
+    }
+    else {
+        m_fn.unreachable(m_block);
+    }
+}
+
+Node::Ptr Lowering::stmt_list(const Node::Ptr &node) {
+    if (! node) {
+        return nullptr;
+    }
+    if (! node->is_stmt_list()) {
+        return stmt(node);
+    }
+
+    // Variables declared here go out of scope at the end, uncovering the ones
+    // they hide.
+    auto &frame = m_ctx.frame();
+    std::vector<std::pair<std::string, std::optional<std::pair<Slots, std::string>>>> hidden;
+
+    const auto &stmts = static_cast<const ast::StmtList &>(*node).get_stmts();
+    for (auto &s : stmts) {
+        if (auto let = dynamic_cast<const ast::Let *>(s.get())) {
+            const auto &name = let->get_name()->get_id();
+            if (std::none_of(hidden.begin(), hidden.end(),
+                        [&](const auto &entry) { return entry.first == name; })) {
+                auto var = m_vars.find(name);
+                auto type = frame.find_local(name);
+                hidden.emplace_back(name, std::nullopt);
+                if (var != m_vars.end() && type) {
+                    hidden.back().second.emplace(var->second, *type);
+                }
+            }
+        }
+        if (auto ret = stmt(s)) {
+            return ret;
+        }
+    }
+
+    // Instances that only ever have their members used here go back to the
+    // allocator at the end of the block. Early returns leave them to the heap.
+    for (auto it = stmts.begin(); it != stmts.end(); ++it) {
+        auto let = std::dynamic_pointer_cast<ast::Let>(*it);
+        if (! let || let->get_init() || ! let->get_type()) {
+            continue;
+        }
+        const auto &var_name = let->get_name()->get_id();
+        auto cls = m_ctx.get_layout().find_class(let->get_type()->get_id());
+        if (! cls || cls->leaks_this()
+                || ! std::all_of(std::next(it), stmts.end(), [&](const Node::Ptr &stmt) {
+                       return kiraz::only_dereferenced(*stmt, var_name);
+                   })) {
+            continue;
+        }
+        ValueId args[] = {m_vars.at(var_name)[0], constant(Type::I32, cls->get_size())};
+        call("__free", {}, args);
+    }
+
+    for (auto &[name, outer] : hidden) {
+        if (outer) {
+            m_vars[name] = outer->first;
+            frame.locals[name] = outer->second;
+        }
+        else {
+            m_vars.erase(name);
+        }
+    }
+    return nullptr;
+}
+
+Node::Ptr Lowering::stmt(const Node::Ptr &node) {
+    if (auto let = dynamic_cast<const ast::Let *>(node.get())) {
+        return this->let(*let);
+    }
+    if (node->is_assign()) {
+        return assign(node);
+    }
+    if (node->is_if()) {
+        return if_stmt(static_cast<const ast::If &>(*node));
+    }
+    if (node->is_while()) {
+        return while_stmt(static_cast<const ast::While &>(*node));
+    }
+    if (node->is_stmt_list()) {
+        return stmt_list(node);
+    }
+    if (node->is_return()) {
+        Slots value;
+        if (auto ret_value = static_cast<const ast::Return &>(*node).get_value()) {
+            if (auto ret = expr(ret_value, value)) {
+                return ret;
+            }
+        }
+        std::vector<ValueId> values(value.begin(), value.end());
+        m_fn.ret(m_block, values);
+        // Whatever follows is unreachable.
+        m_block = m_fn.add_block();
+        return nullptr;
+    }
+
+    // Calls made for their side effects. Unused values are dropped later.
+    Slots unused;
+    return expr(node, unused);
+}
+
+Node::Ptr Lowering::let(const ast::Let &let) {
+    auto &frame = m_ctx.frame();
+    const auto &var_name = let.get_name()->get_id();
+    auto type = let.get_type() ? let.get_type()->get_id()
+            : let.get_init()   ? kiraz::type_of(m_ctx, *let.get_init())
+                               : "";
+    auto kind = kiraz::kind_of(type);
+
+    Slots value;
+    if (let.get_init()) {
+        if (auto ret = expr(let.get_init(), value)) {
+            return ret;
+        }
+    }
+    else if (kind == ValueKind::Object) {
+        auto cls = m_ctx.get_layout().find_class(type);
+        if (! cls && ! kiraz::is_memory_class(type)) {
+            return error(let.get_type(), "Identifier '{}' is not found", type);
+        }
+        if (cls) {
+            m_ctx.use_runtime();
+            ValueId size = constant(Type::I32, cls->get_size());
+            static constexpr Type ADDRESS[] = {Type::I32};
+            value = call("__alloc", ADDRESS, std::span(&size, 1));
+            ValueId self = value[0];
+            call(FF("{}.__init", type), {}, std::span(&self, 1));
+        }
+    }
+    else {
+        value = zero(slot_types(kind));
+    }
+
+    m_vars[var_name] = value;
+    frame.locals[var_name] = type;
+    return nullptr;
+}
+
+Node::Ptr Lowering::assign(const Node::Ptr &node) {
+    const auto &assignment = static_cast<const ast::Assignment &>(*node);
+    const auto &lhs = assignment.get_lhs();
+    const auto &rhs = assignment.get_rhs();
+
+    if (lhs->is_dot()) {
+        const auto &dot = static_cast<const ast::Dot &>(*lhs);
+        auto field = find_field(dot);
+        if (! field) {
+            return error(node, "Identifier '{}.{}' is not found",
+                    kiraz::type_of(m_ctx, *dot.get_lhs()), dot.get_rhs()->get_id());
+        }
+        Slots object;
+        if (auto ret = expr(dot.get_lhs(), object)) {
+            return ret;
+        }
+        return store(object[0], *field, rhs);
+    }
+
+    const auto &name = lhs->get_id();
+    if (auto var = m_vars.find(name); var != m_vars.end()) {
+        Slots value;
+        if (auto ret = expr(rhs, value)) {
+            return ret;
+        }
+        m_vars[name] = value;
+        return nullptr;
+    }
+
+    // A field of this, inside a method
+    auto cls = m_ctx.get_layout().find_class(m_ctx.frame().self);
+    auto field = cls ? cls->find_field(name) : nullptr;
+    if (! field) {
+        return error(node, "Identifier '{}' is not found", name);
+    }
+    return store(m_vars.at("this")[0], *field, rhs);
+}
+
+Node::Ptr Lowering::condition(const Node::Ptr &node, ValueId &out) {
+    Slots value;
+    if (auto ret = expr(node, value)) {
+        return ret;
+    }
+    if (value.empty()) {
+        return error(node, "Condition has no value");
+    }
+    out = value[0];
+    if (m_fn[out].type == Type::I64) {
+        out = add(Op::Ne, Type::I32, {out, constant(Type::I64, 0)});
+    }
+    return nullptr;
+}
+
+void Lowering::merge(BlockId b, const Vars &before,
+        const std::vector<std::pair<BlockId, Vars>> &vars) {
+    m_vars = before;
+    if (vars.empty()) {
+        return;
+    }
+
+    const auto &preds = m_fn.block(b).preds;
+    std::vector<const Vars *> incoming;
+    for (auto pred : preds) {
+        auto iter = std::find_if(
+                vars.begin(), vars.end(), [&](const auto &entry) { return entry.first == pred; });
+        assert(iter != vars.end());
+        incoming.push_back(&iter->second);
+    }
+
+    std::vector<ValueId> operands(preds.size());
+    for (auto &[name, slots] : m_vars) {
+        std::array<ValueId, 2> joined = {NONE, NONE};
+        for (size_t i = 0; i < slots.size(); ++i) {
+            for (size_t p = 0; p < preds.size(); ++p) {
+                operands[p] = incoming[p]->at(name)[i];
+            }
+            if (std::all_of(operands.begin(), operands.end(),
+                        [&](ValueId v) { return v == operands[0]; })) {
+                joined[i] = operands[0];
+                continue;
+            }
+            joined[i] = m_fn.add_phi(b, m_fn[operands[0]].type);
+            m_fn.set_operands(joined[i], operands);
+        }
+        if (slots.size() == 1) {
+            slots = joined[0];
+        }
+        else if (slots.size() == 2) {
+            slots = {joined[0], joined[1]};
+        }
+    }
+}
+
+Node::Ptr Lowering::if_stmt(const ast::If &stmt) {
+    ValueId cond;
+    if (auto ret = condition(stmt.get_cond(), cond)) {
+        return ret;
+    }
+
+    // The parser gives ifs without else an empty one.
+    auto else_list = stmt.get_else();
+    if (else_list && else_list->is_stmt_list()
+            && static_cast<const ast::StmtList &>(*else_list).get_stmts().empty()) {
+        else_list = nullptr;
+    }
+
+    auto then_block = m_fn.add_block();
+    auto join = m_fn.add_block();
+    auto else_block = else_list ? m_fn.add_block() : join;
+    m_fn.cond_br(m_block, cond, then_block, else_block);
+
+    auto before = m_vars;
+    std::vector<std::pair<BlockId, Vars>> vars;
+    if (! else_list) {
+        vars.emplace_back(m_block, before);
+    }
+
+    for (auto [block, list] :
+            {std::pair(then_block, stmt.get_then()), std::pair(else_block, else_list)}) {
+        if (block == join) {
+            continue;
+        }
+        m_block = block;
+        m_vars = before;
+        if (auto ret = stmt_list(list)) {
+            return ret;
+        }
+        if (! m_fn.is_terminated(m_block)) {
+            m_fn.br(m_block, join);
+            vars.emplace_back(m_block, std::move(m_vars));
+        }
+    }
+
+    merge(join, before, vars);
+    m_block = join;
+    return nullptr;
+}
+
+Node::Ptr Lowering::while_stmt(const ast::While &stmt) {
+    auto header = m_fn.add_block();
+    auto preheader = m_block;
+    m_fn.br(preheader, header);
+
+    // Whatever the body assigns gets a phi, to be filled in once the body
+    // is done. The ones that turn out not to change are removed later.
+    std::vector<std::string> assigned;
+    if (stmt.get_repeat()) {
+        collect_assigned(*stmt.get_repeat(), assigned);
+    }
+    auto before = m_vars;
+    std::vector<std::pair<std::string, std::array<ValueId, 2>>> phis;
+    for (auto &name : assigned) {
+        auto var = m_vars.find(name);
+        if (var == m_vars.end()) {
+            continue;
+        }
+        std::array<ValueId, 2> phi = {NONE, NONE};
+        for (size_t i = 0; i < var->second.size(); ++i) {
+            phi[i] = m_fn.add_phi(header, m_fn[var->second[i]].type);
+        }
+        var->second = var->second.size() == 2 ? Slots(phi[0], phi[1]) : Slots(phi[0]);
+        phis.emplace_back(name, phi);
+    }
+
+    m_block = header;
+    ValueId cond;
+    if (auto ret = condition(stmt.get_cond(), cond)) {
+        return ret;
+    }
+    auto body = m_fn.add_block();
+    auto exit = m_fn.add_block();
+    m_fn.cond_br(m_block, cond, body, exit);
+    auto at_header = m_vars;
+
+    m_block = body;
+    if (auto ret = stmt_list(stmt.get_repeat())) {
+        return ret;
+    }
+    if (! m_fn.is_terminated(m_block)) {
+        m_fn.br(m_block, header);
+    }
+
+    const auto &preds = m_fn.block(header).preds;
+    std::vector<ValueId> operands(preds.size());
+    for (auto &[name, phi] : phis) {
+        for (size_t i = 0; i < 2 && phi[i] != NONE; ++i) {
+            for (size_t p = 0; p < preds.size(); ++p) {
+                operands[p] = (preds[p] == preheader ? before : m_vars).at(name)[i];
+            }
+            m_fn.set_operands(phi[i], operands);
+        }
+    }
+
+    m_vars = std::move(at_header);
+    m_block = exit;
+    return nullptr;
+}
+
+Node::Ptr Lowering::expr(const Node::Ptr &node, Slots &out) {
+    out = {};
+    if (auto value = dynamic_cast<const ast::Integer *>(node.get())) {
+        out = constant(Type::I64, value->get_value());
+        return nullptr;
+    }
+    if (auto value = dynamic_cast<const ast::Boolean *>(node.get())) {
+        out = constant(Type::I32, value->get_value());
+        return nullptr;
+    }
+    if (auto value = dynamic_cast<const ast::String *>(node.get())) {
+        // Strings are passed around as (address, length)
+        auto coords = m_ctx.add_to_memory(value->get_value());
+        out = {add(Op::Address, Type::I32, {}, coords.offset), constant(Type::I32, coords.length)};
+        return nullptr;
+    }
+    if (auto sign = dynamic_cast<const ast::Signed *>(node.get())) {
+        if (auto value = std::dynamic_pointer_cast<ast::Integer>(sign->get_operand());
+                value && sign->is_negative()) {
+            out = constant(Type::I64, 0 - static_cast<uint64_t>(value->get_value()));
+            return nullptr;
+        }
+        if (auto ret = expr(sign->get_operand(), out)) {
+            return ret;
+        }
+        if (sign->is_negative()) {
+            out = add(Op::Sub, Type::I64, {constant(Type::I64, 0), out[0]});
+        }
+        return nullptr;
+    }
+    if (dynamic_cast<const ast::Id *>(node.get())) {
+        return id(node, out);
+    }
+    if (dynamic_cast<const ast::BinaryOp *>(node.get())) {
+        return binary(node, out);
+    }
+    if (node->is_dot()) {
+        const auto &dot = static_cast<const ast::Dot &>(*node);
+        auto field = find_field(dot);
+        if (! field) {
+            return error(node, "Identifier '{}.{}' is not found",
+                    kiraz::type_of(m_ctx, *dot.get_lhs()), dot.get_rhs()->get_id());
+        }
+        Slots object;
+        if (auto ret = expr(dot.get_lhs(), object)) {
+            return ret;
+        }
+        out = load(object[0], *field);
+        return nullptr;
+    }
+    if (node->is_call()) {
+        return call(node, out);
+    }
+    return nullptr;
+}
+
+Node::Ptr Lowering::id(const Node::Ptr &node, Slots &out) {
+    const auto &name = node->get_id();
+    if (name == "true" || name == "false") {
+        out = constant(Type::I32, name == "true");
+        return nullptr;
+    }
+
+    if (auto var = m_vars.find(name); var != m_vars.end()) {
+        out = var->second;
+        return nullptr;
+    }
+
+    // Fields of this, inside methods
+    auto cls = m_ctx.get_layout().find_class(m_ctx.frame().self);
+    if (auto field = cls ? cls->find_field(name) : nullptr) {
+        out = load(m_vars.at("this")[0], *field);
+        return nullptr;
+    }
+
+    return error(node, "Identifier '{}' is not found", name);
+}
+
+Node::Ptr Lowering::binary(const Node::Ptr &node, Slots &out) {
+    const auto &op = static_cast<const ast::BinaryOp &>(*node);
+    auto type = kiraz::type_of(m_ctx, *op.get_left());
+    auto opcode = binary_opcode(op.get_kind(), kiraz::kind_of(type));
+    if (! opcode.defined) {
+        return error(node, "Operator '{}' is not defined for type '{}'", op.get_op_symbol(), type);
+    }
+
+    if (auto reduced = strength_reduce(op)) {
+        Slots x;
+        if (auto ret = expr(reduced->operand, x)) {
+            return ret;
+        }
+        out = sequence(reduced->code, x[0]);
+        return nullptr;
+    }
+
+    Slots left, right;
+    if (auto ret = expr(op.get_left(), left)) {
+        return ret;
+    }
+    if (auto ret = expr(op.get_right(), right)) {
+        return ret;
+    }
+    auto operand_type = m_fn[left[0]].type;
+    out = add(opcode.op, op.is_comparison() ? Type::I32 : operand_type, {left[0], right[0]});
+    return nullptr;
+}
+
+Slots Lowering::sequence(const kiraz::strength::Sequence &code, ValueId x) {
+    using kiraz::strength::Opcode;
+
+    std::vector<ValueId> stack = {x};
+    std::vector<ValueId> temps(kiraz::strength::count_temps(code), NONE);
+    for (const auto &insn : code) {
+        switch (insn.op) {
+        case Opcode::Const:
+            stack.push_back(constant(Type::I64, insn.imm));
+            break;
+        case Opcode::Get:
+            stack.push_back(temps[insn.imm]);
+            break;
+        case Opcode::Set:
+            temps[insn.imm] = stack.back();
+            stack.pop_back();
+            break;
+        case Opcode::Tee:
+            temps[insn.imm] = stack.back();
+            break;
+        default: {
+            auto b = stack.back();
+            stack.pop_back();
+            auto a = stack.back();
+            stack.back() = add(strength_op(insn.op), Type::I64, {a, b});
+            break;
+        }
+        }
+    }
+    assert(stack.size() == 1);
+    return stack.back();
+}
+
+Node::Ptr Lowering::args(const std::vector<Node::Ptr> &args, std::vector<ValueId> &out) {
+    for (auto &arg : args) {
+        Slots value;
+        if (auto ret = expr(arg, value)) {
+            return ret;
+        }
+        out.insert(out.end(), value.begin(), value.end());
+    }
+    return nullptr;
+}
+
+Node::Ptr Lowering::call(const Node::Ptr &node, Slots &out) {
+    const auto &callee = static_cast<const ast::Call &>(*node);
+    const auto &name = callee.get_name();
+    const auto &arg_nodes = call_args(callee.get_args());
+    const auto &layout = m_ctx.get_layout();
+    const auto &frame = m_ctx.frame();
+
+    std::vector<ValueId> values;
+    if (name->is_dot()) {
+        const auto &dot = static_cast<const ast::Dot &>(*name);
+        const auto &method = dot.get_rhs()->get_id();
+
+        if (dot.get_lhs()->get_id() == "io" && method == "print") {
+            if (arg_nodes.empty()) {
+                return nullptr;
+            }
+            if (auto ret = args({arg_nodes[0]}, values)) {
+                return ret;
+            }
+            switch (kiraz::kind_of(kiraz::type_of(m_ctx, *arg_nodes[0]))) {
+            case ValueKind::String:
+                call("io_print_s", {}, values);
+                break;
+            case ValueKind::Boolean:
+                call("io_print_b", {}, values);
+                break;
+            default:
+                call("io_print_i", {}, values);
+                break;
+            }
+            return nullptr;
+        }
+
+        // Static dispatch: the class of the receiver is known here.
+        auto type = kiraz::type_of(m_ctx, *dot.get_lhs());
+        auto cls = layout.find_class(type);
+        if (! cls && kiraz::is_memory_class(type) && kiraz::find_memory_method(method)) {
+            if (auto ret = args(arg_nodes, values)) {
+                return ret;
+            }
+            memory_call(method, values, out);
+            return nullptr;
+        }
+        auto ret_type = cls ? cls->find_method(method) : nullptr;
+        if (! ret_type) {
+            return error(node, "Identifier '{}.{}' is not found", type, method);
+        }
+        Slots self;
+        if (auto ret = expr(dot.get_lhs(), self)) {
+            return ret;
+        }
+        values.push_back(self[0]);
+        if (auto ret = args(arg_nodes, values)) {
+            return ret;
+        }
+        out = call(FF("{}.{}", type, method), slot_types(*ret_type), values);
+        return nullptr;
+    }
+
+    // Other methods of the same class, called without a receiver
+    const auto &func_name = name->get_id();
+    auto cls = layout.find_class(frame.self);
+    auto ret_type = cls ? cls->find_method(func_name) : nullptr;
+    bool is_method = ret_type;
+    if (is_method) {
+        values.push_back(m_vars.at("this")[0]);
+    }
+    else {
+        ret_type = layout.find_function(func_name);
+    }
+    if (auto ret = args(arg_nodes, values)) {
+        return ret;
+    }
+    auto results = ret_type ? slot_types(*ret_type) : std::span<const Type>();
+    if (is_method) {
+        out = call(FF("{}.{}", frame.self, func_name), results, values);
+    }
+    else {
+        out = call(func_name, results, values, layout.is_pure(func_name));
+    }
+    return nullptr;
+}
+
+// Traps unless [offset, offset + length) is in memory. Offsets and lengths of
+// 2^32 and up are out of bounds anyway, so their high halves are or'ed into
+// the end to be caught by the same compare, negative numbers included.
+void Lowering::bounds_check(ValueId offset, ValueId length) {
+    auto end = add(Op::Add, Type::I64, {offset, length});
+    auto high = add(Op::And, Type::I64,
+            {add(Op::Or, Type::I64, {offset, length}), constant(Type::I64, -4294967296)});
+    auto size = add(Op::Shl, Type::I64,
+            {add(Op::ExtendU, Type::I64, {add(Op::MemorySize, Type::I32)}),
+                    constant(Type::I64, 16)});
+    add(Op::TrapIf, Type::Void,
+            {add(Op::GtU, Type::I32, {add(Op::Or, Type::I64, {end, high}), size})});
+}
+
+// The address of size bytes at offset, trapping unless they are in memory.
+// Memory is never smaller than a page, so the check is one compare.
+ValueId Lowering::element_address(ValueId offset, int64_t size) {
+    auto end = add(Op::Shl, Type::I64,
+            {add(Op::ExtendU, Type::I64, {add(Op::MemorySize, Type::I32)}),
+                    constant(Type::I64, 16)});
+    add(Op::TrapIf, Type::Void,
+            {add(Op::GtU, Type::I32,
+                    {offset, add(Op::Sub, Type::I64, {end, constant(Type::I64, size)})})});
+    return add(Op::Wrap, Type::I32, {offset});
+}
+
+void Lowering::memory_call(std::string_view method, const std::vector<ValueId> &args, Slots &out) {
+    if (method == "size") {
+        out = add(Op::Shl, Type::I64,
+                {add(Op::ExtendU, Type::I64, {add(Op::MemorySize, Type::I32)}),
+                        constant(Type::I64, 16)});
+        return;
+    }
+
+    auto offset = args[0];
+    if (method == "load8" || method == "load64") {
+        auto address = element_address(offset, method == "load8" ? 1 : 8);
+        auto load = method == "load8" ? add(Op::Load8U, Type::I32, {address})
+                                      : add(Op::Load, Type::I64, {address});
+        m_fn.set_raw(load);
+        out = method == "load8" ? add(Op::ExtendU, Type::I64, {load}) : load;
+        return;
+    }
+    if (method == "store8" || method == "store64") {
+        auto address = element_address(offset, method == "store8" ? 1 : 8);
+        auto store = method == "store8"
+                ? add(Op::Store8, Type::Void, {address, add(Op::Wrap, Type::I32, {args[1]})})
+                : add(Op::Store, Type::Void, {address, args[1]});
+        m_fn.set_raw(store);
+        return;
+    }
+    if (method == "read") {
+        auto length = args[1];
+        bounds_check(offset, length);
+        m_ctx.use_runtime();
+        static constexpr Type ADDRESS[] = {Type::I32};
+        ValueId size = add(Op::Wrap, Type::I32, {length});
+        auto address = call("__alloc", ADDRESS, std::span(&size, 1))[0];
+        add(Op::MemoryCopy, Type::Void,
+                {address, add(Op::Wrap, Type::I32, {offset}), add(Op::Wrap, Type::I32, {length})});
+        out = {address, add(Op::Wrap, Type::I32, {length})};
+        return;
+    }
+
+    assert(method == "write");
+    auto data = args[1];
+    auto size = args[2];
+    bounds_check(offset, add(Op::ExtendU, Type::I64, {size}));
+    auto address = add(Op::Wrap, Type::I32, {offset});
+    add(Op::MemoryCopy, Type::Void, {address, data, size});
+    out = {add(Op::Wrap, Type::I32, {offset}), size};
+}
+
+const kiraz::FieldLayout *Lowering::find_field(const ast::Dot &dot) const {
+    auto cls = m_ctx.get_layout().find_class(kiraz::type_of(m_ctx, *dot.get_lhs()));
+    return cls ? cls->find_field(dot.get_rhs()->get_id()) : nullptr;
+}
+
+Slots Lowering::load(ValueId address, const kiraz::FieldLayout &field) {
+    Slots retval;
+    switch (field.kind) {
+    case ValueKind::Integer64:
+        retval = add(Op::Load, Type::I64, {address}, field.offset);
+        break;
+    case ValueKind::Boolean:
+        retval = add(Op::Load8U, Type::I32, {address}, field.offset);
+        break;
+    case ValueKind::Object:
+        retval = add(Op::Load, Type::I32, {address}, field.offset);
+        break;
+    case ValueKind::String:
+        retval = {add(Op::Load, Type::I32, {address}, field.offset),
+                add(Op::Load, Type::I32, {address}, field.offset + 4)};
+        break;
+    case ValueKind::Void:
+        break;
+    }
+    if (field.immutable) {
+        for (auto v : retval) {
+            m_fn.set_invariant(v);
+        }
+    }
+    return retval;
+}
+
+Node::Ptr Lowering::store(
+        ValueId address, const kiraz::FieldLayout &field, const Node::Ptr &value) {
+    Slots slots;
+    if (auto ret = expr(value, slots)) {
+        return ret;
+    }
+    if (slots.size() != slot_types(field.kind).size()) {
+        return error(value, "Type of the value does not match field '{}'", field.name);
+    }
+
+    auto op = field.kind == ValueKind::Boolean ? Op::Store8 : Op::Store;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        add(op, Type::Void, {address, slots[i]}, field.offset + 4 * i);
+    }
+    return nullptr;
+}
+
+} // namespace
+
+Node::Ptr lower(kiraz::WasmContext &ctx, const ast::Func &func, Function &out) {
+    return Lowering(ctx, out).func(func);
+}
+
+Node::Ptr lower_init(kiraz::WasmContext &ctx, const kiraz::ClassLayout &cls, Function &out) {
+    return Lowering(ctx, out).init(cls);
+}
+
+} // namespace ir
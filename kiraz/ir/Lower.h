@@ -0,0 +1,33 @@
+#ifndef KIRAZ_IR_LOWER_H
+#define KIRAZ_IR_LOWER_H
+
+#include <kiraz/Node.h>
+#include <kiraz/ir/IR.h>
+
+namespace ast {
+class Func;
+}
+
+namespace kiraz {
+class ClassLayout;
+class WasmContext;
+} // namespace kiraz
+
+namespace ir {
+
+/**
+ * @brief lower: Builds the IR of a function, a method of ctx.frame().self if
+ * that is set. Variables become SSA values as they are assigned, with phis
+ * where control flow joins.
+ *
+ * Returns the node of the first error, if any.
+ */
+Node::Ptr lower(kiraz::WasmContext &ctx, const ast::Func &func, Function &out);
+
+// $Class.__init: stores the initial values of the fields that have one.
+// Instances come zeroed, so the rest is left alone.
+Node::Ptr lower_init(kiraz::WasmContext &ctx, const kiraz::ClassLayout &cls, Function &out);
+
+} // namespace ir
+
+#endif
@@ -0,0 +1,26 @@
+#include "Optimize.h"
+
+#include <kiraz/ir/CountedLoops.h>
+#include <kiraz/ir/LoopInvariants.h>
+#include <kiraz/ir/ProfileGuided.h>
+#include <kiraz/ir/ValueRanges.h>
+#include <kiraz/ir/ValueNumbering.h>
+
+namespace ir {
+
+void optimize(Function &fn, const OptimizeOptions &opts) {
+    if (opts.level == 0) {
+        return;
+    }
+    hoist_loop_invariants(fn);
+    if (opts.level >= 2) {
+        // Bounds and starting values of loops come out as constants.
+        number_values(fn);
+        optimize_loops(fn, opts.unroll, opts.simd);
+        use_value_ranges(fn);
+    }
+    lay_out_branches(fn);
+    number_values(fn);
+}
+
+} // namespace ir
@@ -0,0 +1,29 @@
+#ifndef KIRAZ_IR_OPTIMIZE_H
+#define KIRAZ_IR_OPTIMIZE_H
+
+#include <kiraz/ir/IR.h>
+
+namespace ir {
+
+struct OptimizeOptions {
+    // 0 emits functions as lowered. 1 hoists loop invariants, numbers values
+    // and lays out branches by their profile, 2 also runs optimize_loops of
+    // CountedLoops.h and use_value_ranges of ValueRanges.h.
+    unsigned level = 1;
+
+    // Iterations of counted loops to run at a time, at level 2
+    unsigned unroll = 4;
+
+    // Vectorizes loops over io.Memory with wasm SIMD, at level 2
+    bool simd = false;
+};
+
+/**
+ * @brief optimize: Runs the passes of opts.level over a function lowered
+ * from kiraz, before it is emitted.
+ */
+void optimize(Function &fn, const OptimizeOptions &opts);
+
+} // namespace ir
+
+#endif
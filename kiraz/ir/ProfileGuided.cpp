@@ -0,0 +1,252 @@
+#include "ProfileGuided.h"
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/Profile.h>
+#include <kiraz/Stats.h>
+#include <kiraz/ast/Operator.h>
+#include <kiraz/ir/ControlFlow.h>
+#include <kiraz/ir/Inline.h>
+#include <kiraz/ir/Lower.h>
+
+namespace ir {
+
+namespace {
+
+// Instructions of a function to inline, and of all the functions inlined into
+// one caller
+constexpr size_t INLINE_SIZE = 48;
+constexpr size_t MAX_INLINED = 512;
+
+// The cond_br instructions counted, in block order
+std::vector<ValueId> branches(const Function &fn) {
+    std::vector<ValueId> retval;
+    for (BlockId b = 0; b < fn.block_count(); ++b) {
+        const auto &insts = fn.block(b).insts;
+        if (! insts.empty() && fn[insts.back()].op == Op::CondBr) {
+            retval.push_back(insts.back());
+        }
+    }
+    return retval;
+}
+
+size_t size_of(const Function &fn) {
+    size_t retval = 0;
+    for (BlockId b = 0; b < fn.block_count(); ++b) {
+        retval += fn.block(b).insts.size();
+    }
+    return retval;
+}
+
+// Adds by to the counter at index of the counters at address counters
+void count(Function &fn, ValueId before, uint32_t counters, size_t index, ValueId by) {
+    auto address = fn.add_before(before, Op::Address, Type::I32, {}, counters);
+    auto old = fn.add_before(before, Op::Load, Type::I64, {address}, index * 8);
+    auto sum = fn.add_before(before, Op::Add, Type::I64, {old, by});
+    auto store = fn.add_before(before, Op::Store, Type::Void, {address, sum}, index * 8);
+    fn.set_raw(old);
+    fn.set_raw(store);
+}
+
+bool set_counts(Function &fn, const kiraz::Profile &profile) {
+    auto record = profile.find(fn.get_name(), shape_hash(fn));
+    auto conds = branches(fn);
+    if (! record || record->counters.size() != 1 + 2 * conds.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < conds.size(); ++i) {
+        auto runs = record->counters[1 + 2 * i];
+        auto taken = std::min(record->counters[2 + 2 * i], runs);
+        fn.set_counts(conds[i], {taken, runs - taken});
+    }
+    return true;
+}
+
+// Blocks reached on edges the profile saw taken
+std::vector<bool> find_warm_blocks(const Function &fn) {
+    ControlFlow cfg(fn);
+    std::vector<bool> retval(fn.block_count());
+    retval[Function::ENTRY] = true;
+    for (auto b : cfg.get_order()) {
+        if (! retval[b]) {
+            continue;
+        }
+        const auto &block = fn.block(b);
+        auto counts = fn.get_counts(block.insts.back());
+        for (size_t i = 0; i < block.succs.size(); ++i) {
+            if (block.succs[i] != NONE
+                    && (! counts || (i == 0 ? counts->taken : counts->not_taken) > 0)) {
+                retval[block.succs[i]] = true;
+            }
+        }
+    }
+    return retval;
+}
+
+// The opposite condition of the cond_br branch
+ValueId negate(Function &fn, ValueId branch) {
+    auto cond = fn.operands(branch)[0];
+    auto op = fn[cond].op;
+    auto x = fn.operands(cond).empty() ? NONE : fn.operands(cond)[0];
+    if (op == Op::Eqz && fn[x].type == Type::I32) {
+        return x;
+    }
+    Op inverse;
+    switch (op) {
+    case Op::Eq:
+        inverse = Op::Ne;
+        break;
+    case Op::Ne:
+        inverse = Op::Eq;
+        break;
+    case Op::LtS:
+        inverse = Op::GeS;
+        break;
+    case Op::GeS:
+        inverse = Op::LtS;
+        break;
+    case Op::GtS:
+        inverse = Op::LeS;
+        break;
+    case Op::LeS:
+        inverse = Op::GtS;
+        break;
+    default:
+        return fn.add_before(branch, Op::Eqz, Type::I32, {cond});
+    }
+    return fn.add_before(branch, inverse, Type::I32, {x, fn.operands(cond)[1]});
+}
+
+} // namespace
+
+uint64_t shape_hash(const Function &fn) {
+    // FNV-1a, 64 bit
+    uint64_t retval = 0xcbf29ce484222325ull;
+    auto add = [&](uint64_t x) {
+        retval ^= x;
+        retval *= 0x100000001b3ull;
+    };
+    add(fn.block_count());
+    for (BlockId b = 0; b < fn.block_count(); ++b) {
+        add(fn.block(b).insts.size());
+        for (auto v : fn.block(b).insts) {
+            add(uint64_t(fn[v].op) << 8 | uint64_t(fn[v].type));
+            add(fn[v].count);
+        }
+    }
+    return retval;
+}
+
+void instrument(kiraz::WasmContext &ctx, Function &fn) {
+    auto conds = branches(fn);
+    const auto &name = fn.get_name();
+    auto counters = uint32_t(1 + 2 * conds.size());
+    auto record = ctx.add_to_memory(kiraz::Profile::make_record(name, shape_hash(fn), counters));
+    auto offset = uint32_t(record.offset + kiraz::Profile::counters_offset(name));
+    ctx.add_profile_record(record, {offset, counters * 8});
+
+    const auto &entry = fn.block(Function::ENTRY).insts;
+    auto first = *std::find_if(
+            entry.begin(), entry.end(), [&](ValueId v) { return fn[v].op != Op::Param; });
+    count(fn, first, offset, 0, fn.add_before(first, Op::Const, Type::I64, {}, 1));
+
+    for (size_t i = 0; i < conds.size(); ++i) {
+        auto branch = conds[i];
+        auto cond = fn.operands(branch)[0];
+        count(fn, branch, offset, 1 + 2 * i, fn.add_before(branch, Op::Const, Type::I64, {}, 1));
+        auto zero = fn.add_before(branch, Op::Const, fn[cond].type, {}, 0);
+        auto taken = fn.add_before(branch, Op::Ne, Type::I32, {cond, zero});
+        count(fn, branch, offset, 2 + 2 * i,
+                fn.add_before(branch, Op::ExtendU, Type::I64, {taken}));
+    }
+
+    if (name != "main") {
+        return;
+    }
+    std::vector<BlockId> returns;
+    for (BlockId b = 0; b < fn.block_count(); ++b) {
+        const auto &insts = fn.block(b).insts;
+        if (! insts.empty() && fn[insts.back()].op == Op::Return) {
+            returns.push_back(b);
+        }
+    }
+    for (auto b : returns) {
+        fn.add_call(b, {"__profile_dump", {}, false}, {});
+    }
+}
+
+void use_profile(kiraz::WasmContext &ctx, Function &fn) {
+    const auto &profile = *ctx.get_profile_options().use;
+    if (! set_counts(fn, profile)) {
+        return;
+    }
+
+    const auto &layout = ctx.get_layout();
+    auto hot = [&](const std::string &name) {
+        auto entries = profile.entries(name);
+        return entries > 0 && entries >= profile.total_entries() / 100;
+    };
+    auto warm = find_warm_blocks(fn);
+    std::vector<ValueId> calls;
+    for (BlockId b = 0; b < fn.block_count(); ++b) {
+        if (! warm[b]) {
+            continue;
+        }
+        for (auto v : fn.block(b).insts) {
+            if (fn[v].op != Op::Call) {
+                continue;
+            }
+            const auto &name = fn.callee(v).name;
+            if (name != fn.get_name() && name != "main" && layout.find_definition(name)
+                    && hot(name)) {
+                calls.push_back(v);
+            }
+        }
+    }
+
+    // Callees are lowered again here, as they are in their own fragments.
+    std::unordered_map<std::string, std::optional<Function>> bodies;
+    size_t inlined = 0;
+    for (auto call : calls) {
+        auto name = fn.callee(call).name;
+        auto [iter, added] = bodies.try_emplace(name);
+        if (added) {
+            Function body(name);
+            auto frame = std::exchange(ctx.frame(), {});
+            auto error = lower(ctx, *layout.find_definition(name), body);
+            ctx.frame() = std::move(frame);
+            if (! error && size_of(body) <= INLINE_SIZE) {
+                set_counts(body, profile);
+                iter->second = std::move(body);
+            }
+        }
+        const auto &body = iter->second;
+        if (! body || inlined + size_of(*body) > MAX_INLINED) {
+            continue;
+        }
+        if (inline_call(fn, call, *body)) {
+            inlined += size_of(*body);
+            KIRAZ_STATS_INC(InlinedCalls);
+        }
+    }
+}
+
+void lay_out_branches(Function &fn) {
+    ControlFlow cfg(fn);
+    for (auto b : cfg.get_order()) {
+        auto branch = fn.block(b).insts.back();
+        auto counts = fn.get_counts(branch);
+        const auto &succs = fn.block(b).succs;
+        if (! counts || counts->not_taken <= counts->taken || cfg.is_loop_header(b)
+                || fn.block(succs[0]).preds.size() != 1 || fn.block(succs[1]).preds.size() != 1) {
+            continue;
+        }
+        fn.invert(b, negate(fn, branch));
+    }
+}
+
+} // namespace ir
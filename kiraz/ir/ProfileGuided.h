@@ -0,0 +1,44 @@
+#ifndef KIRAZ_IR_PROFILEGUIDED_H
+#define KIRAZ_IR_PROFILEGUIDED_H
+
+#include <kiraz/ir/IR.h>
+
+namespace kiraz {
+class WasmContext;
+}
+
+namespace ir {
+
+// Hash of the blocks and instructions of a function as lowered, which tells
+// whether a profile was made from the same code
+uint64_t shape_hash(const Function &fn);
+
+/**
+ * @brief instrument: Adds the counters of --profile-generate to a function
+ * just lowered: one for its entries, and for every cond_br in block order one
+ * of its executions and one of the times it went to its first successor.
+ *
+ * The counters are the record of the function in the static data of ctx, see
+ * Profile.h, and main hands the records to the host before it returns.
+ */
+void instrument(kiraz::WasmContext &ctx, Function &fn);
+
+/**
+ * @brief use_profile: Sets the branch counts of a function just lowered from
+ * the --profile-use profile of ctx, when it has a record of the same code.
+ *
+ * Calls of small functions that take one percent of the calls counted or more
+ * are then inlined, on the paths the profile saw run.
+ */
+void use_profile(kiraz::WasmContext &ctx, Function &fn);
+
+/**
+ * @brief lay_out_branches: Makes the arm of an if that ran the most the then
+ * arm, which the engine reaches without a jump. Only if-else shapes are
+ * flipped: branches to blocks with other predecessors stay as they are.
+ */
+void lay_out_branches(Function &fn);
+
+} // namespace ir
+
+#endif
@@ -0,0 +1,316 @@
+#include "ValueNumbering.h"
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+
+#include <kiraz/Stats.h>
+#include <kiraz/ir/ControlFlow.h>
+
+namespace ir {
+
+namespace {
+
+bool is_commutative(Op op) {
+    switch (op) {
+    case Op::Add:
+    case Op::Mul:
+    case Op::And:
+    case Op::Or:
+    case Op::Eq:
+    case Op::Ne:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
+
+// What an instruction computes, as far as matching goes
+struct Expr {
+    Op op;
+    Type type;
+    bool invariant;
+    int64_t imm;
+    uint32_t memory; // version of memory read, 0 if none
+    std::span<const ValueId> operands;
+
+    uint64_t hash() const {
+        uint64_t retval = mix(uint64_t(op) | uint64_t(type) << 8 | uint64_t(invariant) << 16
+                | uint64_t(memory) << 32);
+        retval = mix(retval ^ uint64_t(imm));
+        if (is_commutative(op)) {
+            for (auto v : operands) {
+                retval += mix(v + 1);
+            }
+            return retval;
+        }
+        for (auto v : operands) {
+            retval = mix(retval ^ v);
+        }
+        return retval;
+    }
+
+    bool operator==(const Expr &other) const {
+        if (op != other.op || type != other.type || invariant != other.invariant
+                || imm != other.imm || memory != other.memory
+                || operands.size() != other.operands.size()) {
+            return false;
+        }
+        if (std::equal(operands.begin(), operands.end(), other.operands.begin())) {
+            return true;
+        }
+        return is_commutative(op) && operands.size() == 2 && operands[0] == other.operands[1]
+                && operands[1] == other.operands[0];
+    }
+};
+
+class ValueNumbering {
+public:
+    explicit ValueNumbering(Function &fn)
+            : m_fn(fn), m_cfg(fn), m_repl(fn.value_count(), NONE),
+              m_memory(fn.value_count(), 0), m_exit_memory(fn.block_count(), 0) {}
+
+    size_t run();
+
+private:
+    void visit(BlockId b);
+    bool is_numbered(ValueId v) const;
+    bool writes_memory(ValueId v) const;
+    Expr expr(ValueId v) const;
+    void rename_operands(ValueId v);
+    ValueId simplify(BlockId b, ValueId v);
+    ValueId resolve(ValueId v) const {
+        while (m_repl[v] != NONE) {
+            v = m_repl[v];
+        }
+        return v;
+    }
+
+    Function &m_fn;
+    ControlFlow m_cfg;
+    std::vector<ValueId> m_repl;
+    std::vector<uint32_t> m_memory; // of loads, and of stores after them
+    std::vector<uint32_t> m_exit_memory;
+    uint32_t m_version = 0;
+
+    // Values of the blocks on the path from the entry to the current one
+    std::unordered_multimap<uint64_t, ValueId> m_table;
+    std::vector<std::pair<uint64_t, ValueId>> m_scope;
+    size_t m_removed = 0;
+};
+
+bool ValueNumbering::is_numbered(ValueId v) const {
+    switch (m_fn[v].op) {
+    case Op::Param:
+    case Op::Phi:
+    case Op::Store:
+    case Op::Store8:
+    case Op::VStore:
+    case Op::MemoryCopy:
+        return false;
+    case Op::Call:
+        return m_fn.callee(v).pure;
+    default:
+        break;
+    }
+    return ! is_terminator(m_fn[v].op);
+}
+
+bool ValueNumbering::writes_memory(ValueId v) const {
+    switch (m_fn[v].op) {
+    case Op::Store:
+    case Op::Store8:
+    case Op::VStore:
+    case Op::MemoryCopy:
+        return true;
+    case Op::Call:
+        return ! m_fn.callee(v).pure;
+    default:
+        break;
+    }
+    return false;
+}
+
+Expr ValueNumbering::expr(ValueId v) const {
+    const auto &inst = m_fn[v];
+    auto operands = m_fn.operands(v);
+    if (inst.op == Op::Store) {
+        // A load of what it stored, until memory changes again
+        return {Op::Load, m_fn[operands[1]].type, false, inst.imm, m_memory[v],
+                operands.first(1)};
+    }
+    auto memory = reads_memory(inst.op) && ! inst.invariant ? m_memory[v] : 0;
+    return {inst.op, inst.type, inst.invariant, inst.imm, memory, operands};
+}
+
+void ValueNumbering::rename_operands(ValueId v) {
+    auto operands = m_fn.operands(v);
+    if (std::none_of(operands.begin(), operands.end(),
+                [&](ValueId operand) { return m_repl[operand] != NONE; })) {
+        return;
+    }
+    std::vector<ValueId> renamed(operands.begin(), operands.end());
+    for (auto &operand : renamed) {
+        operand = resolve(operand);
+    }
+    m_fn.set_operands(v, renamed);
+}
+
+// A constant, or an operand, that v always equals, NONE if there is none
+ValueId ValueNumbering::simplify(BlockId b, ValueId v) {
+    const auto &inst = m_fn[v];
+    auto operands = m_fn.operands(v);
+    if (operands.empty() || operands.size() > 2 || inst.type == Type::Void) {
+        return NONE;
+    }
+
+    std::array<int64_t, 2> x{};
+    size_t constants = 0;
+    for (size_t i = 0; i < operands.size(); ++i) {
+        if (m_fn[operands[i]].op == Op::Const) {
+            x[i] = m_fn[operands[i]].imm;
+            ++constants;
+        }
+    }
+    if (constants == operands.size()) {
+        auto value = fold(inst.op, m_fn[operands[0]].type, std::span(x.data(), operands.size()));
+        if (! value) {
+            return NONE;
+        }
+        // Appended to the block, it is numbered in turn.
+        auto retval = m_fn.add_const(b, inst.type, *value);
+        m_repl.resize(m_fn.value_count(), NONE);
+        m_memory.resize(m_fn.value_count(), 0);
+        return retval;
+    }
+
+    // x + 0, x - 0, x | 0, shifts by 0 and x * 1
+    if (operands.size() != 2) {
+        return NONE;
+    }
+    auto is = [&](size_t i, int64_t value) {
+        return m_fn[operands[i]].op == Op::Const && x[i] == value;
+    };
+    switch (inst.op) {
+    case Op::Add:
+    case Op::Or:
+        return is(1, 0) ? operands[0] : is(0, 0) ? operands[1] : NONE;
+    case Op::Mul:
+        return is(1, 1) ? operands[0] : is(0, 1) ? operands[1] : NONE;
+    case Op::Sub:
+    case Op::Shl:
+    case Op::ShrS:
+    case Op::ShrU:
+        return is(1, 0) ? operands[0] : NONE;
+    default:
+        break;
+    }
+    return NONE;
+}
+
+void ValueNumbering::visit(BlockId b) {
+    const auto &preds = m_fn.block(b).preds;
+    auto memory = preds.size() == 1 ? m_exit_memory[preds[0]] : ++m_version;
+
+    // Folding adds constants to the block as it goes.
+    for (size_t i = 0; i < m_fn.block(b).insts.size(); ++i) {
+        auto v = m_fn.block(b).insts[i];
+        // Phis can refer to values of blocks not visited yet, they are
+        // renamed at the end.
+        if (m_fn[v].op != Op::Phi) {
+            rename_operands(v);
+            if (auto same = simplify(b, v); same != NONE) {
+                m_repl[v] = same;
+                ++m_removed;
+                continue;
+            }
+        }
+        if (reads_memory(m_fn[v].op)) {
+            m_memory[v] = memory;
+        }
+        if (writes_memory(v)) {
+            memory = ++m_version;
+            m_memory[v] = memory;
+        }
+
+        auto e = expr(v);
+        auto hash = e.hash();
+        if (is_numbered(v)) {
+            auto [first, last] = m_table.equal_range(hash);
+            auto match = std::find_if(
+                    first, last, [&](const auto &entry) { return expr(entry.second) == e; });
+            if (match != last) {
+                auto same = match->second;
+                m_repl[v] = m_fn[same].op == Op::Store ? resolve(m_fn.operands(same)[1]) : same;
+                ++m_removed;
+                continue;
+            }
+        }
+        if (is_numbered(v) || m_fn[v].op == Op::Store) {
+            m_table.emplace(hash, v);
+            m_scope.emplace_back(hash, v);
+        }
+    }
+    m_exit_memory[b] = memory;
+}
+
+size_t ValueNumbering::run() {
+    std::vector<std::vector<BlockId>> children(m_fn.block_count());
+    for (auto b : m_cfg.get_order()) {
+        if (b != Function::ENTRY) {
+            children[m_cfg.get_idom(b)].push_back(b);
+        }
+    }
+
+    // Depth first over the dominator tree, dropping the values of a subtree
+    // once it is done
+    struct Frame {
+        BlockId block;
+        size_t scope;
+        size_t next = 0;
+    };
+    std::vector<Frame> stack = {{Function::ENTRY, 0}};
+    visit(Function::ENTRY);
+    while (! stack.empty()) {
+        auto &frame = stack.back();
+        if (frame.next < children[frame.block].size()) {
+            auto child = children[frame.block][frame.next++];
+            stack.push_back({child, m_scope.size()});
+            visit(child);
+            continue;
+        }
+        while (m_scope.size() > frame.scope) {
+            auto [hash, v] = m_scope.back();
+            auto [first, last] = m_table.equal_range(hash);
+            m_table.erase(std::find_if(
+                    first, last, [&](const auto &entry) { return entry.second == v; }));
+            m_scope.pop_back();
+        }
+        stack.pop_back();
+    }
+
+    m_fn.replace_values(m_repl);
+    return m_removed;
+}
+
+} // namespace
+
+size_t number_values(Function &fn) {
+    // Values that only pass through phis unchanged match what they are.
+    fn.remove_unreachable_blocks();
+    fn.remove_trivial_phis();
+
+    auto retval = ValueNumbering(fn).run();
+    KIRAZ_STATS_ADD(RedundantValues, retval);
+    return retval;
+}
+
+} // namespace ir
@@ -0,0 +1,26 @@
+#ifndef KIRAZ_IR_VALUENUMBERING_H
+#define KIRAZ_IR_VALUENUMBERING_H
+
+#include <kiraz/ir/IR.h>
+
+namespace ir {
+
+/**
+ * @brief number_values: Global value numbering over the dominator tree. An
+ * instruction that computes what a dominating one already has is replaced
+ * with the value of that one; values used more than once end up in locals.
+ *
+ * Memory gets a new version at blocks with several predecessors and after
+ * anything that may write it. Loads match loads of the same version, and
+ * take the value of a store of that version to the same place. Invariant
+ * loads and calls of pure functions match regardless of the version.
+ * Divisions and trap_if match too: the second one is only reached if the
+ * first one did not trap.
+ *
+ * Returns the number of instructions removed.
+ */
+size_t number_values(Function &fn);
+
+} // namespace ir
+
+#endif
@@ -0,0 +1,772 @@
+#include "ValueRanges.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <unordered_map>
+
+#include <kiraz/Stats.h>
+#include <kiraz/ir/ControlFlow.h>
+
+namespace ir {
+
+namespace {
+
+constexpr int64_t I32_MIN = std::numeric_limits<int32_t>::min();
+constexpr int64_t I32_MAX = std::numeric_limits<int32_t>::max();
+
+// What a value can be, nothing while lo > hi
+struct Range {
+    int64_t lo = 1;
+    int64_t hi = 0;
+
+    bool empty() const { return lo > hi; }
+    bool is(int64_t x) const { return lo == x && hi == x; }
+    bool within(int64_t min, int64_t max) const { return ! empty() && lo >= min && hi <= max; }
+    bool operator==(const Range &) const = default;
+};
+
+Range full(Type type) {
+    if (type == Type::I32) {
+        return {I32_MIN, I32_MAX};
+    }
+    return {std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()};
+}
+
+// [lo, hi], or the whole type if that does not fit in it
+Range fit(__int128 lo, __int128 hi, Type type) {
+    auto all = full(type);
+    if (lo < all.lo || hi > all.hi) {
+        return all;
+    }
+    return {int64_t(lo), int64_t(hi)};
+}
+
+Range join(Range a, Range b) {
+    if (a.empty()) {
+        return b;
+    }
+    if (b.empty()) {
+        return a;
+    }
+    return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+}
+
+// Contradictions only come up in code that is never run, which keeps a.
+Range meet(Range a, Range b) {
+    Range retval = {std::max(a.lo, b.lo), std::min(a.hi, b.hi)};
+    return retval.empty() ? a : retval;
+}
+
+// All bits up to the highest one of x >= 0
+int64_t mask(int64_t x) {
+    return int64_t(std::bit_ceil(uint64_t(x) + 1) - 1);
+}
+
+bool is_compare(Op op) {
+    switch (op) {
+    case Op::Eq:
+    case Op::Ne:
+    case Op::LtS:
+    case Op::GtS:
+    case Op::LeS:
+    case Op::GeS:
+    case Op::GtU:
+    case Op::Eqz:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+Range compare(Op op, Range a, Range b) {
+    auto known = [](bool yes, bool no) {
+        return yes ? Range{1, 1} : no ? Range{0, 0} : Range{0, 1};
+    };
+    auto apart = a.hi < b.lo || b.hi < a.lo;
+    auto same = a.lo == a.hi && a == b;
+    switch (op) {
+    case Op::Eq:
+        return known(same, apart);
+    case Op::Ne:
+        return known(apart, same);
+    case Op::LtS:
+        return known(a.hi < b.lo, a.lo >= b.hi);
+    case Op::GtS:
+        return known(a.lo > b.hi, a.hi <= b.lo);
+    case Op::LeS:
+        return known(a.hi <= b.lo, a.lo > b.hi);
+    case Op::GeS:
+        return known(a.lo >= b.hi, a.hi < b.lo);
+    case Op::GtU:
+        // Negative numbers are above all others.
+        if (a.lo >= 0 && b.lo >= 0) {
+            return known(a.lo > b.hi, a.hi <= b.lo);
+        }
+        return known(a.hi < 0 && b.lo >= 0, a.lo >= 0 && b.hi < 0);
+    case Op::Eqz:
+        return known(a.is(0), a.lo > 0 || a.hi < 0);
+    default:
+        break;
+    }
+    return {0, 1};
+}
+
+class ValueRanges {
+public:
+    explicit ValueRanges(Function &fn)
+            : m_fn(fn), m_cfg(fn), m_ranges(fn.value_count()), m_safe(fn.value_count()),
+              m_exit(fn.block_count()) {}
+
+    bool analyze();
+    size_t simplify();
+    size_t narrow();
+
+private:
+    using Facts = std::vector<std::pair<ValueId, Range>>;
+
+    bool is_integer(ValueId v) const {
+        return m_fn[v].type == Type::I32 || m_fn[v].type == Type::I64;
+    }
+    Range get(ValueId v) const;
+    Range compute(ValueId v) const;
+    enum class Widen {
+        No,
+        ToBounds, // to the next constant the function compares with
+        ToType,
+    };
+    Range widen(Range old, Range r, Type type, Widen how) const;
+    bool visit(BlockId b, Widen how);
+    void learn(ValueId cond, bool holds);
+    void less(ValueId a, ValueId b, bool strict);
+    void restrict(ValueId v, Range r);
+
+    bool can_narrow(ValueId v) const;
+    bool fits_i32(ValueId v) const;
+
+    Function &m_fn;
+    ControlFlow m_cfg;
+    std::vector<Range> m_ranges; // where values are defined
+    std::vector<bool> m_safe; // trap_if that cannot fire
+    std::vector<Facts> m_exit; // what holds at the end of each block
+    Facts m_facts; // what holds at the instruction being looked at
+    std::vector<int64_t> m_bounds; // sorted
+};
+
+// Values facts are kept for at a time. Dropping the others only makes
+// ranges less precise.
+constexpr size_t MAX_FACTS = 64;
+
+Range ValueRanges::get(ValueId v) const {
+    const auto &inst = m_fn[v];
+    if (inst.op == Op::Const) {
+        return {inst.imm, inst.imm};
+    }
+    auto retval = m_ranges[v];
+    for (const auto &[u, fact] : m_facts) {
+        if (u == v) {
+            retval = meet(retval, fact);
+        }
+    }
+    return retval;
+}
+
+void ValueRanges::restrict(ValueId v, Range r) {
+    if (m_fn[v].op == Op::Const || ! is_integer(v)) {
+        return;
+    }
+    auto iter = std::find_if(
+            m_facts.begin(), m_facts.end(), [&](const auto &fact) { return fact.first == v; });
+    if (iter != m_facts.end()) {
+        iter->second = meet(iter->second, r);
+    }
+    else if (m_facts.size() < MAX_FACTS) {
+        m_facts.emplace_back(v, r);
+    }
+
+    // On to x of x + c, x - c and c - x, which unrolled loops compare, when
+    // those do not overflow
+    const auto &inst = m_fn[v];
+    if (inst.op != Op::Add && inst.op != Op::Sub) {
+        return;
+    }
+    auto ops = m_fn.operands(v);
+    auto c = m_fn[ops[0]].op == Op::Const ? 0 : m_fn[ops[1]].op == Op::Const ? 1 : -1;
+    if (c < 0 || m_fn[ops[1 - c]].op == Op::Const) {
+        return;
+    }
+    auto x = ops[1 - c];
+    auto rx = get(x);
+    r = get(v);
+    if (rx.empty() || r.empty()) {
+        return;
+    }
+    __int128 k = m_fn[ops[c]].imm;
+    auto all = full(inst.type);
+    if (inst.op == Op::Sub && c == 0) {
+        // c - x
+        if (k - rx.hi >= all.lo && k - rx.lo <= all.hi) {
+            restrict(x, fit(k - r.hi, k - r.lo, inst.type));
+        }
+        return;
+    }
+    if (inst.op == Op::Sub) {
+        k = -k;
+    }
+    if (rx.lo + k >= all.lo && rx.hi + k <= all.hi) {
+        restrict(x, fit(r.lo - k, r.hi - k, inst.type));
+    }
+}
+
+// a < b, or a <= b
+void ValueRanges::less(ValueId a, ValueId b, bool strict) {
+    auto ra = get(a);
+    auto rb = get(b);
+    if (ra.empty() || rb.empty()) {
+        return;
+    }
+    auto all = full(m_fn[a].type);
+    if (rb.hi > all.lo || ! strict) {
+        restrict(a, {all.lo, rb.hi - strict});
+    }
+    if (ra.lo < all.hi || ! strict) {
+        restrict(b, {ra.lo + strict, all.hi});
+    }
+}
+
+// What follows from cond being non-zero, or zero
+void ValueRanges::learn(ValueId cond, bool holds) {
+    const auto &inst = m_fn[cond];
+    auto ops = m_fn.operands(cond);
+    switch (inst.op) {
+    case Op::Eqz:
+        if (is_compare(m_fn[ops[0]].op)) {
+            learn(ops[0], ! holds);
+        }
+        else if (holds) {
+            restrict(ops[0], {0, 0});
+        }
+        else if (auto r = get(ops[0]); ! r.empty() && (r.lo == 0 || r.hi == 0)) {
+            restrict(ops[0], r.lo == 0 ? Range{1, r.hi} : Range{r.lo, -1});
+        }
+        return;
+    case Op::LtS:
+        return holds ? less(ops[0], ops[1], true) : less(ops[1], ops[0], false);
+    case Op::GtS:
+        return holds ? less(ops[1], ops[0], true) : less(ops[0], ops[1], false);
+    case Op::LeS:
+        return holds ? less(ops[0], ops[1], false) : less(ops[1], ops[0], true);
+    case Op::GeS:
+        return holds ? less(ops[1], ops[0], false) : less(ops[0], ops[1], true);
+    case Op::Eq:
+    case Op::Ne:
+        if (holds == (inst.op == Op::Eq)) {
+            auto both = meet(get(ops[0]), get(ops[1]));
+            restrict(ops[0], both);
+            restrict(ops[1], both);
+        }
+        return;
+    case Op::And:
+        // Of compares, as unrolled loops test their bounds
+        if (holds && is_compare(m_fn[ops[0]].op) && is_compare(m_fn[ops[1]].op)) {
+            learn(ops[0], true);
+            learn(ops[1], true);
+        }
+        return;
+    case Op::GtU: {
+        auto a = get(ops[0]);
+        auto b = get(ops[1]);
+        if (a.empty() || b.empty() || b.lo < 0) {
+            return;
+        }
+        if (! holds) {
+            restrict(ops[0], {0, b.hi});
+        }
+        else if (a.lo >= 0) {
+            restrict(ops[0], {b.lo + 1, a.hi});
+            restrict(ops[1], {0, a.hi - 1});
+        }
+        return;
+    }
+    default:
+        break;
+    }
+}
+
+Range ValueRanges::compute(ValueId v) const {
+    const auto &inst = m_fn[v];
+    auto ops = m_fn.operands(v);
+    auto type = inst.type;
+    if (inst.op == Op::Phi) {
+        Range retval;
+        for (auto operand : ops) {
+            retval = join(retval, get(operand));
+        }
+        return retval;
+    }
+
+    std::array<Range, 2> x;
+    for (size_t i = 0; i < ops.size() && i < x.size(); ++i) {
+        if (is_integer(ops[i])) {
+            x[i] = get(ops[i]);
+            if (x[i].empty()) {
+                return {};
+            }
+        }
+    }
+    auto [a, b] = x;
+    auto bits = type == Type::I32 ? 32 : 64;
+    auto shift = b.lo == b.hi && b.lo >= 0 && b.lo < bits ? int(b.lo) : -1;
+
+    switch (inst.op) {
+    case Op::Const:
+        return {inst.imm, inst.imm};
+    case Op::Add:
+        return fit(__int128(a.lo) + b.lo, __int128(a.hi) + b.hi, type);
+    case Op::Sub:
+        return fit(__int128(a.lo) - b.hi, __int128(a.hi) - b.lo, type);
+    case Op::Mul: {
+        __int128 corners[] = {__int128(a.lo) * b.lo, __int128(a.lo) * b.hi,
+                __int128(a.hi) * b.lo, __int128(a.hi) * b.hi};
+        auto [lo, hi] = std::minmax_element(std::begin(corners), std::end(corners));
+        return fit(*lo, *hi, type);
+    }
+    case Op::DivS:
+        if (b.lo > 0) {
+            return {std::min(a.lo / b.lo, a.lo / b.hi), std::max(a.hi / b.lo, a.hi / b.hi)};
+        }
+        break;
+    case Op::RemS:
+        // The sign of the dividend
+        if (b.lo > 0) {
+            auto max = b.hi - 1;
+            return {a.lo >= 0 ? 0 : std::max(a.lo, -max), a.hi <= 0 ? 0 : std::min(a.hi, max)};
+        }
+        break;
+    case Op::And:
+        if (a.lo >= 0 && b.lo >= 0) {
+            return {0, std::min(a.hi, b.hi)};
+        }
+        for (auto [p, q] : {std::pair(a, b), std::pair(b, a)}) {
+            if (p.lo >= 0) {
+                return q.lo == q.hi && (q.lo & mask(p.hi)) == 0 ? Range{0, 0} : Range{0, p.hi};
+            }
+        }
+        break;
+    case Op::Or:
+        if (a.lo >= 0 && b.lo >= 0) {
+            if (a.is(0) || b.is(0)) {
+                return a.is(0) ? b : a;
+            }
+            return {std::max(a.lo, b.lo), mask(std::max(a.hi, b.hi))};
+        }
+        break;
+    case Op::Shl:
+        if (shift >= 0) {
+            auto scale = __int128(1) << shift;
+            return fit(a.lo * scale, a.hi * scale, type);
+        }
+        break;
+    case Op::ShrS:
+        if (shift >= 0) {
+            return {a.lo >> shift, a.hi >> shift};
+        }
+        break;
+    case Op::ShrU:
+        if (shift >= 0 && a.lo >= 0) {
+            return {a.lo >> shift, a.hi >> shift};
+        }
+        if (shift > 0) {
+            auto max = bits == 32 ? uint64_t(std::numeric_limits<uint32_t>::max())
+                                  : std::numeric_limits<uint64_t>::max();
+            return {0, int64_t(max >> shift)};
+        }
+        break;
+    case Op::Eq:
+    case Op::Ne:
+    case Op::LtS:
+    case Op::GtS:
+    case Op::LeS:
+    case Op::GeS:
+    case Op::GtU:
+    case Op::Eqz:
+        return compare(inst.op, a, b);
+    case Op::Wrap:
+        return a.within(I32_MIN, I32_MAX) ? a : full(type);
+    case Op::ExtendU:
+        return a.lo >= 0 ? a : Range{0, std::numeric_limits<uint32_t>::max()};
+    case Op::Load8U:
+        return {0, 255};
+    case Op::MemorySize:
+        // Pages of 64 KiB, at least one
+        return {1, 65536};
+    default:
+        break;
+    }
+    return full(type);
+}
+
+// r of a phi that was old, grown further on the sides it grows
+Range ValueRanges::widen(Range old, Range r, Type type, Widen how) const {
+    if (how == Widen::No || old.empty() || r.empty()) {
+        return r;
+    }
+    auto all = full(type);
+    auto bounds = how == Widen::ToBounds ? std::span(m_bounds) : std::span<const int64_t>();
+    if (r.lo < old.lo) {
+        auto iter = std::upper_bound(bounds.begin(), bounds.end(), r.lo);
+        r.lo = iter == bounds.begin() ? all.lo : std::max(*std::prev(iter), all.lo);
+    }
+    if (r.hi > old.hi) {
+        auto iter = std::lower_bound(bounds.begin(), bounds.end(), r.hi);
+        r.hi = iter == bounds.end() ? all.hi : std::min(*iter, all.hi);
+    }
+    return r;
+}
+
+// Returns whether any range changed
+bool ValueRanges::visit(BlockId b, Widen how) {
+    m_facts = b == Function::ENTRY ? Facts() : m_exit[m_cfg.get_idom(b)];
+    const auto &preds = m_fn.block(b).preds;
+    if (preds.size() == 1) {
+        const auto &pred = m_fn.block(preds[0]);
+        auto term = pred.insts.back();
+        if (m_fn[term].op == Op::CondBr) {
+            learn(m_fn.operands(term)[0], pred.succs[0] == b);
+        }
+    }
+
+    bool changed = false;
+    for (auto v : m_fn.block(b).insts) {
+        const auto &inst = m_fn[v];
+        if (inst.op == Op::TrapIf) {
+            auto cond = m_fn.operands(v)[0];
+            m_safe[v] = get(cond).is(0);
+            learn(cond, false);
+            continue;
+        }
+        if (! is_integer(v)) {
+            continue;
+        }
+        auto r = compute(v);
+        auto old = m_ranges[v];
+        if (inst.op == Op::Phi) {
+            r = widen(old, r, inst.type, how);
+        }
+        if (r != old) {
+            m_ranges[v] = r;
+            changed = true;
+        }
+    }
+    m_exit[b] = std::move(m_facts);
+    m_facts.clear();
+    return changed;
+}
+
+bool ValueRanges::analyze() {
+    // Loops mostly stop at a constant they compare with, or next to it.
+    for (auto b : m_cfg.get_order()) {
+        for (auto v : m_fn.block(b).insts) {
+            if (! is_compare(m_fn[v].op)) {
+                continue;
+            }
+            for (auto operand : m_fn.operands(v)) {
+                if (auto c = m_fn[operand].imm; m_fn[operand].op == Op::Const
+                        && c > std::numeric_limits<int64_t>::min()
+                        && c < std::numeric_limits<int64_t>::max()) {
+                    m_bounds.insert(m_bounds.end(), {c - 1, c, c + 1});
+                }
+            }
+        }
+    }
+    std::sort(m_bounds.begin(), m_bounds.end());
+    m_bounds.erase(std::unique(m_bounds.begin(), m_bounds.end()), m_bounds.end());
+
+    auto pass = [&](Widen how) {
+        bool changed = false;
+        for (auto b : m_cfg.get_order()) {
+            changed |= visit(b, how);
+        }
+        return changed;
+    };
+
+    // Phis widened to the type can only change twice more each.
+    constexpr size_t PLAIN_PASSES = 3;
+    constexpr size_t BOUNDS_PASSES = 32;
+    constexpr size_t MAX_PASSES = 64;
+    for (size_t passes = 0;; ++passes) {
+        auto how = passes < PLAIN_PASSES ? Widen::No
+                : passes < BOUNDS_PASSES ? Widen::ToBounds
+                                         : Widen::ToType;
+        if (! pass(how)) {
+            break;
+        }
+        if (passes == MAX_PASSES) {
+            return false;
+        }
+    }
+    // Going down again from ranges that hold keeps them holding.
+    pass(Widen::No);
+    pass(Widen::No);
+    return true;
+}
+
+size_t ValueRanges::simplify() {
+    std::vector<ValueId> repl(m_fn.value_count(), NONE);
+    std::vector<ValueId> constants;
+    size_t retval = 0;
+    for (auto b : m_cfg.get_order()) {
+        for (auto v : m_fn.block(b).insts) {
+            const auto &inst = m_fn[v];
+            if (inst.op == Op::TrapIf && m_safe[v]) {
+                // Nothing uses it, it is only removed.
+                repl[v] = m_fn.operands(v)[0];
+                ++retval;
+            }
+            else if (is_integer(v) && m_ranges[v].lo == m_ranges[v].hi
+                    && ! has_side_effects(inst.op) && ! reads_memory(inst.op)
+                    && inst.op != Op::Const && inst.op != Op::Param && inst.op != Op::Result) {
+                constants.push_back(v);
+            }
+        }
+    }
+    for (auto v : constants) {
+        repl[v] = m_fn.add_const(m_fn[v].block, m_fn[v].type, m_ranges[v].lo);
+    }
+    m_fn.replace_values(repl);
+    return retval;
+}
+
+// A value the emitter can compute with i32 as well. Additions, subtractions,
+// multiplications, bitwise operations and left shifts by less than 32 give
+// the low half of their result from the low halves of their operands, the
+// others need operands that fit.
+bool ValueRanges::can_narrow(ValueId v) const {
+    const auto &inst = m_fn[v];
+    if (inst.type != Type::I64 || ! m_ranges[v].within(0, I32_MAX)) {
+        return false;
+    }
+    auto ops = m_fn.operands(v);
+    switch (inst.op) {
+    case Op::Phi:
+    case Op::Add:
+    case Op::Sub:
+    case Op::Mul:
+    case Op::And:
+    case Op::Or:
+    case Op::ExtendU:
+        return true;
+    case Op::Shl:
+        return get(ops[1]).within(0, 31);
+    case Op::ShrS:
+    case Op::ShrU:
+    case Op::DivS:
+    case Op::RemS:
+        return fits_i32(ops[0]) && fits_i32(ops[1])
+                && (inst.op == Op::DivS || inst.op == Op::RemS || get(ops[1]).within(0, 31));
+    default:
+        break;
+    }
+    return false;
+}
+
+bool ValueRanges::fits_i32(ValueId v) const {
+    return get(v).within(0, I32_MAX);
+}
+
+/**
+ * Webs of values that can be narrowed, joined by their uses of each other
+ * and by the compares between them, are narrowed together. Each web costs a
+ * wrap for every operand from outside of it, an extension for every use
+ * outside of it but by compares and wraps, and saves the wraps and the
+ * extensions in it.
+ */
+size_t ValueRanges::narrow() {
+    auto n = m_fn.value_count();
+    // Constants added by simplify
+    m_ranges.resize(n);
+    const auto &order = m_cfg.get_order();
+    std::vector<std::vector<std::pair<ValueId, uint32_t>>> users(n);
+    std::vector<bool> candidate(n);
+    for (auto b : order) {
+        for (auto v : m_fn.block(b).insts) {
+            auto ops = m_fn.operands(v);
+            for (uint32_t i = 0; i < ops.size(); ++i) {
+                users[ops[i]].emplace_back(v, i);
+            }
+            candidate[v] = can_narrow(v);
+        }
+    }
+
+    // Compares whose operands are all narrowed or small constants go to i32.
+    auto is_narrow_compare = [&](ValueId v) {
+        if (! is_compare(m_fn[v].op)) {
+            return false;
+        }
+        auto ops = m_fn.operands(v);
+        return std::all_of(ops.begin(), ops.end(), [&](ValueId operand) {
+            const auto &inst = m_fn[operand];
+            return candidate[operand]
+                    || (inst.op == Op::Const && inst.type == Type::I64 && inst.imm >= I32_MIN
+                            && inst.imm <= I32_MAX);
+        });
+    };
+
+    std::vector<ValueId> web(n);
+    std::iota(web.begin(), web.end(), 0);
+    auto find = [&](ValueId v) {
+        while (web[v] != v) {
+            v = web[v] = web[web[v]];
+        }
+        return v;
+    };
+    auto unite = [&](ValueId a, ValueId b) { web[find(a)] = find(b); };
+    for (auto b : order) {
+        for (auto v : m_fn.block(b).insts) {
+            auto ops = m_fn.operands(v);
+            if (candidate[v] || is_narrow_compare(v)) {
+                for (auto operand : ops) {
+                    if (candidate[operand]) {
+                        unite(v, operand);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<int64_t> cost(n);
+    for (ValueId v = 0; v < n; ++v) {
+        if (! candidate[v]) {
+            continue;
+        }
+        auto &c = cost[find(v)];
+        bool extended = m_fn[v].op == Op::ExtendU;
+        if (! extended) {
+            for (auto operand : m_fn.operands(v)) {
+                c += ! candidate[operand] && m_fn[operand].op != Op::Const;
+            }
+        }
+        bool used_wide = false;
+        for (auto [user, i] : users[v]) {
+            if (candidate[user] || is_narrow_compare(user)) {
+                continue;
+            }
+            if (m_fn[user].op == Op::Wrap) {
+                --c;
+            }
+            else {
+                used_wide = true;
+                c += ! extended;
+            }
+        }
+        c -= extended && ! used_wide;
+    }
+
+    std::vector<bool> narrowed(n);
+    for (ValueId v = 0; v < n; ++v) {
+        narrowed[v] = candidate[v] && cost[find(v)] < 0;
+    }
+
+    // Extensions of narrowed values are left to their other uses.
+    auto value32 = [&](ValueId v) {
+        return m_fn[v].op == Op::ExtendU ? m_fn.operands(v)[0] : v;
+    };
+    std::unordered_map<ValueId, ValueId> constants;
+    auto constant32 = [&](ValueId c) {
+        auto [iter, added] = constants.try_emplace(c, NONE);
+        if (added) {
+            iter->second = m_fn.add_const(Function::ENTRY, Type::I32, int32_t(m_fn[c].imm));
+        }
+        return iter->second;
+    };
+    // A conversion of operand i of user, in its predecessor for a phi
+    auto convert = [&](ValueId user, uint32_t i, Op op, Type type) {
+        auto operand = m_fn.operands(user)[i];
+        if (m_fn[user].op == Op::Phi) {
+            return m_fn.add(m_fn.block(m_fn[user].block).preds[i], op, type, {operand});
+        }
+        return m_fn.add_before(user, op, type, {operand});
+    };
+
+    // Conversions go into blocks as they are narrowed.
+    std::vector<ValueId> members;
+    for (auto b : order) {
+        for (auto v : m_fn.block(b).insts) {
+            if (narrowed[v]) {
+                members.push_back(v);
+            }
+        }
+    }
+
+    std::vector<ValueId> repl(n, NONE);
+    std::vector<bool> done(n); // compares already narrowed
+    size_t retval = 0;
+    for (auto v : members) {
+        if (m_fn[v].op != Op::ExtendU) {
+            std::vector<ValueId> ops(m_fn.operands(v).begin(), m_fn.operands(v).end());
+            for (uint32_t i = 0; i < ops.size(); ++i) {
+                if (narrowed[ops[i]]) {
+                    ops[i] = value32(ops[i]);
+                }
+                else if (m_fn[ops[i]].op == Op::Const) {
+                    ops[i] = constant32(ops[i]);
+                }
+                else {
+                    ops[i] = convert(v, i, Op::Wrap, Type::I32);
+                }
+            }
+            m_fn.set_operands(v, ops);
+            m_fn.set_type(v, Type::I32);
+            ++retval;
+        }
+
+        for (auto [user, i] : users[v]) {
+            if (narrowed[user]) {
+                continue;
+            }
+            if (done[user]) {
+                continue;
+            }
+            if (m_fn[user].op == Op::Wrap) {
+                repl[user] = value32(v);
+            }
+            else if (is_narrow_compare(user)) {
+                done[user] = true;
+                std::vector<ValueId> ops(
+                        m_fn.operands(user).begin(), m_fn.operands(user).end());
+                for (auto &operand : ops) {
+                    operand = narrowed[operand] ? value32(operand) : constant32(operand);
+                }
+                m_fn.set_operands(user, ops);
+            }
+            else if (m_fn[v].op != Op::ExtendU) {
+                std::vector<ValueId> ops(
+                        m_fn.operands(user).begin(), m_fn.operands(user).end());
+                ops[i] = convert(user, i, Op::ExtendU, Type::I64);
+                m_fn.set_operands(user, ops);
+            }
+        }
+    }
+    m_fn.replace_values(repl);
+    return retval;
+}
+
+} // namespace
+
+size_t use_value_ranges(Function &fn) {
+    fn.remove_unreachable_blocks();
+
+    ValueRanges ranges(fn);
+    if (! ranges.analyze()) {
+        return 0;
+    }
+    auto retval = ranges.simplify();
+    KIRAZ_STATS_ADD(RemovedChecks, retval);
+    KIRAZ_STATS_ADD(NarrowedValues, ranges.narrow());
+    return retval;
+}
+
+} // namespace ir
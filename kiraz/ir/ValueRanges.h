@@ -0,0 +1,33 @@
+#ifndef KIRAZ_IR_VALUERANGES_H
+#define KIRAZ_IR_VALUERANGES_H
+
+#include <kiraz/ir/IR.h>
+
+namespace ir {
+
+/**
+ * @brief use_value_ranges: Works out the range of every integer value and
+ * simplifies what the ranges decide.
+ *
+ * Ranges are intervals, narrowed where they are used by the conditions of
+ * the branches that lead there and by the trap_if checks already passed.
+ * Loops are analysed until their phis stop growing: after a few rounds a phi
+ * that still grows jumps to the next constant the function compares with, or
+ * to the whole type, and is narrowed again once the ranges hold.
+ *
+ * - trap_if checks that cannot fire are removed, such as bounds checks of
+ *   io.Memory that stay within the first page.
+ * - Values that can only be one constant are replaced with it, which lets
+ *   value numbering fold signed divisions of values that are never negative
+ *   into shifts.
+ * - Integer64 values between 0 and 2^31 - 1 are computed as i32 where that
+ *   saves more conversions than it adds, counting the wraps to addresses and
+ *   the extensions of bytes they replace.
+ *
+ * Returns the number of checks removed.
+ */
+size_t use_value_ranges(Function &fn);
+
+} // namespace ir
+
+#endif
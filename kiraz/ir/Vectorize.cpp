@@ -0,0 +1,870 @@
+#include "Vectorize.h"
+
+#include <algorithm>
+#include <bit>
+#include <unordered_map>
+
+namespace ir {
+
+namespace {
+
+constexpr int64_t VECTOR_BYTES = 16;
+
+// Strides of indexes, small enough for the distance they go in 2^32
+// iterations to fit in an i64
+constexpr int64_t MAX_STRIDE = 1 << 16;
+
+enum class Kind : uint8_t {
+    None, // left out of the copy: values of the header, branches, checks
+    Uniform, // the same on every iteration
+    Index, // a uniform value plus stride times the iteration
+    Address, // an index wrapped to i32, only used by loads and stores
+    Bound, // an index compared to a uniform value, only used by trap_if
+    Vector,
+    Mask, // compares, all bits of a lane set where they hold
+    Sum, // values of reductions, only used to add to them
+};
+
+struct Info {
+    Kind kind = Kind::None;
+    bool exact = false; // byte lanes: the integer is the byte, 0 to 255
+    int64_t stride = 0; // indexes, addresses and bounds
+};
+
+// A phi of the header adding term to itself, on every iteration or only
+// when the condition of the if is taken
+struct Reduction {
+    ValueId phi = NONE;
+    ValueId init = NONE;
+    ValueId next = NONE;
+    ValueId step = NONE; // phi + term
+    ValueId term = NONE;
+    ValueId merge = NONE; // the phi after the if, of step and phi
+    bool taken = true; // merge is step when the condition holds
+};
+
+struct Access {
+    ValueId inst;
+    ValueId offset; // the i64 index of the address
+    size_t position; // in program order
+};
+
+struct Check {
+    ValueId index;
+    ValueId bound;
+    int64_t stride;
+};
+
+size_t index_of(const std::vector<BlockId> &preds, BlockId b) {
+    return std::find(preds.begin(), preds.end(), b) - preds.begin();
+}
+
+std::optional<Op> vector_op(Op op) {
+    switch (op) {
+    case Op::Add:
+        return Op::VAdd;
+    case Op::Sub:
+        return Op::VSub;
+    case Op::Mul:
+        return Op::VMul;
+    case Op::And:
+        return Op::VAnd;
+    case Op::Or:
+        return Op::VOr;
+    case Op::Shl:
+        return Op::VShl;
+    case Op::ShrS:
+        return Op::VShrS;
+    case Op::ShrU:
+        return Op::VShrU;
+    case Op::Eq:
+    case Op::Eqz:
+        return Op::VEq;
+    case Op::Ne:
+        return Op::VNe;
+    case Op::LtS:
+        return Op::VLt;
+    case Op::GtS:
+    case Op::GtU:
+        return Op::VGt;
+    case Op::LeS:
+        return Op::VLe;
+    case Op::GeS:
+        return Op::VGe;
+    default:
+        break;
+    }
+    return std::nullopt;
+}
+
+bool is_compare(Op op) { return op >= Op::Eq && op <= Op::Eqz; }
+
+class Vectorizer {
+public:
+    Vectorizer(Function &fn, const Loop &loop)
+            : m_fn(fn), m_loop(loop), m_info(fn.value_count()) {}
+
+    bool analyze();
+    void build();
+
+private:
+    bool find_body();
+    bool find_phis();
+    bool classify(ValueId v);
+    bool classify_vector(ValueId v);
+    bool check_uses() const;
+
+    Info info(ValueId v) const;
+    bool in_loop(ValueId v) const { return m_loop.contains(m_fn[v].block); }
+    bool is_byte(ValueId v) const;
+    bool taken(BlockId pred) const;
+
+    // Values in the check block and the vector loop
+    ValueId uniform(ValueId v) const;
+    ValueId scalar_i32(ValueId v);
+    ValueId splat(ValueId v);
+    ValueId vector(ValueId v);
+    ValueId index(ValueId v, size_t at);
+    ValueId check_add(Op op, Type type, std::initializer_list<ValueId> operands = {},
+            int64_t imm = 0) {
+        return m_fn.add(m_check, op, type, operands, imm);
+    }
+    ValueId check_const(int64_t value) { return m_fn.add_const(m_check, Type::I64, value); }
+    ValueId body_add(Op op, Type type, std::initializer_list<ValueId> operands, int64_t imm = 0) {
+        return m_fn.add(m_body, op, type, operands, imm);
+    }
+    void emit(ValueId v);
+
+    Function &m_fn;
+    const Loop &m_loop;
+    std::vector<Info> m_info;
+
+    BlockId m_branch = NONE; // the block ending in the if, if there is one
+    std::vector<ValueId> m_order; // of the body, in program order
+    std::vector<Reduction> m_reductions;
+    std::vector<Access> m_accesses;
+    std::vector<Check> m_checks;
+    std::vector<ValueId> m_ranged; // uniform values that have to be bytes
+    ValueId m_store = NONE;
+
+    int64_t m_size = 0; // of the elements loaded and stored
+    Lanes m_lanes = Lanes::I8x16;
+    int64_t m_factor = 0; // iterations at a time
+
+    BlockId m_check = NONE;
+    BlockId m_body = NONE;
+    std::unordered_map<ValueId, ValueId> m_uniform;
+    std::unordered_map<ValueId, ValueId> m_splat;
+    std::unordered_map<ValueId, ValueId> m_vector;
+    // Indexes on the first iteration, after the last one, and in the vector
+    // loop
+    std::array<std::unordered_map<ValueId, ValueId>, 3> m_index;
+    std::unordered_map<ValueId, ValueId> m_next; // of the phis of the vector loop
+    ValueId m_zero = NONE;
+};
+
+Info Vectorizer::info(ValueId v) const {
+    if (! in_loop(v)) {
+        return {Kind::Uniform};
+    }
+    return m_info[v];
+}
+
+bool Vectorizer::is_byte(ValueId v) const {
+    auto x = info(v);
+    if (x.kind == Kind::Uniform) {
+        return m_fn[v].op == Op::Const && m_fn[v].imm >= 0 && m_fn[v].imm <= 255;
+    }
+    return x.exact;
+}
+
+// Whether the edge from pred to the block after the if is taken when its
+// condition holds
+bool Vectorizer::taken(BlockId pred) const {
+    const auto &succs = m_fn.block(m_branch).succs;
+    return pred == m_branch ? succs[0] == m_loop.latch : pred == succs[0];
+}
+
+bool Vectorizer::find_body() {
+    const auto &blocks = m_loop.blocks;
+    const auto &header = m_fn.block(m_loop.header);
+    auto cond = m_fn.operands(header.insts.back())[0];
+    for (auto v : header.insts) {
+        if (m_fn[v].op != Op::Phi && v != cond && v != header.insts.back()) {
+            return false;
+        }
+    }
+
+    auto first = header.succs[0];
+    if (blocks.size() == 2) {
+        m_order = m_fn.block(first).insts;
+        return first == m_loop.latch;
+    }
+    const auto &succs = m_fn.block(first).succs;
+    if (succs[1] == NONE || succs[0] == succs[1]) {
+        return false;
+    }
+    m_branch = first;
+    m_order = m_fn.block(first).insts;
+    size_t arms = 0;
+    for (auto b : blocks) {
+        if (b == m_loop.header || b == first || b == m_loop.latch) {
+            continue;
+        }
+        const auto &block = m_fn.block(b);
+        if (b != succs[0] && b != succs[1]) {
+            return false;
+        }
+        if (block.preds.size() != 1 || block.succs[0] != m_loop.latch
+                || block.succs[1] != NONE) {
+            return false;
+        }
+        m_order.insert(m_order.end(), block.insts.begin(), block.insts.end());
+        ++arms;
+    }
+    const auto &latch = m_fn.block(m_loop.latch);
+    if (arms + 3 != blocks.size() || latch.preds.size() != 2) {
+        return false;
+    }
+    m_order.insert(m_order.end(), latch.insts.begin(), latch.insts.end());
+    return true;
+}
+
+bool Vectorizer::find_phis() {
+    const auto &preds = m_fn.block(m_loop.header).preds;
+    auto entry = index_of(preds, m_loop.preheader);
+    auto back = index_of(preds, m_loop.latch);
+    for (auto phi : m_fn.block(m_loop.header).insts) {
+        if (m_fn[phi].op != Op::Phi) {
+            break;
+        }
+        auto iv = std::find_if(m_loop.ivs.begin(), m_loop.ivs.end(),
+                [&](const auto &iv) { return iv.phi == phi; });
+        if (iv != m_loop.ivs.end()) {
+            m_info[phi] = {Kind::Index, false, iv->step};
+            continue;
+        }
+
+        Reduction r;
+        r.phi = phi;
+        r.init = m_fn.operands(phi)[entry];
+        r.next = m_fn.operands(phi)[back];
+        if (m_fn[phi].type != Type::I64) {
+            return false;
+        }
+        r.step = r.next;
+        if (m_branch != NONE && m_fn[r.next].op == Op::Phi
+                && m_fn[r.next].block == m_loop.latch) {
+            const auto &latch_preds = m_fn.block(m_loop.latch).preds;
+            auto operands = m_fn.operands(r.next);
+            size_t same = operands[0] == phi ? 0 : 1;
+            if (operands[same] != phi) {
+                return false;
+            }
+            r.merge = r.next;
+            r.step = operands[1 - same];
+            r.taken = taken(latch_preds[1 - same]);
+        }
+        if (m_fn[r.step].op != Op::Add || ! in_loop(r.step)) {
+            return false;
+        }
+        auto operands = m_fn.operands(r.step);
+        if (operands[0] != phi && operands[1] != phi) {
+            return false;
+        }
+        r.term = operands[0] == phi ? operands[1] : operands[0];
+        for (auto v : {r.phi, r.step, r.merge}) {
+            if (v != NONE) {
+                m_info[v] = {Kind::Sum};
+            }
+        }
+        m_reductions.push_back(r);
+    }
+    return true;
+}
+
+bool Vectorizer::classify(ValueId v) {
+    const auto &inst = m_fn[v];
+    auto operands = m_fn.operands(v);
+    if (m_info[v].kind == Kind::Sum) {
+        return true;
+    }
+
+    switch (inst.op) {
+    case Op::Br:
+        return true;
+    case Op::CondBr:
+        return info(operands[0]).kind == Kind::Mask;
+    case Op::Phi: {
+        auto a = info(operands[0]).kind;
+        auto b = info(operands[1]).kind;
+        if (a == Kind::Mask && b == Kind::Mask) {
+            m_info[v] = {Kind::Mask};
+            return true;
+        }
+        if ((a != Kind::Vector && a != Kind::Uniform) || (b != Kind::Vector && b != Kind::Uniform)
+                || (m_size != 1 && inst.type != Type::I64)) {
+            return false;
+        }
+        m_info[v] = {Kind::Vector, is_byte(operands[0]) && is_byte(operands[1])};
+        return true;
+    }
+    case Op::DivS:
+    case Op::RemS:
+        return false;
+    default:
+        break;
+    }
+
+    if (std::all_of(operands.begin(), operands.end(),
+                [&](ValueId operand) { return info(operand).kind == Kind::Uniform; })
+            && ! has_side_effects(inst.op) && ! reads_memory(inst.op) && inst.op != Op::Param
+            && inst.op != Op::Result) {
+        m_info[v] = {Kind::Uniform};
+        return true;
+    }
+
+    auto is_index = [&](ValueId operand) {
+        auto kind = info(operand).kind;
+        return kind == Kind::Index || kind == Kind::Uniform;
+    };
+    auto stride = [&](ValueId operand) { return info(operand).stride; };
+    auto set_index = [&](Kind kind, int64_t s) {
+        if (s < -MAX_STRIDE || s > MAX_STRIDE) {
+            return false;
+        }
+        m_info[v] = {kind, false, s};
+        return true;
+    };
+    auto address = [&](ValueId operand, int64_t size) {
+        if (info(operand).kind != Kind::Address || info(operand).stride != size
+                || (m_size != 0 && m_size != size)) {
+            return false;
+        }
+        m_size = size;
+        m_accesses.push_back({v, m_fn.operands(operand)[0], m_accesses.size()});
+        return true;
+    };
+
+    switch (inst.op) {
+    case Op::Add:
+    case Op::Sub:
+        if (is_index(operands[0]) && is_index(operands[1])) {
+            return set_index(Kind::Index,
+                    inst.op == Op::Add ? stride(operands[0]) + stride(operands[1])
+                                       : stride(operands[0]) - stride(operands[1]));
+        }
+        break;
+    case Op::Mul:
+    case Op::Shl:
+        if (info(operands[0]).kind == Kind::Index && m_fn[operands[1]].op == Op::Const) {
+            auto x = m_fn[operands[1]].imm;
+            if (x < 0 || x > (inst.op == Op::Mul ? MAX_STRIDE : 16)) {
+                return false;
+            }
+            return set_index(Kind::Index,
+                    inst.op == Op::Mul ? stride(operands[0]) * x : stride(operands[0]) << x);
+        }
+        break;
+    case Op::Wrap:
+        if (info(operands[0]).kind == Kind::Index) {
+            return set_index(Kind::Address, stride(operands[0]));
+        }
+        break;
+    case Op::GtU:
+        if (info(operands[0]).kind == Kind::Index && info(operands[1]).kind == Kind::Uniform) {
+            return set_index(Kind::Bound, stride(operands[0]));
+        }
+        break;
+    case Op::TrapIf: {
+        auto bound = info(operands[0]);
+        if (bound.kind != Kind::Bound || bound.stride < 0) {
+            return false;
+        }
+        auto compare = m_fn.operands(operands[0]);
+        m_checks.push_back({compare[0], compare[1], bound.stride});
+        return true;
+    }
+    case Op::Load:
+    case Op::Load8U: {
+        auto size = inst.op == Op::Load8U ? 1 : 8;
+        if (! inst.raw || inst.imm != 0 || (size == 8 && inst.type != Type::I64)
+                || ! address(operands[0], size)) {
+            return false;
+        }
+        m_info[v] = {Kind::Vector, size == 1};
+        return true;
+    }
+    case Op::Store:
+    case Op::Store8: {
+        auto size = inst.op == Op::Store8 ? 1 : 8;
+        auto value = info(operands[1]).kind;
+        if (! inst.raw || inst.imm != 0 || m_store != NONE
+                || (m_fn[v].block != m_branch && m_fn[v].block != m_loop.latch)
+                || (size == 8 && m_fn[operands[1]].type != Type::I64)
+                || (value != Kind::Vector && value != Kind::Uniform)
+                || ! address(operands[0], size)) {
+            return false;
+        }
+        m_store = v;
+        return true;
+    }
+    default:
+        break;
+    }
+    return classify_vector(v);
+}
+
+// Lane-wise arithmetic, compares and conversions. Byte lanes only keep the
+// low byte: only what keeps it the same is allowed on them, and what needs
+// the whole value only takes exact bytes.
+bool Vectorizer::classify_vector(ValueId v) {
+    const auto &inst = m_fn[v];
+    auto operands = m_fn.operands(v);
+    if (m_size == 0 || operands.empty()) {
+        return false;
+    }
+    bool bytes = m_size == 1;
+    for (auto operand : operands) {
+        auto kind = info(operand).kind;
+        if (kind != Kind::Vector && kind != Kind::Uniform && kind != Kind::Mask) {
+            return false;
+        }
+    }
+    auto a = info(operands[0]).kind;
+    auto b = operands.size() > 1 ? info(operands[1]).kind : Kind::Uniform;
+    bool masks = a == Kind::Mask && (b == Kind::Mask || operands.size() == 1);
+    if (a == Kind::Mask && ! masks) {
+        return false;
+    }
+    if (b == Kind::Mask && a != Kind::Mask) {
+        return false;
+    }
+    if (! bytes && ! masks && ! is_compare(inst.op) && inst.type != Type::I64) {
+        return false;
+    }
+    auto is_small = [&](ValueId operand, int64_t limit) {
+        return m_fn[operand].op == Op::Const && m_fn[operand].imm >= 0
+                && m_fn[operand].imm < limit;
+    };
+
+    switch (inst.op) {
+    case Op::Add:
+    case Op::Sub:
+        if (masks) {
+            return false;
+        }
+        m_info[v] = {Kind::Vector};
+        return true;
+    case Op::Mul:
+        if (masks || bytes) {
+            return false;
+        }
+        m_info[v] = {Kind::Vector};
+        return true;
+    case Op::And:
+    case Op::Or:
+        if (masks) {
+            m_info[v] = {Kind::Mask};
+            return true;
+        }
+        m_info[v] = {Kind::Vector,
+                inst.op == Op::And ? is_byte(operands[0]) || is_byte(operands[1])
+                                   : is_byte(operands[0]) && is_byte(operands[1])};
+        return true;
+    case Op::Shl:
+        if (b != Kind::Uniform || (bytes && ! is_small(operands[1], 8))) {
+            return false;
+        }
+        m_info[v] = {Kind::Vector};
+        return true;
+    case Op::ShrS:
+    case Op::ShrU:
+        if (b != Kind::Uniform || (bytes && ! (is_byte(operands[0]) && is_small(operands[1], 8)))) {
+            return false;
+        }
+        m_info[v] = {Kind::Vector, bytes};
+        return true;
+    case Op::Eqz:
+        if (! masks && bytes && ! is_byte(operands[0])) {
+            return false;
+        }
+        m_info[v] = {Kind::Mask};
+        return true;
+    case Op::Wrap:
+    case Op::ExtendU:
+        if (masks || ! bytes) {
+            return false;
+        }
+        m_info[v] = {Kind::Vector, is_byte(operands[0])};
+        return true;
+    default:
+        break;
+    }
+
+    if (! is_compare(inst.op) || masks || (! bytes && inst.op == Op::GtU)) {
+        return false;
+    }
+    // Bytes compare to other values in the vector loop only when these are
+    // bytes too.
+    for (auto operand : operands) {
+        if (! bytes || is_byte(operand)) {
+            continue;
+        }
+        if (info(operand).kind != Kind::Uniform) {
+            return false;
+        }
+        m_ranged.push_back(operand);
+    }
+    m_info[v] = {Kind::Mask};
+    return true;
+}
+
+// Reductions are only added to, the rest checks its operands
+bool Vectorizer::check_uses() const {
+    for (const auto &r : m_reductions) {
+        auto term = info(r.term);
+        if ((term.kind != Kind::Vector && term.kind != Kind::Uniform)
+                || (m_size == 1 && ! is_byte(r.term))) {
+            return false;
+        }
+    }
+    for (auto v : m_order) {
+        for (auto operand : m_fn.operands(v)) {
+            if (info(operand).kind != Kind::Sum) {
+                continue;
+            }
+            auto r = std::find_if(m_reductions.begin(), m_reductions.end(), [&](const auto &r) {
+                return operand == r.phi || operand == r.step || operand == r.merge;
+            });
+            bool ok = (operand == r->phi && (v == r->step || v == r->merge))
+                    || (operand == r->step && v == r->merge);
+            if (! ok) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Vectorizer::analyze() {
+    if (! m_loop.is_counted() || m_fn[m_fn.block(m_loop.latch).insts.back()].op != Op::Br) {
+        return false;
+    }
+    auto step = m_loop.ivs[m_loop.counter].step;
+    if (step <= 0 || step > MAX_STRIDE || ! std::has_single_bit(uint64_t(step))) {
+        return false;
+    }
+    if (! find_body() || ! find_phis()) {
+        return false;
+    }
+    for (auto v : m_order) {
+        if (! classify(v)) {
+            return false;
+        }
+    }
+    if (m_size == 0 || ! check_uses()) {
+        return false;
+    }
+    m_lanes = m_size == 1 ? Lanes::I8x16 : Lanes::I64x2;
+    m_factor = VECTOR_BYTES / m_size;
+    return true;
+}
+
+ValueId Vectorizer::uniform(ValueId v) const {
+    return in_loop(v) ? m_uniform.at(v) : v;
+}
+
+ValueId Vectorizer::scalar_i32(ValueId v) {
+    auto u = uniform(v);
+    return m_fn[u].type == Type::I64 ? check_add(Op::Wrap, Type::I32, {u}) : u;
+}
+
+ValueId Vectorizer::splat(ValueId v) {
+    if (auto found = m_splat.find(v); found != m_splat.end()) {
+        return found->second;
+    }
+    auto x = m_lanes == Lanes::I64x2 ? uniform(v) : scalar_i32(v);
+    auto retval = check_add(Op::VSplat, Type::V128, {x}, int64_t(m_lanes));
+    m_splat[v] = retval;
+    return retval;
+}
+
+ValueId Vectorizer::vector(ValueId v) {
+    return info(v).kind == Kind::Uniform ? splat(v) : m_vector.at(v);
+}
+
+// v on the first iteration, after the last one, or in the vector loop
+ValueId Vectorizer::index(ValueId v, size_t at) {
+    if (info(v).kind == Kind::Uniform) {
+        return uniform(v);
+    }
+    auto &cache = m_index[at];
+    if (auto found = cache.find(v); found != cache.end()) {
+        return found->second;
+    }
+    auto block = at == 2 ? m_body : m_check;
+    std::vector<ValueId> operands;
+    for (auto operand : m_fn.operands(v)) {
+        operands.push_back(index(operand, at));
+    }
+    auto retval = m_fn.add(block, m_fn[v].op, m_fn[v].type, operands, m_fn[v].imm);
+    cache[v] = retval;
+    return retval;
+}
+
+void Vectorizer::emit(ValueId v) {
+    const auto &inst = m_fn[v];
+    auto operands = m_fn.operands(v);
+    auto lanes = int64_t(m_lanes);
+    switch (inst.op) {
+    case Op::Load:
+    case Op::Load8U:
+        m_vector[v] = body_add(Op::VLoad, Type::V128, {index(operands[0], 2)});
+        return;
+    case Op::Store:
+    case Op::Store8:
+        body_add(Op::VStore, Type::Void, {index(operands[0], 2), vector(operands[1])});
+        return;
+    case Op::Phi: {
+        const auto &preds = m_fn.block(inst.block).preds;
+        auto mask = vector(m_fn.operands(m_fn.block(m_branch).insts.back())[0]);
+        auto then_value = vector(operands[taken(preds[0]) ? 0 : 1]);
+        auto else_value = vector(operands[taken(preds[0]) ? 1 : 0]);
+        m_vector[v] = body_add(Op::VBitselect, Type::V128, {then_value, else_value, mask});
+        return;
+    }
+    case Op::Wrap:
+    case Op::ExtendU:
+        m_vector[v] = vector(operands[0]);
+        return;
+    case Op::Eqz:
+        m_vector[v] = body_add(Op::VEq, Type::V128, {vector(operands[0]), m_zero}, lanes);
+        return;
+    case Op::Shl:
+    case Op::ShrS:
+    case Op::ShrU:
+        m_vector[v] = body_add(*vector_op(inst.op), Type::V128,
+                {vector(operands[0]), scalar_i32(operands[1])}, lanes);
+        return;
+    default:
+        break;
+    }
+    auto op = *vector_op(inst.op);
+    m_vector[v] = body_add(op, Type::V128, {vector(operands[0]), vector(operands[1])},
+            op == Op::VAnd || op == Op::VOr ? 0 : lanes);
+}
+
+void Vectorizer::build() {
+    const auto &counter = m_loop.ivs[m_loop.counter];
+    auto step = counter.step;
+    auto header = m_loop.header;
+    std::vector<std::pair<ValueId, ValueId>> phis; // of the header, from the preheader and latch
+    {
+        const auto &preds = m_fn.block(header).preds;
+        auto entry = index_of(preds, m_loop.preheader);
+        auto back = index_of(preds, m_loop.latch);
+        for (auto v : m_fn.block(header).insts) {
+            if (m_fn[v].op == Op::Phi) {
+                phis.emplace_back(m_fn.operands(v)[entry], m_fn.operands(v)[back]);
+            }
+        }
+    }
+
+    m_check = m_fn.add_block();
+    m_body = m_fn.add_block();
+    auto done = m_fn.add_block();
+    auto merge = m_fn.add_block();
+    m_fn.redirect(m_loop.preheader, header, m_check);
+
+    for (auto v : m_order) {
+        if (m_info[v].kind == Kind::Uniform) {
+            std::vector<ValueId> operands;
+            for (auto operand : m_fn.operands(v)) {
+                operands.push_back(uniform(operand));
+            }
+            m_uniform[v] = m_fn.add(m_check, m_fn[v].op, m_fn[v].type, operands, m_fn[v].imm);
+        }
+    }
+
+    // The vector loop runs span / step iterations, a multiple of the factor,
+    // when there are some and no more than 2^32.
+    auto init = counter.init;
+    auto distance = check_add(Op::Sub, Type::I64, {m_loop.bound, init});
+    if (m_loop.compare == Op::LeS) {
+        distance = check_add(Op::Add, Type::I64, {distance, check_const(1)});
+    }
+    auto span = check_add(Op::And, Type::I64,
+            {check_add(Op::Add, Type::I64, {distance, check_const(step - 1)}),
+                    check_const(-m_factor * step)});
+    auto trips = check_add(
+            Op::ShrU, Type::I64, {span, check_const(std::countr_zero(uint64_t(step)))});
+    auto ok = check_add(Op::And, Type::I32,
+            {check_add(m_loop.compare, Type::I32, {init, m_loop.bound}),
+                    check_add(Op::Eqz, Type::I32,
+                            {check_add(Op::GtU, Type::I32,
+                                    {check_add(Op::Sub, Type::I64, {span, check_const(1)}),
+                                            check_const(0xFFFFFFFF)})})});
+    std::unordered_map<ValueId, ValueId> ends;
+    for (const auto &iv : m_loop.ivs) {
+        m_index[0][iv.phi] = iv.init;
+        ends[iv.phi] = check_add(Op::Add, Type::I64,
+                {iv.init, check_add(Op::Mul, Type::I64, {trips, check_const(iv.step)})});
+        m_index[1][iv.phi] = ends[iv.phi];
+    }
+
+    // Every access stays in memory, and so do the indexes trap_if checks.
+    // Values bytes compare to are bytes. The store does not write what loads
+    // read in a later iteration of the same vector, nor loads after it what
+    // it writes in a later one.
+    auto memory_size = check_add(Op::Shl, Type::I64,
+            {check_add(Op::ExtendU, Type::I64, {check_add(Op::MemorySize, Type::I32)}),
+                    check_const(16)});
+    auto fails = m_fn.add_const(m_check, Type::I32, 0);
+    auto fail_if = [&](ValueId cond) {
+        fails = check_add(Op::Or, Type::I32, {fails, cond});
+    };
+    for (const auto &access : m_accesses) {
+        auto first = index(access.offset, 0);
+        auto end = index(access.offset, 1);
+        fail_if(check_add(Op::GtU, Type::I32, {first, end}));
+        fail_if(check_add(Op::GtU, Type::I32, {end, memory_size}));
+    }
+    for (const auto &check : m_checks) {
+        auto first = index(check.index, 0);
+        auto last = check_add(Op::Sub, Type::I64,
+                {index(check.index, 1), check_const(check.stride)});
+        fail_if(check_add(Op::GtU, Type::I32, {first, last}));
+        fail_if(check_add(Op::GtU, Type::I32, {last, uniform(check.bound)}));
+    }
+    for (auto v : m_ranged) {
+        auto x = uniform(v);
+        fail_if(check_add(Op::GtU, Type::I32, {x, m_fn.add_const(m_check, m_fn[x].type, 255)}));
+    }
+    if (m_store != NONE) {
+        auto store = std::find_if(m_accesses.begin(), m_accesses.end(),
+                [&](const auto &access) { return access.inst == m_store; });
+        auto stored = index(store->offset, 0);
+        for (const auto &access : m_accesses) {
+            if (access.inst == m_store || access.offset == store->offset) {
+                continue;
+            }
+            // Vectors overlap when they are 1 to 15 bytes apart, in the
+            // direction that matters.
+            auto load = index(access.offset, 0);
+            auto before = access.position < store->position;
+            auto apart = check_add(Op::Sub, Type::I64,
+                    {check_add(Op::Sub, Type::I64,
+                             {before ? stored : load, before ? load : stored}),
+                            check_const(1)});
+            fail_if(check_add(Op::Eqz, Type::I32,
+                    {check_add(Op::GtU, Type::I32, {apart, check_const(VECTOR_BYTES - 2)})}));
+        }
+    }
+    ok = check_add(Op::And, Type::I32, {ok, check_add(Op::Eqz, Type::I32, {fails})});
+    m_zero = check_add(Op::VSplat, Type::V128, {m_fn.add_const(m_check, Type::I64, 0)},
+            int64_t(Lanes::I64x2));
+    m_fn.cond_br(m_check, ok, m_body, merge);
+
+    // The vector loop
+    std::vector<std::pair<ValueId, ValueId>> body_phis; // and their values from the check block
+    for (const auto &iv : m_loop.ivs) {
+        auto phi = m_fn.add_phi(m_body, Type::I64);
+        m_index[2][iv.phi] = phi;
+        body_phis.emplace_back(phi, iv.init);
+        m_next[phi] = body_add(Op::Add, Type::I64, {phi, check_const(iv.step * m_factor)});
+    }
+    std::vector<ValueId> sums;
+    for (size_t i = 0; i < m_reductions.size(); ++i) {
+        auto phi = m_fn.add_phi(m_body, Type::V128);
+        body_phis.emplace_back(phi, m_zero);
+        sums.push_back(phi);
+    }
+    for (auto v : m_order) {
+        auto kind = m_info[v].kind;
+        if (kind == Kind::Vector || kind == Kind::Mask
+                || (m_fn[v].op == Op::Store || m_fn[v].op == Op::Store8)) {
+            emit(v);
+        }
+    }
+    for (size_t i = 0; i < m_reductions.size(); ++i) {
+        const auto &r = m_reductions[i];
+        auto term = vector(r.term);
+        if (r.merge != NONE) {
+            auto mask = vector(m_fn.operands(m_fn.block(m_branch).insts.back())[0]);
+            term = r.taken ? body_add(Op::VBitselect, Type::V128, {term, m_zero, mask})
+                           : body_add(Op::VBitselect, Type::V128, {m_zero, term, mask});
+        }
+        auto sum = sums[i];
+        if (m_lanes == Lanes::I8x16) {
+            term = body_add(Op::VExtAddPairwiseU, Type::V128, {term}, int64_t(Lanes::I16x8));
+            term = body_add(Op::VExtAddPairwiseU, Type::V128, {term}, int64_t(Lanes::I32x4));
+            sum = body_add(Op::VAdd, Type::V128,
+                    {sum, body_add(Op::VExtendLowU, Type::V128, {term}, int64_t(Lanes::I64x2))},
+                    int64_t(Lanes::I64x2));
+            term = body_add(Op::VExtendHighU, Type::V128, {term}, int64_t(Lanes::I64x2));
+        }
+        m_next[sums[i]] = body_add(Op::VAdd, Type::V128, {sum, term}, int64_t(Lanes::I64x2));
+    }
+    auto i = m_index[2].at(counter.phi);
+    auto end = ends.at(counter.phi);
+    m_fn.cond_br(m_body, body_add(Op::Ne, Type::I32, {m_next.at(i), end}), m_body, done);
+
+    std::vector<ValueId> operands;
+    for (auto [phi, from_check] : body_phis) {
+        operands.clear();
+        for (auto pred : m_fn.block(m_body).preds) {
+            operands.push_back(pred == m_check ? from_check : m_next.at(phi));
+        }
+        m_fn.set_operands(phi, operands);
+    }
+
+    // Results of the reductions, and the values the original loop goes on
+    // from
+    std::unordered_map<ValueId, ValueId> results;
+    for (size_t k = 0; k < m_reductions.size(); ++k) {
+        const auto &r = m_reductions[k];
+        auto sum = m_next.at(sums[k]);
+        results[r.phi] = m_fn.add(done, Op::Add, Type::I64,
+                {r.init,
+                        m_fn.add(done, Op::Add, Type::I64,
+                                {m_fn.add(done, Op::VExtractLane, Type::I64, {sum}, 0),
+                                        m_fn.add(done, Op::VExtractLane, Type::I64, {sum}, 1)})});
+    }
+    m_fn.br(done, merge);
+    m_fn.br(merge, header);
+
+    size_t k = 0;
+    for (auto v : m_fn.block(header).insts) {
+        if (m_fn[v].op != Op::Phi) {
+            break;
+        }
+        auto [from_preheader, from_latch] = phis[k++];
+        auto phi = m_fn.add_phi(merge, m_fn[v].type);
+        auto after = ends.contains(v) ? ends.at(v) : results.at(v);
+        operands.clear();
+        for (auto pred : m_fn.block(merge).preds) {
+            operands.push_back(pred == m_check ? from_preheader : after);
+        }
+        m_fn.set_operands(phi, operands);
+
+        operands.clear();
+        for (auto pred : m_fn.block(header).preds) {
+            operands.push_back(pred == m_loop.latch ? from_latch : phi);
+        }
+        m_fn.set_operands(v, operands);
+    }
+}
+
+} // namespace
+
+bool vectorize_loop(Function &fn, const Loop &loop) {
+    Vectorizer vectorizer(fn, loop);
+    if (! vectorizer.analyze()) {
+        return false;
+    }
+    vectorizer.build();
+    return true;
+}
+
+} // namespace ir
@@ -0,0 +1,34 @@
+#ifndef KIRAZ_IR_VECTORIZE_H
+#define KIRAZ_IR_VECTORIZE_H
+
+#include <kiraz/ir/CountedLoops.h>
+
+namespace ir {
+
+/**
+ * @brief vectorize_loop: Puts a copy of a counted loop over io.Memory in
+ * front of it that runs 16 bytes worth of iterations at a time with v128
+ * instructions. The original loop does what is left, or everything when the
+ * copy cannot run.
+ *
+ * The loop counts up, and every iteration goes on to the next elements:
+ * bytes of load8 and store8, lanes of an i8x16, or integers of load64 and
+ * store64 in an i64x2. Its body is straight code, or one if whose arms only
+ * compute. It may:
+ *
+ * - store lane-wise arithmetic of what it loads, once per iteration
+ * - add up such values in a phi of the header: sums, counts of compares
+ * - select between values in the phis after the if
+ *
+ * Byte lanes hold the low byte of the integers the loop computes, which is
+ * all a store needs. Sums and compares need the whole value, so they only
+ * take bytes as loaded, or masked.
+ *
+ * The copy only runs when all of its accesses are in bounds and the store
+ * does not write what a later iteration of the same 16 bytes loads.
+ */
+bool vectorize_loop(Function &fn, const Loop &loop);
+
+} // namespace ir
+
+#endif
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/ModuleCache.h>
+#include <kiraz/SourceManager.h>
+
+namespace kiraz {
+
+namespace {
+
+const std::string CODE = "import io;"
+                         "class C { let n : Integer64;"
+                         "    func bump() : Integer64 { n = n + 1; return n; }; };"
+                         "func f(a : Integer64, s : String) : Boolean {"
+                         "    let c : C; while (a > 0) { a = a - 1; c.bump(); };"
+                         "    if (a == 0) { io.print(s); } else { return false; };"
+                         "    return true; };";
+
+const std::string LINES = "func f(a : Integer64) : Integer64 {\n"
+                          "    let b = a * 2;\n"
+                          "    return -b;\n"
+                          "};\n"
+                          "class C {\n"
+                          "    let n : Integer64;\n"
+                          "};\n";
+
+// Line and column of every node, in source order
+std::vector<std::pair<int, int>> locations(const Node::Ptr &root) {
+    std::vector<std::pair<int, int>> retval;
+    std::function<void(const Node::Ptr &)> visit = [&](const Node::Ptr &n) {
+        retval.emplace_back(n->get_line(), n->get_col());
+        n->for_each_child(visit);
+    };
+    visit(root);
+    return retval;
+}
+
+std::string_view file_of(const Node::Ptr &n) {
+    return SourceManager::instance().lookup(n->get_offset()).file;
+}
+
+std::string read_file(const std::filesystem::path &path) {
+    std::ifstream f(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+}
+
+void write_file(const std::filesystem::path &path, const std::string &data) {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    f.write(data.data(), data.size());
+}
+
+} // namespace
+
+struct ModuleCacheFixture : public ::testing::Test {
+    void SetUp() override {
+        auto test = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        dir = std::filesystem::temp_directory_path() / FF("kiraz_test_cache.{}", test);
+        std::filesystem::remove_all(dir);
+    }
+    void TearDown() override { std::filesystem::remove_all(dir); }
+
+    static Node::Ptr parse(const std::string &code) {
+        Compiler compiler;
+        return compiler.compile_module("test", code);
+    }
+
+    std::filesystem::path entry(const std::string &name, uint64_t key) const {
+        return dir / FF("{}.{:016x}.kia", name, key);
+    }
+
+    std::vector<std::string> files() const {
+        std::vector<std::string> retval;
+        for (auto &e : std::filesystem::directory_iterator(dir)) {
+            retval.push_back(e.path().filename().string());
+        }
+        std::sort(retval.begin(), retval.end());
+        return retval;
+    }
+
+    std::filesystem::path dir;
+};
+
+TEST_F(ModuleCacheFixture, serialize_round_trip) {
+    auto root = parse(CODE);
+    ASSERT_TRUE(root);
+    std::string data;
+    ASSERT_TRUE(ModuleCache::serialize(root, data));
+    auto copy = ModuleCache::deserialize(data);
+    ASSERT_TRUE(copy);
+    ASSERT_EQ(copy->as_string(), root->as_string());
+
+    ASSERT_FALSE(ModuleCache::deserialize(data.substr(0, data.size() - 1)));
+    ASSERT_FALSE(ModuleCache::deserialize(data + '\0'));
+}
+
+TEST_F(ModuleCacheFixture, offsets_round_trip) {
+    // What the module is about to be registered at
+    auto base = SourceManager::instance().mark().next;
+    auto root = parse(LINES);
+    auto expected = locations(root);
+    ASSERT_EQ(expected.size(), root->count_nodes());
+    ASSERT_EQ(expected.back().first, 6);
+
+    std::string data;
+    ASSERT_TRUE(ModuleCache::serialize(root, data, base));
+    auto copy_base = SourceManager::instance().add_file("copy.ki", LINES);
+    auto copy = ModuleCache::deserialize(data, copy_base);
+    ASSERT_TRUE(copy);
+    ASSERT_EQ(locations(copy), expected);
+    ASSERT_EQ(file_of(copy), "copy.ki");
+}
+
+TEST_F(ModuleCacheFixture, cache_hits_point_into_their_source) {
+    auto cache = std::make_shared<ModuleCache>(dir.string());
+    Compiler compiler;
+    compiler.set_module_cache(cache);
+    auto first = compiler.compile_module("m", LINES);
+    auto second = compiler.compile_module("m", LINES);
+    ASSERT_EQ(cache->get_hits(), 1u);
+    ASSERT_EQ(locations(second), locations(first));
+    ASSERT_NE(second->get_offset(), first->get_offset());
+    ASSERT_EQ(file_of(second), "m");
+}
+
+TEST_F(ModuleCacheFixture, unary_minus_round_trip) {
+    auto code = "func f(a : Integer64) : Integer64 { return -a * -3; };";
+    auto root = parse(code);
+    std::string data;
+    ASSERT_TRUE(ModuleCache::serialize(root, data));
+    auto copy = ModuleCache::deserialize(data);
+    ASSERT_TRUE(copy);
+    ASSERT_EQ(copy->as_string(), root->as_string());
+    ASSERT_NE(root->as_string().find("Signed(OP_MINUS, Id(a))"), std::string::npos);
+
+    ModuleCache cache(dir.string());
+    ASSERT_TRUE(cache.store("m", ModuleCache::make_key(code), root));
+    ASSERT_TRUE(cache.load_ast("m", ModuleCache::make_key(code)));
+}
+
+TEST_F(ModuleCacheFixture, load_ast_hit_and_miss) {
+    auto root = parse(CODE);
+    ModuleCache cache(dir.string());
+    auto key = ModuleCache::make_key(CODE);
+
+    ASSERT_FALSE(cache.load_ast("m", key));
+    ASSERT_TRUE(cache.store("m", key, root));
+    auto loaded = cache.load_ast("m", key);
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(loaded->as_string(), root->as_string());
+
+    // Any change to the source is a different key.
+    ASSERT_FALSE(cache.load_ast("m", ModuleCache::make_key(CODE + " ")));
+    ASSERT_EQ(cache.get_hits(), 1u);
+    ASSERT_EQ(cache.get_misses(), 2u);
+
+    // No temporary file is left behind.
+    ASSERT_EQ(files(), std::vector<std::string>{entry("m", key).filename().string()});
+}
+
+TEST_F(ModuleCacheFixture, stale_and_corrupt_entries_miss) {
+    ModuleCache cache(dir.string());
+    auto key = ModuleCache::make_key(CODE);
+    ASSERT_TRUE(cache.store("m", key, parse(CODE)));
+    auto data = read_file(entry("m", key));
+
+    // magic, u32 version, u64 key, then the AST
+    auto bumped = data;
+    ++bumped[4];
+    write_file(entry("m", key), bumped);
+    ASSERT_FALSE(cache.load_ast("m", key));
+
+    write_file(entry("m", key), data.substr(0, data.size() - 3));
+    ASSERT_FALSE(cache.load_ast("m", key));
+
+    auto flipped = data;
+    flipped[16] = char(0xFF);
+    write_file(entry("m", key), flipped);
+    ASSERT_FALSE(cache.load_ast("m", key));
+
+    write_file(entry("m", key), data);
+    ASSERT_TRUE(cache.load_ast("m", key));
+}
+
+TEST_F(ModuleCacheFixture, prune) {
+    ModuleCache cache(dir.string());
+    auto root = parse(CODE);
+    auto old_key = ModuleCache::make_key("let a = 1;");
+    auto key = ModuleCache::make_key(CODE);
+    ASSERT_TRUE(cache.store("m", old_key, root));
+    ASSERT_TRUE(cache.store("n", old_key, root));
+    write_file(dir / "m.notes", "");
+
+    // Storing an entry drops the other entries of the module only.
+    ASSERT_TRUE(cache.store("m", key, root));
+    ASSERT_EQ(files(), (std::vector<std::string>{entry("m", key).filename().string(), "m.notes",
+                               entry("n", old_key).filename().string()}));
+
+    cache.prune("n", key);
+    ASSERT_EQ(files(), (std::vector<std::string>{
+                               entry("m", key).filename().string(), "m.notes"}));
+}
+
+TEST_F(ModuleCacheFixture, compile_module_skips_the_parser) {
+    auto cache = std::make_shared<ModuleCache>(dir.string());
+    Compiler compiler;
+    compiler.set_module_cache(cache);
+    auto first = compiler.compile_module("m", CODE);
+    auto second = compiler.compile_module("m", CODE);
+    ASSERT_EQ(cache->get_misses(), 1u);
+    ASSERT_EQ(cache->get_hits(), 1u);
+    ASSERT_NE(first, second);
+    ASSERT_EQ(first->as_string(), second->as_string());
+}
+
+} // namespace kiraz
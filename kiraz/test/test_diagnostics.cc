@@ -0,0 +1,32 @@
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/Node.h>
+#include <kiraz/SourceManager.h>
+
+namespace kiraz {
+
+TEST(Diagnostics, syntax_errors_all_reported) {
+    Compiler compiler;
+
+    /* perform */
+    auto ret = compiler.compile_string(
+            "let a = ;\nlet b = 1;\nfunc f() : Null { a + ; let c = 2; };\nclass C { let x = ; };");
+
+    /* verify */
+    ASSERT_NE(ret, 0);
+    ASSERT_FALSE(Node::get_root());
+
+    auto &diags = compiler.get_diagnostics();
+    ASSERT_EQ(diags.size(), 3u);
+    ASSERT_EQ(SourceManager::instance().lookup(diags[0].offset).line, 1u);
+    ASSERT_EQ(SourceManager::instance().lookup(diags[1].offset).line, 3u);
+    ASSERT_EQ(SourceManager::instance().lookup(diags[2].offset).line, 4u);
+    ASSERT_EQ(compiler.get_error(), "Error at 1:9: syntax error at token: ;\n"
+                                    "Error at 3:23: syntax error at token: ;\n"
+                                    "Error at 4:19: syntax error at token: ;\n");
+}
+
+} // namespace kiraz
@@ -0,0 +1,601 @@
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/ir/ControlFlow.h>
+#include <kiraz/ir/Emit.h>
+#include <kiraz/ir/IR.h>
+#include <kiraz/ir/Inline.h>
+#include <kiraz/ir/ProfileGuided.h>
+#include <kiraz/ir/ValueNumbering.h>
+
+namespace ir {
+
+std::string emit_wat(Function &fn) {
+    kiraz::WasmContext ctx;
+    emit(ctx, fn);
+    return ctx.body().str();
+}
+
+// The wat of one function of a compiled module
+std::string compile_func(
+        const std::string &code, const std::string &name, const OptimizeOptions &opts = {}) {
+    kiraz::Compiler compiler;
+    compiler.set_optimize_options(opts);
+    EXPECT_EQ(compiler.compile_string(code), 0) << compiler.get_error();
+    auto wat = compiler.get_wasm_ctx().body().str();
+    auto header = FF("  (func ${}", name);
+    for (auto begin = wat.find(header); begin != std::string::npos;
+            begin = wat.find(header, begin + 1)) {
+        auto next = wat[begin + header.size()];
+        if (next == ' ' || next == '\n') {
+            return wat.substr(begin, wat.find("\n  )\n", begin) + 5 - begin);
+        }
+    }
+    return "";
+}
+
+TEST(IR, trivial_phis_are_removed) {
+    // A loop that never changes x
+    Function fn("f");
+    auto x = fn.add_param("x", Type::I64);
+    fn.add_result(Type::I64);
+    auto header = fn.add_block();
+    auto body = fn.add_block();
+    auto exit = fn.add_block();
+    fn.br(Function::ENTRY, header);
+    auto phi = fn.add_phi(header, Type::I64);
+    auto cond = fn.add(header, Op::Ne, Type::I32, {phi, fn.add_const(header, Type::I64, 0)});
+    fn.cond_br(header, cond, body, exit);
+    fn.add(body, Op::Add, Type::I64, {phi, phi});
+    fn.br(body, header);
+    ValueId operands[] = {x, phi};
+    fn.set_operands(phi, operands);
+    fn.ret(exit, std::span(&phi, 1));
+
+    fn.remove_trivial_phis();
+    fn.remove_dead_code();
+    EXPECT_EQ(fn.as_string(), "func $f(i64) i64\n"
+                              "b0:\n"
+                              "  v0:i64 = param $x\n"
+                              "  br b1\n"
+                              "b1: ; preds b0 b2\n"
+                              "  v3:i64 = const 0\n"
+                              "  v4:i32 = ne v0, v3\n"
+                              "  br_if v4, b2, b3\n"
+                              "b2: ; preds b1\n"
+                              "  br b1\n"
+                              "b3: ; preds b1\n"
+                              "  return v0\n");
+}
+
+TEST(ControlFlow, nested_loops) {
+    // b0 -> b1 (outer) -> b2 (inner) -> b3 -> b2, b2 -> b4 -> b1, b1 -> b5
+    Function fn("f");
+    for (int i = 0; i < 6; ++i) {
+        fn.add_block();
+    }
+    auto cond = fn.add_const(Function::ENTRY, Type::I32, 1);
+    fn.br(0, 1);
+    fn.cond_br(1, cond, 2, 5);
+    fn.cond_br(2, cond, 3, 4);
+    fn.br(3, 2);
+    fn.br(4, 1);
+    fn.ret(5, {});
+
+    ControlFlow cfg(fn);
+    EXPECT_EQ(cfg.get_idom(4), 2u);
+    EXPECT_EQ(cfg.get_idom(5), 1u);
+    EXPECT_TRUE(cfg.dominates(1, 4));
+    EXPECT_FALSE(cfg.dominates(3, 4));
+
+    EXPECT_TRUE(cfg.is_loop_header(1));
+    EXPECT_TRUE(cfg.is_loop_header(2));
+    EXPECT_FALSE(cfg.is_loop_header(3));
+    EXPECT_EQ(cfg.get_loop(3), 2u);
+    EXPECT_EQ(cfg.get_loop(4), 1u);
+    EXPECT_EQ(cfg.get_loop(5), NONE);
+    EXPECT_EQ(cfg.get_parent_loop(2), 1u);
+    EXPECT_TRUE(cfg.in_loop(3, 1));
+    EXPECT_FALSE(cfg.in_loop(4, 2));
+    EXPECT_TRUE(cfg.is_back_edge(3, 2));
+    EXPECT_TRUE(cfg.is_back_edge(4, 1));
+}
+
+TEST(Emit, diamond) {
+    Function fn("f");
+    auto c = fn.add_param("c", Type::I32);
+    auto a = fn.add_param("a", Type::I64);
+    fn.add_result(Type::I64);
+    auto then_block = fn.add_block();
+    auto else_block = fn.add_block();
+    auto join = fn.add_block();
+    fn.cond_br(Function::ENTRY, c, then_block, else_block);
+    auto one = fn.add_const(then_block, Type::I64, 1);
+    auto sum = fn.add(then_block, Op::Add, Type::I64, {a, one});
+    fn.br(then_block, join);
+    fn.br(else_block, join);
+    auto phi = fn.add_phi(join, Type::I64);
+    ValueId operands[] = {sum, a};
+    fn.set_operands(phi, operands);
+    fn.ret(join, std::span(&phi, 1));
+
+    EXPECT_EQ(emit_wat(fn), R"(  (func $f (param $c i32) (param $a i64) (result i64)
+    (local $__t0 i64)
+    local.get $c
+    (if
+      (then
+    local.get $a
+    i64.const 1
+    i64.add
+    local.set $__t0
+      )
+      (else
+    local.get $a
+    local.set $__t0
+      )
+    )
+    local.get $__t0
+  )
+)");
+}
+
+TEST(Emit, loop) {
+    // s = 0; while (i != 0) { s = s + i; i = i - 1; }; return s;
+    Function fn("f");
+    auto n = fn.add_param("n", Type::I64);
+    fn.add_result(Type::I64);
+    auto header = fn.add_block();
+    auto body = fn.add_block();
+    auto exit = fn.add_block();
+    auto zero = fn.add_const(Function::ENTRY, Type::I64, 0);
+    fn.br(Function::ENTRY, header);
+    auto i = fn.add_phi(header, Type::I64);
+    auto s = fn.add_phi(header, Type::I64);
+    auto cond = fn.add(header, Op::Ne, Type::I32, {i, fn.add_const(header, Type::I64, 0)});
+    fn.cond_br(header, cond, body, exit);
+    auto next_s = fn.add(body, Op::Add, Type::I64, {s, i});
+    auto next_i = fn.add(body, Op::Sub, Type::I64, {i, fn.add_const(body, Type::I64, 1)});
+    fn.br(body, header);
+    ValueId i_operands[] = {n, next_i};
+    ValueId s_operands[] = {zero, next_s};
+    fn.set_operands(i, i_operands);
+    fn.set_operands(s, s_operands);
+    fn.ret(exit, std::span(&s, 1));
+
+    // Both phis are read before either is written on the back edge.
+    EXPECT_EQ(emit_wat(fn), R"(  (func $f (param $n i64) (result i64)
+    (local $__t0 i64)
+    (local $__t1 i64)
+    local.get $n
+    i64.const 0
+    local.set $__t1
+    local.set $__t0
+    (loop
+    local.get $__t0
+    i64.const 0
+    i64.ne
+    (if
+      (then
+    local.get $__t0
+    i64.const 1
+    i64.sub
+    local.get $__t1
+    local.get $__t0
+    i64.add
+    local.set $__t1
+    local.set $__t0
+    br 1
+      )
+    )
+    )
+    local.get $__t1
+  )
+)");
+}
+
+TEST(Emit, memory_order_is_kept) {
+    // The load cannot move past the store to be used by the call.
+    Function fn("f");
+    auto p = fn.add_param("p", Type::I32);
+    auto v = fn.add(Function::ENTRY, Op::Load, Type::I64, {p}, 0);
+    fn.add(Function::ENTRY, Op::Store, Type::Void, {p, fn.add_const(Function::ENTRY, Type::I64, 7)},
+            0);
+    fn.add_call(Function::ENTRY, {"io_print_i", {}}, std::span(&v, 1));
+    fn.ret(Function::ENTRY, {});
+
+    EXPECT_EQ(emit_wat(fn), R"(  (func $f (param $p i32)
+    (local $__t0 i64)
+    local.get $p
+    i64.load offset=0
+    local.set $__t0
+    local.get $p
+    i64.const 7
+    i64.store offset=0
+    local.get $__t0
+    call $io_print_i
+  )
+)");
+}
+
+TEST(Emit, locals_are_teed_and_shared) {
+    // a is still on the stack for its first use, b takes its local after its last.
+    Function fn("f");
+    auto n = fn.add_param("n", Type::I64);
+    auto a = fn.add(Function::ENTRY, Op::Mul, Type::I64,
+            {n, fn.add_const(Function::ENTRY, Type::I64, 3)});
+    fn.add_call(Function::ENTRY, {"io_print_i", {}}, std::span(&a, 1));
+    fn.add_call(Function::ENTRY, {"io_print_i", {}}, std::span(&a, 1));
+    auto b = fn.add(Function::ENTRY, Op::Mul, Type::I64,
+            {n, fn.add_const(Function::ENTRY, Type::I64, 5)});
+    fn.add_call(Function::ENTRY, {"io_print_i", {}}, std::span(&b, 1));
+    fn.add_call(Function::ENTRY, {"io_print_i", {}}, std::span(&b, 1));
+    fn.ret(Function::ENTRY, {});
+
+    EXPECT_EQ(emit_wat(fn), R"(  (func $f (param $n i64)
+    (local $__t0 i64)
+    local.get $n
+    i64.const 3
+    i64.mul
+    local.tee $__t0
+    call $io_print_i
+    local.get $__t0
+    call $io_print_i
+    local.get $n
+    i64.const 5
+    i64.mul
+    local.tee $__t0
+    call $io_print_i
+    local.get $__t0
+    call $io_print_i
+  )
+)");
+}
+
+size_t count(const std::string &text, const std::string &what) {
+    size_t retval = 0;
+    for (auto pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos + 1)) {
+        ++retval;
+    }
+    return retval;
+}
+
+TEST(ValueNumbering, dominating_values_are_reused) {
+    // The sum in the entry covers both branches, the one in a branch does not
+    // cover the other.
+    Function fn("f");
+    auto c = fn.add_param("c", Type::I32);
+    auto a = fn.add_param("a", Type::I64);
+    fn.add_result(Type::I64);
+    auto then_block = fn.add_block();
+    auto else_block = fn.add_block();
+    auto sum = fn.add(Function::ENTRY, Op::Add, Type::I64, {a, a});
+    fn.cond_br(Function::ENTRY, c, then_block, else_block);
+    auto again = fn.add(then_block, Op::Add, Type::I64, {a, a});
+    auto x = fn.add(then_block, Op::Mul, Type::I64, {again, a});
+    fn.ret(then_block, std::span(&x, 1));
+    auto y = fn.add(else_block, Op::Mul, Type::I64, {a, sum});
+    fn.ret(else_block, std::span(&y, 1));
+
+    EXPECT_EQ(number_values(fn), 1u);
+    EXPECT_EQ(fn.operands(x)[0], sum);
+    EXPECT_NE(fn[y].block, NONE);
+}
+
+TEST(ValueNumbering, constants_are_folded) {
+    Function fn("f");
+    fn.add_block();
+    fn.add_result(Type::I64);
+    auto two = fn.add_const(Function::ENTRY, Type::I64, 2);
+    auto six = fn.add(Function::ENTRY, Op::Mul, Type::I64,
+            {two, fn.add_const(Function::ENTRY, Type::I64, 3)});
+    auto quot = fn.add(Function::ENTRY, Op::DivS, Type::I64,
+            {six, fn.add_const(Function::ENTRY, Type::I64, 0)});
+    fn.ret(Function::ENTRY, std::span(&quot, 1));
+
+    number_values(fn);
+    fn.remove_dead_code();
+    EXPECT_EQ(fn.as_string(), "func $f() i64\n"
+                              "b0:\n"
+                              "  v3:i64 = const 0\n"
+                              "  v4:i64 = div_s v6, v3\n"
+                              "  v6:i64 = const 6\n"
+                              "  return v4\n");
+}
+
+TEST(ValueNumbering, members_and_pure_calls) {
+    auto wat = compile_func("import io;"
+                            "class P { let x = 1; let n = 0; func bump() : Integer64 { n = n + 1;"
+                            "    return n; }; };"
+                            "func sq(a : Integer64) : Integer64 { return a * a; };"
+                            "func main() : Integer64 { let p : P; let s = p.x + p.x * sq(p.x);"
+                            "    s = s + sq(p.x) + p.n; p.bump(); s = s + p.n + p.n; p.n = 7;"
+                            "    return s + p.n; };",
+            "main");
+    // x is never assigned: one load. n is loaded again after the call, but
+    // not after the store.
+    EXPECT_EQ(count(wat, "i64.load offset=0"), 1u) << wat;
+    EXPECT_EQ(count(wat, "i64.load offset=8"), 2u) << wat;
+    EXPECT_EQ(count(wat, "call $sq"), 1u) << wat;
+}
+
+TEST(LoopInvariants, reads_of_what_the_loop_does_not_write) {
+    auto wat = compile_func("import io;"
+                            "class G { let w = 0; let h = 0; let n = 0; };"
+                            "func main() : Integer64 { let m : Memory; let g : G;"
+                            "    let i = 0; let s = 0;"
+                            "    while (i < 10) { s = s + i * g.w + m.size() * 2; g.n = g.n + 1;"
+                            "        i = i + 1; };"
+                            "    while (i < 20) { s = s + g.w + m.size(); io.print(s); g.w = i;"
+                            "        i = i + 1; };"
+                            "    return s; };",
+            "main");
+    // Only n is stored to in the first loop. The second one calls out, which
+    // could write anything and grow memory.
+    auto loop = wat.find("(loop");
+    auto second = wat.find("(loop", loop + 1);
+    ASSERT_NE(second, std::string::npos) << wat;
+    EXPECT_LT(wat.find("i64.load offset=0"), loop) << wat;
+    EXPECT_LT(wat.find("memory.size"), loop) << wat;
+    EXPECT_GT(wat.find("i64.load offset=16"), loop) << wat;
+    EXPECT_GT(wat.find("i64.load offset=0", loop), second) << wat;
+    EXPECT_GT(wat.find("memory.size", loop), second) << wat;
+}
+
+TEST(CountedLoops, pure_loops_run_at_compile_time) {
+    auto code = "func f() : Integer64 { let i = 0; let s = 0;"
+                "    while (i < 100) { if (i > 50) { s = s + i * i; } else { s = s - 1; };"
+                "        i = i + 1; };"
+                "    let j = 10; while (j >= 0 - 1000000000) { j = j - 3; };"
+                "    return s + j; };";
+    EXPECT_EQ(count(compile_func(code, "f"), "(loop"), 2u);
+    EXPECT_EQ(compile_func(code, "f", {.level = 2}), R"(  (func $f (result i64)
+    i64.const -999714627
+  )
+)");
+}
+
+TEST(CountedLoops, multiplies_step_and_loops_unroll) {
+    auto code = "import io;"
+                "func f(n : Integer64, w : Integer64) : Void { let i = 0;"
+                "    while (i < n) { io.print(i * w); i = i + 1; }; };";
+    EXPECT_EQ(count(compile_func(code, "f"), "(loop"), 1u);
+
+    // An unrolled loop in front of the original one, which runs what is left
+    auto wat = compile_func(code, "f", {.level = 2, .unroll = 4});
+    EXPECT_EQ(count(wat, "(loop"), 2u) << wat;
+    EXPECT_EQ(count(wat, "call $io_print_i"), 5u) << wat;
+    EXPECT_EQ(count(wat, "i64.gt_u"), 1u) << wat;
+    // i * w is added w on every iteration, starting from 0.
+    EXPECT_EQ(count(wat, "i64.mul"), 0u) << wat;
+}
+
+TEST(Vectorize, byte_loops_run_16_at_a_time) {
+    auto code = "import io;"
+                "func f(d : Integer64, s : Integer64, n : Integer64, t : Integer64) : Integer64 {"
+                "    let m : Memory; let i = 0; let c = 0;"
+                "    while (i < n) { let x = m.load8(s + i);"
+                "        if (x > t) { c = c + x; } else { m.store8(d + i, x * 2 + 1); };"
+                "        i = i + 1; };"
+                "    return c; };";
+    EXPECT_EQ(count(compile_func(code, "f", {.level = 2}), "v128"), 0u);
+
+    // The store is in an arm of the if: it stays scalar.
+    auto wat = compile_func(code, "f", {.level = 2, .simd = true});
+    EXPECT_EQ(count(wat, "v128"), 0u) << wat;
+
+    code = "import io;"
+           "func f(d : Integer64, s : Integer64, n : Integer64, t : Integer64) : Integer64 {"
+           "    let m : Memory; let i = 0; let c = 0;"
+           "    while (i < n) { let x = m.load8(s + i); let y = x;"
+           "        if (x > t) { c = c + x; } else { y = x * 2 + 1; };"
+           "        m.store8(d + i, y); i = i + 1; };"
+           "    return c; };";
+    wat = compile_func(code, "f", {.level = 2, .simd = true});
+    EXPECT_EQ(count(wat, "(loop"), 2u) << wat;
+    EXPECT_EQ(count(wat, "v128.load"), 1u) << wat;
+    EXPECT_EQ(count(wat, "v128.store"), 1u) << wat;
+    EXPECT_EQ(count(wat, "i8x16.gt_u"), 1u) << wat;
+    EXPECT_EQ(count(wat, "v128.bitselect"), 2u) << wat;
+    EXPECT_EQ(count(wat, "i16x8.extadd_pairwise_i8x16_u"), 1u) << wat;
+    // The original loop runs what is left, with its checks.
+    EXPECT_GT(wat.find("i32.load8_u", wat.find("v128.store")), wat.find("v128.store")) << wat;
+    EXPECT_GT(wat.find("unreachable", wat.find("v128.store")), wat.find("v128.store")) << wat;
+}
+
+TEST(Vectorize, integer_loops_run_2_at_a_time) {
+    auto code = "func f(d : Integer64, n : Integer64) : Integer64 {"
+                "    let m : Memory; let i = 0; let s = 0;"
+                "    while (i < n) { let x = m.load64(d + i * 8); s = s + x * 3;"
+                "        m.store64(d + i * 8, x - 1); i = i + 1; };"
+                "    return s; };";
+    auto wat = compile_func(code, "f", {.level = 2, .simd = true});
+    EXPECT_EQ(count(wat, "v128.load"), 1u) << wat;
+    EXPECT_EQ(count(wat, "i64x2.add"), 2u) << wat;
+    EXPECT_EQ(count(wat, "i64x2.extract_lane"), 2u) << wat;
+
+    // Counts go to addresses that depend on what is loaded: no scatter.
+    code = "func f(d : Integer64, n : Integer64) : Void {"
+           "    let m : Memory; let i = 0;"
+           "    while (i < n) { let c = d + m.load8(i) * 8; m.store64(c, m.load64(c) + 1);"
+           "        i = i + 1; }; };";
+    wat = compile_func(code, "f", {.level = 2, .simd = true});
+    EXPECT_EQ(count(wat, "v128"), 0u) << wat;
+}
+
+TEST(ValueRanges, checks_that_cannot_fire) {
+    auto code = "func f(n : Integer64) : Integer64 { let m : Memory;"
+                "    if (n < 0) { return 0; }; if (n > 1000) { return 1000; };"
+                "    return m.load8(32768 + n * 16) + n / 8; };";
+    auto wat = compile_func(code, "f");
+    EXPECT_EQ(count(wat, "memory.size"), 1u) << wat;
+    EXPECT_GT(count(wat, "i64.shr_s"), 1u) << wat;
+
+    // The address stays within the first page and n / 8 is a single shift.
+    wat = compile_func(code, "f", {.level = 2});
+    EXPECT_EQ(count(wat, "memory.size"), 0u) << wat;
+    EXPECT_EQ(count(wat, "i64.shr_s"), 1u) << wat;
+}
+
+TEST(ValueRanges, counters_are_narrowed) {
+    auto code = "func f() : Integer64 { let m : Memory; let i = 0; let s = 0;"
+                "    while (i < 4096) { s = s + m.load8(32768 + i) / 4; i = i + 1; };"
+                "    return s; };";
+    auto wat = compile_func(code, "f", {.level = 2});
+    EXPECT_EQ(count(wat, "memory.size"), 0u) << wat;
+    EXPECT_EQ(count(wat, "i64.lt_s"), 0u) << wat;
+    EXPECT_EQ(count(wat, "i32.wrap_i64"), 0u) << wat;
+    EXPECT_GT(count(wat, "i32.load8_u"), 0u) << wat;
+    EXPECT_EQ(count(wat, "i32.load8_u"), count(wat, "i64.extend_i32_u")) << wat;
+}
+
+TEST(Profile, records_of_runs_add_up) {
+    auto record = kiraz::Profile::make_record("f", 42, 3);
+    auto counters = kiraz::Profile::counters_offset("f");
+    record[counters] = 2;
+    record[counters + 8] = 5;
+
+    kiraz::Profile profile;
+    EXPECT_TRUE(profile.merge(record + record));
+    auto f = profile.find("f", 42);
+    ASSERT_NE(f, nullptr);
+    EXPECT_EQ(f->counters, (std::vector<uint64_t>{4, 10, 0}));
+    EXPECT_EQ(profile.total_entries(), 4u);
+
+    // Records of code that has changed since, and of a run cut short
+    EXPECT_EQ(profile.find("f", 43), nullptr);
+    EXPECT_FALSE(profile.merge(record + record.substr(0, record.size() - 1)));
+    EXPECT_EQ(profile.entries("f"), 4u);
+}
+
+TEST(ProfileGuided, calls_are_inlined) {
+    Function callee("g");
+    auto x = callee.add_param("x", Type::I64);
+    callee.add_result(Type::I64);
+    auto twice = callee.add(Function::ENTRY, Op::Add, Type::I64, {x, x});
+    callee.ret(Function::ENTRY, std::span(&twice, 1));
+
+    Function fn("f");
+    auto a = fn.add_param("a", Type::I64);
+    fn.add_result(Type::I64);
+    auto call = fn.add_call(Function::ENTRY, {"g", {Type::I64}}, std::span(&a, 1));
+    auto sum = fn.add(Function::ENTRY, Op::Add, Type::I64, {call, a});
+    fn.ret(Function::ENTRY, std::span(&sum, 1));
+
+    EXPECT_TRUE(inline_call(fn, call, callee));
+    fn.remove_trivial_phis();
+    fn.remove_dead_code();
+    EXPECT_EQ(fn.as_string(), "func $f(i64) i64\n"
+                              "b0:\n"
+                              "  v0:i64 = param $a\n"
+                              "  br b2\n"
+                              "b1: ; preds b2\n"
+                              "  v2:i64 = add v4, v0\n"
+                              "  return v2\n"
+                              "b2: ; preds b0\n"
+                              "  v4:i64 = add v0, v0\n"
+                              "  br b1\n");
+}
+
+TEST(ProfileGuided, if_arm_that_ran_the_most_comes_first) {
+    Function fn("f");
+    auto a = fn.add_param("a", Type::I64);
+    fn.add_result(Type::I64);
+    auto rare = fn.add_block();
+    auto common = fn.add_block();
+    auto cond = fn.add(Function::ENTRY, Op::Eq, Type::I32,
+            {a, fn.add_const(Function::ENTRY, Type::I64, 5)});
+    fn.cond_br(Function::ENTRY, cond, rare, common);
+    for (auto b : {rare, common}) {
+        auto value = fn.add_const(b, Type::I64, b);
+        fn.ret(b, std::span(&value, 1));
+    }
+
+    // Without counts nothing moves.
+    auto unprofiled = fn.as_string();
+    lay_out_branches(fn);
+    EXPECT_EQ(fn.as_string(), unprofiled);
+
+    fn.set_counts(fn.block(Function::ENTRY).insts.back(), {1, 99});
+    lay_out_branches(fn);
+    fn.remove_dead_code();
+    EXPECT_EQ(fn.as_string(), "func $f(i64) i64\n"
+                              "b0:\n"
+                              "  v0:i64 = param $a\n"
+                              "  v1:i64 = const 5\n"
+                              "  v8:i32 = ne v0, v1\n"
+                              "  br_if v8, b2, b1\n"
+                              "b1: ; preds b0\n"
+                              "  v4:i64 = const 1\n"
+                              "  return v4\n"
+                              "b2: ; preds b0\n"
+                              "  v6:i64 = const 2\n"
+                              "  return v6\n");
+}
+
+TEST(Lower, assignments_in_loops_and_branches) {
+    auto wat = compile_func("func f(n : Integer64) : Integer64 {"
+                            "    let s = 0;"
+                            "    while (n > 0) { if (n > 10) { s = s + 2; } else { s = s + 1; };"
+                            "        n = n - 1; };"
+                            "    return s; };",
+            "f");
+    // s after the if shares the local of s in the loop: no copy on the back edge.
+    EXPECT_EQ(wat, R"(  (func $f (param $n i64) (result i64)
+    (local $__t0 i64)
+    (local $__t1 i64)
+    i64.const 0
+    local.get $n
+    local.set $__t1
+    local.set $__t0
+    (loop
+    local.get $__t1
+    i64.const 0
+    i64.gt_s
+    (if
+      (then
+    local.get $__t1
+    i64.const 10
+    i64.gt_s
+    (if
+      (then
+    local.get $__t0
+    i64.const 2
+    i64.add
+    local.set $__t0
+      )
+      (else
+    local.get $__t0
+    i64.const 1
+    i64.add
+    local.set $__t0
+      )
+    )
+    local.get $__t1
+    i64.const 1
+    i64.sub
+    local.set $__t1
+    br 1
+      )
+    )
+    )
+    local.get $__t0
+  )
+)");
+}
+
+TEST(Lower, scopes_end_with_their_blocks) {
+    auto wat = compile_func("import io; func f() : Void {"
+                            "    let x = 1; if (true) { let x = 2; io.print(x); }; io.print(x); };",
+            "f");
+    EXPECT_NE(wat.find("i64.const 1\n    call $io_print_i\n  )"), std::string::npos) << wat;
+}
+
+TEST(Lower, unknown_identifier) {
+    kiraz::Compiler compiler;
+    EXPECT_NE(compiler.compile_string("import io; func main() : Void { io.print(zz); };"), 0);
+    EXPECT_NE(compiler.get_error().find("Identifier 'zz' is not found"), std::string::npos);
+}
+
+} // namespace ir
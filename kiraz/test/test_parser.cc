@@ -4,9 +4,11 @@
 #include <lexer.hpp>
 #include <main.h>
 
+#include <kiraz/IncrementalParser.h>
 #include <kiraz/Node.h>
-
-extern std::shared_ptr<Token> curtoken;
+#include <kiraz/SourceManager.h>
+#include <kiraz/Token.h>
+#include <kiraz/ast/Operator.h>
 
 struct ParserFixture : public testing::Test {
     YY_BUFFER_STATE buffer = nullptr;
@@ -25,8 +27,8 @@ struct ParserFixture : public testing::Test {
         }
 
         yydebug = 0;
-        Token::colno = 1;
         curtoken.reset();
+        token::offset = 0;
     }
 
     void verify_root(const std::string &code, const std::string &ast) {
@@ -496,3 +498,63 @@ TEST_F(ParserFixture, return_bad_operand) {
 TEST_F(ParserFixture, bonus) {
     verify_no_root("1---2;");
 }
+
+TEST_F(ParserFixture, recovered_no_root) {
+    verify_no_root("let a = ; let b = 1; func f() : Null { a + ; };");
+}
+
+TEST_F(ParserFixture, node_locations) {
+    std::string code = "1 + 2;\n\n  3 +\n4;\n";
+    buffer = yy_scan_bytes(code.data(), code.size());
+    token::offset = kiraz::SourceManager::instance().add_file("locations.ki", code);
+
+    yyparse();
+
+    auto module = std::dynamic_pointer_cast<ast::StmtList>(Node::current_root());
+    ASSERT_TRUE(module);
+    ASSERT_EQ(module->get_stmts().size(), 2);
+    ASSERT_EQ(module->get_stmts()[0]->get_line(), 1);
+    ASSERT_EQ(module->get_stmts()[0]->get_col(), 1);
+    ASSERT_EQ(module->get_stmts()[1]->get_line(), 3);
+    ASSERT_EQ(module->get_stmts()[1]->get_col(), 3);
+
+    auto loc = kiraz::SourceManager::instance().lookup(module->get_stmts()[1]->get_offset() + 4);
+    ASSERT_EQ(loc.file, "locations.ki");
+    ASSERT_EQ(loc.line, 4);
+    ASSERT_EQ(loc.col, 1);
+}
+
+TEST_F(ParserFixture, incremental_edit) {
+    kiraz::IncrementalParser parser("incremental.ki");
+    auto before = parser.set_text("func f() : Null { 1 + 2; };\n"
+                                  "let a = 1;\n"
+                                  "func g() : Null { 3; };\n");
+    ASSERT_TRUE(before);
+    auto g = static_cast<ast::StmtList &>(*before).get_stmts()[2];
+
+    // let a = 1; -> let abc = 1 * 4;
+    auto after = parser.apply({33, 0, "bc"});
+    after = parser.apply({38, 1, "1 * 4"});
+    ASSERT_TRUE(after);
+    ASSERT_EQ(parser.get_reparsed(), 1);
+    ASSERT_EQ(parser.get_reused(), 2);
+
+    const auto &stmts = static_cast<ast::StmtList &>(*after).get_stmts();
+    ASSERT_EQ(stmts.size(), 3);
+    ASSERT_EQ(stmts[2], g);
+    ASSERT_EQ(stmts[2]->get_line(), 3);
+    ASSERT_EQ(stmts[1]->get_col(), 1);
+
+    buffer = yy_scan_string(parser.get_text().data());
+    yyparse();
+    ASSERT_TRUE(Node::current_root());
+    ASSERT_EQ(after->as_string(), Node::current_root()->as_string());
+
+    // Unbalanced: falls back to a full parse, which fails. The root of an
+    // unrelated parse is not taken for its result.
+    yy_delete_buffer(buffer);
+    buffer = yy_scan_string("let z = 3;");
+    yyparse();
+    ASSERT_TRUE(Node::current_root());
+    ASSERT_FALSE(parser.apply({0, 4, "{"}));
+}
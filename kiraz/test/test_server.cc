@@ -0,0 +1,179 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <kiraz/Server.h>
+#include <kiraz/SourceManager.h>
+
+namespace kiraz {
+
+namespace {
+
+const std::string CODE = "func f(a : Integer64) : Integer64 { return a + 1; };";
+
+#ifndef _WIN32
+
+std::string socket_path(const char *test) {
+    return (std::filesystem::temp_directory_path() / FF("kiraz_{}.{}.sock", test, getpid()))
+            .string();
+}
+
+// A client that connects and then sends nothing
+int connect_idle(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#endif
+
+} // namespace
+
+#ifndef _WIN32
+
+TEST(CompileServer, memo_hit_and_miss) {
+    CompileServer server("unused.sock");
+    auto first = server.compile({"a.ki", CODE});
+    ASSERT_EQ(first.status, 0) << first.diagnostics;
+    ASSERT_NE(first.wat.find("(func $f"), std::string::npos);
+    ASSERT_EQ(server.get_memo_hits(), 0u);
+
+    auto second = server.compile({"b.ki", CODE});
+    ASSERT_EQ(server.get_memo_hits(), 1u);
+    ASSERT_EQ(second.status, 0);
+    ASSERT_EQ(second.wat, first.wat);
+
+    server.compile({"a.ki", CODE + " "});
+    ASSERT_EQ(server.get_memo_hits(), 1u);
+    ASSERT_EQ(server.get_requests(), 3u);
+}
+
+TEST(CompileServer, error_response) {
+    CompileServer server("unused.sock");
+    auto resp = server.compile({"bad.ki", "func f( {"});
+    ASSERT_NE(resp.status, 0);
+    ASSERT_TRUE(resp.wat.empty());
+    ASSERT_FALSE(resp.diagnostics.empty());
+}
+
+TEST(CompileServer, options_are_part_of_the_memo_key) {
+    CompileServer server("unused.sock");
+    CompileRequest req{"a.ki", CODE};
+    auto plain = server.compile(req);
+
+    req.profile_generate = true;
+    auto other = server.compile(req);
+    ASSERT_EQ(other.status, 0) << other.diagnostics;
+    ASSERT_EQ(server.get_memo_hits(), 0u);
+    ASSERT_NE(other.wat, plain.wat);
+
+    server.compile(req);
+    ASSERT_EQ(server.get_memo_hits(), 1u);
+
+    req.profile = "not a profile";
+    auto bad = server.compile(req);
+    ASSERT_NE(bad.status, 0);
+    ASSERT_NE(bad.diagnostics.find("malformed profile"), std::string::npos);
+}
+
+TEST(CompileServer, sources_are_released) {
+    CompileServer server("unused.sock", 0);
+    server.compile({"a.ki", CODE});
+    auto before = SourceManager::instance().mark();
+
+    for (int i = 0; i < 3; ++i) {
+        server.compile({"a.ki", CODE});
+        server.compile({"bad.ki", "func f( {"});
+    }
+    auto after = SourceManager::instance().mark();
+    ASSERT_EQ(after.next, before.next);
+    ASSERT_EQ(after.files, before.files);
+}
+
+TEST(CompileServer, socket_round_trip) {
+    auto path = socket_path("socket_round_trip");
+    CompileServer server(path);
+    server.set_io_timeout(std::chrono::milliseconds(200));
+    std::thread thread([&server] { server.run(); });
+
+    int fd = -1;
+    for (int i = 0; i < 200 && fd < 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        fd = connect_idle(path);
+    }
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+
+    CompileRequest req{"a.ki", CODE};
+    req.profile_generate = true;
+    CompileResponse resp;
+    ASSERT_TRUE(CompileClient::compile(path, req, resp));
+    ASSERT_EQ(resp.status, 0) << resp.diagnostics;
+    ASSERT_NE(resp.wat.find("(func $f"), std::string::npos);
+    ASSERT_NE(resp.wat.find("profile"), std::string::npos);
+
+    CompileResponse again;
+    ASSERT_TRUE(CompileClient::compile(path, req, again));
+    ASSERT_EQ(again.wat, resp.wat);
+
+    CompileResponse bad;
+    ASSERT_TRUE(CompileClient::compile(path, {"bad.ki", "func f( {"}, bad));
+    ASSERT_NE(bad.status, 0);
+    ASSERT_FALSE(bad.diagnostics.empty());
+
+    // A stalled client is dropped instead of holding up the next one.
+    auto idle = connect_idle(path);
+    ASSERT_GE(idle, 0);
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(CompileClient::compile(path, {"a.ki", CODE}, resp));
+    ASSERT_EQ(resp.status, 0);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+    ::close(idle);
+
+    server.stop();
+    ::close(connect_idle(path));
+    thread.join();
+    ASSERT_EQ(server.get_requests(), 4u);
+    ASSERT_EQ(server.get_memo_hits(), 1u);
+}
+
+TEST(CompileClient, gives_up_on_a_stalled_server) {
+    CompileResponse resp;
+    auto path = socket_path("stalled_server");
+    ASSERT_FALSE(CompileClient::compile(path, {"a.ki", CODE}, resp));
+
+    // Listens, but never answers
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(::listen(fd, 4), 0);
+
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_FALSE(CompileClient::compile(
+            path, {"a.ki", CODE}, resp, std::chrono::milliseconds(100)));
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+    ::close(fd);
+    ::unlink(path.data());
+}
+
+#endif
+
+} // namespace kiraz
@@ -0,0 +1,99 @@
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/Stats.h>
+
+namespace kiraz {
+
+namespace {
+
+const std::string CODE = "import io;"
+                         "func f(a : Integer64) : Integer64 {"
+                         "    while (a > 0) { a = a - 1; io.print(a); };"
+                         "    return a; };";
+
+// The keys of a json object, in order, with those of nested objects
+std::vector<std::string> keys_of(const std::string &json) {
+    std::vector<std::string> retval;
+    std::regex key("\"([a-z_]+)\":");
+    for (auto it = std::sregex_iterator(json.begin(), json.end(), key);
+            it != std::sregex_iterator(); ++it) {
+        retval.push_back((*it)[1]);
+    }
+    return retval;
+}
+
+// The number after "key": in json, -1 if there is none
+int64_t value_of(const std::string &json, const std::string &key) {
+    auto at = json.find(FF("\"{}\":", key));
+    if (at == std::string::npos) {
+        return -1;
+    }
+    return std::stoll(json.substr(at + key.size() + 3));
+}
+
+} // namespace
+
+struct StatsFixture : public ::testing::Test {
+    void SetUp() override {
+        Stats::reset();
+        Stats::enable();
+    }
+    void TearDown() override {
+        Stats::enable(false);
+        Stats::reset();
+    }
+};
+
+TEST_F(StatsFixture, report_json) {
+    {
+        Compiler compiler;
+        ASSERT_EQ(compiler.compile_string(CODE), 0) << compiler.get_error();
+    }
+    auto json = Stats::report_json();
+
+    std::vector<std::string> expected{"phases"};
+    for (int p = 0; p < Stats::PHASE_COUNT; ++p) {
+        expected.insert(expected.end(), {Stats::name_of(Stats::Phase(p)), "ns", "calls"});
+    }
+    expected.push_back("counters");
+    for (int c = 0; c < Stats::COUNTER_COUNT; ++c) {
+        expected.push_back(Stats::name_of(Stats::Counter(c)));
+    }
+    ASSERT_EQ(keys_of(json), expected);
+
+    auto depth = 0;
+    for (auto c : json) {
+        depth += c == '{' ? 1 : c == '}' ? -1 : 0;
+        ASSERT_GE(depth, 0);
+    }
+    ASSERT_EQ(depth, 0);
+    ASSERT_EQ(json.front(), '{');
+    ASSERT_EQ(json.substr(json.size() - 2), "}\n");
+
+#ifdef KIRAZ_ENABLE_STATS
+    ASSERT_GT(value_of(json, "nodes_allocated"), 0);
+    ASSERT_GT(value_of(json, "bytes_emitted"), 0);
+    for (auto phase : {Stats::Parse, Stats::Analyse, Stats::CodeGen}) {
+        ASSERT_GT(Stats::get_calls(phase), 0u) << Stats::name_of(phase);
+        ASSERT_EQ(value_of(json.substr(json.find(Stats::name_of(phase))), "calls"),
+                int64_t(Stats::get_calls(phase)));
+    }
+#endif
+}
+
+TEST_F(StatsFixture, disabled_collects_nothing) {
+    Stats::enable(false);
+    {
+        Compiler compiler;
+        ASSERT_EQ(compiler.compile_string(CODE), 0) << compiler.get_error();
+    }
+    ASSERT_EQ(Stats::get(Stats::NodesAllocated), 0u);
+    ASSERT_EQ(Stats::get_calls(Stats::Parse), 0u);
+}
+
+} // namespace kiraz
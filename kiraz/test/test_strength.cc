@@ -0,0 +1,179 @@
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <kiraz/StrengthReduce.h>
+
+namespace kiraz::strength {
+
+constexpr auto MIN = std::numeric_limits<int64_t>::min();
+constexpr auto MAX = std::numeric_limits<int64_t>::max();
+
+// Runs seq the way a wasm engine would, with wrapping arithmetic
+int64_t run(const Sequence &seq, int64_t x) {
+    std::vector<uint64_t> stack = {static_cast<uint64_t>(x)};
+    std::vector<uint64_t> temps(count_temps(seq));
+    auto pop = [&] {
+        auto retval = stack.back();
+        stack.pop_back();
+        return retval;
+    };
+
+    for (const auto &insn : seq) {
+        switch (insn.op) {
+        case Opcode::Const:
+            stack.push_back(insn.imm);
+            continue;
+        case Opcode::Get:
+            stack.push_back(temps[insn.imm]);
+            continue;
+        case Opcode::Set:
+            temps[insn.imm] = pop();
+            continue;
+        case Opcode::Tee:
+            temps[insn.imm] = stack.back();
+            continue;
+        default:
+            break;
+        }
+
+        auto b = pop();
+        auto a = pop();
+        switch (insn.op) {
+        case Opcode::Add:
+            stack.push_back(a + b);
+            break;
+        case Opcode::Sub:
+            stack.push_back(a - b);
+            break;
+        case Opcode::Mul:
+            stack.push_back(a * b);
+            break;
+        case Opcode::And:
+            stack.push_back(a & b);
+            break;
+        case Opcode::Shl:
+            stack.push_back(a << (b & 63));
+            break;
+        case Opcode::ShrS:
+            stack.push_back(static_cast<int64_t>(a) >> (b & 63));
+            break;
+        case Opcode::ShrU:
+            stack.push_back(a >> (b & 63));
+            break;
+        case Opcode::RemS:
+            stack.push_back(static_cast<int64_t>(a) % static_cast<int64_t>(b));
+            break;
+        default:
+            ADD_FAILURE() << "unexpected opcode " << opcode_name(insn.op);
+        }
+    }
+
+    EXPECT_EQ(stack.size(), 1u);
+    return static_cast<int64_t>(stack.back());
+}
+
+struct StrengthFixture : public ::testing::Test {
+    // Small numbers, powers of two and their neighbours, the extremes, common
+    // constants and some random numbers
+    static std::vector<int64_t> edge_cases(int64_t small, int random) {
+        std::set<int64_t> retval;
+        for (int64_t i = -small; i <= small; ++i) {
+            retval.insert(i);
+        }
+        for (int k = 0; k < 63; ++k) {
+            for (int64_t d : {-1, 0, 1}) {
+                retval.insert((int64_t(1) << k) + d);
+                retval.insert(-(int64_t(1) << k) + d);
+            }
+        }
+        for (int64_t d = 0; d < 4; ++d) {
+            retval.insert(MIN + d);
+            retval.insert(MAX - d);
+        }
+        for (int64_t v : {10, 100, 1000, 3600, 1000000, 86400000, 1000000007}) {
+            retval.insert(v);
+            retval.insert(-v);
+        }
+        std::mt19937_64 rng(42);
+        for (int i = 0; i < random; ++i) {
+            retval.insert(static_cast<int64_t>(rng()));
+            retval.insert(static_cast<int64_t>(rng() >> (rng() % 64)));
+        }
+        return {retval.begin(), retval.end()};
+    }
+
+    static std::vector<int64_t> constants() { return edge_cases(130, 20); }
+
+    static std::vector<int64_t> operands(int64_t c) {
+        static const auto cases = edge_cases(1030, 200);
+        auto retval = cases;
+        // Around multiples of c, where quotients change. Products wrap.
+        for (uint64_t q : {1, 2, 7, 1 << 20, 1 << 30}) {
+            for (int64_t d : {-1, 0, 1}) {
+                retval.push_back(static_cast<int64_t>(q * c) + d);
+                retval.push_back(static_cast<int64_t>(0 - q * c) + d);
+            }
+        }
+        return retval;
+    }
+};
+
+TEST_F(StrengthFixture, mul) {
+    for (auto c : constants()) {
+        auto seq = lower_mul(c);
+        if (! seq) {
+            continue;
+        }
+        for (auto x : operands(c)) {
+            auto expected = static_cast<int64_t>(static_cast<uint64_t>(x) * c);
+            ASSERT_EQ(run(*seq, x), expected) << x << " * " << c;
+        }
+    }
+}
+
+TEST_F(StrengthFixture, div) {
+    for (auto c : constants()) {
+        auto seq = lower_div(c);
+        if (! seq) {
+            continue;
+        }
+        ASSERT_FALSE(c == 0 || c == -1 || c == MIN) << c;
+        for (auto x : operands(c)) {
+            ASSERT_EQ(run(*seq, x), x / c) << x << " / " << c;
+        }
+    }
+}
+
+TEST_F(StrengthFixture, rem) {
+    for (auto c : constants()) {
+        auto seq = lower_rem(c);
+        if (! seq) {
+            ASSERT_TRUE(c == 0 || c == -1) << c;
+            continue;
+        }
+        for (auto x : operands(c)) {
+            ASSERT_EQ(run(*seq, x), x % c) << x << " % " << c;
+        }
+    }
+}
+
+TEST_F(StrengthFixture, shapes) {
+    // Powers of two are shifts and masks
+    EXPECT_EQ(lower_mul(8)->size(), 2u);
+    EXPECT_EQ(lower_div(1024)->size(), 10u);
+    EXPECT_EQ(lower_rem(16)->size(), 11u);
+    EXPECT_EQ(lower_mul(9)->size(), 5u);
+    EXPECT_EQ(lower_mul(-7)->size(), 5u);
+
+    // Others keep their instruction
+    EXPECT_FALSE(lower_mul(1000));
+    EXPECT_FALSE(lower_div(10));
+    EXPECT_EQ(lower_rem(10)->size(), 2u);
+}
+
+} // namespace kiraz::strength
@@ -0,0 +1,99 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/SymbolMap.h>
+#include <kiraz/ast/Literal.h>
+
+namespace kiraz {
+
+namespace {
+
+int64_t value_of(const Node::Ptr *node) {
+    return static_cast<const ast::Integer &>(**node).get_value();
+}
+
+} // namespace
+
+TEST(SymbolMap, grows_past_inline_storage) {
+    SymbolMap map;
+    ASSERT_TRUE(map.empty());
+    ASSERT_FALSE(map.find("a"));
+
+    // Long names take the eight bytes at a time path of hash() as well.
+    // 1000 symbols rehash the spilled table six times.
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i) {
+        names.push_back(i % 2 ? FF("s{}", i) : FF("a_rather_long_identifier_{}", i));
+        map[names.back()] = std::make_shared<ast::Integer>(i);
+        ASSERT_EQ(map.size(), names.size());
+
+        for (size_t j = 0; j < names.size(); ++j) {
+            auto found = map.find(names[j]);
+            ASSERT_TRUE(found) << names[j] << " of " << names.size();
+            ASSERT_EQ(value_of(found), int64_t(j));
+        }
+        ASSERT_FALSE(map.find(FF("t{}", i)));
+        ASSERT_FALSE(map.find(names.back() + "x"));
+    }
+
+    // Iteration follows insertion order.
+    size_t i = 0;
+    for (const auto &e : map) {
+        ASSERT_EQ(e.name, names[i]);
+        ASSERT_EQ(e.hash, SymbolMap::hash(names[i]));
+        ++i;
+    }
+    ASSERT_EQ(i, names.size());
+}
+
+TEST(SymbolMap, existing_names_are_not_added_again) {
+    SymbolMap map;
+    for (size_t count : {SymbolMap::INLINE_SIZE, SymbolMap::INLINE_SIZE + 1, size_t(40)}) {
+        for (size_t i = map.size(); i < count; ++i) {
+            map[FF("n{}", i)] = std::make_shared<ast::Integer>(i);
+        }
+        auto &node = map["n0"];
+        ASSERT_EQ(value_of(&node), 0);
+        node = std::make_shared<ast::Integer>(-1);
+        ASSERT_EQ(map.size(), count);
+        ASSERT_EQ(value_of(map.find("n0")), -1);
+        map["n0"] = std::make_shared<ast::Integer>(0);
+    }
+
+    // A name that is not there gets a null entry.
+    ASSERT_FALSE(map["new"]);
+    ASSERT_EQ(map.size(), 41u);
+    ASSERT_TRUE(map.find("new"));
+}
+
+TEST(SymbolTable, scope_lookup_chains) {
+    Compiler compiler;
+    SymbolTable st(ScopeType::Module);
+
+    // Enough symbols for the module scope to move out of inline storage
+    for (int i = 0; i < 100; ++i) {
+        st.add_symbol(FF("m{}", i), std::make_shared<ast::Integer>(i));
+    }
+
+    auto func = std::make_shared<ast::Id>("f");
+    func->set_cur_symtab(st.get_cur_symtab());
+    {
+        auto scope = st.enter_scope(ScopeType::Func, func);
+        auto local = st.add_symbol("m7", std::make_shared<ast::Integer>(-7));
+
+        ASSERT_EQ(st.get_symbol("m7").second, local);
+        ASSERT_TRUE(st.get_symbol("m99").second);
+        ASSERT_FALSE(st.get_symbol("m100").second);
+        ASSERT_EQ(st.get_symbols().size(), 1u);
+    }
+
+    ASSERT_NE(st.get_symbol("m7").second, nullptr);
+    ASSERT_EQ(static_cast<ast::Integer &>(*st.get_symbol("m7").second).get_value(), 7);
+    ASSERT_EQ(st.get_symbols().size(), 100u);
+}
+
+} // namespace kiraz
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <kiraz/Compiler.h>
+#include <kiraz/Trace.h>
+
+namespace kiraz {
+
+namespace {
+
+struct Event {
+    int tid;
+    int64_t ts;
+    int64_t dur;
+    std::string cat;
+    std::string name;
+
+    bool contains(const Event &other) const {
+        return tid == other.tid && ts <= other.ts && other.ts + other.dur <= ts + dur;
+    }
+    bool disjoint(const Event &other) const {
+        return ts + dur <= other.ts || other.ts + other.dur <= ts;
+    }
+};
+
+struct TraceFile {
+    std::vector<Event> events;
+    std::map<int, std::string> threads;
+
+    std::vector<Event> find(const std::string &cat, const std::string &name) const {
+        std::vector<Event> retval;
+        for (const auto &ev : events) {
+            if (ev.cat == cat && ev.name == name) {
+                retval.push_back(ev);
+            }
+        }
+        return retval;
+    }
+
+    // What the last compile recorded: from its parse phase on, which runs on
+    // the main thread
+    TraceFile last_compile() const {
+        auto parse = find("phase", "parse");
+        EXPECT_FALSE(parse.empty());
+        TraceFile retval{{}, threads};
+        for (const auto &ev : events) {
+            if (! parse.empty() && ev.ts >= parse.back().ts) {
+                retval.events.push_back(ev);
+            }
+        }
+        return retval;
+    }
+};
+
+// Tracing can not be stopped, and its timestamps count from the start, so it
+// is started once for all tests.
+const std::string &trace_path() {
+    static std::string retval = [] {
+        auto path = (std::filesystem::temp_directory_path() / "kiraz_test_trace.json").string();
+        Trace::start(path);
+        return path;
+    }();
+    return retval;
+}
+
+TraceFile read_trace() {
+    EXPECT_TRUE(Trace::write());
+    std::ifstream f(trace_path());
+    std::string text(std::istreambuf_iterator<char>(f), {});
+    std::filesystem::remove(trace_path());
+
+    // Trace::write puts one event on each line.
+    std::regex meta(R"re(\{"ph":"M","name":"thread_name","pid":1,"tid":(\d+),)re"
+                    R"re("args":\{"name":"([^"]*)"\}\})re");
+    std::regex complete(R"re(\{"ph":"X","pid":1,"tid":(\d+),"ts":(\d+),"dur":(\d+),)re"
+                        R"re("cat":"(\w+)","name":"([^"]*)","args":\{[^{}]*\}\})re");
+    EXPECT_TRUE(text.starts_with("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"));
+    EXPECT_TRUE(text.ends_with("\n]}\n"));
+
+    TraceFile retval;
+    std::istringstream lines(text);
+    std::string line;
+    std::getline(lines, line);
+    std::smatch m;
+    while (std::getline(lines, line) && line != "]}") {
+        if (line.ends_with(",")) {
+            line.pop_back();
+        }
+        if (std::regex_match(line, m, meta)) {
+            retval.threads[std::stoi(m[1])] = m[2];
+        }
+        else if (std::regex_match(line, m, complete)) {
+            retval.events.push_back(
+                    {std::stoi(m[1]), std::stoll(m[2]), std::stoll(m[3]), m[4], m[5]});
+        }
+        else {
+            ADD_FAILURE() << "not a trace event: " << line;
+        }
+    }
+    return retval;
+}
+
+// Events of a thread must nest: any two either do not overlap or one of them
+// contains the other.
+void expect_nested(const TraceFile &trace) {
+    for (const auto &a : trace.events) {
+        ASSERT_TRUE(trace.threads.contains(a.tid)) << a.tid;
+        for (const auto &b : trace.events) {
+            if (&a == &b || a.tid != b.tid) {
+                continue;
+            }
+            ASSERT_TRUE(a.disjoint(b) || a.contains(b) || b.contains(a))
+                    << a.name << " and " << b.name << " overlap";
+        }
+    }
+}
+
+} // namespace
+
+TEST(TraceEvents, compile_events) {
+    trace_path();
+    {
+        Compiler compiler;
+        auto code = "class One { let n : Integer64;"
+                    "    func bump() : Integer64 { n = n + 1; return n; }; };"
+                    "func one_f(a : Integer64) : Integer64 { return a * 2; };";
+        ASSERT_EQ(compiler.compile_string(code), 0) << compiler.get_error();
+    }
+    auto trace = read_trace();
+    expect_nested(trace);
+    ASSERT_EQ(trace.threads[1], "main");
+    trace = trace.last_compile();
+
+    auto parse = trace.find("phase", "parse");
+    auto analyse = trace.find("phase", "analyse");
+    auto codegen = trace.find("phase", "codegen");
+    ASSERT_EQ(parse.size(), 1u);
+    ASSERT_EQ(analyse.size(), 1u);
+    ASSERT_EQ(codegen.size(), 1u);
+    ASSERT_LE(parse[0].ts + parse[0].dur, analyse[0].ts);
+    ASSERT_LE(analyse[0].ts + analyse[0].dur, codegen[0].ts);
+
+    auto cls = trace.find("class", "One");
+    auto bump = trace.find("func", "One.bump");
+    auto f = trace.find("func", "one_f");
+    ASSERT_EQ(bump.size(), 1u);
+    ASSERT_EQ(f.size(), 1u);
+    ASSERT_TRUE(codegen[0].contains(f[0]));
+    ASSERT_TRUE(codegen[0].contains(bump[0]));
+    ASSERT_TRUE(std::any_of(cls.begin(), cls.end(), [&](auto &c) { return c.contains(bump[0]); }));
+}
+
+TEST(TraceEvents, compile_events_with_jobs) {
+    trace_path();
+    {
+        Compiler compiler;
+        compiler.set_jobs(2);
+        auto code = "func two_a(a : Integer64) : Integer64 { return a + 1; };"
+                    "func two_b(a : Integer64) : Integer64 { return a + 2; };"
+                    "func two_c(a : Integer64) : Integer64 { return a + 3; };";
+        ASSERT_EQ(compiler.compile_string(code), 0) << compiler.get_error();
+    }
+    auto trace = read_trace();
+    expect_nested(trace);
+    trace = trace.last_compile();
+
+    for (auto name : {"two_a", "two_b", "two_c"}) {
+        auto events = trace.find("func", name);
+        ASSERT_EQ(events.size(), 1u) << name;
+        ASSERT_FALSE(trace.threads[events[0].tid].empty());
+    }
+}
+
+} // namespace kiraz
@@ -302,6 +302,99 @@ TEST_F(WasmGenFixture, if_simple_true) {
     );
 }
 
+TEST_F(WasmGenFixture, parallel_matches_serial) {
+    std::string code = "import io;\n";
+    for (int i = 0; i < 64; ++i) {
+        code += FF("func f{}() : Void {{ io.print(\"s{}\"); io.print({}); }};\n", i, i, i);
+    }
+
+    std::string wat[2];
+    for (unsigned jobs : {1, 8}) {
+        Compiler compiler;
+        compiler.set_jobs(jobs);
+        ASSERT_EQ(compiler.compile_string(code), 0);
+        wat[jobs > 1] = compiler.get_wasm_ctx().body().str();
+    }
+
+    ASSERT_EQ(wat[0], wat[1]);
+    ASSERT_NE(wat[1].find("i32.const 179\n    i32.const 3\n"), std::string::npos); // "s63"
+}
+
+TEST_F(WasmGenFixture, class_fields_and_methods) {
+    verify_output( //
+            "   import io;"
+            "\n class P { let flag = true; let x : Integer64 = 3; let name : String = \"pt\";"
+            "\n     func move(dx : Integer64) : Integer64 { x = x + dx; return x; }; };"
+            "\n func main() : Void { let p : P; let q : P; p.name = \"q\";"
+            "\n     io.print(p.move(4)); io.print(q.x); io.print(p.name); io.print(p.flag); };",
+            {"7", "3", "q", "true"});
+}
+
+TEST_F(WasmGenFixture, class_layout_packed) {
+    Compiler compiler;
+    ASSERT_EQ(compiler.compile_string(
+                      "class P { let b = true; let s : String; let i : Integer64; let o : P; };"),
+            0);
+
+    auto cls = compiler.get_wasm_ctx().get_layout().find_class("P");
+    ASSERT_TRUE(cls);
+    EXPECT_EQ(cls->find_field("i")->offset, 0u);
+    EXPECT_EQ(cls->find_field("s")->offset, 8u);
+    EXPECT_EQ(cls->find_field("o")->offset, 16u);
+    EXPECT_EQ(cls->find_field("b")->offset, 20u);
+    EXPECT_EQ(cls->get_size(), 24u);
+}
+
+TEST_F(WasmGenFixture, freed_instances_are_reused_zeroed) {
+    verify_output( //
+            "   import io;"
+            "\n class C { let n : Integer64; func bump() : Integer64 { n = n + 1; return n; }; };"
+            "\n func main() : Void { let i : Integer64 = 0;"
+            "\n     while (i == 0) { let c : C; io.print(c.bump()); i = c.n; };"
+            "\n     let d : C; io.print(d.bump()); };",
+            {"1", "1"});
+
+    Compiler compiler;
+    ASSERT_EQ(compiler.compile_string(
+                      "class C { let n : Integer64; func self() : C { return this; }; };"
+                      "func main() : Void { let c : C; };"),
+            0);
+    EXPECT_EQ(compiler.get_wasm_ctx().body().str().find("call $__free\n"), std::string::npos);
+}
+
+TEST_F(WasmGenFixture, memory_read_write) {
+    verify_output( //
+            "   import io;"
+            "\n func main() : Void { let m : Memory; let w = m.write(1000, \"hello\");"
+            "\n     m.write(2000, w); io.print(m.read(2001, 3)); io.print(m.size()); };",
+            {"ell", "65536"});
+}
+
+TEST_F(WasmGenFixture, integer_arithmetic_and_comparisons) {
+    verify_output( //
+            "   import io;"
+            "\n func main() : Void { let a : Integer64 = 17; let b : Integer64 = -5;"
+            "\n     io.print(a - b); io.print(a * b); io.print(a / b); io.print(-(a - 20));"
+            "\n     io.print(a < b); io.print(a > b); io.print(a <= 17); io.print(b >= 0);"
+            "\n     io.print(a != b); io.print(true == false); };",
+            {"22", "-85", "-3", "3", "false", "true", "true", "false", "true", "false"});
+}
+
+TEST_F(WasmGenFixture, strength_reduced_constants) {
+    const std::string code = //
+            "   import io;"
+            "\n func main() : Void { let a : Integer64 = -17;"
+            "\n     io.print(a / 8); io.print(a - a / 8 * 8); io.print(a * 9); io.print(a / -4);"
+            "\n     io.print(a - a / 10 * 10); };";
+    verify_output(code, {"-2", "-1", "-153", "4", "-7"});
+
+    Compiler compiler;
+    ASSERT_EQ(compiler.compile_string(code), 0);
+    const auto &wat = compiler.get_wasm_ctx().body().str();
+    EXPECT_EQ(wat.find("i64.div_s"), std::string::npos);
+    EXPECT_EQ(wat.find("i64.mul"), std::string::npos);
+}
+
 } // namespace kiraz
 
 int main(int argc, char **argv) {
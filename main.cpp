@@ -1,12 +1,22 @@
 
 #include <cassert>
+#include <charconv>
 #include <cstdio>
+#include <cstdlib>
+#include <fstream>
 
 #include "lexer.hpp"
 #include "main.h"
 #include "parser.hpp"
 
+#include <kiraz/Compiler.h>
 #include <kiraz/Node.h>
+#include <kiraz/Parallel.h>
+#include <kiraz/Server.h>
+#include <kiraz/SourceManager.h>
+#include <kiraz/Stats.h>
+#include <kiraz/Token.h>
+#include <kiraz/Trace.h>
 
 extern int yydebug;
 
@@ -19,11 +29,30 @@ enum Mode {
     MODE_UNKNOWN,
     MODE_FILE,
     MODE_TEXT,
+    MODE_COMPILE,
     MODE_HELP,
 };
 
+static std::shared_ptr<kiraz::ModuleCache> s_cache;
+static std::string s_server_socket;
+static std::string s_serve_socket;
+static unsigned s_jobs = 1;
+static kiraz::RuntimeOptions s_runtime_options;
+static ir::OptimizeOptions s_optimize_options;
+static kiraz::ProfileOptions s_profile_options;
+static std::string s_profile_data;
+
+enum TimeReport {
+    TIME_REPORT_NONE,
+    TIME_REPORT_TEXT,
+    TIME_REPORT_JSON,
+};
+
+static TimeReport s_time_report = TIME_REPORT_NONE;
+
 static int test(std::string_view str) {
-    auto buffer = yy_scan_string(str.data());
+    auto buffer = yy_scan_bytes(str.data(), str.size());
+    token::offset = kiraz::SourceManager::instance().add_file("<string>", str);
     auto ret = yyparse();
     yy_delete_buffer(buffer);
 
@@ -31,12 +60,38 @@ static int test(std::string_view str) {
         fmt::print("{}\n", Node::current_root()->as_string());
     }
 
-    return ret;
+    // The parser recovers from syntax errors, so yyparse may succeed anyway.
+    return Node::current_root() ? ret : ERR;
+}
+
+// Digits only: no sign, no spaces, nothing after the number
+static bool parse_unsigned(std::string_view s, unsigned &out) {
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ! s.empty() && ec == std::errc() && end == s.data() + s.size();
 }
 
 static int usage(int argc, char **argv) {
     fmt::print("Usage: {} -s [string to parse] ....\n", argv[0]);
     fmt::print("       {} -f [file to parse] ....\n", argv[0]);
+    fmt::print("       {} -c [file to compile] ....\n", argv[0]);
+    fmt::print("       {} --cache-dir=[dir] Reuse analysed modules stored in dir\n", argv[0]);
+    fmt::print("       {} --server=[socket] Serve compile requests on socket\n", argv[0]);
+    fmt::print("       {} --connect=[socket] Send -c requests to a running server\n", argv[0]);
+    fmt::print("       {} --jobs=[n] Analyse and generate functions on n threads, 0 for all\n",
+            argv[0]);
+    fmt::print("       {} --heap-reset Free everything main allocated when it is called again\n",
+            argv[0]);
+    fmt::print("       {} -O[0-2] Optimization level, -O2 adds unrolling and other loop changes\n",
+            argv[0]);
+    fmt::print("       {} --unroll=[n] Iterations of counted loops to run at a time at -O2\n",
+            argv[0]);
+    fmt::print("       {} --simd Vectorize loops over io.Memory at -O2\n", argv[0]);
+    fmt::print("       {} --profile-generate Count calls and branches, for the host import"
+               " profile.dump\n",
+            argv[0]);
+    fmt::print("       {} --profile-use=[file] Optimize for the counts of a profile\n", argv[0]);
+    fmt::print("       {} --time-report[=json] Print phase timings and counters\n", argv[0]);
+    fmt::print("       {} --trace=[file] Write a Chrome trace of the compilation\n", argv[0]);
     fmt::print("       {} -h Show this help\n", argv[0]);
 
     return ERR;
@@ -51,21 +106,70 @@ static int handle_mode_text(std::string_view arg) {
 }
 
 static int handle_mode_file(std::string_view arg) {
-    FILE *file = fopen(arg.data(), "r");
-    if (!file) {
-        fmt::print("Error: Could not open file '{}'\n", arg);
-        return ERR;
+    std::string code;
+    {
+        std::ifstream f(std::string(arg), std::ios::binary);
+        if (! f.is_open()) {
+            fmt::print("Error: Could not open file '{}'\n", arg);
+            return ERR;
+        }
+        code.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
     }
-    
-    yyin = file;
+
+    auto buffer = yy_scan_bytes(code.data(), code.size());
+    token::offset = kiraz::SourceManager::instance().add_file(std::string(arg), code);
     auto ret = yyparse();
-    fclose(file);
+    yy_delete_buffer(buffer);
     
     if (Node::current_root()) {
         fmt::print("{}\n", Node::current_root()->as_string());
     }
     
-    return ret;
+    return Node::current_root() ? ret : ERR;
+}
+
+static int handle_mode_compile(std::string_view arg) {
+    if (! s_server_socket.empty()) {
+        kiraz::CompileRequest req;
+        req.name = arg;
+
+        std::ifstream f(req.name, std::ios::binary);
+        if (! f.is_open()) {
+            perror(req.name.data());
+            return ERR;
+        }
+        req.source.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        req.jobs = s_jobs;
+        req.runtime = s_runtime_options;
+        req.optimize = s_optimize_options;
+        req.profile_generate = s_profile_options.generate;
+        req.profile = s_profile_data;
+
+        // Fall back to compiling in-process when no server is around.
+        kiraz::CompileResponse resp;
+        if (kiraz::CompileClient::compile(s_server_socket, req, resp)) {
+            fmt::print(stderr, "{}", resp.diagnostics);
+            fmt::print("{}", resp.wat);
+            return resp.status;
+        }
+    }
+
+    kiraz::Compiler compiler;
+    compiler.set_module_cache(s_cache);
+    compiler.set_jobs(s_jobs);
+    compiler.set_runtime_options(s_runtime_options);
+    compiler.set_optimize_options(s_optimize_options);
+    compiler.set_profile_options(s_profile_options);
+
+    if (auto ret = compiler.compile_file(std::string(arg)); ret != OK) {
+        if (! compiler.get_error().empty()) {
+            fmt::print(stderr, "{}", compiler.get_error());
+        }
+        return ret;
+    }
+
+    fmt::print("{}", compiler.get_wasm_ctx().body().str());
+    return OK;
 }
 
 int main(int argc, char **argv) {
@@ -73,6 +177,21 @@ int main(int argc, char **argv) {
 
     static Mode mode = MODE_UNKNOWN;
 
+    struct ReportsOnExit {
+        ~ReportsOnExit() {
+            if (! kiraz::Trace::write()) {
+                fmt::print(stderr, "Error: Could not write trace\n");
+            }
+
+            if (s_time_report == TIME_REPORT_TEXT) {
+                fmt::print(stderr, "{}", kiraz::Stats::report());
+            }
+            else if (s_time_report == TIME_REPORT_JSON) {
+                fmt::print(stderr, "{}", kiraz::Stats::report_json());
+            }
+        }
+    } reports_on_exit;
+
     if (argc < 2) {
         return usage(argc, argv);
     }
@@ -93,10 +212,101 @@ int main(int argc, char **argv) {
                 continue;
             }
 
+            if (arg == "-c") {
+                mode = MODE_COMPILE;
+                continue;
+            }
+
             if (arg == "-h") {
                 mode = MODE_HELP;
                 continue;
             }
+
+            if (arg.starts_with("--cache-dir=")) {
+                s_cache = std::make_shared<kiraz::ModuleCache>(
+                        std::string(arg.substr(sizeof("--cache-dir=") - 1)));
+                continue;
+            }
+
+            if (arg.starts_with("--jobs=")) {
+                auto value = arg.substr(sizeof("--jobs=") - 1);
+                if (! parse_unsigned(value, s_jobs)) {
+                    fmt::print(stderr, "Error: Invalid number of jobs '{}'\n", value);
+                    return usage(argc, argv);
+                }
+                // As in CompileServer, more threads than cores only add overhead.
+                if (s_jobs == 0 || s_jobs > kiraz::hardware_jobs()) {
+                    s_jobs = kiraz::hardware_jobs();
+                }
+                continue;
+            }
+
+            if (arg == "--heap-reset") {
+                s_runtime_options.reset_heap = true;
+                continue;
+            }
+
+            if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+                s_optimize_options.level = arg[2] - '0';
+                continue;
+            }
+
+            if (arg.starts_with("--unroll=")) {
+                auto value = arg.substr(sizeof("--unroll=") - 1);
+                if (! parse_unsigned(value, s_optimize_options.unroll)
+                        || s_optimize_options.unroll == 0) {
+                    fmt::print(stderr, "Error: Invalid unroll count '{}', must be at least 1\n",
+                            value);
+                    return usage(argc, argv);
+                }
+                continue;
+            }
+
+            if (arg == "--simd") {
+                s_optimize_options.simd = true;
+                continue;
+            }
+
+            if (arg == "--profile-generate") {
+                s_profile_options.generate = true;
+                continue;
+            }
+
+            if (arg.starts_with("--profile-use=")) {
+                auto path = std::string(arg.substr(sizeof("--profile-use=") - 1));
+                // Kept as read, for requests to a server
+                std::ifstream f(path, std::ios::binary);
+                s_profile_data.assign(
+                        std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+                auto profile = std::make_shared<kiraz::Profile>();
+                if (! f.is_open() || ! profile->merge(s_profile_data)) {
+                    fmt::print(stderr, "Error: Could not read profile '{}'\n", path);
+                    return ERR;
+                }
+                s_profile_options.use = std::move(profile);
+                continue;
+            }
+
+            if (arg == "--time-report" || arg == "--time-report=json") {
+                s_time_report = arg == "--time-report" ? TIME_REPORT_TEXT : TIME_REPORT_JSON;
+                kiraz::Stats::enable();
+                continue;
+            }
+
+            if (arg.starts_with("--trace=")) {
+                kiraz::Trace::start(std::string(arg.substr(sizeof("--trace=") - 1)));
+                continue;
+            }
+
+            if (arg.starts_with("--connect=")) {
+                s_server_socket = arg.substr(sizeof("--connect=") - 1);
+                continue;
+            }
+
+            if (arg.starts_with("--server=")) {
+                s_serve_socket = arg.substr(sizeof("--server=") - 1);
+                continue;
+            }
         }
 
         switch (mode) {
@@ -115,6 +325,12 @@ int main(int argc, char **argv) {
                 return ret;
             }
             break;
+
+        case MODE_COMPILE:
+            if (auto ret = handle_mode_compile(argv[i]); ret != OK) {
+                return ret;
+            }
+            break;
         }
 
         mode = MODE_UNKNOWN;
@@ -124,5 +340,12 @@ int main(int argc, char **argv) {
         return usage(argc, argv);
     }
 
+    // Started once every option is in, so that those after --server= count
+    if (! s_serve_socket.empty()) {
+        kiraz::CompileServer server(s_serve_socket);
+        server.set_module_cache(s_cache);
+        return server.run();
+    }
+
     return 0;
 }
@@ -14,4 +14,7 @@ extern int yydebug;
 extern FILE *yyin;
 #define YY_DECL int yylex(void)
 #define YYSTYPE std::shared_ptr<Node>
+#include <kiraz/SourceManager.h>
+#define YYLTYPE kiraz::SourceRange
+#define YYLTYPE_IS_DECLARED 1
 #include "parser.hpp"
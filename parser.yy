@@ -4,13 +4,46 @@
 #include <kiraz/ast/Operator.h>
 #include <kiraz/ast/Literal.h>
 
-#include <kiraz/token/Literal.h>
+#include <kiraz/Compiler.h>
+#include <kiraz/IncrementalParser.h>
+#include <kiraz/Token.h>
+
+#include <kiraz/Stats.h>
 
 int yyerror(const char *msg);
-extern std::shared_ptr<Token> curtoken;
-extern int yylineno;
+
+// Nodes built by a rule start where the rule's first token starts.
+#define YYLLOC_DEFAULT(Current, Rhs, N)                                                            \
+    do {                                                                                           \
+        if (N) {                                                                                   \
+            (Current).begin = YYRHSLOC(Rhs, 1).begin;                                              \
+            (Current).end = YYRHSLOC(Rhs, N).end;                                                  \
+        }                                                                                          \
+        else {                                                                                     \
+            (Current).begin = (Current).end = YYRHSLOC(Rhs, 0).end;                                \
+        }                                                                                          \
+        Node::set_next_offset((Current).begin);                                                    \
+    } while (0)
+
+#define YYLOCATION_PRINT(File, Loc) fprintf(File, "%u-%u", (Loc)->begin, (Loc)->end)
+
+#ifdef KIRAZ_ENABLE_STATS
+static int counted_yylex() {
+    auto retval = yylex();
+    if (retval > 0) {
+        KIRAZ_STATS_INC(TokensLexed);
+    }
+    return retval;
+}
+#define yylex counted_yylex
+#endif
 %}
 
+%locations
+
+/* yynerrs is a global that bison never resets on its own */
+%initial-action { yynerrs = 0; }
+
 %token    REJECTED
 
 /* Keywords */
@@ -60,19 +93,37 @@ extern int yylineno;
 %%
 
 /* Program entry point */
-stmt: single_stmt               { 
-        Node::add<ast::StmtList>(std::vector{$1}); 
-      }
-    | stmt single_stmt          { 
-        auto root = Node::get_root();
-        auto list = std::dynamic_pointer_cast<ast::StmtList>(root);
-        if (list) {
-            list->add($2);
-        } else {
-            Node::add<ast::StmtList>(std::vector{$1, $2});
+program: stmt                   {
+        // A module with syntax errors never becomes the root. What could be
+        // recovered is still handed to the compiler for semantic checks.
+        if (yynerrs == 0) {
+            Node::set_root($1);
+        }
+        else if (kiraz::IncrementalParser::is_speculating()) {
+            // Caller falls back to a full parse
+        }
+        else if (auto compiler = kiraz::Compiler::current()) {
+            compiler->set_partial_root($1);
         }
       }
-    | REJECTED                  { yyerror("Rejected token"); }
+    ;
+
+/* Top-level statements start at their first token, IncrementalParser relies on it */
+stmt: single_stmt               {
+        $$ = std::make_shared<ast::StmtList>(std::vector<Node::Ptr>{});
+        if ($1) {
+            $1->set_offset(@1.begin);
+            static_cast<ast::StmtList &>(*$$).add($1);
+        }
+      }
+    | stmt single_stmt          {
+        if ($2) {
+            $2->set_offset(@2.begin);
+            static_cast<ast::StmtList &>(*$1).add($2);
+        }
+        $$ = $1;
+      }
+    | stmt error                { $$ = $1; }
     ;
 
 single_stmt: func_stmt
@@ -85,12 +136,19 @@ single_stmt: func_stmt
     | import_stmt
     | return_stmt
     | expr OP_SCOLON
-    | OP_LBRACE stmt_list OP_RBRACE { $$ = $2; }  
+    | block
+    | error OP_SCOLON           { $$ = nullptr; }
+    | error OP_RBRACE           { $$ = nullptr; }
+    ;
+
+/* Braced statement list. Errors inside resynchronise on ';' or the closing '}' */
+block: OP_LBRACE stmt_list OP_RBRACE          { $$ = $2; }
+    | OP_LBRACE stmt_list error OP_RBRACE    { $$ = $2; }
     ;
 
 /* Function definition */
-func_stmt: KW_FUNC IDENTIFIER OP_LPAREN func_args OP_RPAREN OP_COLON type_annotation OP_LBRACE stmt_list OP_RBRACE {
-        $$ = std::make_shared<ast::Func>($2, $4, $7, $9);
+func_stmt: KW_FUNC IDENTIFIER OP_LPAREN func_args OP_RPAREN OP_COLON type_annotation block {
+        $$ = std::make_shared<ast::Func>($2, $4, $7, $8);
       }
     ;
 /* Function arguments */
@@ -135,41 +193,44 @@ let_stmt: KW_LET IDENTIFIER OP_ASSIGN expr {
 assignment_stmt: IDENTIFIER OP_ASSIGN expr {
         $$ = std::make_shared<ast::Assignment>($1, $3);
       }
+    | expr OP_DOT IDENTIFIER OP_ASSIGN expr {
+        $$ = std::make_shared<ast::Assignment>(std::make_shared<ast::Dot>($1, $3), $5);
+      }
     ;
 
 /* Class definition */
-class_stmt: KW_CLASS IDENTIFIER OP_LBRACE stmt_list OP_RBRACE {
-        $$ = Node::add<ast::Class>($2, $4);
+class_stmt: KW_CLASS IDENTIFIER block {
+        $$ = std::make_shared<ast::Class>($2, $3);
       }
     ;
 
 /* If statement */
-if_stmt: KW_IF OP_LPAREN expr OP_RPAREN OP_LBRACE stmt_list OP_RBRACE {
-        $$ = Node::add<ast::If>($3, $6, std::make_shared<ast::StmtList>(std::vector<Node::Ptr>{}));
+if_stmt: KW_IF OP_LPAREN expr OP_RPAREN block {
+        $$ = std::make_shared<ast::If>($3, $5, std::make_shared<ast::StmtList>(std::vector<Node::Ptr>{}));
       }
-    | KW_IF OP_LPAREN expr OP_RPAREN OP_LBRACE stmt_list OP_RBRACE KW_ELSE OP_LBRACE stmt_list OP_RBRACE {
-        $$ = Node::add<ast::If>($3, $6, $10);
+    | KW_IF OP_LPAREN expr OP_RPAREN block KW_ELSE block {
+        $$ = std::make_shared<ast::If>($3, $5, $7);
       }
-    | KW_IF OP_LPAREN expr OP_RPAREN OP_LBRACE stmt_list OP_RBRACE KW_ELSE if_stmt {
-        $$ = Node::add<ast::If>($3, $6, $9);
+    | KW_IF OP_LPAREN expr OP_RPAREN block KW_ELSE if_stmt {
+        $$ = std::make_shared<ast::If>($3, $5, $7);
       }
     ;
 
 /* While statement */
-while_stmt: KW_WHILE OP_LPAREN expr OP_RPAREN OP_LBRACE stmt_list OP_RBRACE {
-        $$ = Node::add<ast::While>($3, $6);
+while_stmt: KW_WHILE OP_LPAREN expr OP_RPAREN block {
+        $$ = std::make_shared<ast::While>($3, $5);
       }
     ;
 
 /* Import statement */
 import_stmt: KW_IMPORT IDENTIFIER OP_SCOLON {
-        $$ = Node::add<ast::Import>($2);
+        $$ = std::make_shared<ast::Import>($2);
       }
     ;
 
 /* Return statement */
 return_stmt: KW_RETURN expr OP_SCOLON {
-        $$ = Node::add<ast::Return>($2);
+        $$ = std::make_shared<ast::Return>($2);
       }
     ;
 
@@ -225,6 +286,7 @@ stmt_list: /* empty */                    { $$ = std::make_shared<ast::StmtList>
         list->add($2);
         $$ = $1;
       }
+    | stmt_list error OP_SCOLON          { $$ = $1; }
     ;
 
 /* Expressions */
@@ -265,16 +327,25 @@ call_arg_list: expr              {
 %%
 
 int yyerror(const char *s) {
-    if (curtoken) {
-        fmt::print("** Parser Error at {}:{} at token: {}\n",
-            yylineno, Token::colno, curtoken->as_string());
+    if (kiraz::IncrementalParser::is_speculating()) {
+        return 1;
+    }
+
+    auto offset = curtoken ? curtoken.offset : token::offset;
+    auto what = curtoken
+        ? FF(" at token: {}", token::describe(curtoken, std::string_view(yytext, yyleng)))
+        : std::string(", null token");
+
+    // The compiler collects every error and reports them together, parsing
+    // goes on from the next ';' or '}'.
+    if (auto compiler = kiraz::Compiler::current()) {
+        compiler->add_diagnostic(offset, s + what);
     }
     else {
-        fmt::print("** Parser Error at {}:{}, null token\n",
-            yylineno, Token::colno);
+        auto loc = kiraz::SourceManager::instance().lookup(offset);
+        fmt::print("** Parser Error at {}:{}{}\n", loc.line, loc.col, what);
     }
 
-    Token::colno = 0;
     Node::reset_root();
 
     return 1;
@@ -28,6 +28,46 @@ add_executable(test_semantics kiraz/test/test_semantics.cc)
 target_link_libraries(test_semantics kiraz GTest::gtest_main ${FLEX_LIBRARIES})
 gtest_discover_tests(test_semantics)
 
+# test_strength
+add_executable(test_strength kiraz/test/test_strength.cc)
+target_link_libraries(test_strength kiraz GTest::gtest_main ${FLEX_LIBRARIES})
+gtest_discover_tests(test_strength)
+
+# test_ir
+add_executable(test_ir kiraz/test/test_ir.cc)
+target_link_libraries(test_ir kiraz GTest::gtest_main ${FLEX_LIBRARIES})
+gtest_discover_tests(test_ir)
+
+# test_cache
+add_executable(test_cache kiraz/test/test_cache.cc)
+target_link_libraries(test_cache kiraz GTest::gtest_main ${FLEX_LIBRARIES})
+gtest_discover_tests(test_cache)
+
+# test_server
+add_executable(test_server kiraz/test/test_server.cc)
+target_link_libraries(test_server kiraz GTest::gtest_main ${FLEX_LIBRARIES})
+gtest_discover_tests(test_server)
+
+# test_stats
+add_executable(test_stats kiraz/test/test_stats.cc)
+target_link_libraries(test_stats kiraz GTest::gtest_main ${FLEX_LIBRARIES})
+gtest_discover_tests(test_stats)
+
+# test_trace
+add_executable(test_trace kiraz/test/test_trace.cc)
+target_link_libraries(test_trace kiraz GTest::gtest_main ${FLEX_LIBRARIES})
+gtest_discover_tests(test_trace)
+
+# test_diagnostics
+add_executable(test_diagnostics kiraz/test/test_diagnostics.cc)
+target_link_libraries(test_diagnostics kiraz GTest::gtest_main ${FLEX_LIBRARIES})
+gtest_discover_tests(test_diagnostics)
+
+# test_symbols
+add_executable(test_symbols kiraz/test/test_symbols.cc)
+target_link_libraries(test_symbols kiraz GTest::gtest_main ${FLEX_LIBRARIES})
+gtest_discover_tests(test_symbols)
+
 
 # test_wasmgen
 option(KIRAZ_TEST_WASMGEN "Enable wasmgen tests" TRUE)